@@ -0,0 +1,190 @@
+#ifndef OCTOMAP_SERVER_BINARY_MAP_FILE_H
+#define OCTOMAP_SERVER_BINARY_MAP_FILE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <octomap/OcTreeKey.h>
+#include <octomap_msgs/Octomap.h>
+
+namespace octomap_server {
+
+// Header only loader of binary (.bt) map files into a message, without
+// building the tree, for the minimal node. The file is memory mapped, the
+// header lines are parsed in place and the payload is copied once, straight
+// into the message.
+
+// A read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile() { close(); }
+
+  bool open(const std::string& filename);
+  /// Drop the pages before p from memory, they are not needed anymore
+  void release(const char* p);
+  void close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char* data_;
+  size_t size_;
+};
+
+/// Read the binary map file into msg: binary, id, resolution, depth and data.
+/// Returns false with the reason in error if the file can not be read or is
+/// not a binary map. The frame and stamp of msg are left alone.
+bool readBinaryMapFile(const std::string& filename, octomap_msgs::Octomap* msg, std::string* error);
+
+inline bool MappedFile::open(const std::string& filename)
+{
+  close();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after closing the file
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  // the payload is read once, front to back
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+  return true;
+}
+
+inline void MappedFile::release(const char* p)
+{
+  const size_t page_size = sysconf(_SC_PAGESIZE);
+  const size_t length = ((p - data_) / page_size) * page_size;
+  if (length > 0)
+    madvise(const_cast<char*>(data_), length, MADV_DONTNEED);
+}
+
+inline void MappedFile::close()
+{
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+inline bool readBinaryMapFile(const std::string& filename, octomap_msgs::Octomap* msg, std::string* error)
+{
+  MappedFile file;
+  if (!file.open(filename))
+  {
+    *error = std::string("unable to open the file: ") + strerror(errno);
+    return false;
+  }
+
+  size_t node_count = 0;
+  msg->binary = true;
+  msg->depth = 16;
+  msg->resolution = 0.0;
+  msg->id = "";
+  msg->data.clear();
+
+  // Parse the header lines in place, the payload follows the data line
+  const char* pos = file.data();
+  const char* end = file.data() + file.size();
+  bool found_data = false;
+  while (pos < end && !found_data)
+  {
+    const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+    if (!eol)
+      eol = end;
+    std::istringstream ss(std::string(pos, eol));
+    pos = (eol < end) ? eol + 1 : end;
+
+    std::string first_word;
+    ss >> first_word;
+    if (first_word == "id")
+    {
+      ss >> msg->id;
+    }
+    else if (first_word == "res")
+    {
+      ss >> msg->resolution;
+    }
+    else if (first_word == "size")
+    {
+      ss >> node_count;
+    }
+    else if (first_word == "depth")
+    {
+      unsigned int depth;
+      ss >> depth;
+      if (depth > octomap::KEY_BIT_WIDTH)
+      {
+        std::ostringstream reason;
+        reason << "invalid depth " << depth;
+        *error = reason.str();
+        return false;
+      }
+      msg->depth = depth;
+    }
+    else if (first_word == "data")
+    {
+      found_data = true;
+    }
+  }
+
+  // The only copy of the payload, straight from the page cache into the
+  // message. The message type owns its buffer, so one copy is the minimum.
+  // Copy in chunks and drop the pages copied so far, so the mapping does
+  // not add the size of the file to the peak memory use.
+  static const size_t COPY_CHUNK_SIZE = 64 * 1024 * 1024;
+  msg->data.reserve(end - pos);
+  while (pos < end)
+  {
+    const char* chunk_end = pos + std::min<size_t>(COPY_CHUNK_SIZE, end - pos);
+    msg->data.insert(msg->data.end(), pos, chunk_end);
+    pos = chunk_end;
+    file.release(pos);
+  }
+  file.close();
+
+  if (msg->resolution == 0.0)
+  {
+    *error = "could not read resolution";
+    return false;
+  }
+  if (msg->id.empty())
+  {
+    *error = "could not read id";
+    return false;
+  }
+  if (msg->data.empty() && node_count > 0)
+  {
+    std::ostringstream reason;
+    reason << "data size mismatch. Header says there are " << node_count << " nodes but actually read "
+           << msg->data.size() << " bytes.";
+    *error = reason.str();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_BINARY_MAP_FILE_H
@@ -0,0 +1,100 @@
+#ifndef OCTOMAP_SERVER_CHANGE_JOURNAL_H
+#define OCTOMAP_SERVER_CHANGE_JOURNAL_H
+
+#include <cstdint>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+
+namespace octomap_server {
+
+// A flat, append-only journal of octree node changes.
+// Every change is packed into one 64-bit record holding the node key, the
+// depth of the node in the tree and a bit telling whether the binary
+// (occupied/free) state of the node changed. Appending a change is a single
+// push_back, as opposed to marking a node in a bounds octree, which costs a
+// walk from the root and (likely) node allocations for every change.
+// Records are deduplicated with compact(), which is called when the journal
+// doubles in size and should be called once per cycle before reading the
+// records back.
+// A disabled journal drops every change, so tracking costs nothing when
+// nobody is interested in the changes.
+class ChangeJournal
+{
+public:
+  typedef uint64_t Record;
+
+  ChangeJournal();
+
+  /// NOTE: disabling the journal clears it
+  void setEnabled(bool enabled);
+  bool isEnabled() const { return enabled_; }
+
+  inline void append(const octomap::OcTreeKey& key, unsigned int depth, bool binary_changed)
+  {
+    if (!enabled_)
+    {
+      return;
+    }
+    records_.push_back(pack(key, depth, binary_changed));
+    if (records_.size() >= compact_threshold_)
+    {
+      compact();
+    }
+  }
+
+  /// Sort the journal and merge records of the same node.
+  void compact();
+  /// Sort the given records and merge records of the same node.
+  static void compactRecords(std::vector<Record>* records);
+  void clear();
+  bool empty() const { return records_.empty(); }
+  size_t size() const { return records_.size(); }
+  /// Records in the journal, only sorted and unique after calling compact()
+  const std::vector<Record>& records() const { return records_; }
+
+  static inline Record pack(const octomap::OcTreeKey& key, unsigned int depth, bool binary_changed)
+  {
+    return (static_cast<Record>(key[0]) << 38) |
+           (static_cast<Record>(key[1]) << 22) |
+           (static_cast<Record>(key[2]) << 6) |
+           (static_cast<Record>(depth & 0x1f) << 1) |
+           (binary_changed ? 1 : 0);
+  }
+  static inline octomap::OcTreeKey recordKey(Record record)
+  {
+    return octomap::OcTreeKey((record >> 38) & 0xffff, (record >> 22) & 0xffff, (record >> 6) & 0xffff);
+  }
+  static inline unsigned int recordDepth(Record record) { return (record >> 1) & 0x1f; }
+  static inline bool recordBinaryChanged(Record record) { return (record & 1) != 0; }
+
+  /// Mark every journaled node in the given (binary) bounds tree as occupied.
+  /// If binary_only is set, only nodes whose binary state changed are marked.
+  template <class TREE>
+  void markTree(TREE* bounds_tree, bool binary_only) const
+  {
+    markTree(records_, bounds_tree, binary_only);
+  }
+
+  template <class TREE>
+  static void markTree(const std::vector<Record>& records, TREE* bounds_tree, bool binary_only)
+  {
+    const float value = bounds_tree->getClampingThresMaxLog();
+    for (const Record record : records)
+    {
+      if (binary_only && !recordBinaryChanged(record))
+      {
+        continue;
+      }
+      bounds_tree->setNodeValueAtDepth(recordKey(record), recordDepth(record), value);
+    }
+  }
+
+private:
+  bool enabled_;
+  size_t compact_threshold_;
+  std::vector<Record> records_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_CHANGE_JOURNAL_H
@@ -0,0 +1,62 @@
+#ifndef OCTOMAP_SERVER_CHANGE_RING_H
+#define OCTOMAP_SERVER_CHANGE_RING_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <octomap_server/ChangeJournal.h>
+
+namespace octomap_server {
+
+// A bounded history of the (compacted) change journals of recent update
+// cycles, each tagged with the update sequence number it was published with.
+// It lets a client that missed some updates ask for the merged changes since
+// the last update it saw, instead of starting over with the whole map.
+// The history only covers a contiguous range of cycles. Old cycles are
+// dropped when either limit is hit, and reset() forgets all of them when
+// changes happened that were not journaled.
+class ChangeRing
+{
+public:
+  typedef ChangeJournal::Record Record;
+
+  ChangeRing();
+
+  /// A limit of zero disables the ring
+  void setLimits(size_t max_cycles, size_t max_records);
+  bool isEnabled() const { return max_cycles_ > 0 && max_records_ > 0; }
+
+  /// Store the changes published with the given seq. If seq does not follow
+  /// the last stored cycle, the history is reset first.
+  void push(uint32_t seq, const std::vector<Record>& records);
+  /// Forget the history, the next cycle stored will have next_seq
+  void reset(uint32_t next_seq);
+
+  /// Merge the changes of all cycles after since_seq into records (sorted
+  /// and unique). Return false if some of these cycles are not in the ring.
+  bool collect(uint32_t since_seq, std::vector<Record>* records) const;
+
+  size_t cycles() const { return cycles_.size(); }
+  size_t records() const { return record_count_; }
+
+private:
+  struct Cycle
+  {
+    uint32_t seq;
+    std::vector<Record> records;
+  };
+
+  void trim();
+
+  size_t max_cycles_;
+  size_t max_records_;
+  // seq of the oldest cycle that can be collected, and of the next cycle
+  uint32_t first_seq_;
+  uint32_t next_seq_;
+  size_t record_count_;
+  std::deque<Cycle> cycles_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_CHANGE_RING_H
@@ -0,0 +1,129 @@
+#ifndef OCTOMAP_SERVER_CHECKPOINTER_H
+#define OCTOMAP_SERVER_CHECKPOINTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <ros/time.h>
+#include <octomap_server/ChangeJournal.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+
+namespace octomap_server {
+
+class TileCache;
+
+// Periodic checkpoints of a live tree, for crash recovery.
+// A checkpoint is a snapshot of the whole tree in its native format
+// (snapshot_<generation>.ot), followed by a journal of the nodes changed
+// since (journal_<generation>.bin), appended to once per update cycle.
+// Snapshots are copied from the tree a slice at a time, at most
+// snapshot_leafs_per_cycle leafs per update cycle in key (Morton) order, and
+// built and written by a background thread, so mapping goes on while they
+// are taken. Once a snapshot is complete, the older snapshots and journals
+// are removed.
+// The journal stores the state of the changed nodes, not the changes, so
+// replaying it after the snapshot gives the tree as of the last cycle. The
+// journal of a snapshot starts before its first slice is copied, so it also
+// brings the slices copied before a change up to date.
+// With tile paging, the tiles paged out while a snapshot is copied are kept
+// in snapshot_<generation>.tiles (hard linked, or copied across file
+// systems) and grafted into the snapshot before it is written, so the
+// snapshot holds the whole map.
+class Checkpointer
+{
+public:
+  typedef ChangeJournal::Record Record;
+
+  Checkpointer();
+  /// Waits for a snapshot being written
+  ~Checkpointer();
+
+  /// Checkpoints go to directory, an empty directory disables checkpoints
+  void setDirectory(const std::string& directory);
+  bool isEnabled() const { return !directory_.empty(); }
+  void setSnapshotPeriod(double seconds) { snapshot_period_ = seconds; }
+  /// Leafs copied per cycle while taking a snapshot, 0 to copy the whole
+  /// tree at once
+  void setSnapshotLeafsPerCycle(size_t leafs) { snapshot_leafs_per_cycle_ = leafs; }
+
+  /// Read the last snapshot and replay the journals after it. Returns NULL
+  /// if there is no checkpoint.
+  OcTreeStampedWithExpiry* restore();
+  /// Remove all snapshots and journals, e.g. those of an earlier run when
+  /// starting a new map instead of restoring it. Their journals would
+  /// otherwise be replayed onto the snapshot of that run.
+  void discard();
+
+  /// Journal the nodes changed in the last cycle (records are compacted
+  /// ChangeJournal records) and start a snapshot when it is due. tiles pages
+  /// the tree out, if it is paged.
+  void checkpoint(const OcTreeStampedWithExpiry& tree, const std::vector<Record>& records,
+                  const ros::Time& now, const TileCache* tiles = NULL);
+  /// Take a snapshot on the next checkpoint, as the tree changed in a way
+  /// the journal can not describe (e.g. it was reset or replaced)
+  void requestSnapshot() { snapshot_requested_ = true; }
+
+private:
+  enum EntryType { ERASE = 0, LEAF = 1 };
+
+  void journalNode(const OcTreeStampedWithExpiry& tree, Record record, std::string* buffer) const;
+  void journalLeafsRecurs(const OcTreeStampedWithExpiry& tree, const OcTreeStampedWithExpiry::NodeType* node,
+                          const octomap::OcTreeKey& key, unsigned int depth, std::string* buffer) const;
+  static void appendEntry(EntryType type, const octomap::OcTreeKey& key, unsigned int depth,
+                          const OcTreeStampedWithExpiry::NodeType* node, std::string* buffer);
+  bool replayJournal(const std::string& filename, OcTreeStampedWithExpiry* tree) const;
+  static void applyEntries(const char* entries, size_t num_entries, OcTreeStampedWithExpiry* tree);
+
+  void startSnapshot(const OcTreeStampedWithExpiry& tree, const ros::Time& now, const TileCache* tiles);
+  /// Copy the next slice of the tree, and hand the snapshot to the writer
+  /// once all of it is copied
+  void continueSnapshot(const OcTreeStampedWithExpiry& tree, const TileCache* tiles);
+  /// Keep the tiles paged out since the last call. Forget those that were
+  /// dropped, neither paged out nor in the tree anymore.
+  void keepEvictedTiles(const OcTreeStampedWithExpiry& tree, const TileCache& tiles);
+  /// Append the leafs after copy_cursor_ to snapshot_entries_, until budget
+  /// leafs are copied. Returns false if it stopped for the budget.
+  bool copyLeafsRecurs(const OcTreeStampedWithExpiry& tree, const OcTreeStampedWithExpiry::NodeType* node,
+                       const octomap::OcTreeKey& node_min, unsigned int depth, size_t* budget);
+  void writeSnapshot(boost::shared_ptr<OcTreeStampedWithExpiry> snapshot,
+                     boost::shared_ptr<const std::string> entries, std::vector<octomap::OcTreeKey> tiles,
+                     unsigned int tile_depth, uint64_t generation);
+  void removeBefore(uint64_t generation) const;
+  void removeTileDirectory(uint64_t generation) const;
+
+  std::string snapshotFilename(uint64_t generation) const;
+  std::string journalFilename(uint64_t generation) const;
+  std::string tileDirectory(uint64_t generation) const;
+  std::string tileFilename(uint64_t generation, const octomap::OcTreeKey& tile) const;
+  std::vector<uint64_t> listGenerations(const std::string& prefix, const std::string& suffix) const;
+
+  std::string directory_;
+  double snapshot_period_;
+  size_t snapshot_leafs_per_cycle_;
+  ros::Time last_snapshot_time_;
+  bool snapshot_requested_;
+  // generation of the journal being appended to
+  uint64_t generation_;
+  // the snapshot being copied: an empty tree with the parameters of the
+  // source, the journal entries of the leafs copied so far, and the Morton
+  // code of the first voxel after them
+  bool copying_;
+  boost::shared_ptr<OcTreeStampedWithExpiry> snapshot_;
+  std::string snapshot_entries_;
+  uint64_t copy_cursor_;
+  // tiles kept for the snapshot being copied, with their eviction number
+  std::unordered_map<octomap::OcTreeKey, uint64_t, octomap::OcTreeKey::KeyHash> snapshot_tiles_;
+  unsigned int snapshot_tile_depth_;
+  std::ofstream journal_;
+  boost::thread writer_;
+  std::atomic<bool> writing_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_CHECKPOINTER_H
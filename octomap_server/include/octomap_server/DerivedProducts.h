@@ -0,0 +1,47 @@
+#ifndef OCTOMAP_SERVER_DERIVED_PRODUCTS_H
+#define OCTOMAP_SERVER_DERIVED_PRODUCTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <nav_msgs/OccupancyGrid.h>
+
+namespace octomap_server {
+
+// Products the server derives from a whole map in its first traversal,
+// saved next to the map file (<map>.derived) so that loading the same map
+// again publishes them without traversing the tree.
+// The sidecar is keyed on a hash of the map file's metadata and of the
+// parameters the products depend on; any other key is a miss.
+struct DerivedProducts
+{
+  struct OccupiedLeaf
+  {
+    float x, y, z;
+    uint32_t depth;
+  };
+
+  /// The projected 2D map
+  nav_msgs::OccupancyGrid gridmap;
+  /// The occupied leafs in the height range, without speckles, as in the
+  /// point cloud
+  std::vector<OccupiedLeaf> occupied;
+};
+
+static const uint64_t FNV1A64_OFFSET = 14695981039346656037ull;
+
+/// 64 bit FNV-1a hash of data, continuing from hash
+uint64_t fnv1a64(const void* data, size_t size, uint64_t hash = FNV1A64_OFFSET);
+/// Hash of the device, inode, size and modification time of a file, which
+/// change whenever the file is rewritten or replaced, without reading it
+bool hashFileStat(const std::string& filename, uint64_t* hash);
+
+std::string derivedProductsFilename(const std::string& map_filename);
+bool writeDerivedProducts(const std::string& filename, uint64_t key, const DerivedProducts& products);
+/// Returns false if the file is missing, unreadable or saved for another key
+bool readDerivedProducts(const std::string& filename, uint64_t key, DerivedProducts* products);
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_DERIVED_PRODUCTS_H
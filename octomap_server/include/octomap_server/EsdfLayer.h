@@ -0,0 +1,200 @@
+#ifndef OCTOMAP_SERVER_ESDF_LAYER_H
+#define OCTOMAP_SERVER_ESDF_LAYER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/ChangeJournal.h>
+
+namespace octomap_server {
+
+// Euclidean distance field (ESDF) of the occupied voxels in a window around
+// the robot, maintained incrementally from the journal of map changes.
+// Occupied voxels are at distance 0, the field is not signed inside of
+// obstacles.
+// Like DynamicEDT3D, every cell keeps the cell of its nearest obstacle.
+// A new obstacle lowers the distances around it with a wave from the
+// obstacle, a removed obstacle raises the cells that pointed at it and then
+// lets the surrounding cells lower them again, so a change only costs work
+// in the area whose distances it changes. Waves stop at the maximum
+// distance, beyond which cells hold the maximum distance.
+// Passing nearest obstacles between neighbors is not an exact EDT in every
+// configuration: a cell always holds the distance to an actual obstacle,
+// so it is never too small, but it may be to an obstacle slightly farther
+// than the nearest one. test_esdf_layer checks the distances against a
+// brute force EDT, with a tolerance of 0.1 voxel.
+// The window is a dense grid of voxels of the tree, moved with follow()
+// and rebuilt from the tree when it moves.
+class EsdfLayer
+{
+public:
+  EsdfLayer();
+
+  /// Window of size_xy x size_xy x size_z voxels, distances up to
+  /// max_distance voxels, unknown space counted as free or as occupied.
+  /// A size of 0 disables the layer.
+  void configure(unsigned int size_xy, unsigned int size_z, double max_distance, bool unknown_occupied,
+                 unsigned int tree_depth = 16);
+  bool isEnabled() const { return !obstacle_.empty(); }
+
+  /// Center the window on key when key strays more than a quarter of the
+  /// window from its center. The window is rebuilt on the next update.
+  /// Returns true if the window moved.
+  bool follow(const octomap::OcTreeKey& key);
+  /// Rebuild the window on the next update, e.g. when the tree was replaced
+  void reset() { rebuild_ = true; }
+  bool needsRebuild() const { return rebuild_; }
+  /// Bounds of the window, false before it was placed with follow()
+  bool window(octomap::OcTreeKey* min, octomap::OcTreeKey* max) const;
+
+  /// Apply the nodes whose binary state changed in records, read back from
+  /// tree, or rebuild the window
+  template <class TREE>
+  void update(const TREE& tree, const std::vector<ChangeJournal::Record>& records);
+
+  /// Distance in voxels from the voxel of key to the nearest occupied voxel,
+  /// the maximum distance if there is none closer. False outside the window.
+  bool distance(const octomap::OcTreeKey& key, float* distance) const;
+  float getMaxDistance() const { return max_distance_; }
+
+private:
+  enum Flags { OCCUPIED = 1, RAISED = 2, READ_OCCUPIED = 4 };
+  // A cell to process, by squared distance
+  typedef std::pair<int32_t, int32_t> QueueEntry;
+  typedef std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > Queue;
+
+  int32_t cellIndex(int x, int y, int z) const { return x + size_[0] * (y + size_[1] * z); }
+  void cellCoords(int32_t index, int* coords) const;
+  /// Coordinates of neighbor n of the cell at coords, false outside of the
+  /// window
+  bool neighborCoords(const int* coords, size_t n, int* neighbor_coords) const;
+
+  /// Set READ_OCCUPIED on the cells in [min, max] (window cells) occupied in
+  /// tree
+  template <class TREE>
+  void readBox(const TREE& tree, const int* min, const int* max);
+  template <class TREE>
+  void readBoxRecurs(const TREE& tree, const typename TREE::NodeType* node, const int* node_min,
+                     unsigned int depth, const int* min, const int* max);
+  void markBox(const int* node_min, int node_size, const int* min, const int* max);
+  /// Turn the cells in [min, max] into obstacles or free cells as read
+  void applyBox(const int* min, const int* max);
+
+  void clearCells();
+  void setObstacle(int32_t index);
+  void removeObstacle(int32_t index);
+  void processQueue();
+  void raise(int32_t index);
+  void lower(int32_t index);
+
+  unsigned int tree_depth_;
+  int size_[3];
+  int32_t max_distance_sq_;
+  float max_distance_;
+  bool unknown_occupied_;
+  // key of the first cell, valid once placed
+  bool placed_;
+  int origin_[3];
+  bool rebuild_;
+  // per cell: nearest obstacle cell (-1 for none), squared distance to it
+  // in voxels, flags
+  std::vector<int32_t> obstacle_;
+  std::vector<int32_t> distance_sq_;
+  std::vector<uint8_t> flags_;
+  Queue queue_;
+  // offsets of the 26 neighbors
+  std::vector<int32_t> neighbor_offsets_;
+  std::vector<int> neighbor_steps_;
+};
+
+template <class TREE>
+void EsdfLayer::update(const TREE& tree, const std::vector<ChangeJournal::Record>& records)
+{
+  if (!isEnabled() || !placed_)
+    return;
+  if (rebuild_)
+  {
+    rebuild_ = false;
+    clearCells();
+    const int min[3] = { 0, 0, 0 };
+    const int max[3] = { size_[0] - 1, size_[1] - 1, size_[2] - 1 };
+    readBox(tree, min, max);
+    applyBox(min, max);
+    processQueue();
+    return;
+  }
+  for (const ChangeJournal::Record record : records)
+  {
+    if (!ChangeJournal::recordBinaryChanged(record))
+      continue;
+    // cube of the node, clipped to the window
+    const octomap::OcTreeKey key = ChangeJournal::recordKey(record);
+    const int node_size = 1 << (tree_depth_ - std::min(ChangeJournal::recordDepth(record), tree_depth_));
+    int min[3], max[3];
+    bool inside = true;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      const int node_min = (key[i] & ~(node_size - 1)) - origin_[i];
+      min[i] = std::max(node_min, 0);
+      max[i] = std::min(node_min + node_size - 1, size_[i] - 1);
+      inside = inside && min[i] <= max[i];
+    }
+    if (inside)
+    {
+      readBox(tree, min, max);
+      applyBox(min, max);
+    }
+  }
+  processQueue();
+}
+
+template <class TREE>
+void EsdfLayer::readBox(const TREE& tree, const int* min, const int* max)
+{
+  const int root_min[3] = { -origin_[0], -origin_[1], -origin_[2] };
+  if (!tree.getRoot())
+  {
+    if (unknown_occupied_)
+      markBox(root_min, 1 << tree_depth_, min, max);
+    return;
+  }
+  readBoxRecurs(tree, tree.getRoot(), root_min, 0, min, max);
+}
+
+template <class TREE>
+void EsdfLayer::readBoxRecurs(const TREE& tree, const typename TREE::NodeType* node, const int* node_min,
+                              unsigned int depth, const int* min, const int* max)
+{
+  const int node_size = 1 << (tree_depth_ - depth);
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (node_min[i] > max[i] || node_min[i] + node_size - 1 < min[i])
+      return;
+  }
+  if (depth == tree_depth_ || !tree.nodeHasChildren(node))
+  {
+    if (tree.isNodeOccupied(node))
+      markBox(node_min, node_size, min, max);
+    return;
+  }
+  const int child_size = node_size / 2;
+  for (unsigned int pos = 0; pos < 8; ++pos)
+  {
+    // same child order as computeChildIdx()
+    const int child_min[3] = { node_min[0] + ((pos & 1) ? child_size : 0),
+                               node_min[1] + ((pos & 2) ? child_size : 0),
+                               node_min[2] + ((pos & 4) ? child_size : 0) };
+    if (tree.nodeChildExists(node, pos))
+      readBoxRecurs(tree, tree.getNodeChild(node, pos), child_min, depth + 1, min, max);
+    else if (unknown_occupied_)
+      markBox(child_min, child_size, min, max);
+  }
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_ESDF_LAYER_H
@@ -0,0 +1,52 @@
+#ifndef OCTOMAP_SERVER_FILE_WRITE_BUFFER_H
+#define OCTOMAP_SERVER_FILE_WRITE_BUFFER_H
+
+#include <cstdint>
+#include <streambuf>
+#include <string>
+
+namespace octomap_server {
+
+// A stream buffer writing straight to a file in large blocks, for writing
+// maps to disk without holding them in memory. With direct I/O the page
+// cache is bypassed (O_DIRECT), so saving a large map does not evict
+// everything else from it. Direct I/O falls back to regular writes if the
+// file system does not support it.
+// In direct mode, flushing the stream does nothing, as only whole blocks can
+// be written. Everything is written by close().
+class FileWriteBuffer : public std::streambuf
+{
+public:
+  FileWriteBuffer();
+  /// Closes the file, use close() to know whether that worked
+  ~FileWriteBuffer();
+
+  /// With exclusive, fail if the file already exists instead of truncating it
+  bool open(const std::string& filename, bool direct_io, bool exclusive = false,
+            size_t buffer_size = 4 * 1024 * 1024);
+  /// Write what is left and close the file. Returns false if any write failed.
+  bool close();
+
+  bool isOpen() const { return fd_ >= 0; }
+  bool isDirect() const { return direct_; }
+  uint64_t bytesWritten() const { return bytes_written_; }
+
+protected:
+  int_type overflow(int_type c);
+  int sync();
+
+private:
+  bool writeBuffer(bool final);
+  bool writeAll(const char* data, size_t size);
+
+  int fd_;
+  bool direct_;
+  bool failed_;
+  char* buffer_;
+  size_t buffer_size_;
+  uint64_t bytes_written_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_FILE_WRITE_BUFFER_H
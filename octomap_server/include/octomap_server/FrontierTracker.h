@@ -0,0 +1,261 @@
+#ifndef OCTOMAP_SERVER_FRONTIER_TRACKER_H
+#define OCTOMAP_SERVER_FRONTIER_TRACKER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/ChangeJournal.h>
+
+namespace octomap_server {
+
+// The frontier of the map for exploration: the free voxels with at least one
+// unknown voxel among their 26 neighbors.
+// The set is maintained from the journal of map changes. A node whose
+// binary state changed (which includes nodes created and deleted) can only
+// change the frontier state of its own voxels and of the voxels next to it,
+// so only those are checked again, instead of scanning the whole map.
+// Voxels of the tiles evicted from memory look unknown, so the frontier
+// runs along the edges of the tiles in memory. Paging does not go through
+// the journal, the tiles paged in or out are given to updateBox() instead.
+class FrontierTracker
+{
+public:
+  typedef std::unordered_set<octomap::OcTreeKey, octomap::OcTreeKey::KeyHash> KeySet;
+
+  // A 26-connected group of frontier voxels
+  struct Cluster
+  {
+    size_t size;
+    // mean of the voxel keys
+    double center[3];
+    octomap::OcTreeKey min;
+    octomap::OcTreeKey max;
+  };
+
+  FrontierTracker();
+
+  void configure(bool enabled, unsigned int tree_depth = 16);
+  bool isEnabled() const { return enabled_; }
+  /// Scan the whole tree on the next update, e.g. when the tree was replaced
+  void reset() { rebuild_ = true; }
+
+  /// Check the voxels around the nodes whose binary state changed in
+  /// records again, read back from tree, or scan the whole tree
+  template <class TREE>
+  void update(const TREE& tree, const std::vector<ChangeJournal::Record>& records);
+  /// Check the voxels in [min, max] (voxel keys) and next to it again, e.g.
+  /// a tile paged in or out of tree
+  template <class TREE>
+  void updateBox(const TREE& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+
+  const KeySet& frontiers() const { return frontiers_; }
+  /// Group the frontier voxels, dropping the groups of fewer than min_size
+  /// voxels
+  void cluster(size_t min_size, std::vector<Cluster>* clusters) const;
+
+private:
+  /// Drop the frontier voxels in [min, max]
+  void eraseBox(const unsigned int* min, const unsigned int* max);
+
+  /// Find the frontier voxels in [min, max] (voxel keys)
+  template <class TREE>
+  void scanBox(const TREE& tree, const unsigned int* min, const unsigned int* max);
+  template <class TREE>
+  void scanBoxRecurs(const TREE& tree, const typename TREE::NodeType* node, const unsigned int* node_min,
+                     unsigned int depth, const unsigned int* min, const unsigned int* max);
+  /// Find the frontier voxels on the faces of a free leaf, within
+  /// [min, max]. Voxels inside of the leaf only have known neighbors.
+  template <class TREE>
+  void scanLeaf(const TREE& tree, const unsigned int* leaf_min, unsigned int leaf_size, const unsigned int* min,
+                const unsigned int* max);
+  /// True if a neighbor of the voxel key outside of its leaf is unknown
+  template <class TREE>
+  bool hasUnknownNeighbor(const TREE& tree, const octomap::OcTreeKey& key, const unsigned int* leaf_min,
+                          unsigned int leaf_size) const;
+
+  bool enabled_;
+  unsigned int tree_depth_;
+  bool rebuild_;
+  KeySet frontiers_;
+  // voxels to check again this update, for the small changed nodes
+  KeySet candidates_;
+};
+
+template <class TREE>
+void FrontierTracker::update(const TREE& tree, const std::vector<ChangeJournal::Record>& records)
+{
+  if (!enabled_)
+    return;
+  const unsigned int max_key = (1u << tree_depth_) - 1;
+  if (rebuild_)
+  {
+    rebuild_ = false;
+    frontiers_.clear();
+    const unsigned int min[3] = { 0, 0, 0 };
+    const unsigned int max[3] = { max_key, max_key, max_key };
+    scanBox(tree, min, max);
+    return;
+  }
+  candidates_.clear();
+  for (const ChangeJournal::Record record : records)
+  {
+    if (!ChangeJournal::recordBinaryChanged(record))
+      continue;
+    // cube of the node grown by one voxel for the neighbors
+    const octomap::OcTreeKey key = ChangeJournal::recordKey(record);
+    const unsigned int node_size = 1u << (tree_depth_ - std::min(ChangeJournal::recordDepth(record), tree_depth_));
+    unsigned int min[3], max[3];
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      const unsigned int node_min = key[i] & ~(node_size - 1);
+      min[i] = node_min > 0 ? node_min - 1 : 0;
+      max[i] = std::min(node_min + node_size, max_key);
+    }
+    // Changes are mostly single voxels next to each other, their boxes
+    // overlap and are merged first. Large nodes are scanned by leaf.
+    if (node_size <= 4)
+    {
+      for (unsigned int x = min[0]; x <= max[0]; ++x)
+        for (unsigned int y = min[1]; y <= max[1]; ++y)
+          for (unsigned int z = min[2]; z <= max[2]; ++z)
+            candidates_.insert(octomap::OcTreeKey(x, y, z));
+    }
+    else
+    {
+      eraseBox(min, max);
+      scanBox(tree, min, max);
+    }
+  }
+  for (const octomap::OcTreeKey& key : candidates_)
+  {
+    frontiers_.erase(key);
+    const unsigned int voxel[3] = { key[0], key[1], key[2] };
+    scanBox(tree, voxel, voxel);
+  }
+  candidates_.clear();
+}
+
+template <class TREE>
+void FrontierTracker::updateBox(const TREE& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max)
+{
+  // a pending rebuild scans everything anyway
+  if (!enabled_ || rebuild_)
+    return;
+  const unsigned int max_key = (1u << tree_depth_) - 1;
+  unsigned int box_min[3], box_max[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    box_min[i] = min[i] > 0 ? min[i] - 1 : 0;
+    box_max[i] = std::min(static_cast<unsigned int>(max[i]) + 1, max_key);
+  }
+  eraseBox(box_min, box_max);
+  scanBox(tree, box_min, box_max);
+}
+
+template <class TREE>
+void FrontierTracker::scanBox(const TREE& tree, const unsigned int* min, const unsigned int* max)
+{
+  if (!tree.getRoot())
+    return;
+  const unsigned int root_min[3] = { 0, 0, 0 };
+  scanBoxRecurs(tree, tree.getRoot(), root_min, 0, min, max);
+}
+
+template <class TREE>
+void FrontierTracker::scanBoxRecurs(const TREE& tree, const typename TREE::NodeType* node,
+                                    const unsigned int* node_min, unsigned int depth, const unsigned int* min,
+                                    const unsigned int* max)
+{
+  const unsigned int node_size = 1u << (tree_depth_ - depth);
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (node_min[i] > max[i] || node_min[i] + node_size - 1 < min[i])
+      return;
+  }
+  if (depth == tree_depth_ || !tree.nodeHasChildren(node))
+  {
+    if (!tree.isNodeOccupied(node))
+      scanLeaf(tree, node_min, node_size, min, max);
+    return;
+  }
+  const unsigned int child_size = node_size / 2;
+  for (unsigned int pos = 0; pos < 8; ++pos)
+  {
+    // same child order as computeChildIdx(), missing children are unknown
+    if (!tree.nodeChildExists(node, pos))
+      continue;
+    const unsigned int child_min[3] = { node_min[0] + ((pos & 1) ? child_size : 0),
+                                        node_min[1] + ((pos & 2) ? child_size : 0),
+                                        node_min[2] + ((pos & 4) ? child_size : 0) };
+    scanBoxRecurs(tree, tree.getNodeChild(node, pos), child_min, depth + 1, min, max);
+  }
+}
+
+template <class TREE>
+void FrontierTracker::scanLeaf(const TREE& tree, const unsigned int* leaf_min, unsigned int leaf_size,
+                               const unsigned int* min, const unsigned int* max)
+{
+  unsigned int lower[3], upper[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    lower[i] = std::max(leaf_min[i], min[i]);
+    upper[i] = std::min(leaf_min[i] + leaf_size - 1, max[i]);
+  }
+  const unsigned int leaf_max[3] = { leaf_min[0] + leaf_size - 1, leaf_min[1] + leaf_size - 1,
+                                     leaf_min[2] + leaf_size - 1 };
+  for (unsigned int x = lower[0]; x <= upper[0]; ++x)
+  {
+    for (unsigned int y = lower[1]; y <= upper[1]; ++y)
+    {
+      // away from the x and y faces only the two z faces are visited
+      const bool face_xy = x == leaf_min[0] || x == leaf_max[0] || y == leaf_min[1] || y == leaf_max[1];
+      for (unsigned int z = lower[2]; z <= upper[2]; ++z)
+      {
+        if (!face_xy && z != leaf_min[2] && z != leaf_max[2])
+        {
+          if (leaf_max[2] > upper[2])
+            break;
+          z = leaf_max[2];
+        }
+        const octomap::OcTreeKey key(x, y, z);
+        if (hasUnknownNeighbor(tree, key, leaf_min, leaf_size))
+          frontiers_.insert(key);
+      }
+    }
+  }
+}
+
+template <class TREE>
+bool FrontierTracker::hasUnknownNeighbor(const TREE& tree, const octomap::OcTreeKey& key,
+                                         const unsigned int* leaf_min, unsigned int leaf_size) const
+{
+  const int max_key = (1 << tree_depth_) - 1;
+  for (int dx = -1; dx <= 1; ++dx)
+  {
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+      for (int dz = -1; dz <= 1; ++dz)
+      {
+        const int n[3] = { key[0] + dx, key[1] + dy, key[2] + dz };
+        bool in_leaf = true;
+        bool in_map = true;
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+          in_leaf = in_leaf && n[i] >= int(leaf_min[i]) && n[i] < int(leaf_min[i] + leaf_size);
+          in_map = in_map && n[i] >= 0 && n[i] <= max_key;
+        }
+        if (in_leaf || !in_map)
+          continue;
+        if (!tree.search(octomap::OcTreeKey(n[0], n[1], n[2])))
+          return true;
+      }
+    }
+  }
+  return false;
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_FRONTIER_TRACKER_H
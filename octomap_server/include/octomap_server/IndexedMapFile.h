@@ -0,0 +1,125 @@
+#ifndef OCTOMAP_SERVER_INDEXED_MAP_FILE_H
+#define OCTOMAP_SERVER_INDEXED_MAP_FILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+
+namespace octomap_server {
+
+// Indexed map files (.oti) hold a regular octomap binary (.bt) or full (.ot)
+// data stream, cut at a fixed depth into the top levels of the tree and the
+// subtrees below them, plus a table locating every subtree in the file.
+// Subtrees can be decoded in parallel, and subtrees outside an area of
+// interest do not need to be read at all.
+//
+// Layout:
+//   text header, in the style of the .bt header, ending with a "data" line
+//   subtree table, one IndexedSubtreeEntry per subtree, in stream order
+//   top levels of the stream, without the subtrees (top_size bytes)
+//   subtree streams, back to back
+// Numbers in the binary part are stored in host byte order, like octomap
+// does for .bt and .ot files.
+
+static const char* const INDEXED_MAP_FILE_EXTENSION = ".oti";
+// Subtrees at depth 6 are 51.2m wide at 5cm resolution, small enough to load
+// the area around a robot and few enough to keep the table small
+static const unsigned int DEFAULT_INDEXED_SPLIT_DEPTH = 6;
+
+struct IndexedMapHeader
+{
+  IndexedMapHeader()
+    : resolution(0.0), tree_depth(16), binary(true), split_depth(0), num_subtrees(0), top_size(0) {}
+  std::string id;
+  double resolution;
+  unsigned int tree_depth;
+  // binary (.bt) or full (.ot) data stream
+  bool binary;
+  // depth of the subtree roots
+  unsigned int split_depth;
+  uint64_t num_subtrees;
+  uint64_t top_size;
+};
+
+struct IndexedSubtreeEntry
+{
+  // key of the subtree root, at split_depth
+  octomap::OcTreeKey key;
+  // full streams only: false if the subtree root was written as a leaf
+  bool write_children;
+  // position of the subtree in the top levels of the stream
+  uint64_t splice_offset;
+  // position of the subtree stream, relative to the first subtree stream
+  uint64_t data_offset;
+  uint64_t data_size;
+
+  static const size_t SERIALIZED_SIZE = 32;
+};
+
+bool isIndexedMapFile(const std::string& filename);
+
+bool writeIndexedMapHeader(std::ostream& s, const IndexedMapHeader& header);
+/// Read the header, leaving s at the subtree table
+bool readIndexedMapHeader(std::istream& s, IndexedMapHeader* header);
+void writeIndexedSubtreeEntry(std::ostream& s, const IndexedSubtreeEntry& entry);
+bool readIndexedSubtreeEntry(std::istream& s, IndexedSubtreeEntry* entry);
+
+/// Write an indexed map from the pieces of its stream: the top levels and the
+/// data of the subtrees in stream order, with the key, write_children and
+/// splice_offset of their entries set. Fills in the rest of the header and
+/// the entries.
+bool writeIndexedMapPieces(std::ostream& s, IndexedMapHeader header, const std::string& top,
+                           std::vector<IndexedSubtreeEntry>* entries, const std::vector<const std::string*>& data);
+
+/// Write the tree as an indexed map, encoding the subtrees with num_threads
+/// threads. Subtrees are rooted at split_depth.
+template <class TREE>
+bool writeIndexedMap(const TREE& tree, bool binary, std::ostream& s,
+                     unsigned int split_depth, unsigned int num_threads)
+{
+  detail::SplitStream<TREE> stream;
+  if (!stream.write(tree, binary, WriteAllPolicy(), num_threads, split_depth))
+  {
+    return false;
+  }
+
+  IndexedMapHeader header;
+  header.id = messageTreeType(tree);
+  header.resolution = tree.getResolution();
+  header.tree_depth = tree.getTreeDepth();
+  header.binary = binary;
+  header.split_depth = split_depth;
+  std::vector<IndexedSubtreeEntry> entries;
+  std::vector<const std::string*> data;
+  for (const detail::SplitSubtree<TREE>& subtree : stream.subtrees())
+  {
+    IndexedSubtreeEntry entry;
+    entry.key = subtree.key;
+    entry.write_children = subtree.write_children;
+    entry.splice_offset = subtree.offset;
+    entries.push_back(entry);
+    data.push_back(&subtree.data);
+  }
+  return writeIndexedMapPieces(s, header, stream.top(), &entries, data);
+}
+
+template <class TREE>
+bool writeIndexedMap(const TREE& tree, bool binary, const std::string& filename,
+                     unsigned int split_depth, unsigned int num_threads)
+{
+  std::ofstream file(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  if (!file.is_open())
+  {
+    return false;
+  }
+  return writeIndexedMap(tree, binary, file, split_depth, num_threads);
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_INDEXED_MAP_FILE_H
@@ -0,0 +1,105 @@
+#ifndef OCTOMAP_SERVER_INFLATION_LAYER_H
+#define OCTOMAP_SERVER_INFLATION_LAYER_H
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <nav_msgs/OccupancyGrid.h>
+
+namespace octomap_server {
+
+// Cost grid of the projected 2D map with the occupied cells inflated by the
+// robot radius, for planners and costmaps that would otherwise inflate the
+// full map every time it is published.
+// Occupied cells cost 100, cells within the inscribed radius of an obstacle
+// 99, and the cost of cells up to the inflation radius decays
+// exponentially with the distance beyond the inscribed radius, like the
+// costmap_2d inflation layer (scaled to the 0-100 range of occupancy
+// grids). Other cells keep the value of the projected map.
+// Distances come from a brushfire from the obstacles that carries the
+// nearest obstacle along. The grid is compared with the previous one in
+// blocks of PATCH_SIZE cells, and every block with changes gives its own
+// patch, so changes far apart do not inflate everything between them.
+// Only the cells within the inflation radius of cells that became or
+// stopped being obstacles are inflated again, other changes (free to
+// unknown and back) only rewrite the cells that changed. A change of the
+// grid geometry (the map growing) rebuilds the whole grid.
+class InflationLayer
+{
+public:
+  // Cells of the grid updated by an update
+  struct Patch
+  {
+    unsigned int x;
+    unsigned int y;
+    unsigned int width;
+    unsigned int height;
+  };
+
+  // Side of the blocks of cells the changes are collected in
+  static const unsigned int PATCH_SIZE = 64;
+
+  InflationLayer();
+
+  /// Radii in meters, an inflation radius of 0 disables the layer
+  void configure(double inscribed_radius, double inflation_radius, double cost_scaling_factor);
+  bool isEnabled() const { return inflation_radius_ > 0.0; }
+
+  /// Apply the changes of grid since the previous update. Returns false if
+  /// no cell changed, otherwise patches are the areas updated, at most one
+  /// per block. rebuilt is set when the whole grid was computed again (a
+  /// single patch), e.g. because its geometry changed.
+  bool update(const nav_msgs::OccupancyGrid& grid, std::vector<Patch>* patches, bool* rebuilt = NULL);
+  /// The inflated grid
+  const nav_msgs::OccupancyGrid& getGrid() const { return costs_; }
+
+private:
+  // A cell to process, by squared distance to its nearest obstacle
+  typedef std::pair<int32_t, int32_t> QueueEntry;
+  typedef std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > Queue;
+
+  // Changes in a block since the last update, as boxes of cells (x min,
+  // y min, x max, y max)
+  struct Block
+  {
+    Block() { clear(); }
+    void clear();
+
+    // cells that became or stopped being obstacles
+    int obstacles[4];
+    // cells to inflate again
+    int inflate[4];
+    // cells rewritten without inflating them again
+    int rewrite[4];
+  };
+
+  void computeCostTable(double resolution);
+  /// Compute the costs of the cells in target from the obstacles within the
+  /// inflation radius of it
+  void inflate(const Patch& target);
+
+  double inscribed_radius_;
+  double inflation_radius_;
+  double cost_scaling_factor_;
+  bool rebuild_;
+  // inflation radius in cells, and the cost by squared distance in cells
+  int radius_;
+  std::vector<int8_t> cost_table_;
+  // the projected map the costs were computed from
+  std::vector<int8_t> occupancy_;
+  nav_msgs::OccupancyGrid costs_;
+  // inflation cost of every cell, 0 outside of the inflation radius
+  std::vector<int8_t> inflation_;
+  std::vector<Block> blocks_;
+  // per cell of the area being inflated: nearest obstacle cell (-1 for
+  // none) and squared distance to it
+  std::vector<int32_t> nearest_;
+  std::vector<int32_t> distance_sq_;
+  Queue queue_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_INFLATION_LAYER_H
@@ -0,0 +1,43 @@
+#ifndef OCTOMAP_SERVER_LEVEL_OF_DETAIL_H
+#define OCTOMAP_SERVER_LEVEL_OF_DETAIL_H
+
+#include <vector>
+#include <octomap/octomap_types.h>
+
+namespace octomap_server {
+
+// Distance dependent level of detail.
+// A list of distance bands, each with the maximum tree depth to publish
+// nodes at when they are within that distance of the origin (the robot).
+// Beyond the last band, the depth of the last band is used.
+// The distance of a node is the distance from the origin to the closest
+// point of the node's box, so a node is never published coarser than any
+// of its descendants would require.
+class LevelOfDetail
+{
+public:
+  LevelOfDetail();
+
+  /// Set the bands, distances must be increasing, depths must not increase
+  /// with the distance and both lists the same size. Returns false (and
+  /// disables LOD) otherwise. No bands disables LOD.
+  bool configure(const std::vector<double>& distances, const std::vector<int>& depths);
+  bool isEnabled() const { return !distances_.empty(); }
+
+  void setOrigin(const octomap::point3d& origin) { origin_ = origin; }
+  const octomap::point3d& getOrigin() const { return origin_; }
+
+  /// Depth to publish at, at the given distance from the origin
+  unsigned int depthAt(double distance) const;
+  /// Depth to publish at for a node with the given center and size
+  unsigned int nodeDepth(const octomap::point3d& center, double size) const;
+
+private:
+  std::vector<double> distances_;
+  std::vector<unsigned int> depths_;
+  octomap::point3d origin_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_LEVEL_OF_DETAIL_H
@@ -0,0 +1,68 @@
+#ifndef OCTOMAP_SERVER_MAP_SERIALIZATION_CACHE_H
+#define OCTOMAP_SERVER_MAP_SERIALIZATION_CACHE_H
+
+#include <cstdint>
+#include <functional>
+#include <boost/thread.hpp>
+#include <octomap_msgs/Octomap.h>
+
+namespace octomap_server {
+
+// A versioned cache of the serialized binary and full map messages.
+// The version is a map modification counter maintained by the owner of the
+// map. All consumers of the serialized map (new subscribers and the
+// GetOctomap services) share the cache, so the map is serialized once per
+// version, no matter how many clients ask for it.
+// Maps can be built synchronously, or in a background thread from a
+// snapshot of the map, in which case the last built (stale, but consistent)
+// map can be served while the new one is built.
+class MapSerializationCache
+{
+public:
+  // Fill in the given message, return true on success.
+  // Serializers passed to buildAsync run in another thread, and must own
+  // (a snapshot of) everything they access, or lock it.
+  typedef std::function<bool(octomap_msgs::Octomap&)> Serializer;
+
+  MapSerializationCache();
+  // non-copyable, owns the background threads
+  MapSerializationCache(const MapSerializationCache &rhs) = delete;
+  ~MapSerializationCache();
+
+  /// Return the cached map of the given version, or a null pointer
+  octomap_msgs::OctomapConstPtr get(bool binary, uint64_t version) const;
+  /// Return the latest cached map of any version, or a null pointer
+  octomap_msgs::OctomapConstPtr getLatest(bool binary, uint64_t* version = nullptr) const;
+  /// Serialize the map in the calling thread and cache it
+  octomap_msgs::OctomapConstPtr build(bool binary, uint64_t version, const Serializer& serializer);
+  /// Serialize the map in a background thread and cache it when done.
+  /// Does nothing if a build of this map type is already running.
+  void buildAsync(bool binary, uint64_t version, const Serializer& serializer);
+  bool isBuilding(bool binary) const;
+  /// Wait for the background builds, e.g. before what they read goes away
+  void wait();
+
+private:
+  struct Slot
+  {
+    Slot() : version(0), building(false) {}
+    octomap_msgs::OctomapConstPtr map;
+    uint64_t version;
+    bool building;
+    boost::thread worker;
+  };
+
+  Slot& slot(bool binary) { return slots_[binary ? 1 : 0]; }
+  const Slot& slot(bool binary) const { return slots_[binary ? 1 : 0]; }
+  // Store the map unless a newer version is already cached.
+  // Must be called with mutex_ held.
+  void store(Slot& slot, const octomap_msgs::OctomapConstPtr& map, uint64_t version);
+  void buildWorker(bool binary, uint64_t version, Serializer serializer);
+
+  mutable boost::mutex mutex_;
+  Slot slots_[2];
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_MAP_SERIALIZATION_CACHE_H
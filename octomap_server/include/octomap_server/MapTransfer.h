@@ -0,0 +1,55 @@
+#ifndef OCTOMAP_SERVER_MAP_TRANSFER_H
+#define OCTOMAP_SERVER_MAP_TRANSFER_H
+
+#include <cstdint>
+#include <map>
+#include <vector>
+#include <octomap_msgs/Octomap.h>
+#include <ros/time.h>
+
+namespace octomap_server {
+
+// Sessions of chunked map transfers. A session keeps the serialized map it
+// was started with, so its chunks come from that snapshot while mapping
+// goes on, and clients can fetch (or fetch again) chunks in any order.
+// Sessions are dropped when no chunk was fetched for the timeout, and the
+// least recently used one when there are too many.
+class MapTransfer
+{
+public:
+  MapTransfer();
+
+  void setLimits(size_t max_sessions, double timeout);
+
+  /// Start a session serving the data of map in chunks of chunk_size bytes,
+  /// return its id
+  uint32_t start(const octomap_msgs::OctomapConstPtr& map, size_t chunk_size);
+  /// Number of chunks of a session, 0 if there is no such session
+  uint32_t numChunks(uint32_t id) const;
+  /// Copy chunk index of a session to data, false if there is no such
+  /// session or chunk
+  bool chunk(uint32_t id, uint32_t index, std::vector<int8_t>* data, uint32_t* crc);
+  void clear() { sessions_.clear(); }
+
+  static uint32_t crc32(const int8_t* data, size_t size);
+
+private:
+  struct Session
+  {
+    octomap_msgs::OctomapConstPtr map;
+    size_t chunk_size;
+    ros::WallTime last_used;
+  };
+  typedef std::map<uint32_t, Session> SessionMap;
+
+  void expire(const ros::WallTime& now);
+
+  size_t max_sessions_;
+  double timeout_;
+  uint32_t next_id_;
+  SessionMap sessions_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_MAP_TRANSFER_H
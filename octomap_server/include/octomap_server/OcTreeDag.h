@@ -0,0 +1,150 @@
+#ifndef OCTOMAP_SERVER_OCTREE_DAG_H
+#define OCTOMAP_SERVER_OCTREE_DAG_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+#include <octomap/octomap_types.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+
+namespace octomap_server {
+
+// The binary occupancy of an octree as a directed acyclic graph, in which
+// identical subtrees are stored once, for archived and static maps.
+// A DAG node is the binary stream mask of a tree node (2 bits per child: 01
+// free leaf, 10 occupied leaf, 11 inner node) and the ids of its inner
+// children. Nodes are hash-consed while building, so a subtree repeated all
+// over the map, like a stretch of empty space or of wall, becomes a single
+// node. Expanding the DAG gives back the binary stream of the tree.
+// A root without children (a tree pruned to a single leaf) has no DAG node,
+// its occupancy is stored on its own.
+class OcTreeDag
+{
+public:
+  enum Occupancy { UNKNOWN = 0, FREE = 1, OCCUPIED = 2 };
+
+  OcTreeDag();
+
+  static const char* const FILE_EXTENSION;
+
+  /// Build from the binary occupancy of tree. With prune, inner nodes whose
+  /// children are 8 leafs of the same occupancy become leafs, as the binary
+  /// occupancy can not tell them apart.
+  template <class TREE>
+  void build(const TREE& tree, bool prune);
+  void clear();
+
+  bool write(const std::string& filename) const;
+  bool read(const std::string& filename);
+
+  double getResolution() const { return resolution_; }
+  unsigned int getTreeDepth() const { return tree_depth_; }
+  const std::string& getTreeType() const { return id_; }
+  bool empty() const { return masks_.empty() && root_leaf_ == UNKNOWN; }
+  /// Number of DAG nodes
+  size_t size() const { return masks_.size(); }
+  /// Number of nodes of the tree the DAG expands to
+  uint64_t treeSize() const { return tree_size_; }
+  /// Bytes used by the nodes
+  size_t memoryUsage() const;
+
+  bool coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey* key) const;
+  /// Occupancy of the leaf holding key, and its depth
+  Occupancy search(const octomap::OcTreeKey& key, unsigned int* depth = NULL) const;
+
+  /// Same as octomap_msgs::binaryMapToMsg() of the tree the DAG was built
+  /// from (after pruning). Like octomap, a leaf root is sent without its
+  /// occupancy.
+  bool binaryMapToMsg(octomap_msgs::Octomap& msg) const;
+
+private:
+  /// Bits 2i set for the inner children in a mask
+  static uint16_t innerBits(uint16_t mask) { return mask & (mask >> 1) & 0x5555; }
+
+  template <class TREE>
+  int64_t buildRecurs(const TREE& tree, const typename TREE::NodeType* node, bool prune);
+  uint32_t addNode(uint16_t mask, const std::vector<uint32_t>& children);
+  void writeBinaryRecurs(uint32_t id, std::vector<int8_t>* data) const;
+  uint64_t countTreeNodes() const;
+
+  std::string id_;
+  double resolution_;
+  unsigned int tree_depth_;
+  octomap::key_type tree_max_val_;
+  uint64_t tree_size_;
+  // node i has the mask masks_[i], and its inner children are
+  // children_[first_child_[i]] onwards, in the order of their bits
+  std::vector<uint16_t> masks_;
+  std::vector<uint32_t> first_child_;
+  std::vector<uint32_t> children_;
+  uint32_t root_;
+  // occupancy of the root when it is a leaf, UNKNOWN when it has children
+  Occupancy root_leaf_;
+  // mask and children of the nodes, only while building
+  std::unordered_map<std::string, uint32_t> unique_;
+};
+
+template <class TREE>
+void OcTreeDag::build(const TREE& tree, bool prune)
+{
+  clear();
+  id_ = messageTreeType(tree);
+  resolution_ = tree.getResolution();
+  tree_depth_ = tree.getTreeDepth();
+  tree_max_val_ = 1 << (tree_depth_ - 1);
+  if (tree.getRoot())
+  {
+    const int64_t root = buildRecurs(tree, tree.getRoot(), prune);
+    if (root < 0)
+    {
+      root_leaf_ = static_cast<Occupancy>(-1 - root);
+    }
+    else
+    {
+      root_ = root;
+    }
+  }
+  unique_.clear();
+  tree_size_ = countTreeNodes();
+}
+
+// Returns the node id, or -1 - occupancy for a leaf
+template <class TREE>
+int64_t OcTreeDag::buildRecurs(const TREE& tree, const typename TREE::NodeType* node, bool prune)
+{
+  if (!tree.nodeHasChildren(node))
+  {
+    return -1 - (tree.isNodeOccupied(node) ? OCCUPIED : FREE);
+  }
+  uint16_t mask = 0;
+  std::vector<uint32_t> children;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (tree.nodeChildExists(node, i))
+    {
+      const int64_t child = buildRecurs(tree, tree.getNodeChild(node, i), prune);
+      if (child >= 0)
+      {
+        mask |= 3 << (2 * i);
+        children.push_back(child);
+      }
+      else
+      {
+        mask |= (-1 - child) << (2 * i);
+      }
+    }
+  }
+  // the root stays, its children are what the stream sends
+  if (prune && (mask == 0x5555 || mask == 0xaaaa) && node != tree.getRoot())
+  {
+    return -1 - (mask == 0xaaaa ? OCCUPIED : FREE);
+  }
+  return addNode(mask, children);
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_OCTREE_DAG_H
@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <limits>
 #include <stdlib.h>
+#include <string>
+#include <vector>
 #include <octomap/OcTreeNode.h>
 #include <octomap/OccupancyOcTreeBase.h>
 #include <octomap_server/SensorUpdateKeyMap.h>
@@ -12,10 +14,18 @@
 namespace octomap_server {
 using NodeChangeNotification = std::function<void(const octomap::OcTreeKey&, unsigned int)>;
 
+// How the node at a key and depth lies with respect to a region
+enum class RegionOverlap { OUTSIDE, PARTIAL, INSIDE };
+using RegionTest = std::function<RegionOverlap(const octomap::OcTreeKey&, unsigned int)>;
+
 // node definition
+class OcTreeStampedWithExpiry;
+
 class OcTreeNodeStampedWithExpiry : public octomap::OcTreeNode
 {
     using super = octomap::OcTreeNode;
+    // The indexed reader links children from several threads at once
+    friend class OcTreeStampedWithExpiry;
   public:
     // Class-wide Parameters.
 
@@ -111,7 +121,23 @@ class OcTreeStampedWithExpiry : public octomap::OccupancyOcTreeBase <OcTreeNodeS
       }
     }
 
-    std::string getTreeType() const {return "OcTree";}
+    std::string getTreeType() const {return "OcTreeStampedWithExpiry";}
+
+    // Copy the sensor model and expiry parameters of another tree, e.g. of
+    // the configured tree when replacing it by one read from a file
+    void copyParameters(const OcTreeStampedWithExpiry& other);
+
+    // The native (.ot) data stream, which keeps the timestamp and expiry of
+    // every node next to its value. Timestamps are stored as 32 bit offsets
+    // from the timestamp of the root. Messages use the OcTree streams
+    // instead, see messageTreeType().
+    std::istream& readData(std::istream& s);
+    std::ostream& writeData(std::ostream& s) const;
+    // Write the record of one node of the native stream, with its stamps
+    // relative to base_stamp and the bits of the children that follow it
+    static void writeNativeNode(std::ostream& s, const NodeType& node, time_t base_stamp, uint8_t children);
+    // Bytes of a node record in the native stream
+    static const size_t NATIVE_NODE_SIZE = sizeof(float) + 2 * sizeof(int32_t) + sizeof(char);
 
     // Time of last update
     time_t getLastUpdateTime() const {return last_expire_time;}
@@ -165,7 +191,82 @@ class OcTreeStampedWithExpiry : public octomap::OccupancyOcTreeBase <OcTreeNodeS
     // of new nodes in the update and depth is the tree_depth.
     void applyUpdate(const SensorUpdateKeyMap& update);
 
+    // Set the leafs in the box of keys [min, max] to the minimum (free), or
+    // delete them with delete minimum, reporting the changes to the value
+    // change callback. Only the nodes above the box are updated, so the cost
+    // follows the size of the box, not of the tree. Leafs partly in the box
+    // are split, so the space outside the box keeps its value.
+    void clearAABB(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+    // Same for the region test tells apart, or with erase delete the leafs
+    // instead. Leafs partly in the region are split. test must not answer
+    // PARTIAL for nodes at the tree depth.
+    void clearRegion(const RegionTest& test, bool erase);
+
+    // Set the node at key and depth, creating it if needed and dropping its
+    // children, e.g. to replay a checkpoint journal. Call
+    // updateInnerOccupancy() when done.
+    void setNodeAtDepth(const octomap::OcTreeKey& key, unsigned int depth,
+                        float log_odds, time_t stamp, time_t expiry);
+
+    // Write the subtree at key and depth in the native stream format, with the
+    // stamp of its top node as the base. Returns false if there is no node
+    // at key and depth.
+    bool writeSubtree(std::ostream& s, const octomap::OcTreeKey& key, unsigned int depth) const;
+    // Delete the subtree at key and depth, and the ancestors left without
+    // children, keeping the tree size right. Returns the number of nodes
+    // deleted.
+    size_t deleteSubtree(const octomap::OcTreeKey& key, unsigned int depth);
+    // Read a subtree written by writeSubtree() back in at key and depth. Where
+    // the tree already has children the stream only fills in the gaps, where
+    // it has a leaf the stream replaces it.
+    bool readSubtree(std::istream& s, const octomap::OcTreeKey& key, unsigned int depth);
+
+    // Read an indexed map file (see IndexedMapFile.h), replacing the tree.
+    // The subtrees are decoded by num_threads threads. If bbx_min and bbx_max
+    // are given, only the subtrees overlapping that box are read.
+    bool readIndexed(const std::string& filename,
+                     unsigned int num_threads,
+                     const octomap::point3d* bbx_min = nullptr,
+                     const octomap::point3d* bbx_max = nullptr);
+
   protected:
+    // Where a subtree of an indexed map file goes in the tree
+    struct IndexedSlot
+    {
+      NodeType* parent;
+      unsigned int child;
+      octomap::OcTreeKey key;
+      size_t offset;
+    };
+
+    // Create a child without touching the tree size, so it can be called
+    // from several threads for different parents
+    NodeType* createIndexedChild(NodeType* node, unsigned int child);
+    // Read a binary or full data stream below node. With slots given,
+    // the children at split_depth are not read but recorded in slots.
+    bool readIndexedBinaryRecurs(std::istream& s,
+                                 NodeType* node,
+                                 const octomap::OcTreeKey& key,
+                                 unsigned int depth,
+                                 unsigned int split_depth,
+                                 std::vector<IndexedSlot>* slots);
+    bool readIndexedFullRecurs(std::istream& s,
+                               NodeType* node,
+                               const octomap::OcTreeKey& key,
+                               unsigned int depth,
+                               unsigned int split_depth,
+                               std::vector<IndexedSlot>* slots);
+    // Fix up the top levels once the subtrees are in. Returns true if node
+    // lost all of its children to the bounding box and should be removed.
+    bool finishIndexedRecurs(NodeType* node, unsigned int depth, unsigned int split_depth, bool binary);
+
+    void writeStampedNodesRecurs(std::ostream& s, const NodeType* node, time_t base_stamp) const;
+    bool readStampedNodesRecurs(std::istream& s, NodeType* node, time_t base_stamp);
+    // Move the children of src that node lacks into node, replacing node's
+    // value if it is a leaf, and free src. Returns the number of nodes added.
+    size_t mergeSubtreeRecurs(NodeType* node, NodeType* src);
+    size_t countNodesRecurs(const NodeType* node) const;
+
     // Returns true if the node should be removed from the tree
     // This might happen if delete_minimum is set.
     bool applyUpdateRecurs(const SensorUpdateKeyMap& update,
@@ -174,6 +275,15 @@ class OcTreeStampedWithExpiry : public octomap::OccupancyOcTreeBase <OcTreeNodeS
                            const octomap::OcTreeKey& key,
                            unsigned int depth,
                            octomap::key_type center_offset_key);
+    // Returns true if the node should be removed from the tree
+    bool clearRegionRecurs(NodeType* node,
+                           const octomap::OcTreeKey& key,
+                           unsigned int depth,
+                           const RegionTest& test,
+                           bool erase,
+                           bool inside);
+    // Returns true if the leaf should be removed from the tree
+    bool clearLeaf(NodeType* node, const octomap::OcTreeKey& key, unsigned int depth);
     // Quadratic delta-t expiration coefficients. The input is the number of
     // times a particular mode was marked from the default value (which would
     // be the current logodds divided prob_hit_log).
@@ -219,7 +329,7 @@ class OcTreeStampedWithExpiry : public octomap::OccupancyOcTreeBase <OcTreeNodeS
       StaticMemberInitializer() {
         OcTreeStampedWithExpiry* tree = new OcTreeStampedWithExpiry(0.1);
         tree->clearKeyRays();
-        //AbstractOcTree::registerTreeType(tree);
+        AbstractOcTree::registerTreeType(tree);
       }
 
       /**
@@ -233,6 +343,13 @@ class OcTreeStampedWithExpiry : public octomap::OccupancyOcTreeBase <OcTreeNodeS
     static StaticMemberInitializer ocTreeStampedWithExpiryMemberInit;
 };
 
+// Binary and full messages of the tree hold plain OcTree streams, so they can
+// be read by anything reading OcTree messages
+inline std::string messageTreeType(const OcTreeStampedWithExpiry&)
+{
+  return "OcTree";
+}
+
 } // end namespace
 
 #endif
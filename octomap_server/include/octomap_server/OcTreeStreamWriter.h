@@ -0,0 +1,448 @@
+#ifndef OCTOMAP_SERVER_OCTREE_STREAM_WRITER_H
+#define OCTOMAP_SERVER_OCTREE_STREAM_WRITER_H
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/thread.hpp>
+#include <octomap/OcTreeKey.h>
+#include <octomap_msgs/Octomap.h>
+
+namespace octomap_server {
+
+// Writers for the octomap binary and full data streams (as written by
+// writeBinaryData() and writeData()) that let a policy decide, per node, how
+// much of the tree to write. The output is read back by the regular octomap
+// readers, so a node written as a leaf simply is a leaf to the reader.
+//
+// A policy is a functor taking the key and depth of a node and returning:
+//  - SKIP: leave the node out (it reads back as unknown space)
+//  - LEAF: write the node, but none of its children
+//  - RECURSE: write the node and ask about its children
+// The root node is always written.
+enum class NodeWriteAction { SKIP, LEAF, RECURSE };
+
+// The tree type put in messages and stream files. Trees with a native file
+// format of their own overload this to name the type their streams are read
+// as (found by argument dependent lookup).
+template <class TREE>
+inline std::string messageTreeType(const TREE& tree)
+{
+  return tree.getTreeType();
+}
+
+// Policy writing the whole tree, same output as the octomap writers
+struct WriteAllPolicy
+{
+  NodeWriteAction operator()(const octomap::OcTreeKey&, unsigned int) const
+  {
+    return NodeWriteAction::RECURSE;
+  }
+};
+
+// Policy limiting the depth of the tree per node, e.g. with LevelOfDetail
+template <class TREE, class DEPTH_FUNC>
+class DepthLimitPolicy
+{
+public:
+  DepthLimitPolicy(const TREE& tree, const DEPTH_FUNC& depth_func)
+    : tree_(tree), depth_func_(depth_func) {}
+
+  NodeWriteAction operator()(const octomap::OcTreeKey& key, unsigned int depth) const
+  {
+    unsigned int max_depth = depth_func_(tree_.keyToCoord(key, depth), tree_.getNodeSize(depth));
+    return depth >= max_depth ? NodeWriteAction::LEAF : NodeWriteAction::RECURSE;
+  }
+
+private:
+  const TREE& tree_;
+  const DEPTH_FUNC& depth_func_;
+};
+
+// Policy writing the nodes overlapping a box of keys, down to max_depth.
+// The box is applied while writing, nodes partly in the box are written
+// whole.
+class BoundingBoxPolicy
+{
+public:
+  BoundingBoxPolicy(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max, unsigned int tree_depth,
+                    unsigned int max_depth)
+    : min_(min), max_(max), tree_depth_(tree_depth), max_depth_(max_depth) {}
+
+  NodeWriteAction operator()(const octomap::OcTreeKey& key, unsigned int depth) const
+  {
+    // a node at depth covers size keys, starting size / 2 below its key
+    const unsigned int size = 1u << (tree_depth_ - depth);
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      const unsigned int node_min = key[i] - size / 2;
+      if (node_min > max_[i] || node_min + size - 1 < min_[i])
+      {
+        return NodeWriteAction::SKIP;
+      }
+    }
+    return depth >= max_depth_ ? NodeWriteAction::LEAF : NodeWriteAction::RECURSE;
+  }
+
+private:
+  octomap::OcTreeKey min_;
+  octomap::OcTreeKey max_;
+  unsigned int tree_depth_;
+  unsigned int max_depth_;
+};
+
+namespace detail {
+
+template <class TREE>
+inline octomap::OcTreeKey rootKey(const TREE& tree)
+{
+  const octomap::key_type center = tree.coordToKey(0.0);
+  return octomap::OcTreeKey(center, center, center);
+}
+
+template <class TREE>
+inline octomap::key_type childCenterOffset(const TREE& tree, unsigned int depth)
+{
+  // offset from a node center at depth to its children's centers
+  return tree.coordToKey(0.0) >> (depth + 1);
+}
+
+// A subtree cut out of the stream by the parallel writer, to be encoded
+// separately and spliced back in at offset.
+template <class TREE>
+struct SplitSubtree
+{
+  const typename TREE::NodeType* node;
+  octomap::OcTreeKey key;
+  bool write_children;
+  size_t offset;
+  std::string data;
+};
+
+// The recursive writers stop at split_depth if subtrees is given, and record
+// the subtrees they would have written from there on instead.
+template <class TREE, class POLICY>
+void writeBinaryNodesRecurs(const TREE& tree, std::ostream& s, const POLICY& policy,
+                            const typename TREE::NodeType* node,
+                            const octomap::OcTreeKey& key, unsigned int depth,
+                            unsigned int split_depth = 0,
+                            std::vector<SplitSubtree<TREE> >* subtrees = nullptr)
+{
+  std::bitset<8> child_masks[2];
+  bool recurse[8] = {false};
+  octomap::OcTreeKey child_keys[8];
+  const octomap::key_type offset = childCenterOffset(tree, depth);
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!tree.nodeChildExists(node, i))
+    {
+      continue;
+    }
+    octomap::computeChildKey(i, offset, key, child_keys[i]);
+    NodeWriteAction action = policy(child_keys[i], depth + 1);
+    if (action == NodeWriteAction::SKIP)
+    {
+      continue;
+    }
+    const typename TREE::NodeType* child = tree.getNodeChild(node, i);
+    std::bitset<8>& mask = child_masks[i / 4];
+    const unsigned int bit = (i % 4) * 2;
+    if (action == NodeWriteAction::RECURSE && tree.nodeHasChildren(child))
+    {
+      mask[bit] = 1;
+      mask[bit + 1] = 1;
+      recurse[i] = true;
+    }
+    else if (tree.isNodeOccupied(child))
+    {
+      mask[bit + 1] = 1;
+    }
+    else
+    {
+      mask[bit] = 1;
+    }
+  }
+
+  char child1to4 = static_cast<char>(child_masks[0].to_ulong());
+  char child5to8 = static_cast<char>(child_masks[1].to_ulong());
+  s.write(&child1to4, sizeof(char));
+  s.write(&child5to8, sizeof(char));
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!recurse[i])
+    {
+      continue;
+    }
+    if (subtrees && depth + 1 >= split_depth)
+    {
+      SplitSubtree<TREE> subtree = {tree.getNodeChild(node, i), child_keys[i], true,
+                                    static_cast<size_t>(s.tellp()), std::string()};
+      subtrees->push_back(subtree);
+    }
+    else
+    {
+      writeBinaryNodesRecurs(tree, s, policy, tree.getNodeChild(node, i), child_keys[i], depth + 1,
+                             split_depth, subtrees);
+    }
+  }
+}
+
+template <class TREE, class POLICY>
+void writeFullNodesRecurs(const TREE& tree, std::ostream& s, const POLICY& policy,
+                          const typename TREE::NodeType* node,
+                          const octomap::OcTreeKey& key, unsigned int depth, bool write_children,
+                          unsigned int split_depth = 0,
+                          std::vector<SplitSubtree<TREE> >* subtrees = nullptr)
+{
+  node->writeData(s);
+
+  std::bitset<8> children;
+  octomap::OcTreeKey child_keys[8];
+  bool child_recurse[8] = {false};
+  if (write_children)
+  {
+    const octomap::key_type offset = childCenterOffset(tree, depth);
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (!tree.nodeChildExists(node, i))
+      {
+        continue;
+      }
+      octomap::computeChildKey(i, offset, key, child_keys[i]);
+      NodeWriteAction action = policy(child_keys[i], depth + 1);
+      if (action != NodeWriteAction::SKIP)
+      {
+        children[i] = 1;
+        child_recurse[i] = (action == NodeWriteAction::RECURSE);
+      }
+    }
+  }
+  char children_char = static_cast<char>(children.to_ulong());
+  s.write(&children_char, sizeof(char));
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!children[i])
+    {
+      continue;
+    }
+    if (subtrees && depth + 1 >= split_depth)
+    {
+      SplitSubtree<TREE> subtree = {tree.getNodeChild(node, i), child_keys[i], child_recurse[i],
+                                    static_cast<size_t>(s.tellp()), std::string()};
+      subtrees->push_back(subtree);
+    }
+    else
+    {
+      writeFullNodesRecurs(tree, s, policy, tree.getNodeChild(node, i), child_keys[i], depth + 1,
+                           child_recurse[i], split_depth, subtrees);
+    }
+  }
+}
+
+// The stream of a tree, split into its top levels and the subtrees below
+// them. The subtrees are encoded by several threads, and the pieces are put
+// back together in stream order.
+template <class TREE>
+class SplitStream
+{
+public:
+  SplitStream() : split_depth_(0) {}
+
+  /// Split at split_depth, or at a depth suiting num_threads if it is 0
+  template <class POLICY>
+  bool write(const TREE& tree, bool binary, const POLICY& policy, unsigned int num_threads,
+             unsigned int split_depth = 0)
+  {
+    if (split_depth == 0)
+    {
+      // Cut deep enough to keep all threads busy, even if the tree is lopsided
+      split_depth = 1;
+      while (split_depth < 5 && (1u << (3 * split_depth)) < 8 * num_threads)
+      {
+        ++split_depth;
+      }
+    }
+    split_depth_ = split_depth;
+    if (!tree.getRoot())
+    {
+      return true;
+    }
+
+    std::ostringstream top_stream;
+    if (binary)
+    {
+      writeBinaryNodesRecurs(tree, top_stream, policy, tree.getRoot(), rootKey(tree), 0,
+                             split_depth, &subtrees_);
+    }
+    else
+    {
+      writeFullNodesRecurs(tree, top_stream, policy, tree.getRoot(), rootKey(tree), 0, true,
+                           split_depth, &subtrees_);
+    }
+    if (!top_stream.good())
+    {
+      return false;
+    }
+    top_ = top_stream.str();
+
+    std::atomic<size_t> next(0);
+    std::atomic<bool> ok(true);
+    auto worker = [&]() {
+      for (size_t i = next++; i < subtrees_.size(); i = next++)
+      {
+        SplitSubtree<TREE>& subtree = subtrees_[i];
+        std::ostringstream subtree_stream;
+        if (binary)
+        {
+          writeBinaryNodesRecurs(tree, subtree_stream, policy, subtree.node, subtree.key, split_depth);
+        }
+        else
+        {
+          writeFullNodesRecurs(tree, subtree_stream, policy, subtree.node, subtree.key, split_depth,
+                               subtree.write_children);
+        }
+        if (!subtree_stream.good())
+        {
+          ok = false;
+        }
+        subtree.data = subtree_stream.str();
+      }
+    };
+    boost::thread_group threads;
+    const size_t num_workers = std::min<size_t>(std::max(num_threads, 1u), subtrees_.size());
+    for (size_t i = 1; i < num_workers; ++i)
+    {
+      threads.create_thread(worker);
+    }
+    worker();
+    threads.join_all();
+    return ok;
+  }
+
+  size_t size() const
+  {
+    size_t total = top_.size();
+    for (const SplitSubtree<TREE>& subtree : subtrees_)
+    {
+      total += subtree.data.size();
+    }
+    return total;
+  }
+
+  /// Call sink(data, size) for every piece of the stream, in order
+  template <class SINK>
+  void forEachPiece(SINK sink) const
+  {
+    size_t pos = 0;
+    for (const SplitSubtree<TREE>& subtree : subtrees_)
+    {
+      sink(top_.data() + pos, subtree.offset - pos);
+      sink(subtree.data.data(), subtree.data.size());
+      pos = subtree.offset;
+    }
+    sink(top_.data() + pos, top_.size() - pos);
+  }
+
+  unsigned int splitDepth() const { return split_depth_; }
+  /// The top levels of the stream, without the subtrees
+  const std::string& top() const { return top_; }
+  /// The subtrees, in stream order
+  const std::vector<SplitSubtree<TREE> >& subtrees() const { return subtrees_; }
+
+private:
+  unsigned int split_depth_;
+  std::string top_;
+  std::vector<SplitSubtree<TREE> > subtrees_;
+};
+
+}  // namespace detail
+
+/// Same as TREE::writeBinaryData(), filtered by policy
+template <class TREE, class POLICY>
+bool writeBinaryData(const TREE& tree, std::ostream& s, const POLICY& policy)
+{
+  if (tree.getRoot())
+  {
+    detail::writeBinaryNodesRecurs(tree, s, policy, tree.getRoot(), detail::rootKey(tree), 0);
+  }
+  return s.good();
+}
+
+/// Same as TREE::writeData(), filtered by policy
+template <class TREE, class POLICY>
+bool writeFullData(const TREE& tree, std::ostream& s, const POLICY& policy)
+{
+  if (tree.getRoot())
+  {
+    detail::writeFullNodesRecurs(tree, s, policy, tree.getRoot(), detail::rootKey(tree), 0, true);
+  }
+  return s.good();
+}
+
+/// Same output as writeBinaryData() or writeFullData(), byte for byte, but
+/// the subtrees below the top levels of the tree are encoded by num_threads
+/// threads. The policy is called from all of them.
+template <class TREE, class POLICY>
+bool writeDataParallel(const TREE& tree, bool binary, std::ostream& s, const POLICY& policy,
+                       unsigned int num_threads)
+{
+  if (num_threads <= 1)
+  {
+    return binary ? writeBinaryData(tree, s, policy) : writeFullData(tree, s, policy);
+  }
+  detail::SplitStream<TREE> stream;
+  if (!stream.write(tree, binary, policy, num_threads))
+  {
+    return false;
+  }
+  stream.forEachPiece([&s](const char* data, size_t size) { s.write(data, size); });
+  return s.good();
+}
+
+/// Same as octomap_msgs::binaryMapToMsg() and fullMapToMsg(), filtered by
+/// policy, and optionally encoded by several threads
+template <class TREE, class POLICY>
+bool mapToMsg(const TREE& tree, bool binary, const POLICY& policy, octomap_msgs::Octomap& msg,
+              unsigned int num_threads = 1)
+{
+  msg.resolution = tree.getResolution();
+  msg.id = messageTreeType(tree);
+  msg.binary = binary;
+
+  if (num_threads <= 1)
+  {
+    std::stringstream datastream;
+    bool ok = binary ? writeBinaryData(tree, datastream, policy) : writeFullData(tree, datastream, policy);
+    if (!ok)
+    {
+      return false;
+    }
+    std::string datastring = datastream.str();
+    msg.data = std::vector<int8_t>(datastring.begin(), datastring.end());
+    return true;
+  }
+
+  // Copy the pieces straight into the message
+  detail::SplitStream<TREE> stream;
+  if (!stream.write(tree, binary, policy, num_threads))
+  {
+    return false;
+  }
+  msg.data.clear();
+  msg.data.reserve(stream.size());
+  stream.forEachPiece([&msg](const char* data, size_t size) {
+    msg.data.insert(msg.data.end(), data, data + size);
+  });
+  return true;
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_OCTREE_STREAM_WRITER_H
@@ -33,6 +33,7 @@
 #include <ros/ros.h>
 #include <visualization_msgs/MarkerArray.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <std_msgs/ColorRGBA.h>
 
 // #include <moveit_msgs/CollisionObject.h>
@@ -74,6 +75,35 @@
 #include <octomap_server/PointCloudSynchronizer.h>
 #include <octomap_server/OcTreeStampedWithExpiry.h>
 #include <octomap_server/SensorUpdateKeyMap.h>
+#include <octomap_server/ChangeJournal.h>
+#include <octomap_server/ChangeRing.h>
+#include <octomap_server/LevelOfDetail.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+#include <octomap_server/GetOctomapUpdate.h>
+#include <octomap_server/SaveMap.h>
+#include <octomap_server/QueryOccupancy.h>
+#include <octomap_server/CastRays.h>
+#include <octomap_server/QueryDistance.h>
+#include <octomap_server/GetOctomapRegion.h>
+#include <octomap_server/StartMapTransfer.h>
+#include <octomap_server/GetMapChunk.h>
+#include <octomap_server/ClearRegions.h>
+#include <octomap_server/MapSerializationCache.h>
+#include <octomap_server/MapTransfer.h>
+#include <octomap_server/IndexedMapFile.h>
+#include <octomap_server/Checkpointer.h>
+#include <octomap_server/DerivedProducts.h>
+#include <octomap_server/FileWriteBuffer.h>
+#include <octomap_server/SuccinctOcTree.h>
+#include <octomap_server/TileCache.h>
+#include <octomap_server/TiledMapWriter.h>
+#include <octomap_server/PointQuery.h>
+#include <octomap_server/RayCaster.h>
+#include <octomap_server/EsdfLayer.h>
+#include <octomap_server/FrontierTracker.h>
+#include <octomap_server/InflationLayer.h>
+#include <octomap_server/SharedMapWriter.h>
+#include <octomap_server/RegionSet.h>
 
 namespace octomap_server {
 class OctomapServer {
@@ -86,9 +116,29 @@ public:
   virtual ~OctomapServer();
   virtual bool octomapBinarySrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
   virtual bool octomapFullSrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
+  // The map in the native format of the tree, including timestamps and expiry
+  bool octomapStampedSrv(OctomapSrv::Request  &req, OctomapSrv::GetOctomap::Response &res);
+  // The part of the map in a box, down to a maximum depth
+  bool octomapRegionSrv(GetOctomapRegion::Request& req, GetOctomapRegion::Response& res);
+  // The map in chunks, for maps too large for one response
+  bool startMapTransferSrv(StartMapTransfer::Request& req, StartMapTransfer::Response& res);
+  bool getMapChunkSrv(GetMapChunk::Request& req, GetMapChunk::Response& res);
+  // Write the map to a file on this machine, without building a message
+  bool saveMapSrv(SaveMap::Request& req, SaveMap::Response& res);
+  // Clear the box. Leafs partly inside are split and keep their value
+  // outside the box, where they used to be cleared whole.
   bool clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp);
   bool eraseBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp);
+  // Clear or erase many boxes, oriented boxes and prisms at once
+  bool clearRegionsSrv(ClearRegions::Request& req, ClearRegions::Response& res);
   bool resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp);
+  bool octomapUpdateSrv(GetOctomapUpdate::Request& req, GetOctomapUpdate::Response& res);
+  // Occupancy of a batch of points
+  bool queryOccupancySrv(QueryOccupancy::Request& req, QueryOccupancy::Response& res);
+  // First occupied voxel along a batch of rays
+  bool castRaysSrv(CastRays::Request& req, CastRays::Response& res);
+  // Distance to the nearest obstacle from the distance field
+  bool queryDistanceSrv(QueryDistance::Request& req, QueryDistance::Response& res);
 
   virtual void insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud);
   virtual void insertSegmentedCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& ground_cloud,
@@ -101,6 +151,31 @@ public:
                                             const std::string& sensor_origin_frame_id,
                                             unsigned int callback_id);
   virtual bool openFile(const std::string& filename);
+  /// Replace the map by the last checkpoint, if there is one
+  bool restoreCheckpoint();
+  /// Key of the derived products of a map file, for the current parameters
+  bool derivedProductsKey(const std::string& filename, uint64_t* key) const;
+  /// Publish the derived products saved with a map file instead of
+  /// traversing the map, false if there are none for key
+  bool publishDerivedProducts(const std::string& filename, uint64_t key);
+  /// Graft prefetched tiles, prefetch the tiles around the robot and evict
+  /// tiles over the memory budget
+  void pageTiles();
+  /// Page the tiles overlapping a box back in
+  void loadTiles(const octomap::point3d& min, const octomap::point3d& max);
+  /// Keys of a box clamped to the keys of the tree
+  bool boxToKeys(const octomap::point3d& min, const octomap::point3d& max, octomap::OcTreeKey* minKey,
+                 octomap::OcTreeKey* maxKey) const;
+  /// Move the distance field with the robot, apply the changes of this cycle
+  /// and publish its slice
+  void updateEsdf(const ros::Time& rostime);
+  /// Apply the changes of this cycle to the frontier, and publish it when
+  /// due
+  void updateFrontiers(const ros::Time& rostime);
+  /// Inflate around the cells of the 2D map changed in this cycle, and
+  /// publish the inflated map when it is rebuilt, and the patches otherwise
+  void publishInflatedMap(const ros::Time& rostime);
+  void writeSharedMap(const ros::Time& rostime);
 
   void startTrackingBounds(std::string name);
   void stopTrackingBounds(std::string name);
@@ -202,8 +277,40 @@ protected:
   void onNewFullMapUpdateSubscription(const ros::SingleSubscriberPublisher& pub);
   void publishFullOctoMapUpdate(const ros::Time& rostime = ros::Time::now(),
       const ros::SingleSubscriberPublisher* pub = nullptr);
+  void onNewInflatedMapSubscription(const ros::SingleSubscriberPublisher& pub);
   virtual void publishAll(const ros::Time& rostime = ros::Time::now());
 
+  /// count a modification of m_octree, invalidating the serialized map cache
+  inline void bumpMapVersion() { ++m_mapVersion; }
+  /// return the serialized binary or full map, shared by all clients, and
+  /// the map version it was serialized from (older than m_mapVersion when a
+  /// stale map is served)
+  octomap_msgs::OctomapConstPtr getSerializedMap(bool binary, uint64_t* version = nullptr);
+  /// serialize the whole map in the background map cache worker, from a
+  /// copy of the tree taken while m_octreeMutex is held
+  bool serializeMapInBackground(bool binary, unsigned threads, octomap_msgs::Octomap& msg);
+  /// The map in the native format of the tree, including timestamps and expiry
+  bool stampedMapToMsg(octomap_msgs::Octomap& msg);
+  /// write the map to a save_map file in format (bt, ot, oti or sbt)
+  bool writeMapFile(const std::string& format, std::ostream& stream);
+
+  /// place the level of detail origin at the robot, false if LOD is not used
+  bool updateLodOrigin();
+  /// publish the binary or full map, at the level of detail around the robot
+  template <class PUBLISHER>
+  void publishLodMap(bool binary, const ros::Time& rostime, const PUBLISHER& pub) const;
+  /// add a node to the marker arrays / point cloud, if not null
+  void addOccupiedNodeVis(const OcTreeT::NodeType& node, double x, double y, double z, unsigned int depth,
+                          visualization_msgs::MarkerArray* occupiedNodesVis,
+                          pcl::PointCloud<PCLPoint>* pclCloud) const;
+  void addFreeNodeVis(double x, double y, double z, unsigned int depth,
+                      visualization_msgs::MarkerArray* freeNodesVis) const;
+  /// add the nodes below node, at the level of detail around the robot
+  void addLodNodesVisRecurs(const OcTreeT::NodeType* node, const octomap::OcTreeKey& key, unsigned int depth,
+                            visualization_msgs::MarkerArray* occupiedNodesVis,
+                            visualization_msgs::MarkerArray* freeNodesVis,
+                            pcl::PointCloud<PCLPoint>* pclCloud) const;
+
   /**
   * @brief update occupancy map with a scan labeled as ground and nonground.
   * The scans should be in the global map frame.
@@ -237,6 +344,11 @@ protected:
   */
   bool isSpeckleNode(const octomap::OcTreeKey& key) const;
 
+  /// whether the node hooks below need the full depth traversal of the tree
+  /// when level of detail replaces it for markers and clouds. Subclasses
+  /// using the hooks for anything but the 2D map override this.
+  virtual bool needsNodeTraversal() const { return m_publish2DMap; }
+
   /// hook that is called before traversing all nodes
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
 
@@ -289,6 +401,15 @@ protected:
                 || oldMapInfo.origin.position.y != newMapInfo.origin.position.y);
   }
 
+  /// make the given tree "binary" in nature, for use as a bounds tree
+  void configureBoundsTree(OcTreeT* tree) const;
+  /// track changes only while someone subscribes to the update topics
+  void updateChangeTracking(bool force_enable = false);
+  /// the map changed without journaling, updates before now can not be merged
+  void invalidateChangeHistory();
+  /// fill in an update message with the values of m_octree inside bounds_tree
+  bool buildOctoMapUpdate(OcTreeT* bounds_tree, bool binary, uint32_t seq, const ros::Time& rostime,
+                          octomap_msgs::OctomapUpdate& map_msg) const;
   void enableChangeCallback();
   void disableChangeCallback();
   void touchKeyAtDepth(const octomap::OcTreeKey& key, unsigned int depth = std::numeric_limits<unsigned int>::max());
@@ -299,19 +420,69 @@ protected:
 
   static std_msgs::ColorRGBA heightMapColor(double h);
   ros::NodeHandle m_nh;
-  ros::Publisher  m_markerPub, m_binaryMapPub, m_binaryMapUpdatePub, m_fullMapPub, m_fullMapUpdatePub, m_pointCloudPub, m_collisionObjectPub, m_mapPub, m_cmapPub, m_fmapPub, m_fmarkerPub;
+  ros::Publisher  m_markerPub, m_binaryMapPub, m_binaryMapUpdatePub, m_fullMapPub, m_fullMapUpdatePub, m_pointCloudPub, m_collisionObjectPub, m_mapPub, m_cmapPub, m_fmapPub, m_fmarkerPub, m_esdfSlicePub, m_frontierPub, m_frontierClusterPub, m_inflatedMapPub, m_inflatedMapUpdatePub;
   std::vector<boost::shared_ptr<message_filters::Subscriber<sensor_msgs::PointCloud2> > > m_pointCloudSubs;
   std::vector<boost::shared_ptr<tf::MessageFilter<sensor_msgs::PointCloud2> > > m_tfPointCloudSubs;
   std::vector<boost::shared_ptr<PointCloudSynchronizer>> m_syncs;
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_clearBBXService, m_eraseBBXService, m_resetService;
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_octomapStampedService, m_octomapRegionService, m_startMapTransferService, m_getMapChunkService, m_saveMapService, m_clearBBXService, m_eraseBBXService, m_clearRegionsService, m_resetService, m_octomapUpdateService, m_queryOccupancyService, m_castRaysService, m_queryDistanceService;
   tf::TransformListener m_tfListener;
   boost::recursive_mutex m_config_mutex;
   dynamic_reconfigure::Server<OctomapServerConfig> m_reconfigureServer;
 
   OcTreeT* m_octree;
   OcTreeT* m_universe;
-  OcTreeT* m_octree_deltaBB_;
-  OcTreeT* m_octree_binary_deltaBB_;
+  // changes since the last update publish, bounds trees are built from it
+  ChangeJournal m_updateJournal;
+  // journals of recently published update cycles, for clients that missed some
+  ChangeRing m_changeRing;
+  double m_changeRingKeepTrackingTime;
+  ros::Time m_lastUpdateInterestTime;
+  // periodic snapshots and change journals of the map, for crash recovery
+  Checkpointer m_checkpointer;
+  // directory the save_map service writes in, empty if it is disabled
+  std::string m_saveMapDirectory;
+  unsigned m_saveMapCount;
+  // serialized maps, keyed on the map modification counter
+  uint64_t m_mapVersion;
+  bool m_mapCacheEnabled;
+  bool m_mapCacheAllowStale;
+  MapSerializationCache m_mapCache;
+  unsigned m_serializationThreads;
+  // held by the callbacks changing m_octree or paging its tiles, and by the
+  // map cache worker while it reads the tree
+  boost::recursive_mutex m_octreeMutex;
+  // chunked transfers of serialized maps, and their default chunk size
+  MapTransfer m_mapTransfer;
+  int m_mapTransferChunkSize;
+  unsigned m_castRaysThreads;
+  // reading indexed map files: threads, and optionally the area to read
+  unsigned m_mapLoadThreads;
+  bool m_mapLoadUseBBX;
+  octomap::point3d m_mapLoadBBXMin;
+  octomap::point3d m_mapLoadBBXMax;
+  // save the 2D map and occupied leafs next to loaded map files, to publish
+  // them without a traversal the next time the file is loaded
+  bool m_derivedProductsEnabled;
+  // collects the derived products during a traversal, when not NULL
+  DerivedProducts* m_derivedProducts;
+  // pages the least recently used parts of the map out to disk
+  TileCache m_tileCache;
+  double m_tilePrefetchDistance;
+  // distance field around the robot, and the height of its published slice
+  EsdfLayer m_esdf;
+  double m_esdfSliceZ;
+  // free voxels next to unknown space, for exploration
+  FrontierTracker m_frontiers;
+  double m_frontierPublishPeriod;
+  int m_frontierMinClusterSize;
+  ros::Time m_lastFrontierPublishTime;
+  // the 2D map with the obstacles inflated by the robot radius
+  InflationLayer m_inflation;
+  // exports the map to shared memory for local readers, with the octree
+  SharedMapWriter m_sharedMap;
+  bool m_sharedMapOctree;
+  // distance dependent level of detail of published maps, markers and clouds
+  LevelOfDetail m_lod;
   octomap::KeyRay m_keyRay;  // temp storage for ray casting
   octomap::OcTreeKey m_updateBBXMin;
   octomap::OcTreeKey m_updateBBXMax;
@@ -333,8 +504,8 @@ protected:
   bool m_publishFreeSpace;
   bool m_newFullSub;
   bool m_newBinarySub;
-  uint32_t m_binarySeq;
-  uint32_t m_fullSeq;
+  // seq of the next update cycle, shared by the binary and full update topics
+  uint32_t m_updateSeq;
   double m_publish3DMapPeriod;
   ros::Time m_publish3DMapLastTime;
   double m_publish3DMapUpdatePeriod;
@@ -48,6 +48,9 @@ protected:
   };
   typedef std::vector<ProjectedMap> MultilevelGrid;
 
+  /// the layers are projected in the traversal of the tree
+  virtual bool needsNodeTraversal() const { return true; }
+
   /// hook that is called after traversing all nodes
   virtual void handlePreNodeTraversal(const ros::Time& rostime);
 
@@ -0,0 +1,123 @@
+#ifndef OCTOMAP_SERVER_POINT_QUERY_H
+#define OCTOMAP_SERVER_POINT_QUERY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <geometry_msgs/Point.h>
+#include <octomap/OcTreeKey.h>
+
+namespace octomap_server {
+
+// Occupancy of a batch of points, for the query_occupancy service.
+// The keys of all points are computed in one pass over coordinate arrays,
+// in loops without branches or calls the compiler can vectorize, and sorted
+// in Morton order: consecutive keys then share most of their path in the
+// tree, and each lookup only descends from the deepest node it has in
+// common with the previous one.
+class PointQuery
+{
+public:
+  /// Same values as the constants of QueryOccupancy::Response
+  enum State { UNKNOWN = 0, FREE = 1, OCCUPIED = 2 };
+
+  /// Compute and sort the keys of points in a tree of resolution. Points
+  /// outside of the tree are left unknown.
+  void setPoints(const std::vector<geometry_msgs::Point>& points, double resolution);
+  /// Bounds of the keys of the points inside the tree, false if there are none
+  bool bounds(octomap::OcTreeKey* min, octomap::OcTreeKey* max) const;
+
+  /// Look the points up in an octomap tree
+  template <class TREE>
+  void search(const TREE& tree);
+  /// Look the points up one by one in Morton order, with
+  /// func(key, &log_odds) returning the State of key
+  template <class FUNC>
+  void searchEach(FUNC func);
+
+  /// Results, in the order of the points
+  const std::vector<uint8_t>& states() const { return states_; }
+  const std::vector<float>& logOdds() const { return log_odds_; }
+
+private:
+  static const unsigned int TREE_DEPTH = 16;
+
+  struct SortedKey
+  {
+    uint64_t morton;
+    uint32_t index;
+    octomap::OcTreeKey key;
+    bool operator<(const SortedKey& other) const { return morton < other.morton; }
+  };
+
+  /// Number of top levels two Morton codes share
+  static unsigned int sharedLevels(uint64_t a, uint64_t b);
+
+  std::vector<SortedKey> sorted_;
+  std::vector<uint8_t> states_;
+  std::vector<float> log_odds_;
+};
+
+template <class TREE>
+void PointQuery::search(const TREE& tree)
+{
+  typedef typename TREE::NodeType NodeType;
+  if (!tree.getRoot())
+    return;
+  // path[d] is the node at depth d of the previous lookup, valid up to
+  // path_depth
+  const NodeType* path[TREE_DEPTH + 1];
+  path[0] = tree.getRoot();
+  unsigned int path_depth = 0;
+  const SortedKey* previous = NULL;
+  for (const SortedKey& sorted : sorted_)
+  {
+    if (previous)
+    {
+      if (previous->morton == sorted.morton)
+      {
+        states_[sorted.index] = states_[previous->index];
+        log_odds_[sorted.index] = log_odds_[previous->index];
+        continue;
+      }
+      path_depth = std::min(path_depth, sharedLevels(previous->morton, sorted.morton));
+    }
+    previous = &sorted;
+
+    const NodeType* node = path[path_depth];
+    bool known = true;
+    while (path_depth < TREE_DEPTH && tree.nodeHasChildren(node))
+    {
+      const unsigned int pos = octomap::computeChildIdx(sorted.key, TREE_DEPTH - 1 - path_depth);
+      if (!tree.nodeChildExists(node, pos))
+      {
+        known = false;
+        break;
+      }
+      node = tree.getNodeChild(node, pos);
+      path[++path_depth] = node;
+    }
+    if (known)
+    {
+      states_[sorted.index] = tree.isNodeOccupied(node) ? OCCUPIED : FREE;
+      log_odds_[sorted.index] = node->getLogOdds();
+    }
+  }
+}
+
+template <class FUNC>
+void PointQuery::searchEach(FUNC func)
+{
+  for (const SortedKey& sorted : sorted_)
+  {
+    float log_odds = 0.0f;
+    states_[sorted.index] = func(sorted.key, &log_odds);
+    if (states_[sorted.index] == UNKNOWN)
+      log_odds = 0.0f;
+    log_odds_[sorted.index] = log_odds;
+  }
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_POINT_QUERY_H
@@ -0,0 +1,195 @@
+#ifndef OCTOMAP_SERVER_RAY_CASTER_H
+#define OCTOMAP_SERVER_RAY_CASTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <vector>
+#include <boost/thread.hpp>
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/Vector3.h>
+#include <octomap/OcTreeKey.h>
+#include <octomap/octomap_types.h>
+#include <octomap_server/PointQuery.h>
+
+namespace octomap_server {
+
+// Ray casting for the cast_rays service.
+// Rays hop from node to node: each step looks up the leaf holding the
+// current key, or the largest unknown node around it, and moves to where
+// the ray leaves that node's cube. Pruned free space and unknown space are
+// crossed in one step per node instead of one per voxel. Batches of rays
+// are spread over threads.
+class RayCaster
+{
+public:
+  struct Ray
+  {
+    octomap::point3d origin;
+    octomap::point3d direction;
+  };
+
+  struct Result
+  {
+    Result() : hit(false), crossed_unknown(false), range(0.0) {}
+    bool hit;
+    bool crossed_unknown;
+    /// Center of the voxel hit, same as OccupancyOcTreeBase::castRay(), or
+    /// the end of the ray
+    octomap::point3d end;
+    /// Distance from the origin to where the ray enters the voxel hit, or
+    /// length of the ray
+    double range;
+  };
+
+  explicit RayCaster(double resolution, unsigned int tree_depth = 16);
+
+  /// Rays of a CastRays request, false unless there is one origin for all
+  /// directions or one per direction
+  static bool makeRays(const std::vector<geometry_msgs::Point>& origins,
+                       const std::vector<geometry_msgs::Vector3>& directions, std::vector<Ray>* rays);
+  /// Fill a CastRays response
+  template <class RESPONSE>
+  static void fillResponse(const std::vector<Result>& results, RESPONSE* res);
+
+  /// Cast every ray up to max_range, or to the bounds of the tree if
+  /// max_range is not positive. lookup(key, &depth) returns the
+  /// PointQuery::State of the leaf holding key and its depth, or UNKNOWN and
+  /// the depth of the missing node above key.
+  template <class LOOKUP>
+  void cast(const std::vector<Ray>& rays, double max_range, unsigned int num_threads, LOOKUP lookup,
+            std::vector<Result>* results) const;
+  template <class LOOKUP>
+  Result castRay(const Ray& ray, double max_range, LOOKUP& lookup) const;
+
+  /// Lookup function of an octomap tree
+  template <class TREE>
+  static PointQuery::State searchTree(const TREE& tree, const octomap::OcTreeKey& key, unsigned int* depth);
+
+private:
+  /// Key of the voxel where the ray enters the tree, and the distance to it.
+  /// False if the ray misses the tree.
+  bool enter(const Ray& ray, double max_t, octomap::OcTreeKey* key, double* t) const;
+  /// Move key to the node the ray enters when it leaves the node of depth
+  /// holding key, and t to the distance where it does. False if the ray
+  /// leaves the tree there, with t at the bounds.
+  bool step(const Ray& ray, unsigned int depth, octomap::OcTreeKey* key, double* t) const;
+
+  double resolution_;
+  unsigned int tree_depth_;
+  int tree_max_val_;
+};
+
+template <class RESPONSE>
+void RayCaster::fillResponse(const std::vector<Result>& results, RESPONSE* res)
+{
+  res->hit.resize(results.size());
+  res->end_points.resize(results.size());
+  res->ranges.resize(results.size());
+  res->crossed_unknown.resize(results.size());
+  for (size_t i = 0; i < results.size(); ++i)
+  {
+    res->hit[i] = results[i].hit;
+    res->end_points[i].x = results[i].end.x();
+    res->end_points[i].y = results[i].end.y();
+    res->end_points[i].z = results[i].end.z();
+    res->ranges[i] = results[i].range;
+    res->crossed_unknown[i] = results[i].crossed_unknown;
+  }
+}
+
+template <class LOOKUP>
+void RayCaster::cast(const std::vector<Ray>& rays, double max_range, unsigned int num_threads, LOOKUP lookup,
+                     std::vector<Result>* results) const
+{
+  results->resize(rays.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    for (size_t i = next++; i < rays.size(); i = next++)
+    {
+      (*results)[i] = castRay(rays[i], max_range, lookup);
+    }
+  };
+  boost::thread_group threads;
+  const size_t num_workers = std::min<size_t>(std::max(num_threads, 1u), rays.size());
+  for (size_t i = 1; i < num_workers; ++i)
+  {
+    threads.create_thread(worker);
+  }
+  worker();
+  threads.join_all();
+}
+
+template <class LOOKUP>
+RayCaster::Result RayCaster::castRay(const Ray& ray, double max_range, LOOKUP& lookup) const
+{
+  Result result;
+  const double max_t = max_range > 0.0 ? max_range : std::numeric_limits<double>::infinity();
+  Ray normalized = ray;
+  const double length = normalized.direction.norm();
+  if (length <= 0.0)
+  {
+    result.end = ray.origin;
+    return result;
+  }
+  normalized.direction /= length;
+
+  octomap::OcTreeKey key;
+  double t = 0.0;
+  bool inside = enter(normalized, max_t, &key, &t);
+  while (inside)
+  {
+    // a lookup not telling the depth steps one voxel at a time
+    unsigned int depth = tree_depth_;
+    const PointQuery::State state = lookup(key, &depth);
+    if (state == PointQuery::OCCUPIED)
+    {
+      result.hit = true;
+      result.range = t;
+      for (unsigned int i = 0; i < 3; ++i)
+      {
+        result.end(i) = (double(key[i]) - tree_max_val_ + 0.5) * resolution_;
+      }
+      return result;
+    }
+    if (state == PointQuery::UNKNOWN)
+    {
+      result.crossed_unknown = true;
+    }
+    inside = step(normalized, depth, &key, &t) && t <= max_t;
+  }
+  // the length of the ray, up to the bounds of the tree without a max range
+  result.range = std::min(t, max_t);
+  result.end = normalized.origin + normalized.direction * result.range;
+  return result;
+}
+
+template <class TREE>
+PointQuery::State RayCaster::searchTree(const TREE& tree, const octomap::OcTreeKey& key, unsigned int* depth)
+{
+  const typename TREE::NodeType* node = tree.getRoot();
+  unsigned int d = 0;
+  if (!node)
+  {
+    *depth = 0;
+    return PointQuery::UNKNOWN;
+  }
+  const unsigned int tree_depth = tree.getTreeDepth();
+  while (d < tree_depth && tree.nodeHasChildren(node))
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, tree_depth - 1 - d);
+    if (!tree.nodeChildExists(node, pos))
+    {
+      *depth = d + 1;
+      return PointQuery::UNKNOWN;
+    }
+    node = tree.getNodeChild(node, pos);
+    d++;
+  }
+  *depth = d;
+  return tree.isNodeOccupied(node) ? PointQuery::OCCUPIED : PointQuery::FREE;
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_RAY_CASTER_H
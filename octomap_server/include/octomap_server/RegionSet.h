@@ -0,0 +1,71 @@
+#ifndef OCTOMAP_SERVER_REGION_SET_H
+#define OCTOMAP_SERVER_REGION_SET_H
+
+#include <vector>
+#include <octomap/octomap_types.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+
+namespace octomap_server {
+
+// A union of regions of the map: axis aligned boxes, oriented boxes and
+// prisms (polygons in the xy plane extruded along z), for clearing or
+// erasing all of them in one traversal of the tree.
+class RegionSet
+{
+public:
+  RegionSet();
+
+  void addBox(const octomap::point3d& min, const octomap::point3d& max);
+  /// Box of the given full size along its axes, centered at center and
+  /// rotated by the quaternion (w, x, y, z)
+  void addOrientedBox(const octomap::point3d& center, const double* rotation, const octomap::point3d& size);
+  /// Polygon (z ignored) extruded from min_z to max_z. The polygon is closed
+  /// implicitly and may be concave.
+  void addPrism(const std::vector<octomap::point3d>& polygon, double min_z, double max_z);
+
+  bool empty() const { return boxes_.empty() && oriented_boxes_.empty() && prisms_.empty(); }
+  /// Axis aligned bounds of all regions, false if there are none
+  bool bounds(octomap::point3d* min, octomap::point3d* max) const;
+
+  /// How the cube around center with half size half_size lies with respect
+  /// to the union of the regions. For voxels (the nodes at the tree depth)
+  /// only their center is tested, so the answer is never PARTIAL.
+  RegionOverlap overlap(const octomap::point3d& center, double half_size, bool voxel) const;
+
+private:
+  struct Box
+  {
+    double min[3];
+    double max[3];
+  };
+  struct OrientedBox
+  {
+    double center[3];
+    // box axes in the map frame (the rows of the rotation to the box frame)
+    double axes[3][3];
+    double half_size[3];
+  };
+  struct Prism
+  {
+    // x, y of the vertices
+    std::vector<double> xy;
+    double min[3];
+    double max[3];
+  };
+
+  static RegionOverlap overlap(const Box& box, const double* center, double half_size);
+  static RegionOverlap overlap(const OrientedBox& box, const double* center, double half_size);
+  static RegionOverlap overlap(const Prism& prism, const double* center, double half_size);
+  static bool contains(const Prism& prism, double x, double y);
+  /// True if the segment from (x0, y0) to (x1, y1) crosses the square
+  static bool segmentHitsSquare(double x0, double y0, double x1, double y1, const double* center,
+                                double half_size);
+
+  std::vector<Box> boxes_;
+  std::vector<OrientedBox> oriented_boxes_;
+  std::vector<Prism> prisms_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_REGION_SET_H
@@ -10,6 +10,9 @@ namespace octomap_server {
 class SensorUpdateKeyMapImpl
 {
 public:
+  // Depth and level are set after construction, start at the root so that
+  // bounds set before them make a single voxel
+  SensorUpdateKeyMapImpl() : depth_(0), level_(0) {}
   virtual ~SensorUpdateKeyMapImpl() {}
   /// Clear the update
   virtual void clear() = 0;
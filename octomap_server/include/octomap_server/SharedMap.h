@@ -0,0 +1,212 @@
+#ifndef OCTOMAP_SERVER_SHARED_MAP_H
+#define OCTOMAP_SERVER_SHARED_MAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace octomap_server {
+
+// Layout of the shared memory segment the server exports its map to, and a
+// header only reader for local consumers.
+// The segment holds a header and two slots. The writer fills the slot the
+// readers are not pointed at, then advances the generation in the header to
+// point them at it. Every slot is guarded by a sequence counter (a
+// seqlock): odd while the slot is written, so a reader that raced with the
+// writer sees the counter change and reads again. Readers never write to
+// the segment and never block the writer.
+// Only this header and POSIX are needed to read the segment.
+
+static const uint32_t SHARED_MAP_MAGIC = 0x4f4d5348;  // "OMSH"
+static const uint32_t SHARED_MAP_LAYOUT_VERSION = 1;
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shared map counters need lock free atomics");
+
+struct SharedMapHeader
+{
+  // written last by the writer, read first by the readers
+  std::atomic<uint32_t> magic;
+  uint32_t layout_version;
+  // bytes of each slot, including its SharedMapSlot
+  uint64_t slot_size;
+  // number of maps written, the latest one is in slot (generation - 1) % 2
+  std::atomic<uint64_t> generation;
+  // set when the writer went away, a restarted writer creates a new segment
+  std::atomic<uint32_t> closed;
+};
+
+struct SharedMapSlot
+{
+  // odd while the slot is written
+  std::atomic<uint64_t> sequence;
+  uint64_t generation;
+  // map modification counter of the server the octree was serialized from,
+  // unchanged maps are not written. The grid may be newer when the server
+  // serves stale octrees.
+  uint64_t map_version;
+  uint32_t stamp_sec;
+  uint32_t stamp_nsec;
+  char frame_id[64];
+
+  // 2D projected map, as nav_msgs/OccupancyGrid. Empty when not projected.
+  uint32_t grid_width;
+  uint32_t grid_height;
+  float grid_resolution;
+  uint32_t reserved;
+  // position and orientation (x, y, z, w) of cell (0, 0)
+  double grid_origin_position[3];
+  double grid_origin_orientation[4];
+  // offset from the start of the slot, and size in bytes
+  uint64_t grid_offset;
+  uint64_t grid_size;
+
+  // Octree in the binary octomap stream format, as the data of
+  // octomap_msgs/Octomap. Empty when not exported.
+  char octree_id[32];
+  double octree_resolution;
+  uint64_t octree_offset;
+  uint64_t octree_size;
+};
+
+/// Offset of slot i from the start of the segment
+inline size_t sharedMapSlotOffset(size_t slot_size, unsigned int i)
+{
+  return (sizeof(SharedMapHeader) + 63) / 64 * 64 + i * slot_size;
+}
+
+// A slot while it is read: valid only within SharedMapReader::read()
+struct SharedMapView
+{
+  const SharedMapSlot* slot;
+  // slot->grid_width * slot->grid_height cells, row major
+  const int8_t* grid;
+  // slot->octree_size bytes
+  const char* octree;
+};
+
+class SharedMapReader
+{
+public:
+  SharedMapReader() : data_(NULL), size_(0) {}
+  ~SharedMapReader() { close(); }
+  SharedMapReader(const SharedMapReader&) = delete;
+  SharedMapReader& operator=(const SharedMapReader&) = delete;
+
+  /// Map the segment name (as passed to shm_open(), e.g. "/octomap"),
+  /// false if it does not exist (yet) or is not a shared map
+  bool open(const std::string& name);
+  void close();
+  bool isOpen() const { return data_ != NULL; }
+  /// True when the writer closed the segment: open() it again to follow a
+  /// restarted writer
+  bool isClosed() const { return data_ && header()->closed.load(std::memory_order_acquire) != 0; }
+
+  /// Number of maps written so far, 0 before the first one. Poll it to
+  /// find out if there is a new map.
+  uint64_t generation() const;
+
+  /// Call func(const SharedMapView&) on the latest map in place, without
+  /// copying it. func runs again if the writer overwrote the map while it
+  /// was read, so it must not act on what it read before it returns: copy
+  /// or compute what is needed, then use it once read() returned true.
+  /// False when no map was written yet, or the map was overwritten
+  /// max_attempts times in a row.
+  template <class FUNC>
+  bool read(FUNC func, unsigned int max_attempts = 100) const;
+
+private:
+  const SharedMapHeader* header() const { return static_cast<const SharedMapHeader*>(data_); }
+
+  void* data_;
+  size_t size_;
+};
+
+inline bool SharedMapReader::open(const std::string& name)
+{
+  close();
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sharedMapSlotOffset(0, 0))
+  {
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  data_ = data;
+  size_ = st.st_size;
+  // The writer sizes the segment before it fills in the header
+  if (header()->magic.load(std::memory_order_acquire) != SHARED_MAP_MAGIC
+      || header()->layout_version != SHARED_MAP_LAYOUT_VERSION
+      || sharedMapSlotOffset(header()->slot_size, 2) > size_)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+inline void SharedMapReader::close()
+{
+  if (data_)
+    munmap(data_, size_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+inline uint64_t SharedMapReader::generation() const
+{
+  return data_ ? header()->generation.load(std::memory_order_acquire) : 0;
+}
+
+template <class FUNC>
+bool SharedMapReader::read(FUNC func, unsigned int max_attempts) const
+{
+  if (!data_)
+    return false;
+  const size_t slot_size = header()->slot_size;
+  for (unsigned int attempt = 0; attempt < max_attempts; ++attempt)
+  {
+    const uint64_t generation = header()->generation.load(std::memory_order_acquire);
+    if (generation == 0)
+      return false;
+    const char* base = static_cast<const char*>(data_) + sharedMapSlotOffset(slot_size, (generation - 1) % 2);
+    const SharedMapSlot* slot = reinterpret_cast<const SharedMapSlot*>(base);
+    const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence % 2 != 0)
+      continue;
+    // A torn slot can hold any offsets, only hand out the ones in the slot
+    const uint64_t grid_offset = slot->grid_offset, grid_size = slot->grid_size;
+    const uint64_t octree_offset = slot->octree_offset, octree_size = slot->octree_size;
+    const bool valid = grid_offset <= slot_size && grid_size <= slot_size - grid_offset
+                       && octree_offset <= slot_size && octree_size <= slot_size - octree_offset
+                       && uint64_t(slot->grid_width) * slot->grid_height <= grid_size;
+    if (valid)
+    {
+      SharedMapView view;
+      view.slot = slot;
+      view.grid = reinterpret_cast<const int8_t*>(base + grid_offset);
+      view.octree = base + octree_offset;
+      func(view);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->sequence.load(std::memory_order_relaxed) == sequence)
+      return valid;
+  }
+  return false;
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_SHARED_MAP_H
@@ -0,0 +1,50 @@
+#ifndef OCTOMAP_SERVER_SHARED_MAP_WRITER_H
+#define OCTOMAP_SERVER_SHARED_MAP_WRITER_H
+
+#include <cstdint>
+#include <string>
+#include <nav_msgs/OccupancyGrid.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_server/SharedMap.h>
+
+namespace octomap_server {
+
+// Writes the map to a POSIX shared memory segment for SharedMapReader.
+// The segment is created with a fixed slot size, maps that do not fit are
+// not written.
+class SharedMapWriter
+{
+public:
+  SharedMapWriter();
+  ~SharedMapWriter();
+  SharedMapWriter(const SharedMapWriter&) = delete;
+  SharedMapWriter& operator=(const SharedMapWriter&) = delete;
+
+  /// Create the segment name, replacing a segment left behind, with room
+  /// for maps of up to slot_size bytes
+  bool open(const std::string& name, size_t slot_size);
+  /// Mark the segment closed for the readers and remove it
+  void close();
+  bool isOpen() const { return data_ != NULL; }
+
+  /// Write the grid and the octree, either of which may be NULL, as the
+  /// latest map
+  bool write(const nav_msgs::OccupancyGrid* grid, const octomap_msgs::Octomap* octree, uint64_t map_version,
+             const std::string& frame_id, const ros::Time& stamp);
+  /// Number of maps written, and the version of the last one
+  uint64_t getGeneration() const { return data_ ? header()->generation.load(std::memory_order_relaxed) : 0; }
+  uint64_t getMapVersion() const { return map_version_; }
+
+private:
+  SharedMapHeader* header() const { return static_cast<SharedMapHeader*>(data_); }
+
+  std::string name_;
+  void* data_;
+  size_t size_;
+  // version of the last map written
+  uint64_t map_version_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_SHARED_MAP_WRITER_H
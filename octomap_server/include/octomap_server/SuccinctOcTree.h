@@ -0,0 +1,249 @@
+#ifndef OCTOMAP_SERVER_SUCCINCT_OCTREE_H
+#define OCTOMAP_SERVER_SUCCINCT_OCTREE_H
+
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <octomap/OcTreeKey.h>
+#include <octomap/octomap_types.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+
+namespace octomap_server {
+
+// A read-only octree stored as succinct bit vectors, memory mapped from a
+// .sbt file, for serving static maps.
+// Nodes are numbered in level order (root first). One bit per node tells
+// whether the node has children, and every node with children has a byte of
+// child bits, in the same order. Ranks on these bit vectors lead from a node
+// to its first child and to its value, so no pointers are stored: a node
+// costs about a byte and a bit, plus a float for every leaf.
+class SuccinctOcTree
+{
+public:
+  SuccinctOcTree();
+  ~SuccinctOcTree();
+
+  static const char* const FILE_EXTENSION;
+
+  /// Write tree as a .sbt stream. Leafs are occupied at or above the tree's
+  /// occupancy threshold.
+  template <class TREE>
+  static bool write(const TREE& tree, std::ostream& s);
+
+  /// The bit vectors of a .sbt stream, built from the nodes in level order
+  class Builder
+  {
+  public:
+    Builder() : num_nodes_(0), num_inner_(0) {}
+
+    /// Add the next node, with the bits of its children, none for a leaf
+    void addNode(uint8_t child_mask, float log_odds)
+    {
+      if (num_nodes_ % 64 == 0)
+      {
+        inner_bits_.push_back(0);
+      }
+      if (child_mask)
+      {
+        inner_bits_.back() |= 1ull << (num_nodes_ % 64);
+        if (num_inner_ % 8 == 0)
+        {
+          child_bits_.push_back(0);
+        }
+        child_bits_.back() |= static_cast<uint64_t>(child_mask) << (8 * (num_inner_ % 8));
+        num_inner_++;
+      }
+      else
+      {
+        leaf_values_.push_back(log_odds);
+      }
+      num_nodes_++;
+    }
+
+    bool write(std::ostream& s, const std::string& id, double resolution, unsigned int tree_depth,
+               float occupancy_threshold);
+
+  private:
+    std::vector<uint64_t> inner_bits_;
+    std::vector<uint64_t> child_bits_;
+    std::vector<float> leaf_values_;
+    uint64_t num_nodes_;
+    uint64_t num_inner_;
+  };
+
+  /// Map a .sbt file
+  bool open(const std::string& filename);
+  void close();
+  bool isOpen() const { return data_ != NULL; }
+
+  double getResolution() const { return resolution_; }
+  unsigned int getTreeDepth() const { return tree_depth_; }
+  const std::string& getTreeType() const { return id_; }
+  uint64_t size() const { return num_nodes_; }
+  uint64_t numLeafs() const { return num_nodes_ - num_inner_; }
+  /// Bytes of the mapped file
+  size_t memoryUsage() const { return size_; }
+
+  bool coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey* key) const;
+  octomap::point3d keyToCoord(const octomap::OcTreeKey& key, unsigned int depth) const;
+
+  /// Find the leaf holding key. Returns false in unknown space, with the
+  /// depth of the missing node above key.
+  bool search(const octomap::OcTreeKey& key, float* log_odds, unsigned int* depth = NULL) const;
+  bool isOccupied(float log_odds) const { return log_odds >= occupancy_threshold_; }
+
+  /// Call func(key, depth, log_odds) for every leaf overlapping the key box
+  template <class FUNC>
+  void forEachLeafBBX(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max, FUNC func) const;
+
+  /// Same as octomap_msgs::binaryMapToMsg() and fullMapToMsg() of the tree
+  /// the file was written from
+  bool binaryMapToMsg(octomap_msgs::Octomap& msg) const;
+  bool fullMapToMsg(octomap_msgs::Octomap& msg) const;
+
+private:
+  // Ranks are sampled every 512 bits
+  static const unsigned int RANK_BLOCK_BITS = 512;
+  static const unsigned int RANK_BLOCK_WORDS = RANK_BLOCK_BITS / 64;
+
+  /// Number of set bits before pos
+  static inline uint64_t rank1(const uint64_t* words, const uint64_t* ranks, uint64_t pos)
+  {
+    uint64_t rank = ranks[pos / RANK_BLOCK_BITS];
+    for (uint64_t w = (pos / RANK_BLOCK_BITS) * RANK_BLOCK_WORDS; w < pos / 64; ++w)
+    {
+      rank += __builtin_popcountll(words[w]);
+    }
+    if (pos % 64)
+    {
+      rank += __builtin_popcountll(words[pos / 64] & ((1ull << (pos % 64)) - 1));
+    }
+    return rank;
+  }
+  static inline uint64_t numWords(uint64_t bits) { return (bits + 63) / 64; }
+  static inline uint64_t numRanks(uint64_t bits) { return bits / RANK_BLOCK_BITS + 1; }
+  static void buildRanks(const std::vector<uint64_t>& words, uint64_t bits, std::vector<uint64_t>* ranks);
+
+  bool hasChildren(uint64_t node) const { return (inner_bits_[node / 64] >> (node % 64)) & 1; }
+  /// Index of a node among the nodes with children
+  uint64_t innerRank(uint64_t node) const { return rank1(inner_bits_, inner_ranks_, node); }
+  uint8_t childMask(uint64_t inner) const { return (child_bits_[inner / 8] >> (8 * (inner % 8))) & 0xff; }
+  /// Index of the first child of the inner node
+  uint64_t firstChild(uint64_t inner) const { return rank1(child_bits_, child_ranks_, 8 * inner) + 1; }
+  float leafValue(uint64_t node) const { return leaf_values_[node - innerRank(node)]; }
+
+  octomap::key_type childCenterOffset(unsigned int depth) const { return tree_max_val_ >> (depth + 1); }
+
+  void writeBinaryRecurs(uint64_t node, std::vector<int8_t>* data) const;
+  float writeFullRecurs(uint64_t node, std::vector<int8_t>* data) const;
+  template <class FUNC>
+  void forEachLeafBBXRecurs(uint64_t node, const octomap::OcTreeKey& key, unsigned int depth,
+                            const octomap::OcTreeKey& min, const octomap::OcTreeKey& max, FUNC& func) const;
+
+  const char* data_;
+  size_t size_;
+  std::string id_;
+  double resolution_;
+  unsigned int tree_depth_;
+  octomap::key_type tree_max_val_;
+  float occupancy_threshold_;
+  uint64_t num_nodes_;
+  uint64_t num_inner_;
+  const uint64_t* inner_bits_;
+  const uint64_t* inner_ranks_;
+  const uint64_t* child_bits_;
+  const uint64_t* child_ranks_;
+  const float* leaf_values_;
+};
+
+template <class TREE>
+bool SuccinctOcTree::write(const TREE& tree, std::ostream& s)
+{
+  // Walk the tree level by level
+  Builder builder;
+  std::vector<const typename TREE::NodeType*> level;
+  std::vector<const typename TREE::NodeType*> next_level;
+  if (tree.getRoot())
+  {
+    level.push_back(tree.getRoot());
+  }
+  while (!level.empty())
+  {
+    for (const typename TREE::NodeType* node : level)
+    {
+      uint8_t mask = 0;
+      if (tree.nodeHasChildren(node))
+      {
+        for (unsigned int i = 0; i < 8; ++i)
+        {
+          if (tree.nodeChildExists(node, i))
+          {
+            mask |= 1 << i;
+            next_level.push_back(tree.getNodeChild(node, i));
+          }
+        }
+      }
+      builder.addNode(mask, node->getLogOdds());
+    }
+    level.swap(next_level);
+    next_level.clear();
+  }
+  return builder.write(s, messageTreeType(tree), tree.getResolution(), tree.getTreeDepth(),
+                       tree.getOccupancyThresLog());
+}
+
+template <class FUNC>
+void SuccinctOcTree::forEachLeafBBX(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max,
+                                    FUNC func) const
+{
+  if (num_nodes_ > 0)
+  {
+    const octomap::OcTreeKey root_key(tree_max_val_, tree_max_val_, tree_max_val_);
+    forEachLeafBBXRecurs(0, root_key, 0, min, max, func);
+  }
+}
+
+template <class FUNC>
+void SuccinctOcTree::forEachLeafBBXRecurs(uint64_t node, const octomap::OcTreeKey& key, unsigned int depth,
+                                          const octomap::OcTreeKey& min, const octomap::OcTreeKey& max,
+                                          FUNC& func) const
+{
+  // keys covered by the node
+  const unsigned int half = depth < tree_depth_ ? 1u << (tree_depth_ - depth - 1) : 0;
+  for (unsigned int j = 0; j < 3; ++j)
+  {
+    const unsigned int lo = depth < tree_depth_ ? key[j] - half : key[j];
+    const unsigned int hi = depth < tree_depth_ ? key[j] + half - 1 : key[j];
+    if (hi < min[j] || lo > max[j])
+    {
+      return;
+    }
+  }
+  if (!hasChildren(node))
+  {
+    func(key, depth, leafValue(node));
+    return;
+  }
+  const uint64_t inner = innerRank(node);
+  const uint8_t mask = childMask(inner);
+  uint64_t child = firstChild(inner);
+  const octomap::key_type offset = childCenterOffset(depth);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (mask & (1 << i))
+    {
+      octomap::OcTreeKey child_key;
+      octomap::computeChildKey(i, offset, key, child_key);
+      forEachLeafBBXRecurs(child, child_key, depth + 1, min, max, func);
+      child++;
+    }
+  }
+}
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_SUCCINCT_OCTREE_H
@@ -0,0 +1,128 @@
+#ifndef OCTOMAP_SERVER_TILE_CACHE_H
+#define OCTOMAP_SERVER_TILE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/thread.hpp>
+#include <octomap/OcTreeKey.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+
+namespace octomap_server {
+
+// Out of core paging of a live tree, to map areas larger than memory.
+// The tree is split in tiles, the subtrees at a fixed depth. When the tree
+// grows past a memory budget, the tiles used least recently are written to a
+// local directory (tile_<x>_<y>_<z>.bin, in the native stream format) and
+// deleted from the tree. Evicted tiles are paged back in when an update or a
+// query reaches them, either synchronously with load() or in the background
+// with prefetch() and finishPrefetch().
+// The tiles on disk only live as long as the server. Checkpoints keep their
+// own copy of the tiles evicted while a snapshot is taken, so the tiles of
+// an earlier run are removed with removeTileFiles() once it is restored.
+class TileCache
+{
+public:
+  typedef std::unordered_map<octomap::OcTreeKey, uint64_t, octomap::OcTreeKey::KeyHash> TileMap;
+
+  TileCache();
+  /// Waits for a prefetch being read
+  ~TileCache();
+
+  /// Tiles are the subtrees at tile_depth, paged to directory when the tree
+  /// takes more than memory_budget bytes. An empty directory disables paging.
+  void configure(const std::string& directory, unsigned int tile_depth, size_t memory_budget);
+  bool isEnabled() const { return !directory_.empty(); }
+  unsigned int getTileDepth() const { return tile_depth_; }
+  size_t numEvicted() const { return evicted_.size(); }
+  /// The evicted tiles, by the key of their first voxel, with a number that
+  /// changes every time the tile is evicted
+  const TileMap& evictedTiles() const { return evicted_; }
+  /// File an evicted tile is written to
+  std::string tileFilename(const octomap::OcTreeKey& tile) const;
+  /// Delete all tile files in the directory, e.g. those of an earlier run.
+  /// Only call while no tile is evicted.
+  void removeTileFiles() const;
+  /// Remember the tiles paged in or out from now on, for takePagedTiles()
+  void setTrackPaging(bool enabled);
+  /// Move the keys of the tiles paged in or out since the last call to
+  /// tiles, as these changes do not go through the change journal
+  void takePagedTiles(std::vector<octomap::OcTreeKey>* tiles);
+
+  /// Mark the tiles overlapping the box as used in this cycle, they are not
+  /// evicted before the next one
+  void touch(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+  /// Page the evicted tiles overlapping the box back in. Returns the number
+  /// of tiles loaded.
+  size_t load(OcTreeStampedWithExpiry* tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+  /// Page all evicted tiles back in, e.g. for an operation on the whole map.
+  /// They count as the least recently used tiles, so call evict() with
+  /// end_cycle false when done to page them out again.
+  size_t loadAll(OcTreeStampedWithExpiry* tree);
+  /// Start reading the evicted tiles overlapping the box in the background,
+  /// unless a prefetch is still being read
+  void prefetch(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max);
+  /// Graft the tiles of a completed prefetch into the tree, skipping those
+  /// loaded or discarded since. Returns the number of tiles grafted.
+  size_t finishPrefetch(OcTreeStampedWithExpiry* tree);
+  /// Evict the least recently used tiles until the tree fits the budget, and
+  /// start the next cycle unless end_cycle is false. Returns the number of
+  /// tiles evicted.
+  size_t evict(OcTreeStampedWithExpiry* tree, bool end_cycle = true);
+  /// Metric bounds of the evicted tiles, false if there are none
+  bool evictedBounds(const OcTreeStampedWithExpiry& tree, octomap::point3d* min, octomap::point3d* max) const;
+  /// Forget the evicted tiles outside the box, as the tree dropped the
+  /// nodes there. The keys of the tiles forgotten are added to discarded.
+  void discardOutside(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min,
+                      const octomap::OcTreeKey& max, std::vector<octomap::OcTreeKey>* discarded = NULL);
+  /// Forget all evicted tiles, as the tree was replaced
+  void clear();
+
+  /// Estimate of the memory taken by the nodes of tree
+  static size_t memoryUsage(const OcTreeStampedWithExpiry& tree);
+
+private:
+  struct PrefetchedTile
+  {
+    octomap::OcTreeKey key;
+    uint64_t generation;
+    std::string data;
+  };
+
+  octomap::key_type tileMask(const OcTreeStampedWithExpiry& tree) const;
+  octomap::OcTreeKey tileKey(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& key) const;
+  bool overlaps(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& tile,
+                const octomap::OcTreeKey& min, const octomap::OcTreeKey& max) const;
+  void collectTilesRecurs(const OcTreeStampedWithExpiry& tree, const OcTreeStampedWithExpiry::NodeType* node,
+                          const octomap::OcTreeKey& key, unsigned int depth,
+                          std::vector<octomap::OcTreeKey>* tiles) const;
+  // Page a tile in, as last used in cycle used
+  bool loadTile(OcTreeStampedWithExpiry* tree, TileMap::iterator it, uint64_t used);
+  size_t loadTiles(OcTreeStampedWithExpiry* tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max,
+                   uint64_t used);
+  void readTiles(std::vector<PrefetchedTile>* tiles);
+  void waitForPrefetch();
+
+  std::string directory_;
+  unsigned int tile_depth_;
+  size_t memory_budget_;
+  // cycle count, and the cycle each resident tile was last used in
+  uint64_t clock_;
+  TileMap last_used_;
+  // generation of the eviction of each evicted tile, so a prefetch of an
+  // older copy is not grafted
+  TileMap evicted_;
+  uint64_t generation_;
+  boost::thread reader_;
+  std::atomic<bool> reading_;
+  std::vector<PrefetchedTile> prefetched_;
+  bool track_paging_;
+  std::vector<octomap::OcTreeKey> paged_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_TILE_CACHE_H
@@ -0,0 +1,66 @@
+#ifndef OCTOMAP_SERVER_TILED_MAP_WRITER_H
+#define OCTOMAP_SERVER_TILED_MAP_WRITER_H
+
+#include <ostream>
+#include <string>
+#include <octomap/OcTreeKey.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/TileCache.h>
+
+namespace octomap_server {
+
+// Writes the whole map of a tree with tiles paged out by a TileCache to a map
+// file or message, without paging the tiles back in. The output is the same
+// as the one written after TileCache::loadAll().
+// First the top of the map is built: the nodes of the tree down to the tile
+// depth, with every evicted tile as a leaf holding its top node, read from
+// the start of its file. The map is then written depth first. The evicted
+// tiles below a node just above the tile depth are read from their files
+// into the top of the map when the writer gets there, and dropped again when
+// it moves on, so no more than 8 tiles are read in at a time.
+class TiledMapWriter
+{
+public:
+  TiledMapWriter(const OcTreeStampedWithExpiry& tree, const TileCache& tiles);
+
+  /// Write a map file in format bt, ot, oti (with the subtrees at
+  /// split_depth) or sbt. Returns false if the stream fails or a tile can not
+  /// be read.
+  bool write(const std::string& format, std::ostream& s, unsigned int split_depth);
+  /// Fill in the binary or full map message, same as mapToMsg() after
+  /// TileCache::loadAll(). Returns false if a tile can not be read.
+  bool toMsg(bool binary, octomap_msgs::Octomap& msg);
+
+private:
+  typedef OcTreeStampedWithExpiry::NodeType NodeType;
+
+  bool build();
+  size_t copyTopRecurs(const NodeType* node, NodeType* copy, unsigned int depth);
+  size_t countNodesRecurs(const NodeType* node) const;
+  octomap::OcTreeKey tileKey(const octomap::OcTreeKey& key) const;
+  // Read the evicted tile into dst, merged with what the tree holds there as
+  // TileCache::load() would
+  bool readTile(const octomap::OcTreeKey& tile, const NodeType* resident, OcTreeStampedWithExpiry* dst) const;
+
+  // Pass every node of the map to the encoder, depth first. node is the node
+  // written, top_node the same node in top_ down to the tile depth, and
+  // resident the node of the tree there, if any.
+  template <class ENCODER>
+  bool walk(ENCODER* encoder);
+  template <class ENCODER>
+  bool walkRecurs(const NodeType* node, NodeType* top_node, const NodeType* resident,
+                  const octomap::OcTreeKey& key, unsigned int depth, ENCODER* encoder);
+
+  const OcTreeStampedWithExpiry& tree_;
+  const TileCache& tiles_;
+  unsigned int tile_depth_;
+  // the top of the map, with the evicted tiles below the node being written
+  OcTreeStampedWithExpiry top_;
+  // nodes of the whole map
+  size_t size_;
+};
+
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_TILED_MAP_WRITER_H
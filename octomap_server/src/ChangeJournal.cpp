@@ -0,0 +1,60 @@
+#include <octomap_server/ChangeJournal.h>
+
+#include <algorithm>
+
+namespace octomap_server {
+
+// Never compact tiny journals, sorting them is not worth it
+static constexpr size_t MIN_COMPACT_THRESHOLD = 64 * 1024;
+
+ChangeJournal::ChangeJournal()
+  : enabled_(false),
+    compact_threshold_(MIN_COMPACT_THRESHOLD)
+{
+}
+
+void ChangeJournal::setEnabled(bool enabled)
+{
+  enabled_ = enabled;
+  if (!enabled_)
+  {
+    clear();
+  }
+}
+
+void ChangeJournal::compact()
+{
+  compactRecords(&records_);
+  // Let the journal grow to twice its unique size before compacting again.
+  // This bounds the memory used when the journal is not read every cycle.
+  compact_threshold_ = std::max(MIN_COMPACT_THRESHOLD, 2 * records_.size());
+}
+
+void ChangeJournal::compactRecords(std::vector<Record>* records)
+{
+  std::vector<Record>& r = *records;
+  std::sort(r.begin(), r.end());
+  // The binary changed bit is the lowest bit of a record, so records of the
+  // same node are adjacent after sorting. Merge them, or-ing the bit.
+  size_t out = 0;
+  for (size_t i = 0; i < r.size(); ++i)
+  {
+    if (out > 0 && (r[out-1] >> 1) == (r[i] >> 1))
+    {
+      r[out-1] |= r[i];
+    }
+    else
+    {
+      r[out++] = r[i];
+    }
+  }
+  r.resize(out);
+}
+
+void ChangeJournal::clear()
+{
+  records_.clear();
+  compact_threshold_ = MIN_COMPACT_THRESHOLD;
+}
+
+}  // namespace octomap_server
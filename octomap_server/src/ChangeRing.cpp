@@ -0,0 +1,86 @@
+#include <octomap_server/ChangeRing.h>
+
+namespace octomap_server {
+
+ChangeRing::ChangeRing()
+  : max_cycles_(0),
+    max_records_(0),
+    first_seq_(0),
+    next_seq_(0),
+    record_count_(0)
+{
+}
+
+void ChangeRing::setLimits(size_t max_cycles, size_t max_records)
+{
+  max_cycles_ = max_cycles;
+  max_records_ = max_records;
+  trim();
+}
+
+void ChangeRing::push(uint32_t seq, const std::vector<Record>& records)
+{
+  if (!isEnabled())
+  {
+    return;
+  }
+  if (seq != next_seq_)
+  {
+    reset(seq);
+  }
+  cycles_.push_back(Cycle());
+  cycles_.back().seq = seq;
+  cycles_.back().records = records;
+  record_count_ += records.size();
+  next_seq_ = seq + 1;
+  trim();
+}
+
+void ChangeRing::reset(uint32_t next_seq)
+{
+  cycles_.clear();
+  record_count_ = 0;
+  first_seq_ = next_seq;
+  next_seq_ = next_seq;
+}
+
+bool ChangeRing::collect(uint32_t since_seq, std::vector<Record>* records) const
+{
+  records->clear();
+  if (!isEnabled())
+  {
+    return false;
+  }
+  // The client needs every cycle after since_seq, up to the last one stored.
+  // Use signed differences so this keeps working when the seq wraps.
+  const uint32_t first_needed = since_seq + 1;
+  if (static_cast<int32_t>(first_needed - first_seq_) < 0 ||
+      static_cast<int32_t>(next_seq_ - first_needed) < 0)
+  {
+    return false;
+  }
+  for (const Cycle& cycle : cycles_)
+  {
+    if (static_cast<int32_t>(cycle.seq - first_needed) >= 0)
+    {
+      records->insert(records->end(), cycle.records.begin(), cycle.records.end());
+    }
+  }
+  ChangeJournal::compactRecords(records);
+  return true;
+}
+
+void ChangeRing::trim()
+{
+  // Always keep the newest cycle, even if it alone is over the record limit
+  while (!cycles_.empty() &&
+         (cycles_.size() > max_cycles_ ||
+          (cycles_.size() > 1 && record_count_ > max_records_)))
+  {
+    record_count_ -= cycles_.front().records.size();
+    cycles_.pop_front();
+    first_seq_ = cycles_.empty() ? next_seq_ : cycles_.front().seq;
+  }
+}
+
+}  // namespace octomap_server
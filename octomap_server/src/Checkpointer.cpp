@@ -0,0 +1,624 @@
+#include <octomap_server/Checkpointer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+#include <octomap_server/TileCache.h>
+
+namespace octomap_server {
+
+static const char* const SNAPSHOT_PREFIX = "snapshot_";
+static const char* const SNAPSHOT_SUFFIX = ".ot";
+static const char* const JOURNAL_PREFIX = "journal_";
+static const char* const JOURNAL_SUFFIX = ".bin";
+static const char* const TILES_SUFFIX = ".tiles";
+
+// Journal layout, in host byte order: one block per cycle of a magic number,
+// the number of entries and the entries. A block cut short by a crash is
+// ignored.
+static const uint32_t JOURNAL_BLOCK_MAGIC = 0x4f544a42;  // "OTJB"
+static const size_t JOURNAL_BLOCK_HEADER_SIZE = 8;
+// key (3 x 16 bit), depth, type, log odds (float), stamp and expiry (64 bit)
+static const size_t JOURNAL_ENTRY_SIZE = 28;
+
+Checkpointer::Checkpointer()
+  : snapshot_period_(600.0),
+    snapshot_leafs_per_cycle_(200000),
+    snapshot_requested_(false),
+    generation_(0),
+    copying_(false),
+    copy_cursor_(0),
+    snapshot_tile_depth_(0),
+    writing_(false)
+{
+}
+
+Checkpointer::~Checkpointer()
+{
+  if (writer_.joinable())
+  {
+    writer_.join();
+  }
+}
+
+void Checkpointer::setDirectory(const std::string& directory)
+{
+  directory_ = directory;
+  if (directory_.empty())
+  {
+    return;
+  }
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    ROS_ERROR("Unable to create checkpoint directory %s: %s", directory_.c_str(), strerror(errno));
+  }
+  // Continue after the checkpoints already there
+  std::vector<uint64_t> snapshots = listGenerations(SNAPSHOT_PREFIX, SNAPSHOT_SUFFIX);
+  std::vector<uint64_t> journals = listGenerations(JOURNAL_PREFIX, JOURNAL_SUFFIX);
+  generation_ = 0;
+  if (!snapshots.empty())
+  {
+    generation_ = std::max(generation_, snapshots.back());
+  }
+  if (!journals.empty())
+  {
+    generation_ = std::max(generation_, journals.back());
+  }
+}
+
+OcTreeStampedWithExpiry* Checkpointer::restore()
+{
+  std::vector<uint64_t> snapshots = listGenerations(SNAPSHOT_PREFIX, SNAPSHOT_SUFFIX);
+  if (snapshots.empty())
+  {
+    return NULL;
+  }
+  ros::WallTime start_time = ros::WallTime::now();
+  const uint64_t generation = snapshots.back();
+  octomap::AbstractOcTree* read_tree = octomap::AbstractOcTree::read(snapshotFilename(generation));
+  OcTreeStampedWithExpiry* tree = dynamic_cast<OcTreeStampedWithExpiry*>(read_tree);
+  if (!tree)
+  {
+    ROS_ERROR("Unable to read checkpoint snapshot %s", snapshotFilename(generation).c_str());
+    delete read_tree;
+    return NULL;
+  }
+
+  // The journal of a snapshot being written at the time of the crash
+  // follows the journal of the last complete one
+  size_t num_journals = 0;
+  for (uint64_t journal : listGenerations(JOURNAL_PREFIX, JOURNAL_SUFFIX))
+  {
+    if (journal >= generation && replayJournal(journalFilename(journal), tree))
+    {
+      num_journals++;
+    }
+  }
+  tree->updateInnerOccupancy();
+  ROS_INFO("Restored checkpoint %lu (%zu nodes, %zu journals) in %f sec", generation, tree->size(),
+           num_journals, (ros::WallTime::now() - start_time).toSec());
+  return tree;
+}
+
+void Checkpointer::discard()
+{
+  if (!isEnabled())
+  {
+    return;
+  }
+  if (writer_.joinable())
+  {
+    writer_.join();
+  }
+  journal_.close();
+  copying_ = false;
+  snapshot_.reset();
+  snapshot_entries_.clear();
+  snapshot_tiles_.clear();
+  removeBefore(std::numeric_limits<uint64_t>::max());
+}
+
+void Checkpointer::checkpoint(const OcTreeStampedWithExpiry& tree, const std::vector<Record>& records,
+                              const ros::Time& now, const TileCache* tiles)
+{
+  if (!isEnabled())
+  {
+    return;
+  }
+
+  if (journal_.is_open() && !records.empty())
+  {
+    std::string buffer(JOURNAL_BLOCK_HEADER_SIZE, '\0');
+    buffer.reserve(JOURNAL_BLOCK_HEADER_SIZE + records.size() * JOURNAL_ENTRY_SIZE);
+    for (const Record record : records)
+    {
+      journalNode(tree, record, &buffer);
+    }
+    const uint32_t num_entries = (buffer.size() - JOURNAL_BLOCK_HEADER_SIZE) / JOURNAL_ENTRY_SIZE;
+    memcpy(&buffer[0], &JOURNAL_BLOCK_MAGIC, sizeof(uint32_t));
+    memcpy(&buffer[4], &num_entries, sizeof(uint32_t));
+    journal_.write(buffer.data(), buffer.size());
+    journal_.flush();
+    if (!journal_)
+    {
+      // Changes from here on are lost until the next snapshot, make it soon
+      ROS_ERROR("Error writing checkpoint journal %s", journalFilename(generation_).c_str());
+      journal_.close();
+    }
+  }
+
+  // A snapshot being copied from a tree that was replaced is started over
+  if (copying_ && !snapshot_requested_)
+  {
+    continueSnapshot(tree, tiles);
+    return;
+  }
+  const bool due = !journal_.is_open() || snapshot_requested_
+                   || (snapshot_period_ > 0.0 && (now - last_snapshot_time_).toSec() >= snapshot_period_);
+  if (due && !writing_)
+  {
+    startSnapshot(tree, now, tiles);
+  }
+}
+
+void Checkpointer::journalNode(const OcTreeStampedWithExpiry& tree, Record record, std::string* buffer) const
+{
+  const octomap::OcTreeKey key = ChangeJournal::recordKey(record);
+  const unsigned int depth = ChangeJournal::recordDepth(record);
+  const OcTreeStampedWithExpiry::NodeType* node = tree.getRoot();
+  if (!node)
+  {
+    appendEntry(ERASE, key, depth, NULL, buffer);
+    return;
+  }
+
+  unsigned int node_depth = 0;
+  while (node_depth < depth && tree.nodeHasChildren(node))
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, tree.getTreeDepth() - 1 - node_depth);
+    if (!tree.nodeChildExists(node, pos))
+    {
+      // unknown space
+      appendEntry(ERASE, key, depth, NULL, buffer);
+      return;
+    }
+    node = tree.getNodeChild(node, pos);
+    node_depth++;
+  }
+  if (!tree.nodeHasChildren(node))
+  {
+    // The node, or the leaf it was pruned into
+    appendEntry(LEAF, tree.adjustKeyAtDepth(key, node_depth), node_depth, node, buffer);
+    return;
+  }
+  // An inner node, store its leafs
+  appendEntry(ERASE, key, depth, NULL, buffer);
+  journalLeafsRecurs(tree, node, tree.adjustKeyAtDepth(key, depth), depth, buffer);
+}
+
+void Checkpointer::journalLeafsRecurs(const OcTreeStampedWithExpiry& tree,
+                                      const OcTreeStampedWithExpiry::NodeType* node,
+                                      const octomap::OcTreeKey& key, unsigned int depth,
+                                      std::string* buffer) const
+{
+  if (!tree.nodeHasChildren(node))
+  {
+    appendEntry(LEAF, key, depth, node, buffer);
+    return;
+  }
+  const octomap::key_type center_offset_key = detail::childCenterOffset(tree, depth);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (tree.nodeChildExists(node, i))
+    {
+      octomap::OcTreeKey child_key;
+      octomap::computeChildKey(i, center_offset_key, key, child_key);
+      journalLeafsRecurs(tree, tree.getNodeChild(node, i), child_key, depth + 1, buffer);
+    }
+  }
+}
+
+void Checkpointer::appendEntry(EntryType type, const octomap::OcTreeKey& key, unsigned int depth,
+                               const OcTreeStampedWithExpiry::NodeType* node, std::string* buffer)
+{
+  char entry[JOURNAL_ENTRY_SIZE] = {0};
+  memcpy(entry, &key[0], sizeof(octomap::key_type));
+  memcpy(entry + 2, &key[1], sizeof(octomap::key_type));
+  memcpy(entry + 4, &key[2], sizeof(octomap::key_type));
+  entry[6] = static_cast<char>(depth);
+  entry[7] = static_cast<char>(type);
+  if (node)
+  {
+    const float value = node->getLogOdds();
+    const int64_t stamp = node->getTimestamp();
+    const int64_t expiry = node->getExpiry();
+    memcpy(entry + 8, &value, sizeof(float));
+    memcpy(entry + 12, &stamp, sizeof(int64_t));
+    memcpy(entry + 20, &expiry, sizeof(int64_t));
+  }
+  buffer->append(entry, sizeof(entry));
+}
+
+bool Checkpointer::replayJournal(const std::string& filename, OcTreeStampedWithExpiry* tree) const
+{
+  std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!file.is_open())
+  {
+    return false;
+  }
+  std::vector<char> entries;
+  char header[JOURNAL_BLOCK_HEADER_SIZE];
+  while (file.read(header, sizeof(header)))
+  {
+    uint32_t magic, num_entries;
+    memcpy(&magic, header, sizeof(uint32_t));
+    memcpy(&num_entries, header + 4, sizeof(uint32_t));
+    if (magic != JOURNAL_BLOCK_MAGIC)
+    {
+      ROS_WARN("Checkpoint journal %s is corrupt, ignoring the rest of it", filename.c_str());
+      break;
+    }
+    entries.resize(static_cast<size_t>(num_entries) * JOURNAL_ENTRY_SIZE);
+    if (!file.read(entries.data(), entries.size()))
+    {
+      // cut short by a crash
+      break;
+    }
+    applyEntries(entries.data(), num_entries, tree);
+  }
+  return true;
+}
+
+void Checkpointer::applyEntries(const char* entries, size_t num_entries, OcTreeStampedWithExpiry* tree)
+{
+  for (size_t i = 0; i < num_entries; ++i)
+  {
+    const char* entry = entries + i * JOURNAL_ENTRY_SIZE;
+    octomap::OcTreeKey key;
+    memcpy(&key[0], entry, sizeof(octomap::key_type));
+    memcpy(&key[1], entry + 2, sizeof(octomap::key_type));
+    memcpy(&key[2], entry + 4, sizeof(octomap::key_type));
+    const unsigned int depth = static_cast<unsigned char>(entry[6]);
+    if (entry[7] == LEAF)
+    {
+      float value;
+      int64_t stamp, expiry;
+      memcpy(&value, entry + 8, sizeof(float));
+      memcpy(&stamp, entry + 12, sizeof(int64_t));
+      memcpy(&expiry, entry + 20, sizeof(int64_t));
+      tree->setNodeAtDepth(key, depth, value, stamp, expiry);
+    }
+    else if (depth == 0)
+    {
+      // deleteNode() takes depth 0 as the full depth
+      tree->clear();
+    }
+    else
+    {
+      tree->deleteNode(key, depth);
+    }
+  }
+}
+
+void Checkpointer::startSnapshot(const OcTreeStampedWithExpiry& tree, const ros::Time& now, const TileCache* tiles)
+{
+  // The changes from here on go to the journal of the new snapshot, including
+  // those to the slices already copied
+  if (journal_.is_open())
+  {
+    journal_.close();
+  }
+  generation_++;
+  journal_.open(journalFilename(generation_).c_str(),
+                std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if (!journal_.is_open())
+  {
+    ROS_ERROR("Unable to open checkpoint journal %s", journalFilename(generation_).c_str());
+  }
+
+  snapshot_.reset(new OcTreeStampedWithExpiry(tree.getResolution()));
+  snapshot_->setTreeDepth(tree.getTreeDepth());
+  snapshot_->copyParameters(tree);
+  snapshot_entries_.clear();
+  snapshot_tiles_.clear();
+  copy_cursor_ = 0;
+  copying_ = true;
+  last_snapshot_time_ = now;
+  snapshot_requested_ = false;
+  continueSnapshot(tree, tiles);
+}
+
+void Checkpointer::continueSnapshot(const OcTreeStampedWithExpiry& tree, const TileCache* tiles)
+{
+  ros::WallTime start_time = ros::WallTime::now();
+  // The tiles paged out before the copy reaches them are not in the tree.
+  // Whatever they held is as of this snapshot or later, like the slices.
+  if (tiles && tiles->isEnabled())
+  {
+    keepEvictedTiles(tree, *tiles);
+  }
+  size_t budget = snapshot_leafs_per_cycle_ > 0 ? snapshot_leafs_per_cycle_ : std::numeric_limits<size_t>::max();
+  const octomap::OcTreeKey root_min(0, 0, 0);
+  const bool done = !tree.getRoot() || copyLeafsRecurs(tree, tree.getRoot(), root_min, 0, &budget);
+  ROS_DEBUG("Copied %zu leafs for checkpoint %lu in %f sec", snapshot_entries_.size() / JOURNAL_ENTRY_SIZE,
+            generation_, (ros::WallTime::now() - start_time).toSec());
+  if (!done)
+  {
+    return;
+  }
+
+  // Building the tree from the leafs and writing it is left to the writer
+  boost::shared_ptr<std::string> entries(new std::string());
+  entries->swap(snapshot_entries_);
+  std::vector<octomap::OcTreeKey> kept_tiles;
+  kept_tiles.reserve(snapshot_tiles_.size());
+  for (const auto& tile : snapshot_tiles_)
+  {
+    kept_tiles.push_back(tile.first);
+  }
+  snapshot_tiles_.clear();
+  if (writer_.joinable())
+  {
+    writer_.join();
+  }
+  writing_ = true;
+  writer_ = boost::thread(&Checkpointer::writeSnapshot, this, snapshot_,
+                          boost::shared_ptr<const std::string>(entries), kept_tiles, snapshot_tile_depth_,
+                          generation_);
+  snapshot_.reset();
+  copying_ = false;
+}
+
+// Copy src to dst, for tiles on another file system than the checkpoints
+static bool copyFile(const std::string& src, const std::string& dst)
+{
+  std::ifstream in(src.c_str(), std::ios_base::in | std::ios_base::binary);
+  std::ofstream out(dst.c_str(), std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  if (!in.is_open() || !out.is_open() || !(out << in.rdbuf()))
+  {
+    return false;
+  }
+  out.close();
+  return !out.fail();
+}
+
+void Checkpointer::keepEvictedTiles(const OcTreeStampedWithExpiry& tree, const TileCache& tiles)
+{
+  snapshot_tile_depth_ = tiles.getTileDepth();
+  const TileCache::TileMap& evicted = tiles.evictedTiles();
+  for (auto it = snapshot_tiles_.begin(); it != snapshot_tiles_.end();)
+  {
+    // Tiles paged back in are copied or journaled from the tree. A tile
+    // neither paged out nor in the tree was dropped since, and its copy must
+    // not bring it back.
+    if (!evicted.count(it->first) && !tree.search(it->first, snapshot_tile_depth_))
+    {
+      unlink(tileFilename(generation_, it->first).c_str());
+      it = snapshot_tiles_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+  for (const TileCache::TileMap::value_type& tile : evicted)
+  {
+    auto kept = snapshot_tiles_.find(tile.first);
+    if (kept != snapshot_tiles_.end() && kept->second == tile.second)
+    {
+      continue;
+    }
+    if (snapshot_tiles_.empty() && mkdir(tileDirectory(generation_).c_str(), 0755) != 0 && errno != EEXIST)
+    {
+      ROS_ERROR("Unable to create checkpoint tile directory %s: %s", tileDirectory(generation_).c_str(),
+                strerror(errno));
+      return;
+    }
+    const std::string src = tiles.tileFilename(tile.first);
+    const std::string dst = tileFilename(generation_, tile.first);
+    unlink(dst.c_str());
+    if (link(src.c_str(), dst.c_str()) != 0 && !copyFile(src, dst))
+    {
+      ROS_ERROR("Unable to keep tile %s for checkpoint %lu, its part of the map is not in the checkpoint",
+                src.c_str(), generation_);
+      unlink(dst.c_str());
+      continue;
+    }
+    snapshot_tiles_[tile.first] = tile.second;
+  }
+}
+
+// Position of a voxel in the depth first order of the tree, the bits of the
+// child index at every depth, from the root down
+static uint64_t mortonCode(const octomap::OcTreeKey& key, unsigned int tree_depth)
+{
+  uint64_t code = 0;
+  for (unsigned int level = 0; level < tree_depth; ++level)
+  {
+    code |= static_cast<uint64_t>(octomap::computeChildIdx(key, level)) << (3 * level);
+  }
+  return code;
+}
+
+bool Checkpointer::copyLeafsRecurs(const OcTreeStampedWithExpiry& tree,
+                                   const OcTreeStampedWithExpiry::NodeType* node,
+                                   const octomap::OcTreeKey& node_min, unsigned int depth, size_t* budget)
+{
+  const unsigned int levels = tree.getTreeDepth() - depth;
+  const uint64_t end = mortonCode(node_min, tree.getTreeDepth()) + (uint64_t(1) << (3 * levels));
+  if (end <= copy_cursor_)
+  {
+    // copied in an earlier cycle, later changes are in the journal
+    return true;
+  }
+  if (!tree.nodeHasChildren(node))
+  {
+    if (*budget == 0)
+    {
+      return false;
+    }
+    // A leaf pruned from nodes partly copied before is copied again
+    appendEntry(LEAF, tree.adjustKeyAtDepth(node_min, depth), depth, node, &snapshot_entries_);
+    --*budget;
+    copy_cursor_ = end;
+    return true;
+  }
+  const octomap::key_type half = static_cast<octomap::key_type>(1u << (levels - 1));
+  for (unsigned int pos = 0; pos < 8; ++pos)
+  {
+    // same order as computeChildIdx(), missing children are unknown
+    if (!tree.nodeChildExists(node, pos))
+    {
+      continue;
+    }
+    const octomap::OcTreeKey child_min(node_min[0] + ((pos & 1) ? half : 0), node_min[1] + ((pos & 2) ? half : 0),
+                                       node_min[2] + ((pos & 4) ? half : 0));
+    if (!copyLeafsRecurs(tree, tree.getNodeChild(node, pos), child_min, depth + 1, budget))
+    {
+      return false;
+    }
+  }
+  copy_cursor_ = std::max(copy_cursor_, end);
+  return true;
+}
+
+void Checkpointer::writeSnapshot(boost::shared_ptr<OcTreeStampedWithExpiry> snapshot,
+                                 boost::shared_ptr<const std::string> entries, std::vector<octomap::OcTreeKey> tiles,
+                                 unsigned int tile_depth, uint64_t generation)
+{
+  ros::WallTime start_time = ros::WallTime::now();
+  applyEntries(entries->data(), entries->size() / JOURNAL_ENTRY_SIZE, snapshot.get());
+  for (const octomap::OcTreeKey& tile : tiles)
+  {
+    const std::string tile_filename = tileFilename(generation, tile);
+    std::ifstream s(tile_filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!s.is_open() || !snapshot->readSubtree(s, tile, tile_depth))
+    {
+      ROS_ERROR("Unable to read tile %s, its part of the map is not in the checkpoint", tile_filename.c_str());
+    }
+  }
+  removeTileDirectory(generation);
+  snapshot->updateInnerOccupancy();
+  const std::string filename = snapshotFilename(generation);
+  const std::string tmp_filename = filename + ".tmp";
+  // Only complete snapshots carry the final name
+  if (snapshot->write(tmp_filename) && rename(tmp_filename.c_str(), filename.c_str()) == 0)
+  {
+    removeBefore(generation);
+    ROS_INFO("Wrote checkpoint %s (%zu nodes) in %f sec", filename.c_str(), snapshot->size(),
+             (ros::WallTime::now() - start_time).toSec());
+  }
+  else
+  {
+    ROS_ERROR("Error writing checkpoint %s", filename.c_str());
+    unlink(tmp_filename.c_str());
+  }
+  writing_ = false;
+}
+
+void Checkpointer::removeBefore(uint64_t generation) const
+{
+  for (uint64_t old : listGenerations(SNAPSHOT_PREFIX, SNAPSHOT_SUFFIX))
+  {
+    if (old < generation)
+    {
+      unlink(snapshotFilename(old).c_str());
+    }
+  }
+  for (uint64_t old : listGenerations(JOURNAL_PREFIX, JOURNAL_SUFFIX))
+  {
+    if (old < generation)
+    {
+      unlink(journalFilename(old).c_str());
+    }
+  }
+  // left by snapshots that were started over or cut short by a crash
+  for (uint64_t old : listGenerations(SNAPSHOT_PREFIX, TILES_SUFFIX))
+  {
+    if (old < generation)
+    {
+      removeTileDirectory(old);
+    }
+  }
+}
+
+void Checkpointer::removeTileDirectory(uint64_t generation) const
+{
+  const std::string directory = tileDirectory(generation);
+  DIR* dir = opendir(directory.c_str());
+  if (!dir)
+  {
+    return;
+  }
+  while (struct dirent* entry = readdir(dir))
+  {
+    const std::string name(entry->d_name);
+    if (name != "." && name != "..")
+    {
+      unlink((directory + "/" + name).c_str());
+    }
+  }
+  closedir(dir);
+  rmdir(directory.c_str());
+}
+
+std::string Checkpointer::snapshotFilename(uint64_t generation) const
+{
+  return directory_ + "/" + SNAPSHOT_PREFIX + std::to_string(generation) + SNAPSHOT_SUFFIX;
+}
+
+std::string Checkpointer::journalFilename(uint64_t generation) const
+{
+  return directory_ + "/" + JOURNAL_PREFIX + std::to_string(generation) + JOURNAL_SUFFIX;
+}
+
+std::string Checkpointer::tileDirectory(uint64_t generation) const
+{
+  return directory_ + "/" + SNAPSHOT_PREFIX + std::to_string(generation) + TILES_SUFFIX;
+}
+
+std::string Checkpointer::tileFilename(uint64_t generation, const octomap::OcTreeKey& tile) const
+{
+  return tileDirectory(generation) + "/tile_" + std::to_string(tile[0]) + "_" + std::to_string(tile[1]) + "_"
+         + std::to_string(tile[2]) + ".bin";
+}
+
+std::vector<uint64_t> Checkpointer::listGenerations(const std::string& prefix, const std::string& suffix) const
+{
+  std::vector<uint64_t> generations;
+  DIR* dir = opendir(directory_.c_str());
+  if (!dir)
+  {
+    return generations;
+  }
+  while (struct dirent* entry = readdir(dir))
+  {
+    const std::string name(entry->d_name);
+    if (name.size() <= prefix.size() + suffix.size()
+        || name.compare(0, prefix.size(), prefix) != 0
+        || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+    {
+      continue;
+    }
+    const std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+    if (number.find_first_not_of("0123456789") == std::string::npos)
+    {
+      generations.push_back(strtoull(number.c_str(), NULL, 10));
+    }
+  }
+  closedir(dir);
+  std::sort(generations.begin(), generations.end());
+  return generations;
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,138 @@
+#include <octomap_server/DerivedProducts.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+
+#include <ros/serialization.h>
+
+namespace octomap_server {
+
+static const char* const DERIVED_PRODUCTS_FILE_HEADER = "# Octomap derived products";
+static const uint64_t FNV1A64_PRIME = 1099511628211ull;
+
+uint64_t fnv1a64(const void* data, size_t size, uint64_t hash)
+{
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= FNV1A64_PRIME;
+  }
+  return hash;
+}
+
+bool hashFileStat(const std::string& filename, uint64_t* hash)
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+  {
+    return false;
+  }
+  const uint64_t fields[] = { uint64_t(st.st_dev), uint64_t(st.st_ino), uint64_t(st.st_size),
+                              uint64_t(st.st_mtim.tv_sec), uint64_t(st.st_mtim.tv_nsec) };
+  *hash = fnv1a64(fields, sizeof(fields));
+  return true;
+}
+
+std::string derivedProductsFilename(const std::string& map_filename)
+{
+  return map_filename + ".derived";
+}
+
+bool writeDerivedProducts(const std::string& filename, uint64_t key, const DerivedProducts& products)
+{
+  const uint32_t grid_size = ros::serialization::serializationLength(products.gridmap);
+  std::vector<uint8_t> grid(grid_size);
+  ros::serialization::OStream grid_stream(grid.data(), grid_size);
+  ros::serialization::serialize(grid_stream, products.gridmap);
+
+  // Written aside and renamed, so a reader never sees half a file
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream s(tmp_filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  if (!s.is_open())
+  {
+    return false;
+  }
+  s << DERIVED_PRODUCTS_FILE_HEADER << "\n";
+  s << "key " << std::hex << key << std::dec << "\n";
+  s << "grid_size " << grid_size << "\n";
+  s << "occupied " << products.occupied.size() << "\n";
+  s << "data\n";
+  s.write(reinterpret_cast<const char*>(grid.data()), grid.size());
+  s.write(reinterpret_cast<const char*>(products.occupied.data()),
+          products.occupied.size() * sizeof(DerivedProducts::OccupiedLeaf));
+  s.close();
+  if (s.fail() || rename(tmp_filename.c_str(), filename.c_str()) != 0)
+  {
+    remove(tmp_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool readDerivedProducts(const std::string& filename, uint64_t key, DerivedProducts* products)
+{
+  std::ifstream s(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  std::string line;
+  if (!s.is_open() || !std::getline(s, line) ||
+      line.compare(0, strlen(DERIVED_PRODUCTS_FILE_HEADER), DERIVED_PRODUCTS_FILE_HEADER) != 0)
+  {
+    return false;
+  }
+  uint64_t file_key = 0;
+  uint32_t grid_size = 0;
+  size_t num_occupied = 0;
+  bool have_key = false, have_grid = false, have_occupied = false, have_data = false;
+  while (!have_data && std::getline(s, line))
+  {
+    std::istringstream ss(line);
+    std::string token;
+    ss >> token;
+    if (token == "key")
+    {
+      have_key = static_cast<bool>(ss >> std::hex >> file_key);
+    }
+    else if (token == "grid_size")
+    {
+      have_grid = static_cast<bool>(ss >> grid_size);
+    }
+    else if (token == "occupied")
+    {
+      have_occupied = static_cast<bool>(ss >> num_occupied);
+    }
+    else if (token == "data")
+    {
+      have_data = true;
+    }
+  }
+  if (!have_data || !have_key || !have_grid || !have_occupied || file_key != key)
+  {
+    return false;
+  }
+
+  std::vector<uint8_t> grid(grid_size);
+  s.read(reinterpret_cast<char*>(grid.data()), grid.size());
+  products->occupied.resize(num_occupied);
+  s.read(reinterpret_cast<char*>(products->occupied.data()),
+         products->occupied.size() * sizeof(DerivedProducts::OccupiedLeaf));
+  if (!s)
+  {
+    return false;
+  }
+  try
+  {
+    ros::serialization::IStream grid_stream(grid.data(), grid_size);
+    ros::serialization::deserialize(grid_stream, products->gridmap);
+  }
+  catch (ros::serialization::StreamOverrunException& e)
+  {
+    return false;
+  }
+  return true;
+}
+
+}  // namespace octomap_server
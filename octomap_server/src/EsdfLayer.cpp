@@ -0,0 +1,274 @@
+#include <octomap_server/EsdfLayer.h>
+
+#include <cmath>
+#include <limits>
+
+namespace octomap_server {
+
+namespace {
+const int32_t UNREACHED = std::numeric_limits<int32_t>::max();
+}
+
+EsdfLayer::EsdfLayer()
+  : tree_depth_(16), max_distance_sq_(0), max_distance_(0.0f), unknown_occupied_(false), placed_(false),
+    rebuild_(true)
+{
+  size_[0] = size_[1] = size_[2] = 0;
+  origin_[0] = origin_[1] = origin_[2] = 0;
+}
+
+void EsdfLayer::configure(unsigned int size_xy, unsigned int size_z, double max_distance, bool unknown_occupied,
+                          unsigned int tree_depth)
+{
+  tree_depth_ = tree_depth;
+  const int max_size = 1 << tree_depth;
+  size_[0] = size_[1] = std::min<int>(size_xy, max_size);
+  size_[2] = std::min<int>(size_z, max_size);
+  max_distance_ = std::max(max_distance, 0.0);
+  max_distance_sq_ = static_cast<int32_t>(std::ceil(max_distance_ * max_distance_));
+  unknown_occupied_ = unknown_occupied;
+  placed_ = false;
+  rebuild_ = true;
+  queue_ = Queue();
+
+  const size_t num_cells = size_[0] > 0 && size_[2] > 0 ? size_t(size_[0]) * size_[1] * size_[2] : 0;
+  obstacle_.assign(num_cells, -1);
+  distance_sq_.assign(num_cells, UNREACHED);
+  flags_.assign(num_cells, 0);
+
+  neighbor_offsets_.clear();
+  neighbor_steps_.clear();
+  for (int dz = -1; dz <= 1; ++dz)
+  {
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+      for (int dx = -1; dx <= 1; ++dx)
+      {
+        if (dx == 0 && dy == 0 && dz == 0)
+          continue;
+        neighbor_offsets_.push_back(dx + size_[0] * (dy + size_[1] * dz));
+        neighbor_steps_.push_back(dx);
+        neighbor_steps_.push_back(dy);
+        neighbor_steps_.push_back(dz);
+      }
+    }
+  }
+}
+
+bool EsdfLayer::follow(const octomap::OcTreeKey& key)
+{
+  if (!isEnabled())
+    return false;
+  bool move = !placed_;
+  for (unsigned int i = 0; i < 3 && !move; ++i)
+  {
+    const int center = origin_[i] + size_[i] / 2;
+    move = std::abs(int(key[i]) - center) > size_[i] / 4;
+  }
+  if (!move)
+    return false;
+  const int max_origin[3] = { (1 << tree_depth_) - size_[0], (1 << tree_depth_) - size_[1],
+                              (1 << tree_depth_) - size_[2] };
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    origin_[i] = std::min(std::max(int(key[i]) - size_[i] / 2, 0), max_origin[i]);
+  }
+  placed_ = true;
+  rebuild_ = true;
+  return true;
+}
+
+bool EsdfLayer::window(octomap::OcTreeKey* min, octomap::OcTreeKey* max) const
+{
+  if (!isEnabled() || !placed_)
+    return false;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    (*min)[i] = origin_[i];
+    (*max)[i] = origin_[i] + size_[i] - 1;
+  }
+  return true;
+}
+
+bool EsdfLayer::distance(const octomap::OcTreeKey& key, float* distance) const
+{
+  if (!isEnabled() || !placed_)
+    return false;
+  int coords[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    coords[i] = int(key[i]) - origin_[i];
+    if (coords[i] < 0 || coords[i] >= size_[i])
+      return false;
+  }
+  const int32_t distance_sq = distance_sq_[cellIndex(coords[0], coords[1], coords[2])];
+  *distance = distance_sq > max_distance_sq_ ? max_distance_ : std::min(std::sqrt(float(distance_sq)), max_distance_);
+  return true;
+}
+
+void EsdfLayer::cellCoords(int32_t index, int* coords) const
+{
+  coords[0] = index % size_[0];
+  coords[1] = (index / size_[0]) % size_[1];
+  coords[2] = index / (size_[0] * size_[1]);
+}
+
+bool EsdfLayer::neighborCoords(const int* coords, size_t n, int* neighbor_coords) const
+{
+  const int* step = &neighbor_steps_[3 * n];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    neighbor_coords[i] = coords[i] + step[i];
+    if (neighbor_coords[i] < 0 || neighbor_coords[i] >= size_[i])
+      return false;
+  }
+  return true;
+}
+
+void EsdfLayer::markBox(const int* node_min, int node_size, const int* min, const int* max)
+{
+  int lo[3], hi[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    lo[i] = std::max(node_min[i], min[i]);
+    hi[i] = std::min(node_min[i] + node_size - 1, max[i]);
+    if (lo[i] > hi[i])
+      return;
+  }
+  for (int z = lo[2]; z <= hi[2]; ++z)
+  {
+    for (int y = lo[1]; y <= hi[1]; ++y)
+    {
+      const int32_t row = cellIndex(0, y, z);
+      for (int x = lo[0]; x <= hi[0]; ++x)
+      {
+        flags_[row + x] |= READ_OCCUPIED;
+      }
+    }
+  }
+}
+
+void EsdfLayer::applyBox(const int* min, const int* max)
+{
+  for (int z = min[2]; z <= max[2]; ++z)
+  {
+    for (int y = min[1]; y <= max[1]; ++y)
+    {
+      const int32_t row = cellIndex(0, y, z);
+      for (int x = min[0]; x <= max[0]; ++x)
+      {
+        const int32_t index = row + x;
+        const bool occupied = flags_[index] & READ_OCCUPIED;
+        flags_[index] &= ~READ_OCCUPIED;
+        if (occupied && !(flags_[index] & OCCUPIED))
+          setObstacle(index);
+        else if (!occupied && (flags_[index] & OCCUPIED))
+          removeObstacle(index);
+      }
+    }
+  }
+}
+
+void EsdfLayer::clearCells()
+{
+  std::fill(obstacle_.begin(), obstacle_.end(), -1);
+  std::fill(distance_sq_.begin(), distance_sq_.end(), UNREACHED);
+  std::fill(flags_.begin(), flags_.end(), 0);
+  queue_ = Queue();
+}
+
+void EsdfLayer::setObstacle(int32_t index)
+{
+  flags_[index] = (flags_[index] | OCCUPIED) & ~RAISED;
+  obstacle_[index] = index;
+  distance_sq_[index] = 0;
+  queue_.push(QueueEntry(0, index));
+}
+
+void EsdfLayer::removeObstacle(int32_t index)
+{
+  flags_[index] = (flags_[index] & ~OCCUPIED) | RAISED;
+  obstacle_[index] = -1;
+  distance_sq_[index] = UNREACHED;
+  queue_.push(QueueEntry(0, index));
+}
+
+void EsdfLayer::processQueue()
+{
+  while (!queue_.empty())
+  {
+    const QueueEntry entry = queue_.top();
+    queue_.pop();
+    const int32_t index = entry.second;
+    if (flags_[index] & RAISED)
+    {
+      raise(index);
+    }
+    // skip cells whose obstacle is gone or that were lowered again since
+    // they were queued
+    else if (obstacle_[index] >= 0 && (flags_[obstacle_[index]] & OCCUPIED) && entry.first == distance_sq_[index])
+    {
+      lower(index);
+    }
+  }
+}
+
+void EsdfLayer::raise(int32_t index)
+{
+  int coords[3];
+  cellCoords(index, coords);
+  for (size_t n = 0; n < neighbor_offsets_.size(); ++n)
+  {
+    int neighbor_coords[3];
+    if (!neighborCoords(coords, n, neighbor_coords))
+      continue;
+    const int32_t neighbor = index + neighbor_offsets_[n];
+    if ((flags_[neighbor] & RAISED) || obstacle_[neighbor] < 0)
+      continue;
+    if (!(flags_[obstacle_[neighbor]] & OCCUPIED))
+    {
+      // its obstacle is gone too, raise it in turn
+      queue_.push(QueueEntry(distance_sq_[neighbor], neighbor));
+      flags_[neighbor] |= RAISED;
+      obstacle_[neighbor] = -1;
+      distance_sq_[neighbor] = UNREACHED;
+    }
+    else
+    {
+      // the edge of the raised area, lower it again from here
+      queue_.push(QueueEntry(distance_sq_[neighbor], neighbor));
+    }
+  }
+  flags_[index] &= ~RAISED;
+}
+
+void EsdfLayer::lower(int32_t index)
+{
+  int coords[3];
+  cellCoords(index, coords);
+  const int32_t obstacle = obstacle_[index];
+  int obstacle_coords[3];
+  cellCoords(obstacle, obstacle_coords);
+  for (size_t n = 0; n < neighbor_offsets_.size(); ++n)
+  {
+    int neighbor_coords[3];
+    if (!neighborCoords(coords, n, neighbor_coords))
+      continue;
+    const int32_t neighbor = index + neighbor_offsets_[n];
+    if (flags_[neighbor] & RAISED)
+      continue;
+    int32_t distance_sq = 0;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      distance_sq += (neighbor_coords[i] - obstacle_coords[i]) * (neighbor_coords[i] - obstacle_coords[i]);
+    }
+    if (distance_sq < distance_sq_[neighbor] && distance_sq <= max_distance_sq_)
+    {
+      distance_sq_[neighbor] = distance_sq;
+      obstacle_[neighbor] = obstacle;
+      queue_.push(QueueEntry(distance_sq, neighbor));
+    }
+  }
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,160 @@
+#include <octomap_server/FileWriteBuffer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+namespace octomap_server {
+
+// O_DIRECT needs buffers, sizes and file offsets aligned to the logical
+// block size of the device, which is at most a page
+static const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+FileWriteBuffer::FileWriteBuffer()
+  : fd_(-1),
+    direct_(false),
+    failed_(false),
+    buffer_(NULL),
+    buffer_size_(0),
+    bytes_written_(0)
+{
+}
+
+FileWriteBuffer::~FileWriteBuffer()
+{
+  close();
+}
+
+bool FileWriteBuffer::open(const std::string& filename, bool direct_io, bool exclusive, size_t buffer_size)
+{
+  close();
+  failed_ = false;
+  bytes_written_ = 0;
+  direct_ = false;
+  fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | (exclusive ? O_EXCL : O_TRUNC), 0644);
+  if (fd_ < 0)
+  {
+    ROS_ERROR("Unable to open %s: %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+  // Switch to direct I/O once the file is open, opening with O_DIRECT on a
+  // file system without it may create the file before failing, so that a
+  // second, exclusive, try would fail
+  if (direct_io)
+  {
+    const int flags = fcntl(fd_, F_GETFL);
+    if (flags != -1 && fcntl(fd_, F_SETFL, flags | O_DIRECT) == 0)
+    {
+      direct_ = true;
+    }
+    else
+    {
+      ROS_WARN("Direct I/O is not supported for %s, using regular writes", filename.c_str());
+    }
+  }
+
+  buffer_size_ = std::max((buffer_size / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT, DIRECT_IO_ALIGNMENT);
+  void* buffer = NULL;
+  if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, buffer_size_) != 0)
+  {
+    ::close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  buffer_ = static_cast<char*>(buffer);
+  setp(buffer_, buffer_ + buffer_size_);
+  return true;
+}
+
+bool FileWriteBuffer::close()
+{
+  if (fd_ < 0)
+  {
+    return !failed_;
+  }
+  writeBuffer(true);
+  if (::close(fd_) != 0)
+  {
+    failed_ = true;
+  }
+  fd_ = -1;
+  free(buffer_);
+  buffer_ = NULL;
+  setp(NULL, NULL);
+  return !failed_;
+}
+
+FileWriteBuffer::int_type FileWriteBuffer::overflow(int_type c)
+{
+  if (fd_ < 0 || !writeBuffer(false))
+  {
+    return traits_type::eof();
+  }
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+  return traits_type::not_eof(c);
+}
+
+int FileWriteBuffer::sync()
+{
+  if (fd_ < 0 || direct_)
+  {
+    return 0;
+  }
+  return writeBuffer(false) ? 0 : -1;
+}
+
+bool FileWriteBuffer::writeBuffer(bool final)
+{
+  const size_t size = pptr() - pbase();
+  size_t direct_size = size;
+  if (direct_ && final)
+  {
+    // Write the whole blocks directly and the rest regularly
+    direct_size = (size / DIRECT_IO_ALIGNMENT) * DIRECT_IO_ALIGNMENT;
+  }
+  bool ok = writeAll(pbase(), direct_size);
+  if (ok && direct_size < size)
+  {
+    int flags = fcntl(fd_, F_GETFL);
+    ok = fcntl(fd_, F_SETFL, flags & ~O_DIRECT) == 0 && writeAll(pbase() + direct_size, size - direct_size);
+  }
+  setp(buffer_, buffer_ + buffer_size_);
+  if (!ok)
+  {
+    failed_ = true;
+  }
+  return ok;
+}
+
+bool FileWriteBuffer::writeAll(const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    ssize_t written = ::write(fd_, data, size);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      ROS_ERROR("Error writing file: %s", strerror(errno));
+      return false;
+    }
+    data += written;
+    size -= written;
+    bytes_written_ += written;
+  }
+  return true;
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,90 @@
+#include <octomap_server/FrontierTracker.h>
+
+namespace octomap_server {
+
+FrontierTracker::FrontierTracker()
+  : enabled_(false), tree_depth_(16), rebuild_(true)
+{
+}
+
+void FrontierTracker::configure(bool enabled, unsigned int tree_depth)
+{
+  enabled_ = enabled;
+  tree_depth_ = tree_depth;
+  rebuild_ = true;
+  frontiers_.clear();
+  candidates_.clear();
+}
+
+void FrontierTracker::eraseBox(const unsigned int* min, const unsigned int* max)
+{
+  const uint64_t volume = uint64_t(max[0] - min[0] + 1) * (max[1] - min[1] + 1) * (max[2] - min[2] + 1);
+  if (volume <= frontiers_.size())
+  {
+    for (unsigned int x = min[0]; x <= max[0]; ++x)
+      for (unsigned int y = min[1]; y <= max[1]; ++y)
+        for (unsigned int z = min[2]; z <= max[2]; ++z)
+          frontiers_.erase(octomap::OcTreeKey(x, y, z));
+    return;
+  }
+  for (KeySet::iterator it = frontiers_.begin(); it != frontiers_.end();)
+  {
+    const octomap::OcTreeKey& key = *it;
+    if (key[0] >= min[0] && key[0] <= max[0] && key[1] >= min[1] && key[1] <= max[1] && key[2] >= min[2]
+        && key[2] <= max[2])
+      it = frontiers_.erase(it);
+    else
+      ++it;
+  }
+}
+
+void FrontierTracker::cluster(size_t min_size, std::vector<Cluster>* clusters) const
+{
+  clusters->clear();
+  KeySet visited;
+  visited.reserve(frontiers_.size());
+  std::vector<octomap::OcTreeKey> stack;
+  for (const octomap::OcTreeKey& seed : frontiers_)
+  {
+    if (!visited.insert(seed).second)
+      continue;
+    Cluster cluster;
+    cluster.size = 0;
+    double sum[3] = { 0.0, 0.0, 0.0 };
+    cluster.min = cluster.max = seed;
+    stack.push_back(seed);
+    while (!stack.empty())
+    {
+      const octomap::OcTreeKey key = stack.back();
+      stack.pop_back();
+      ++cluster.size;
+      for (unsigned int i = 0; i < 3; ++i)
+      {
+        sum[i] += key[i];
+        cluster.min[i] = std::min(cluster.min[i], key[i]);
+        cluster.max[i] = std::max(cluster.max[i], key[i]);
+      }
+      for (int dx = -1; dx <= 1; ++dx)
+      {
+        for (int dy = -1; dy <= 1; ++dy)
+        {
+          for (int dz = -1; dz <= 1; ++dz)
+          {
+            // keys wrap around at the edges of the key range, which maps
+            // never reach
+            const octomap::OcTreeKey neighbor(key[0] + dx, key[1] + dy, key[2] + dz);
+            if (frontiers_.count(neighbor) && visited.insert(neighbor).second)
+              stack.push_back(neighbor);
+          }
+        }
+      }
+    }
+    if (cluster.size < min_size)
+      continue;
+    for (unsigned int i = 0; i < 3; ++i)
+      cluster.center[i] = sum[i] / cluster.size;
+    clusters->push_back(cluster);
+  }
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,147 @@
+#include <octomap_server/IndexedMapFile.h>
+
+#include <cstring>
+#include <sstream>
+
+namespace octomap_server {
+
+static const char* const INDEXED_MAP_FILE_HEADER = "# Octomap indexed file";
+
+bool isIndexedMapFile(const std::string& filename)
+{
+  const size_t ext_len = strlen(INDEXED_MAP_FILE_EXTENSION);
+  return filename.length() > ext_len &&
+         filename.compare(filename.length() - ext_len, ext_len, INDEXED_MAP_FILE_EXTENSION) == 0;
+}
+
+bool writeIndexedMapHeader(std::ostream& s, const IndexedMapHeader& header)
+{
+  s << INDEXED_MAP_FILE_HEADER << "\n# (feel free to add / change comments, but leave the first line as it is!)\n#\n";
+  s << "id " << header.id << "\n";
+  s << "res " << header.resolution << "\n";
+  s << "depth " << header.tree_depth << "\n";
+  s << "format " << (header.binary ? "binary" : "full") << "\n";
+  s << "split_depth " << header.split_depth << "\n";
+  s << "subtrees " << header.num_subtrees << "\n";
+  s << "top_size " << header.top_size << "\n";
+  s << "data\n";
+  return s.good();
+}
+
+bool writeIndexedMapPieces(std::ostream& s, IndexedMapHeader header, const std::string& top,
+                           std::vector<IndexedSubtreeEntry>* entries, const std::vector<const std::string*>& data)
+{
+  header.num_subtrees = entries->size();
+  header.top_size = top.size();
+  if (!writeIndexedMapHeader(s, header))
+  {
+    return false;
+  }
+
+  uint64_t data_offset = 0;
+  for (size_t i = 0; i < entries->size(); ++i)
+  {
+    IndexedSubtreeEntry& entry = (*entries)[i];
+    entry.data_offset = data_offset;
+    entry.data_size = data[i]->size();
+    writeIndexedSubtreeEntry(s, entry);
+    data_offset += entry.data_size;
+  }
+  s.write(top.data(), top.size());
+  for (const std::string* subtree : data)
+  {
+    s.write(subtree->data(), subtree->size());
+  }
+  return s.good();
+}
+
+bool readIndexedMapHeader(std::istream& s, IndexedMapHeader* header)
+{
+  std::string line;
+  if (!std::getline(s, line) || line.compare(0, strlen(INDEXED_MAP_FILE_HEADER), INDEXED_MAP_FILE_HEADER) != 0)
+  {
+    return false;
+  }
+  bool have_res = false, have_format = false, have_split = false, have_subtrees = false, have_top = false;
+  while (std::getline(s, line))
+  {
+    std::istringstream ss(line);
+    std::string token;
+    ss >> token;
+    if (token.empty() || token[0] == '#')
+    {
+      continue;
+    }
+    else if (token == "id")
+    {
+      ss >> header->id;
+    }
+    else if (token == "res")
+    {
+      have_res = static_cast<bool>(ss >> header->resolution);
+    }
+    else if (token == "depth")
+    {
+      ss >> header->tree_depth;
+    }
+    else if (token == "format")
+    {
+      std::string format;
+      ss >> format;
+      header->binary = (format == "binary");
+      have_format = header->binary || format == "full";
+    }
+    else if (token == "split_depth")
+    {
+      have_split = static_cast<bool>(ss >> header->split_depth);
+    }
+    else if (token == "subtrees")
+    {
+      have_subtrees = static_cast<bool>(ss >> header->num_subtrees);
+    }
+    else if (token == "top_size")
+    {
+      have_top = static_cast<bool>(ss >> header->top_size);
+    }
+    else if (token == "data")
+    {
+      return have_res && have_format && have_split && have_subtrees && have_top
+             && header->split_depth > 0 && header->split_depth <= header->tree_depth
+             && header->tree_depth <= octomap::KEY_BIT_WIDTH;
+    }
+  }
+  return false;
+}
+
+void writeIndexedSubtreeEntry(std::ostream& s, const IndexedSubtreeEntry& entry)
+{
+  char buf[IndexedSubtreeEntry::SERIALIZED_SIZE] = {0};
+  memcpy(buf, &entry.key[0], sizeof(octomap::key_type));
+  memcpy(buf + 2, &entry.key[1], sizeof(octomap::key_type));
+  memcpy(buf + 4, &entry.key[2], sizeof(octomap::key_type));
+  buf[6] = entry.write_children ? 1 : 0;
+  // buf[7] is padding
+  memcpy(buf + 8, &entry.splice_offset, sizeof(uint64_t));
+  memcpy(buf + 16, &entry.data_offset, sizeof(uint64_t));
+  memcpy(buf + 24, &entry.data_size, sizeof(uint64_t));
+  s.write(buf, sizeof(buf));
+}
+
+bool readIndexedSubtreeEntry(std::istream& s, IndexedSubtreeEntry* entry)
+{
+  char buf[IndexedSubtreeEntry::SERIALIZED_SIZE];
+  if (!s.read(buf, sizeof(buf)))
+  {
+    return false;
+  }
+  memcpy(&entry->key[0], buf, sizeof(octomap::key_type));
+  memcpy(&entry->key[1], buf + 2, sizeof(octomap::key_type));
+  memcpy(&entry->key[2], buf + 4, sizeof(octomap::key_type));
+  entry->write_children = (buf[6] != 0);
+  memcpy(&entry->splice_offset, buf + 8, sizeof(uint64_t));
+  memcpy(&entry->data_offset, buf + 16, sizeof(uint64_t));
+  memcpy(&entry->data_size, buf + 24, sizeof(uint64_t));
+  return true;
+}
+
+}  // namespace octomap_server
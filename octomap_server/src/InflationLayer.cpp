@@ -0,0 +1,275 @@
+#include <octomap_server/InflationLayer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace octomap_server {
+
+namespace {
+const int32_t UNREACHED = std::numeric_limits<int32_t>::max();
+const int8_t LETHAL = 100;
+const int8_t INSCRIBED = 99;
+
+// Cells over 50 are obstacles, like map_server's default threshold
+inline bool isObstacle(int8_t value)
+{
+  return value > 50;
+}
+
+// Boxes of cells: x min, y min, x max, y max
+inline void clearBox(int* box)
+{
+  box[0] = box[1] = std::numeric_limits<int>::max();
+  box[2] = box[3] = -1;
+}
+
+inline bool isEmptyBox(const int* box)
+{
+  return box[2] < box[0];
+}
+
+inline void addToBox(int x_min, int y_min, int x_max, int y_max, int* box)
+{
+  box[0] = std::min(box[0], x_min);
+  box[1] = std::min(box[1], y_min);
+  box[2] = std::max(box[2], x_max);
+  box[3] = std::max(box[3], y_max);
+}
+
+bool sameGeometry(const nav_msgs::MapMetaData& a, const nav_msgs::MapMetaData& b)
+{
+  return a.width == b.width && a.height == b.height && a.resolution == b.resolution
+         && a.origin.position.x == b.origin.position.x && a.origin.position.y == b.origin.position.y;
+}
+}
+
+InflationLayer::InflationLayer()
+  : inscribed_radius_(0.0), inflation_radius_(0.0), cost_scaling_factor_(10.0), rebuild_(true), radius_(0)
+{
+}
+
+void InflationLayer::configure(double inscribed_radius, double inflation_radius, double cost_scaling_factor)
+{
+  inflation_radius_ = std::max(inflation_radius, 0.0);
+  inscribed_radius_ = std::min(std::max(inscribed_radius, 0.0), inflation_radius_);
+  cost_scaling_factor_ = std::max(cost_scaling_factor, 0.0);
+  rebuild_ = true;
+}
+
+void InflationLayer::Block::clear()
+{
+  clearBox(obstacles);
+  clearBox(inflate);
+  clearBox(rewrite);
+}
+
+bool InflationLayer::update(const nav_msgs::OccupancyGrid& grid, std::vector<Patch>* patches, bool* rebuilt)
+{
+  patches->clear();
+  if (rebuilt)
+    *rebuilt = false;
+  const unsigned int width = grid.info.width;
+  const unsigned int height = grid.info.height;
+  if (!isEnabled() || width == 0 || height == 0 || grid.data.size() < size_t(width) * height)
+    return false;
+  costs_.header = grid.header;
+  const unsigned int blocks_x = (width + PATCH_SIZE - 1) / PATCH_SIZE;
+  const unsigned int blocks_y = (height + PATCH_SIZE - 1) / PATCH_SIZE;
+
+  if (rebuild_ || !sameGeometry(grid.info, costs_.info))
+  {
+    rebuild_ = false;
+    costs_.info = grid.info;
+    occupancy_.assign(grid.data.begin(), grid.data.begin() + size_t(width) * height);
+    costs_.data.assign(occupancy_.size(), -1);
+    inflation_.assign(occupancy_.size(), 0);
+    blocks_.assign(size_t(blocks_x) * blocks_y, Block());
+    computeCostTable(grid.info.resolution);
+    Patch patch;
+    patch.x = patch.y = 0;
+    patch.width = width;
+    patch.height = height;
+    inflate(patch);
+    patches->push_back(patch);
+    if (rebuilt)
+      *rebuilt = true;
+    return true;
+  }
+
+  // Cells that became or stopped being obstacles change the costs within
+  // the inflation radius, other cells keep their inflation cost and only
+  // take the new value where they have none
+  bool changed = false;
+  for (unsigned int y = 0; y < height; ++y)
+  {
+    for (unsigned int x = 0; x < width; ++x)
+    {
+      const size_t idx = size_t(width) * y + x;
+      const int8_t value = grid.data[idx];
+      if (value == occupancy_[idx])
+        continue;
+      changed = true;
+      Block& block = blocks_[blocks_x * (y / PATCH_SIZE) + x / PATCH_SIZE];
+      if (isObstacle(value) != isObstacle(occupancy_[idx]))
+      {
+        addToBox(x, y, x, y, block.obstacles);
+      }
+      else
+      {
+        costs_.data[idx] = inflation_[idx] > 0 ? inflation_[idx] : value;
+        addToBox(x, y, x, y, block.rewrite);
+      }
+      occupancy_[idx] = value;
+    }
+  }
+  if (!changed)
+    return false;
+
+  // The obstacle changes of a block reach the blocks within the radius
+  const int size[2] = { int(width), int(height) };
+  for (unsigned int by = 0; by < blocks_y; ++by)
+  {
+    for (unsigned int bx = 0; bx < blocks_x; ++bx)
+    {
+      const Block& block = blocks_[blocks_x * by + bx];
+      if (isEmptyBox(block.obstacles))
+        continue;
+      int reach_min[2], reach_max[2];
+      for (unsigned int i = 0; i < 2; ++i)
+      {
+        reach_min[i] = std::max(block.obstacles[i] - radius_, 0);
+        reach_max[i] = std::min(block.obstacles[i + 2] + radius_, size[i] - 1);
+      }
+      for (unsigned int ty = reach_min[1] / PATCH_SIZE; ty <= reach_max[1] / PATCH_SIZE; ++ty)
+      {
+        for (unsigned int tx = reach_min[0] / PATCH_SIZE; tx <= reach_max[0] / PATCH_SIZE; ++tx)
+        {
+          Block& target = blocks_[blocks_x * ty + tx];
+          addToBox(std::max(reach_min[0], int(tx * PATCH_SIZE)), std::max(reach_min[1], int(ty * PATCH_SIZE)),
+                   std::min(reach_max[0], int((tx + 1) * PATCH_SIZE) - 1),
+                   std::min(reach_max[1], int((ty + 1) * PATCH_SIZE) - 1), target.inflate);
+        }
+      }
+    }
+  }
+
+  for (size_t i = 0; i < blocks_.size(); ++i)
+  {
+    Block& block = blocks_[i];
+    if (isEmptyBox(block.inflate) && isEmptyBox(block.rewrite))
+      continue;
+    int box[4];
+    clearBox(box);
+    if (!isEmptyBox(block.inflate))
+    {
+      Patch target;
+      target.x = block.inflate[0];
+      target.y = block.inflate[1];
+      target.width = block.inflate[2] - block.inflate[0] + 1;
+      target.height = block.inflate[3] - block.inflate[1] + 1;
+      inflate(target);
+      addToBox(block.inflate[0], block.inflate[1], block.inflate[2], block.inflate[3], box);
+    }
+    if (!isEmptyBox(block.rewrite))
+      addToBox(block.rewrite[0], block.rewrite[1], block.rewrite[2], block.rewrite[3], box);
+    Patch patch;
+    patch.x = box[0];
+    patch.y = box[1];
+    patch.width = box[2] - box[0] + 1;
+    patch.height = box[3] - box[1] + 1;
+    patches->push_back(patch);
+    block.clear();
+  }
+  return true;
+}
+
+void InflationLayer::computeCostTable(double resolution)
+{
+  radius_ = resolution > 0.0 ? static_cast<int>(std::ceil(inflation_radius_ / resolution)) : 0;
+  cost_table_.resize(radius_ * radius_ + 1);
+  for (size_t distance_sq = 0; distance_sq < cost_table_.size(); ++distance_sq)
+  {
+    const double distance = std::sqrt(double(distance_sq)) * resolution;
+    if (distance_sq == 0)
+      cost_table_[distance_sq] = LETHAL;
+    else if (distance <= inscribed_radius_)
+      cost_table_[distance_sq] = INSCRIBED;
+    else if (distance <= inflation_radius_)
+      cost_table_[distance_sq] = static_cast<int8_t>(
+          std::round((INSCRIBED - 1) * std::exp(-cost_scaling_factor_ * (distance - inscribed_radius_))));
+    else
+      cost_table_[distance_sq] = 0;
+  }
+}
+
+void InflationLayer::inflate(const Patch& target)
+{
+  // Every obstacle within the inflation radius of the target is in the
+  // source area, and so is the path of the brushfire from it
+  const int width = costs_.info.width;
+  const int height = costs_.info.height;
+  const int source_min[2] = { std::max(int(target.x) - radius_, 0), std::max(int(target.y) - radius_, 0) };
+  const int source_max[2] = { std::min(int(target.x + target.width) - 1 + radius_, width - 1),
+                              std::min(int(target.y + target.height) - 1 + radius_, height - 1) };
+  const int source_width = source_max[0] - source_min[0] + 1;
+  const int source_height = source_max[1] - source_min[1] + 1;
+  nearest_.assign(size_t(source_width) * source_height, -1);
+  distance_sq_.assign(nearest_.size(), UNREACHED);
+
+  for (int y = 0; y < source_height; ++y)
+  {
+    for (int x = 0; x < source_width; ++x)
+    {
+      if (!isObstacle(occupancy_[size_t(width) * (source_min[1] + y) + source_min[0] + x]))
+        continue;
+      const int32_t index = x + source_width * y;
+      nearest_[index] = index;
+      distance_sq_[index] = 0;
+      queue_.push(QueueEntry(0, index));
+    }
+  }
+
+  const int32_t max_distance_sq = radius_ * radius_;
+  while (!queue_.empty())
+  {
+    const QueueEntry entry = queue_.top();
+    queue_.pop();
+    const int32_t index = entry.second;
+    if (entry.first > distance_sq_[index])
+      continue;
+    const int x = index % source_width, y = index / source_width;
+    const int obstacle_x = nearest_[index] % source_width, obstacle_y = nearest_[index] / source_width;
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+      for (int dx = -1; dx <= 1; ++dx)
+      {
+        const int nx = x + dx, ny = y + dy;
+        if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= source_width || ny >= source_height)
+          continue;
+        const int32_t distance_sq =
+            (nx - obstacle_x) * (nx - obstacle_x) + (ny - obstacle_y) * (ny - obstacle_y);
+        const int32_t neighbor = nx + source_width * ny;
+        if (distance_sq > max_distance_sq || distance_sq >= distance_sq_[neighbor])
+          continue;
+        distance_sq_[neighbor] = distance_sq;
+        nearest_[neighbor] = nearest_[index];
+        queue_.push(QueueEntry(distance_sq, neighbor));
+      }
+    }
+  }
+
+  for (unsigned int y = target.y; y < target.y + target.height; ++y)
+  {
+    for (unsigned int x = target.x; x < target.x + target.width; ++x)
+    {
+      const size_t idx = size_t(width) * y + x;
+      const int32_t distance_sq = distance_sq_[(x - source_min[0]) + size_t(source_width) * (y - source_min[1])];
+      const int8_t cost = distance_sq == UNREACHED ? 0 : cost_table_[distance_sq];
+      inflation_[idx] = cost;
+      costs_.data[idx] = cost > 0 ? cost : occupancy_[idx];
+    }
+  }
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,59 @@
+#include <octomap_server/LevelOfDetail.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace octomap_server {
+
+LevelOfDetail::LevelOfDetail()
+  : origin_(0.0, 0.0, 0.0)
+{
+}
+
+bool LevelOfDetail::configure(const std::vector<double>& distances, const std::vector<int>& depths)
+{
+  distances_.clear();
+  depths_.clear();
+  if (distances.size() != depths.size())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < distances.size(); ++i)
+  {
+    // Farther bands are published as coarse or coarser than nearer ones
+    if (depths[i] < 0 || (i > 0 && (distances[i] <= distances[i-1] || depths[i] > depths[i-1])))
+    {
+      distances_.clear();
+      depths_.clear();
+      return false;
+    }
+    distances_.push_back(distances[i]);
+    depths_.push_back(depths[i]);
+  }
+  return true;
+}
+
+unsigned int LevelOfDetail::depthAt(double distance) const
+{
+  std::vector<double>::const_iterator band = std::lower_bound(distances_.begin(), distances_.end(), distance);
+  if (band == distances_.end())
+  {
+    return depths_.back();
+  }
+  return depths_[band - distances_.begin()];
+}
+
+unsigned int LevelOfDetail::nodeDepth(const octomap::point3d& center, double size) const
+{
+  // distance from the origin to the closest point of the node's box
+  const double half_size = size / 2.0;
+  double dist_sq = 0.0;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    double d = std::max(0.0, std::fabs(center(i) - origin_(i)) - half_size);
+    dist_sq += d * d;
+  }
+  return depthAt(std::sqrt(dist_sq));
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,122 @@
+#include <octomap_server/MapSerializationCache.h>
+
+#include <ros/ros.h>
+
+namespace octomap_server {
+
+MapSerializationCache::MapSerializationCache()
+{
+}
+
+MapSerializationCache::~MapSerializationCache()
+{
+  wait();
+}
+
+void MapSerializationCache::wait()
+{
+  // Not under mutex_, the workers take it when they are done
+  for (Slot& s : slots_)
+  {
+    if (s.worker.joinable())
+    {
+      s.worker.join();
+    }
+  }
+}
+
+octomap_msgs::OctomapConstPtr MapSerializationCache::get(bool binary, uint64_t version) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  const Slot& s = slot(binary);
+  if (s.map && s.version == version)
+  {
+    return s.map;
+  }
+  return octomap_msgs::OctomapConstPtr();
+}
+
+octomap_msgs::OctomapConstPtr MapSerializationCache::getLatest(bool binary, uint64_t* version) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  const Slot& s = slot(binary);
+  if (version)
+  {
+    *version = s.version;
+  }
+  return s.map;
+}
+
+octomap_msgs::OctomapConstPtr MapSerializationCache::build(bool binary, uint64_t version, const Serializer& serializer)
+{
+  octomap_msgs::OctomapPtr map(new octomap_msgs::Octomap);
+  ros::WallTime start_time = ros::WallTime::now();
+  if (!serializer(*map))
+  {
+    return octomap_msgs::OctomapConstPtr();
+  }
+  ROS_DEBUG("Serialized %s map version %lu (%zu bytes) in %f sec", binary ? "binary" : "full",
+            version, map->data.size(), (ros::WallTime::now() - start_time).toSec());
+  boost::mutex::scoped_lock lock(mutex_);
+  store(slot(binary), map, version);
+  return map;
+}
+
+void MapSerializationCache::buildAsync(bool binary, uint64_t version, const Serializer& serializer)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  Slot& s = slot(binary);
+  if (s.building)
+  {
+    return;
+  }
+  // The previous worker (if any) is done, as building is only cleared as
+  // the very last thing the worker does, so joining will not block.
+  if (s.worker.joinable())
+  {
+    s.worker.join();
+  }
+  s.building = true;
+  s.worker = boost::thread(&MapSerializationCache::buildWorker, this, binary, version, serializer);
+}
+
+bool MapSerializationCache::isBuilding(bool binary) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return slot(binary).building;
+}
+
+void MapSerializationCache::store(Slot& s, const octomap_msgs::OctomapConstPtr& map, uint64_t version)
+{
+  if (!s.map || version >= s.version)
+  {
+    s.map = map;
+    s.version = version;
+  }
+}
+
+void MapSerializationCache::buildWorker(bool binary, uint64_t version, Serializer serializer)
+{
+  octomap_msgs::OctomapPtr map(new octomap_msgs::Octomap);
+  ros::WallTime start_time = ros::WallTime::now();
+  bool ok = serializer(*map);
+  if (ok)
+  {
+    ROS_DEBUG("Serialized %s map version %lu (%zu bytes) in the background in %f sec",
+              binary ? "binary" : "full", version, map->data.size(),
+              (ros::WallTime::now() - start_time).toSec());
+  }
+  else
+  {
+    ROS_ERROR("Error serializing OctoMap in the background");
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  Slot& s = slot(binary);
+  if (ok)
+  {
+    store(s, map, version);
+  }
+  s.building = false;
+}
+
+}  // namespace octomap_server
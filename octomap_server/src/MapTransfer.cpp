@@ -0,0 +1,103 @@
+#include <octomap_server/MapTransfer.h>
+
+#include <algorithm>
+#include <boost/crc.hpp>
+
+namespace octomap_server {
+
+MapTransfer::MapTransfer()
+  : max_sessions_(4),
+    timeout_(60.0),
+    next_id_(1)
+{
+}
+
+void MapTransfer::setLimits(size_t max_sessions, double timeout)
+{
+  max_sessions_ = std::max(max_sessions, size_t(1));
+  timeout_ = timeout;
+  expire(ros::WallTime::now());
+}
+
+uint32_t MapTransfer::start(const octomap_msgs::OctomapConstPtr& map, size_t chunk_size)
+{
+  const ros::WallTime now = ros::WallTime::now();
+  expire(now);
+  while (sessions_.size() >= max_sessions_)
+  {
+    SessionMap::iterator oldest = sessions_.begin();
+    for (SessionMap::iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+    {
+      if (it->second.last_used < oldest->second.last_used)
+      {
+        oldest = it;
+      }
+    }
+    sessions_.erase(oldest);
+  }
+  // 0 is never handed out, so clients can use it for "no transfer"
+  if (next_id_ == 0)
+  {
+    ++next_id_;
+  }
+  const uint32_t id = next_id_++;
+  Session& session = sessions_[id];
+  session.map = map;
+  session.chunk_size = std::max(chunk_size, size_t(1));
+  session.last_used = now;
+  return id;
+}
+
+uint32_t MapTransfer::numChunks(uint32_t id) const
+{
+  SessionMap::const_iterator it = sessions_.find(id);
+  if (it == sessions_.end())
+  {
+    return 0;
+  }
+  const size_t size = it->second.map->data.size();
+  return (size + it->second.chunk_size - 1) / it->second.chunk_size;
+}
+
+bool MapTransfer::chunk(uint32_t id, uint32_t index, std::vector<int8_t>* data, uint32_t* crc)
+{
+  const ros::WallTime now = ros::WallTime::now();
+  expire(now);
+  SessionMap::iterator it = sessions_.find(id);
+  if (it == sessions_.end() || index >= numChunks(id))
+  {
+    return false;
+  }
+  Session& session = it->second;
+  session.last_used = now;
+  const std::vector<int8_t>& map_data = session.map->data;
+  const size_t begin = size_t(index) * session.chunk_size;
+  const size_t end = std::min(begin + session.chunk_size, map_data.size());
+  data->assign(map_data.begin() + begin, map_data.begin() + end);
+  *crc = crc32(data->data(), data->size());
+  return true;
+}
+
+uint32_t MapTransfer::crc32(const int8_t* data, size_t size)
+{
+  boost::crc_32_type crc;
+  crc.process_bytes(data, size);
+  return crc.checksum();
+}
+
+void MapTransfer::expire(const ros::WallTime& now)
+{
+  for (SessionMap::iterator it = sessions_.begin(); it != sessions_.end();)
+  {
+    if ((now - it->second.last_used).toSec() > timeout_)
+    {
+      sessions_.erase(it++);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+}  // namespace octomap_server
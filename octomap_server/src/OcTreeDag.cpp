@@ -0,0 +1,281 @@
+#include <octomap_server/OcTreeDag.h>
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace octomap_server {
+
+const char* const OcTreeDag::FILE_EXTENSION = ".dag";
+
+static const char* const DAG_FILE_HEADER = "# Octomap DAG file";
+
+OcTreeDag::OcTreeDag()
+  : resolution_(0.0), tree_depth_(0), tree_max_val_(0), tree_size_(0), root_(0), root_leaf_(UNKNOWN)
+{
+}
+
+void OcTreeDag::clear()
+{
+  id_.clear();
+  tree_size_ = 0;
+  masks_.clear();
+  first_child_.clear();
+  children_.clear();
+  root_ = 0;
+  root_leaf_ = UNKNOWN;
+  unique_.clear();
+}
+
+size_t OcTreeDag::memoryUsage() const
+{
+  return masks_.size() * sizeof(uint16_t) + first_child_.size() * sizeof(uint32_t) +
+         children_.size() * sizeof(uint32_t);
+}
+
+uint32_t OcTreeDag::addNode(uint16_t mask, const std::vector<uint32_t>& children)
+{
+  std::string key(reinterpret_cast<const char*>(&mask), sizeof(mask));
+  key.append(reinterpret_cast<const char*>(children.data()), children.size() * sizeof(uint32_t));
+  std::unordered_map<std::string, uint32_t>::const_iterator it = unique_.find(key);
+  if (it != unique_.end())
+  {
+    return it->second;
+  }
+  const uint32_t id = masks_.size();
+  masks_.push_back(mask);
+  first_child_.push_back(children_.size());
+  children_.insert(children_.end(), children.begin(), children.end());
+  unique_.insert(std::make_pair(key, id));
+  return id;
+}
+
+uint64_t OcTreeDag::countTreeNodes() const
+{
+  if (masks_.empty())
+  {
+    return root_leaf_ != UNKNOWN ? 1 : 0;
+  }
+  // children always come before their parents, so one pass in id order
+  // sizes every subtree
+  std::vector<uint64_t> sizes(masks_.size());
+  for (uint32_t id = 0; id < masks_.size(); ++id)
+  {
+    uint64_t size = 1;
+    uint32_t child = first_child_[id];
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      const unsigned int bits = (masks_[id] >> (2 * i)) & 3;
+      if (bits == 3)
+      {
+        size += sizes[children_[child++]];
+      }
+      else if (bits != 0)
+      {
+        size++;
+      }
+    }
+    sizes[id] = size;
+  }
+  return sizes[root_];
+}
+
+bool OcTreeDag::write(const std::string& filename) const
+{
+  std::ofstream s(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  if (!s.is_open())
+  {
+    return false;
+  }
+  s << DAG_FILE_HEADER << "\n# (feel free to add / change comments, but leave the first line as it is!)\n#\n";
+  s << "id " << id_ << "\n";
+  s << "res " << resolution_ << "\n";
+  s << "depth " << tree_depth_ << "\n";
+  s << "nodes " << masks_.size() << "\n";
+  s << "children " << children_.size() << "\n";
+  s << "root " << root_ << "\n";
+  if (root_leaf_ != UNKNOWN)
+  {
+    s << "root_leaf " << root_leaf_ << "\n";
+  }
+  s << "data\n";
+  s.write(reinterpret_cast<const char*>(masks_.data()), masks_.size() * sizeof(uint16_t));
+  s.write(reinterpret_cast<const char*>(first_child_.data()), first_child_.size() * sizeof(uint32_t));
+  s.write(reinterpret_cast<const char*>(children_.data()), children_.size() * sizeof(uint32_t));
+  s.close();
+  return !s.fail();
+}
+
+bool OcTreeDag::read(const std::string& filename)
+{
+  clear();
+  std::ifstream s(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  std::string line;
+  if (!s.is_open() || !std::getline(s, line) ||
+      line.compare(0, strlen(DAG_FILE_HEADER), DAG_FILE_HEADER) != 0)
+  {
+    return false;
+  }
+  size_t num_nodes = 0, num_children = 0;
+  int root_leaf = UNKNOWN;
+  bool have_res = false, have_nodes = false, have_children = false, have_data = false;
+  tree_depth_ = 16;
+  while (!have_data && std::getline(s, line))
+  {
+    std::istringstream ss(line);
+    std::string token;
+    ss >> token;
+    if (token == "id")
+    {
+      ss >> id_;
+    }
+    else if (token == "res")
+    {
+      have_res = static_cast<bool>(ss >> resolution_);
+    }
+    else if (token == "depth")
+    {
+      ss >> tree_depth_;
+    }
+    else if (token == "nodes")
+    {
+      have_nodes = static_cast<bool>(ss >> num_nodes);
+    }
+    else if (token == "children")
+    {
+      have_children = static_cast<bool>(ss >> num_children);
+    }
+    else if (token == "root")
+    {
+      ss >> root_;
+    }
+    else if (token == "root_leaf")
+    {
+      ss >> root_leaf;
+    }
+    else if (token == "data")
+    {
+      have_data = true;
+    }
+  }
+  if (!have_data || !have_res || !have_nodes || !have_children || id_.empty() || tree_depth_ == 0 ||
+      tree_depth_ > 16 || (num_nodes > 0 && root_ >= num_nodes) || root_leaf < UNKNOWN || root_leaf > OCCUPIED ||
+      (num_nodes > 0 && root_leaf != UNKNOWN))
+  {
+    clear();
+    return false;
+  }
+  tree_max_val_ = 1 << (tree_depth_ - 1);
+  root_leaf_ = static_cast<Occupancy>(root_leaf);
+
+  masks_.resize(num_nodes);
+  first_child_.resize(num_nodes);
+  children_.resize(num_children);
+  s.read(reinterpret_cast<char*>(masks_.data()), masks_.size() * sizeof(uint16_t));
+  s.read(reinterpret_cast<char*>(first_child_.data()), first_child_.size() * sizeof(uint32_t));
+  s.read(reinterpret_cast<char*>(children_.data()), children_.size() * sizeof(uint32_t));
+  if (!s)
+  {
+    clear();
+    return false;
+  }
+  // A node may only point to earlier nodes, so expanding always ends
+  for (uint32_t id = 0; id < masks_.size(); ++id)
+  {
+    const unsigned int num_inner = __builtin_popcount(innerBits(masks_[id]));
+    if (first_child_[id] + static_cast<uint64_t>(num_inner) > children_.size())
+    {
+      clear();
+      return false;
+    }
+    for (unsigned int i = 0; i < num_inner; ++i)
+    {
+      if (children_[first_child_[id] + i] >= id)
+      {
+        clear();
+        return false;
+      }
+    }
+  }
+  tree_size_ = countTreeNodes();
+  return true;
+}
+
+bool OcTreeDag::coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey* key) const
+{
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const int scaled = static_cast<int>(std::floor(coord(i) / resolution_));
+    if (scaled < -static_cast<int>(tree_max_val_) || scaled >= static_cast<int>(tree_max_val_))
+    {
+      return false;
+    }
+    (*key)[i] = scaled + tree_max_val_;
+  }
+  return true;
+}
+
+OcTreeDag::Occupancy OcTreeDag::search(const octomap::OcTreeKey& key, unsigned int* depth) const
+{
+  if (masks_.empty())
+  {
+    if (depth && root_leaf_ != UNKNOWN)
+    {
+      *depth = 0;
+    }
+    return root_leaf_;
+  }
+  uint32_t id = root_;
+  for (unsigned int d = 0; d < tree_depth_; ++d)
+  {
+    const uint16_t mask = masks_[id];
+    const unsigned int pos = octomap::computeChildIdx(key, tree_depth_ - 1 - d);
+    const unsigned int bits = (mask >> (2 * pos)) & 3;
+    if (bits != 3)
+    {
+      if (depth)
+      {
+        *depth = d + 1;
+      }
+      return static_cast<Occupancy>(bits);
+    }
+    // inner children are stored in the order of their bits
+    id = children_[first_child_[id] + __builtin_popcount(innerBits(mask) & ((1u << (2 * pos)) - 1))];
+  }
+  return UNKNOWN;
+}
+
+void OcTreeDag::writeBinaryRecurs(uint32_t id, std::vector<int8_t>* data) const
+{
+  const uint16_t mask = masks_[id];
+  data->push_back(static_cast<int8_t>(mask & 0xff));
+  data->push_back(static_cast<int8_t>(mask >> 8));
+  const uint32_t* child = children_.data() + first_child_[id];
+  for (uint16_t inner = innerBits(mask); inner; inner &= inner - 1)
+  {
+    writeBinaryRecurs(*child++, data);
+  }
+}
+
+bool OcTreeDag::binaryMapToMsg(octomap_msgs::Octomap& msg) const
+{
+  msg.data.clear();
+  msg.id = id_;
+  msg.resolution = resolution_;
+  msg.binary = true;
+  if (!masks_.empty())
+  {
+    // 2 bytes per inner node of the expanded tree, at about 8 nodes each
+    msg.data.reserve(tree_size_ / 4);
+    writeBinaryRecurs(root_, &msg.data);
+  }
+  else if (root_leaf_ != UNKNOWN)
+  {
+    // no children
+    msg.data.resize(2, 0);
+  }
+  return true;
+}
+
+}  // namespace octomap_server
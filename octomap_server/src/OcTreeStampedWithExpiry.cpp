@@ -1,5 +1,12 @@
 #include <ros/ros.h>
 #include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/IndexedMapFile.h>
+
+#include <atomic>
+#include <bitset>
+#include <fstream>
+#include <sstream>
+#include <boost/thread.hpp>
 
 namespace octomap_server {
 
@@ -301,6 +308,145 @@ bool OcTreeStampedWithExpiry::applyUpdateRecurs(
   return false;
 }
 
+void OcTreeStampedWithExpiry::clearAABB(const octomap::OcTreeKey& min, const octomap::OcTreeKey& max)
+{
+  clearRegion([this, &min, &max](const octomap::OcTreeKey& key, unsigned int depth) {
+    // a node covers size keys, starting size / 2 below its key
+    const unsigned int size = 1u << (tree_depth - depth);
+    bool inside = true;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      const unsigned int node_min = key[i] - size / 2;
+      if (node_min > max[i] || node_min + size - 1 < min[i])
+      {
+        return RegionOverlap::OUTSIDE;
+      }
+      inside = inside && node_min >= min[i] && node_min + size - 1 <= max[i];
+    }
+    return inside ? RegionOverlap::INSIDE : RegionOverlap::PARTIAL;
+  }, false);
+}
+
+void OcTreeStampedWithExpiry::clearRegion(const RegionTest& test, bool erase)
+{
+  if (root == nullptr)
+  {
+    return;
+  }
+  octomap::OcTreeKey root_key(tree_max_val, tree_max_val, tree_max_val);
+  const RegionOverlap overlap = test(root_key, 0);
+  if (overlap == RegionOverlap::OUTSIDE)
+  {
+    return;
+  }
+  bool remove;
+  if (overlap == RegionOverlap::INSIDE && erase)
+  {
+    valueChangeCallbackWrapper(root_key, 0, true, root->getLogOdds(), isNodeOccupied(root), clamping_thres_min, false);
+    remove = true;
+  }
+  else if (overlap == RegionOverlap::INSIDE && !nodeHasChildren(root))
+  {
+    remove = clearLeaf(root, root_key, 0);
+  }
+  else
+  {
+    if (!nodeHasChildren(root))
+    {
+      expandNode(root);
+    }
+    remove = clearRegionRecurs(root, root_key, 0, test, erase, overlap == RegionOverlap::INSIDE);
+  }
+  if (remove)
+  {
+    deleteNodeRecurs(root);
+    root = nullptr;
+  }
+}
+
+bool OcTreeStampedWithExpiry::clearRegionRecurs(OcTreeStampedWithExpiry::NodeType* node,
+                                                const octomap::OcTreeKey& key,
+                                                unsigned int depth,
+                                                const RegionTest& test,
+                                                bool erase,
+                                                bool inside)
+{
+  const octomap::key_type center_offset_key = octomap::computeCenterOffsetKey(depth, tree_max_val);
+  bool changed = false;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!nodeChildExists(node, i))
+    {
+      continue;
+    }
+    octomap::OcTreeKey child_key;
+    octomap::computeChildKey(i, center_offset_key, key, child_key);
+    // below a node inside the region, everything is inside
+    const RegionOverlap overlap = inside ? RegionOverlap::INSIDE : test(child_key, depth + 1);
+    if (overlap == RegionOverlap::OUTSIDE)
+    {
+      continue;
+    }
+    changed = true;
+    NodeType* child_node = getNodeChild(node, i);
+    bool remove;
+    if (overlap == RegionOverlap::INSIDE && erase)
+    {
+      // Lie and say the node was just created, like updateNode(), so the
+      // deletion is always reported
+      valueChangeCallbackWrapper(child_key, depth + 1, true, child_node->getLogOdds(), isNodeOccupied(child_node),
+                                 clamping_thres_min, false);
+      remove = true;
+    }
+    else if (overlap == RegionOverlap::INSIDE && !nodeHasChildren(child_node))
+    {
+      remove = clearLeaf(child_node, child_key, depth + 1);
+    }
+    else
+    {
+      // Split leafs partly in the region, pruning merges what is left
+      if (!nodeHasChildren(child_node))
+      {
+        expandNode(child_node);
+      }
+      remove = clearRegionRecurs(child_node, child_key, depth + 1, test, erase, overlap == RegionOverlap::INSIDE);
+    }
+    if (remove)
+    {
+      deleteNodeChild(node, i);
+    }
+  }
+
+  if (!nodeHasChildren(node))
+  {
+    return true;
+  }
+  if (changed && !pruneNode(node))
+  {
+    node->updateOccupancyChildren();
+  }
+  return false;
+}
+
+bool OcTreeStampedWithExpiry::clearLeaf(OcTreeStampedWithExpiry::NodeType* node,
+                                        const octomap::OcTreeKey& key,
+                                        unsigned int depth)
+{
+  const float log_odds = node->getLogOdds();
+  if (delete_minimum)
+  {
+    // Lie and say the node was just created, like updateNode(), so the
+    // deletion is always reported
+    valueChangeCallbackWrapper(key, depth, true, log_odds, isNodeOccupied(node), clamping_thres_min, false);
+    return true;
+  }
+  if (log_odds > clamping_thres_min || node->getTimestamp() != getLastUpdateTimeFreeSpace())
+  {
+    updateNodeLogOddsAndTrackChanges(node, clamping_thres_min - log_odds, false, key, depth);
+  }
+  return false;
+}
+
 void OcTreeStampedWithExpiry::calculateBounds(double xy_distance,
                                               double z_height,
                                               double z_depth,
@@ -426,6 +572,675 @@ bool OcTreeStampedWithExpiry::pruneNode(OcTreeStampedWithExpiry::NodeType* node)
   return rv;
 }
 
+void OcTreeStampedWithExpiry::copyParameters(const OcTreeStampedWithExpiry& other)
+{
+  prob_hit_log = other.prob_hit_log;
+  prob_miss_log = other.prob_miss_log;
+  clamping_thres_min = other.clamping_thres_min;
+  clamping_thres_max = other.clamping_thres_max;
+  occ_prob_thres_log = other.occ_prob_thres_log;
+  a_coeff_ = other.a_coeff_;
+  a_coeff_log_odds_ = other.a_coeff_log_odds_;
+  c_coeff_ = other.c_coeff_;
+  quadratic_start_ = other.quadratic_start_;
+  quadratic_start_log_odds_ = other.quadratic_start_log_odds_;
+  c_coeff_free_ = other.c_coeff_free_;
+  free_space_stamp_mask_ = other.free_space_stamp_mask_;
+  last_expire_time = other.last_expire_time;
+  delete_minimum = other.delete_minimum;
+}
+
+// Timestamps of zero mean "not set" (expiry is calculated lazily), keep them
+// apart from offsets
+static const int32_t UNSET_STAMP_DELTA = std::numeric_limits<int32_t>::min();
+
+static int32_t encodeStamp(time_t stamp, time_t base_stamp)
+{
+  if (stamp == 0)
+  {
+    return UNSET_STAMP_DELTA;
+  }
+  const time_t delta = stamp - base_stamp;
+  return static_cast<int32_t>(std::max<time_t>(std::min<time_t>(delta, std::numeric_limits<int32_t>::max()),
+                                               UNSET_STAMP_DELTA + 1));
+}
+
+static time_t decodeStamp(int32_t delta, time_t base_stamp)
+{
+  return delta == UNSET_STAMP_DELTA ? 0 : base_stamp + delta;
+}
+
+std::ostream& OcTreeStampedWithExpiry::writeData(std::ostream& s) const
+{
+  if (root)
+  {
+    const int64_t base_stamp = root->getTimestamp();
+    s.write(reinterpret_cast<const char*>(&base_stamp), sizeof(base_stamp));
+    writeStampedNodesRecurs(s, root, base_stamp);
+  }
+  return s;
+}
+
+std::istream& OcTreeStampedWithExpiry::readData(std::istream& s)
+{
+  if (root)
+  {
+    ROS_ERROR("Trying to read into an existing tree.");
+    return s;
+  }
+  int64_t base_stamp;
+  if (!s.read(reinterpret_cast<char*>(&base_stamp), sizeof(base_stamp)))
+  {
+    return s;
+  }
+  root = new NodeType();
+  if (!readStampedNodesRecurs(s, root, base_stamp))
+  {
+    ROS_ERROR("Error reading the nodes of a %s stream", getTreeType().c_str());
+  }
+  tree_size = calcNumNodes();
+  size_changed = true;
+  return s;
+}
+
+void OcTreeStampedWithExpiry::writeNativeNode(std::ostream& s, const NodeType& node, time_t base_stamp,
+                                              uint8_t children)
+{
+  const float value = node.getLogOdds();
+  const int32_t stamp = encodeStamp(node.getTimestamp(), base_stamp);
+  const int32_t expiry = encodeStamp(node.getExpiry(), base_stamp);
+  s.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  s.write(reinterpret_cast<const char*>(&stamp), sizeof(stamp));
+  s.write(reinterpret_cast<const char*>(&expiry), sizeof(expiry));
+  const char children_char = static_cast<char>(children);
+  s.write(&children_char, sizeof(char));
+}
+
+void OcTreeStampedWithExpiry::writeStampedNodesRecurs(std::ostream& s, const NodeType* node, time_t base_stamp) const
+{
+  std::bitset<8> children;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    children[i] = nodeChildExists(node, i);
+  }
+  writeNativeNode(s, *node, base_stamp, static_cast<uint8_t>(children.to_ulong()));
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (children[i])
+    {
+      writeStampedNodesRecurs(s, getNodeChild(node, i), base_stamp);
+    }
+  }
+}
+
+bool OcTreeStampedWithExpiry::readStampedNodesRecurs(std::istream& s, NodeType* node, time_t base_stamp)
+{
+  float value;
+  int32_t stamp, expiry;
+  char children_char;
+  s.read(reinterpret_cast<char*>(&value), sizeof(value));
+  s.read(reinterpret_cast<char*>(&stamp), sizeof(stamp));
+  s.read(reinterpret_cast<char*>(&expiry), sizeof(expiry));
+  if (!s.read(&children_char, sizeof(char)))
+  {
+    return false;
+  }
+  node->setLogOdds(value);
+  node->setTimestamp(decodeStamp(stamp, base_stamp));
+  node->setExpiry(decodeStamp(expiry, base_stamp));
+
+  std::bitset<8> children(static_cast<unsigned char>(children_char));
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (children[i] && !readStampedNodesRecurs(s, createNodeChild(node, i), base_stamp))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void OcTreeStampedWithExpiry::setNodeAtDepth(const octomap::OcTreeKey& key, unsigned int depth,
+                                             float log_odds, time_t stamp, time_t expiry)
+{
+  bool just_created = false;
+  if (root == NULL)
+  {
+    root = new NodeType();
+    tree_size++;
+    just_created = true;
+  }
+  NodeType* node = root;
+  for (unsigned int d = 0; d < depth; ++d)
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, this->tree_depth - 1 - d);
+    if (!nodeChildExists(node, pos))
+    {
+      if (!just_created && !nodeHasChildren(node))
+      {
+        // A leaf covering the key, keep its value around the new node
+        expandNode(node);
+      }
+      else
+      {
+        createNodeChild(node, pos);
+        just_created = true;
+      }
+    }
+    else
+    {
+      just_created = false;
+    }
+    node = getNodeChild(node, pos);
+  }
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (nodeChildExists(node, i))
+    {
+      deleteNodeChild(node, i);
+    }
+  }
+  node->setLogOdds(log_odds);
+  node->setTimestamp(stamp);
+  node->setExpiry(expiry);
+}
+
+bool OcTreeStampedWithExpiry::writeSubtree(std::ostream& s, const octomap::OcTreeKey& key, unsigned int depth) const
+{
+  const NodeType* node = root;
+  for (unsigned int d = 0; node && d < depth; ++d)
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, this->tree_depth - 1 - d);
+    node = nodeChildExists(node, pos) ? getNodeChild(node, pos) : NULL;
+  }
+  if (!node)
+  {
+    return false;
+  }
+  const int64_t base_stamp = node->getTimestamp();
+  s.write(reinterpret_cast<const char*>(&base_stamp), sizeof(base_stamp));
+  writeStampedNodesRecurs(s, node, base_stamp);
+  return s.good();
+}
+
+size_t OcTreeStampedWithExpiry::countNodesRecurs(const NodeType* node) const
+{
+  size_t count = 1;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (nodeChildExists(node, i))
+    {
+      count += countNodesRecurs(getNodeChild(node, i));
+    }
+  }
+  return count;
+}
+
+size_t OcTreeStampedWithExpiry::deleteSubtree(const octomap::OcTreeKey& key, unsigned int depth)
+{
+  if (root == NULL)
+  {
+    return 0;
+  }
+  // path[d] is the node at depth d
+  std::vector<NodeType*> path(1, root);
+  for (unsigned int d = 0; d < depth; ++d)
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, this->tree_depth - 1 - d);
+    if (!nodeChildExists(path.back(), pos))
+    {
+      return 0;
+    }
+    path.push_back(getNodeChild(path.back(), pos));
+  }
+
+  size_t deleted = countNodesRecurs(path.back());
+  // Delete the subtree, then the ancestors it leaves without children
+  int d = depth;
+  for (; d > 0; --d)
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, this->tree_depth - d);
+    deleteNodeRecurs(path[d]);
+    path[d - 1]->children[pos] = NULL;
+    if (nodeHasChildren(path[d - 1]))
+    {
+      break;
+    }
+    deleted++;
+  }
+  if (d == 0)
+  {
+    // the root went as well
+    deleteNodeRecurs(root);
+    root = NULL;
+  }
+  else
+  {
+    for (--d; d >= 0; --d)
+    {
+      path[d]->updateOccupancyChildren();
+    }
+  }
+  tree_size -= std::min(deleted, tree_size);
+  size_changed = true;
+  return deleted;
+}
+
+size_t OcTreeStampedWithExpiry::mergeSubtreeRecurs(NodeType* node, NodeType* src)
+{
+  size_t added = 0;
+  if (!nodeHasChildren(node))
+  {
+    // a leaf, the stream has at least as much detail
+    node->copyData(*src);
+  }
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (src->children == NULL || src->children[i] == NULL)
+    {
+      continue;
+    }
+    NodeType* src_child = static_cast<NodeType*>(src->children[i]);
+    src->children[i] = NULL;
+    if (nodeChildExists(node, i))
+    {
+      added += mergeSubtreeRecurs(getNodeChild(node, i), src_child);
+    }
+    else
+    {
+      if (node->children == NULL)
+      {
+        allocNodeChildren(node);
+      }
+      node->children[i] = src_child;
+      added += countNodesRecurs(src_child);
+    }
+  }
+  if (nodeHasChildren(node))
+  {
+    node->updateOccupancyChildren();
+  }
+  deleteNodeRecurs(src);
+  return added;
+}
+
+bool OcTreeStampedWithExpiry::readSubtree(std::istream& s, const octomap::OcTreeKey& key, unsigned int depth)
+{
+  int64_t base_stamp;
+  if (!s.read(reinterpret_cast<char*>(&base_stamp), sizeof(base_stamp)))
+  {
+    return false;
+  }
+  // The detached copy is not part of the tree, and must not count in its size
+  const size_t size = tree_size;
+  NodeType* src = new NodeType();
+  const bool ok = readStampedNodesRecurs(s, src, base_stamp);
+  tree_size = size;
+  if (!ok)
+  {
+    deleteNodeRecurs(src);
+    return false;
+  }
+
+  // Find or make the place of the subtree
+  bool created = false;
+  if (root == NULL)
+  {
+    root = new NodeType();
+    tree_size++;
+    created = true;
+  }
+  std::vector<NodeType*> path(1, root);
+  for (unsigned int d = 0; d < depth; ++d)
+  {
+    NodeType* node = path.back();
+    const unsigned int pos = octomap::computeChildIdx(key, this->tree_depth - 1 - d);
+    if (!nodeChildExists(node, pos))
+    {
+      if (!created && !nodeHasChildren(node))
+      {
+        // A leaf covering the key, keep its value around the subtree
+        expandNode(node);
+      }
+      else
+      {
+        NodeType* child = createNodeChild(node, pos);
+        child->copyData(*src);
+        created = true;
+      }
+    }
+    path.push_back(getNodeChild(node, pos));
+  }
+  tree_size += mergeSubtreeRecurs(path.back(), src);
+  for (int d = static_cast<int>(depth) - 1; d >= 0; --d)
+  {
+    path[d]->updateOccupancyChildren();
+  }
+  size_changed = true;
+  return true;
+}
+
+bool OcTreeStampedWithExpiry::readIndexed(const std::string& filename,
+                                          unsigned int num_threads,
+                                          const octomap::point3d* bbx_min /* = nullptr */,
+                                          const octomap::point3d* bbx_max /* = nullptr */)
+{
+  std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!file.is_open())
+  {
+    ROS_ERROR_STREAM("Unable to open " << filename);
+    return false;
+  }
+  IndexedMapHeader header;
+  if (!readIndexedMapHeader(file, &header))
+  {
+    ROS_ERROR_STREAM("Unable to parse the header of " << filename);
+    return false;
+  }
+  // indexed files hold message streams
+  if (header.id != messageTreeType(*this))
+  {
+    ROS_ERROR_STREAM(filename << " holds a tree of type " << header.id << ", expected " << messageTreeType(*this));
+    return false;
+  }
+  std::vector<IndexedSubtreeEntry> entries(header.num_subtrees);
+  for (IndexedSubtreeEntry& entry : entries)
+  {
+    if (!readIndexedSubtreeEntry(file, &entry))
+    {
+      ROS_ERROR_STREAM("Unable to read the subtree table of " << filename);
+      return false;
+    }
+  }
+  std::string top(header.top_size, '\0');
+  if (!file.read(&top[0], top.size()))
+  {
+    ROS_ERROR_STREAM("Unable to read the top of the tree from " << filename);
+    return false;
+  }
+  const std::streamoff data_start = file.tellg();
+
+  clear();
+  setResolution(header.resolution);
+  setTreeDepth(header.tree_depth);
+  if (top.empty())
+  {
+    // empty tree
+    return entries.empty();
+  }
+
+  // The top levels are small, read them in one go
+  root = new NodeType();
+  if (header.binary)
+  {
+    // the root is always an inner node in binary streams
+    allocNodeChildren(root);
+  }
+  std::vector<IndexedSlot> slots;
+  std::istringstream top_stream(top);
+  const octomap::OcTreeKey root_key(tree_max_val, tree_max_val, tree_max_val);
+  bool ok = header.binary
+      ? readIndexedBinaryRecurs(top_stream, root, root_key, 0, header.split_depth, &slots)
+      : readIndexedFullRecurs(top_stream, root, root_key, 0, header.split_depth, &slots);
+  ok = ok && static_cast<size_t>(top_stream.tellg()) == top.size() && slots.size() == entries.size();
+  for (size_t i = 0; ok && i < slots.size(); ++i)
+  {
+    ok = slots[i].key == entries[i].key && slots[i].offset == entries[i].splice_offset;
+  }
+  if (!ok)
+  {
+    ROS_ERROR_STREAM("The subtree table of " << filename << " does not match its data");
+    clear();
+    return false;
+  }
+
+  // Pick the subtrees overlapping the bounding box
+  std::vector<size_t> selected;
+  selected.reserve(slots.size());
+  const double half_size = getNodeSize(header.split_depth) / 2.0;
+  for (size_t i = 0; i < slots.size(); ++i)
+  {
+    if (bbx_min && bbx_max)
+    {
+      const octomap::point3d center = keyToCoord(slots[i].key, header.split_depth);
+      bool overlaps = true;
+      for (unsigned int j = 0; j < 3; ++j)
+      {
+        overlaps = overlaps && center(j) + half_size >= (*bbx_min)(j) && center(j) - half_size <= (*bbx_max)(j);
+      }
+      if (!overlaps)
+      {
+        continue;
+      }
+    }
+    selected.push_back(i);
+  }
+
+  // Decode the subtrees, every thread reading the file on its own
+  std::atomic<size_t> next(0);
+  std::atomic<bool> subtrees_ok(true);
+  auto worker = [&]() {
+    std::ifstream subtree_file(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+    std::string data;
+    for (size_t i = next++; i < selected.size() && subtrees_ok; i = next++)
+    {
+      const IndexedSlot& slot = slots[selected[i]];
+      const IndexedSubtreeEntry& entry = entries[selected[i]];
+      data.resize(entry.data_size);
+      subtree_file.seekg(data_start + static_cast<std::streamoff>(entry.data_offset));
+      if (!subtree_file.read(&data[0], data.size()))
+      {
+        subtrees_ok = false;
+        break;
+      }
+      std::istringstream subtree_stream(data);
+      NodeType* node = createIndexedChild(slot.parent, slot.child);
+      bool node_ok;
+      if (header.binary)
+      {
+        allocNodeChildren(node);
+        node_ok = readIndexedBinaryRecurs(subtree_stream, node, slot.key, header.split_depth,
+                                          header.split_depth, nullptr);
+        node->updateOccupancyChildren();
+      }
+      else
+      {
+        node_ok = readIndexedFullRecurs(subtree_stream, node, slot.key, header.split_depth,
+                                        header.split_depth, nullptr);
+      }
+      if (!node_ok || static_cast<size_t>(subtree_stream.tellg()) != data.size())
+      {
+        subtrees_ok = false;
+      }
+    }
+  };
+  boost::thread_group threads;
+  const size_t num_workers = std::min<size_t>(std::max(num_threads, 1u), selected.size());
+  for (size_t i = 1; i < num_workers; ++i)
+  {
+    threads.create_thread(worker);
+  }
+  worker();
+  threads.join_all();
+  if (!subtrees_ok)
+  {
+    ROS_ERROR_STREAM("Unable to read the subtrees of " << filename);
+    clear();
+    return false;
+  }
+
+  if (finishIndexedRecurs(root, 0, header.split_depth, header.binary))
+  {
+    // nothing in the bounding box
+    deleteNodeRecurs(root);
+    root = NULL;
+  }
+  tree_size = calcNumNodes();
+  size_changed = true;
+  ROS_DEBUG("Read %zu of %zu subtrees from %s", selected.size(), slots.size(), filename.c_str());
+  return true;
+}
+
+OcTreeStampedWithExpiry::NodeType* OcTreeStampedWithExpiry::createIndexedChild(NodeType* node, unsigned int child)
+{
+  if (node->children == NULL)
+  {
+    allocNodeChildren(node);
+  }
+  NodeType* new_node = new NodeType();
+  node->children[child] = new_node;
+  return new_node;
+}
+
+bool OcTreeStampedWithExpiry::readIndexedBinaryRecurs(std::istream& s,
+                                                      NodeType* node,
+                                                      const octomap::OcTreeKey& key,
+                                                      unsigned int depth,
+                                                      unsigned int split_depth,
+                                                      std::vector<IndexedSlot>* slots)
+{
+  char masks[2];
+  if (!s.read(masks, sizeof(masks)))
+  {
+    return false;
+  }
+  octomap::key_type center_offset_key = octomap::computeCenterOffsetKey(depth, this->tree_max_val);
+  NodeType* inner[8] = {NULL};
+  bool slot[8] = {false};
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    // two bits per child: 01 free, 10 occupied, 11 inner node
+    const unsigned int bits = (static_cast<unsigned char>(masks[i / 4]) >> ((i % 4) * 2)) & 3;
+    if (bits == 0)
+    {
+      continue;
+    }
+    if (bits == 3 && slots && depth + 1 >= split_depth)
+    {
+      slot[i] = true;
+      continue;
+    }
+    NodeType* child = createIndexedChild(node, i);
+    if (bits == 1)
+    {
+      child->setLogOdds(clamping_thres_min);
+    }
+    else if (bits == 2)
+    {
+      child->setLogOdds(clamping_thres_max);
+    }
+    else
+    {
+      allocNodeChildren(child);
+      inner[i] = child;
+    }
+  }
+
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    octomap::OcTreeKey child_key;
+    if (slot[i])
+    {
+      octomap::computeChildKey(i, center_offset_key, key, child_key);
+      IndexedSlot new_slot = {node, i, child_key, static_cast<size_t>(s.tellg())};
+      slots->push_back(new_slot);
+    }
+    else if (inner[i])
+    {
+      octomap::computeChildKey(i, center_offset_key, key, child_key);
+      if (!readIndexedBinaryRecurs(s, inner[i], child_key, depth + 1, split_depth, slots))
+      {
+        return false;
+      }
+      // The top levels are updated by finishIndexedRecurs()
+      if (!slots)
+      {
+        inner[i]->updateOccupancyChildren();
+      }
+    }
+  }
+  return true;
+}
+
+bool OcTreeStampedWithExpiry::readIndexedFullRecurs(std::istream& s,
+                                                    NodeType* node,
+                                                    const octomap::OcTreeKey& key,
+                                                    unsigned int depth,
+                                                    unsigned int split_depth,
+                                                    std::vector<IndexedSlot>* slots)
+{
+  node->readData(s);
+  char children_char;
+  if (!s.read(&children_char, sizeof(char)))
+  {
+    return false;
+  }
+  std::bitset<8> children(static_cast<unsigned char>(children_char));
+  if (children.none())
+  {
+    return true;
+  }
+  allocNodeChildren(node);
+
+  octomap::key_type center_offset_key = octomap::computeCenterOffsetKey(depth, this->tree_max_val);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!children[i])
+    {
+      continue;
+    }
+    octomap::OcTreeKey child_key;
+    octomap::computeChildKey(i, center_offset_key, key, child_key);
+    if (slots && depth + 1 >= split_depth)
+    {
+      IndexedSlot new_slot = {node, i, child_key, static_cast<size_t>(s.tellg())};
+      slots->push_back(new_slot);
+    }
+    else if (!readIndexedFullRecurs(s, createIndexedChild(node, i), child_key, depth + 1, split_depth, slots))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool OcTreeStampedWithExpiry::finishIndexedRecurs(NodeType* node,
+                                                  unsigned int depth,
+                                                  unsigned int split_depth,
+                                                  bool binary)
+{
+  if (node->children == NULL)
+  {
+    return false;
+  }
+  bool have_children = false;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    NodeType* child = static_cast<NodeType*>(node->children[i]);
+    if (child == NULL)
+    {
+      continue;
+    }
+    if (depth + 1 < split_depth && finishIndexedRecurs(child, depth + 1, split_depth, binary))
+    {
+      deleteNodeRecurs(child);
+      node->children[i] = NULL;
+      continue;
+    }
+    have_children = true;
+  }
+  if (!have_children)
+  {
+    return true;
+  }
+  if (binary)
+  {
+    node->updateOccupancyChildren();
+  }
+  return false;
+}
+
 OcTreeStampedWithExpiry::StaticMemberInitializer OcTreeStampedWithExpiry::ocTreeStampedWithExpiryMemberInit;
 
 } // end namespace
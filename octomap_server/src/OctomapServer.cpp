@@ -27,7 +27,13 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <iomanip>
 #include <limits>
+#include <unistd.h>
 #include <octomap_server/OctomapServer.h>
 #include <octomap_server/SensorUpdateKeyMap.h>
 
@@ -39,14 +45,46 @@ bool is_equal (double a, double b, double epsilon = 1.0e-7)
     return std::abs(a - b) < epsilon;
 }
 
+// A non-empty relative path that stays below the directory it is relative to
+static bool isSafeRelativePath(const std::string& path)
+{
+  if (path.empty() || path[0] == '/')
+    return false;
+  size_t start = 0;
+  while (start <= path.size()){
+    size_t end = path.find('/', start);
+    if (end == std::string::npos)
+      end = path.size();
+    if (path.compare(start, end - start, "..") == 0)
+      return false;
+    start = end + 1;
+  }
+  return path[path.size() - 1] != '/';
+}
+
 namespace octomap_server{
 
 OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
 : m_nh(),
   m_reconfigureServer(m_config_mutex),
   m_octree(NULL),
-  m_octree_deltaBB_(NULL),
-  m_octree_binary_deltaBB_(NULL),
+  m_changeRingKeepTrackingTime(30.0),
+  m_saveMapCount(0),
+  m_mapVersion(0),
+  m_mapCacheEnabled(true),
+  m_mapCacheAllowStale(false),
+  m_serializationThreads(0),
+  m_mapTransferChunkSize(4 * 1024 * 1024),
+  m_castRaysThreads(0),
+  m_mapLoadThreads(0),
+  m_mapLoadUseBBX(false),
+  m_derivedProductsEnabled(false),
+  m_derivedProducts(NULL),
+  m_tilePrefetchDistance(0.0),
+  m_esdfSliceZ(0.5),
+  m_frontierPublishPeriod(1.0),
+  m_frontierMinClusterSize(5),
+  m_sharedMapOctree(false),
   m_maxRange(-1.0),
   m_worldFrameId("/map"), m_baseFrameId("base_footprint"),
   m_useHeightMap(true),
@@ -65,6 +103,7 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_publish3DMapUpdateLastTime(ros::Time::now()),
   m_newFullSub(false),
   m_newBinarySub(false),
+  m_updateSeq(0),
   m_res(0.05),
   m_treeDepth(24),
   m_maxTreeDepthSetByConfig(false),
@@ -211,18 +250,9 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_octree->setProbMiss(probMiss);
   m_octree->setClampingThresMin(thresMin);
   m_octree->setClampingThresMax(thresMax);
-  enableChangeCallback();
 
-  // make the universe and delta trees "binary" in nature by making the
-  // probability of hit/miss much bigger than the clamping thresholds
   m_universe = new OcTreeT(m_res);
-  m_universe->setTreeDepth(m_treeDepth);
-  m_universe->setProbHit(.99);
-  m_universe->setProbMiss(.01);
-  m_universe->setClampingThresMin(.1);
-  m_universe->setClampingThresMax(.9);
-  m_octree_deltaBB_ = new OcTreeT(*m_universe);
-  m_octree_binary_deltaBB_ = new OcTreeT(*m_universe);
+  configureBoundsTree(m_universe);
   // set the universe tree to occupied everywhere
   m_universe->setNodeValueAtDepth(OcTreeKey(), 0, m_universe->getClampingThresMaxLog());
 
@@ -265,6 +295,210 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   private_nh.param("publish_3d_map_update_period", m_publish3DMapUpdatePeriod, m_publish3DMapUpdatePeriod);
   private_nh.param("publish_2d_period", m_publish2DPeriod, m_publish2DPeriod);
 
+  // serialize the map once per modification for all new subscribers and
+  // service calls, optionally serving the last serialized map while a new
+  // one is serialized in the background
+  private_nh.param("map_cache/enabled", m_mapCacheEnabled, m_mapCacheEnabled);
+  private_nh.param("map_cache/allow_stale", m_mapCacheAllowStale, m_mapCacheAllowStale);
+
+  // number of threads encoding the binary and full maps, 0 for one per core
+  int serializationThreads = m_serializationThreads;
+  private_nh.param("serialization_threads", serializationThreads, serializationThreads);
+  m_serializationThreads = serializationThreads > 0 ? serializationThreads : boost::thread::hardware_concurrency();
+
+  // chunked map transfers (start_map_transfer and get_map_chunk): chunks of
+  // map_transfer/chunk_size bytes unless the client asks otherwise, and up to
+  // map_transfer/max_sessions transfers, dropped after map_transfer/timeout
+  // seconds without a chunk request
+  int mapTransferMaxSessions = 4;
+  double mapTransferTimeout = 60.0;
+  private_nh.param("map_transfer/chunk_size", m_mapTransferChunkSize, m_mapTransferChunkSize);
+  private_nh.param("map_transfer/max_sessions", mapTransferMaxSessions, mapTransferMaxSessions);
+  private_nh.param("map_transfer/timeout", mapTransferTimeout, mapTransferTimeout);
+  m_mapTransfer.setLimits(std::max(mapTransferMaxSessions, 1), mapTransferTimeout);
+
+  // number of threads casting the rays of a cast_rays request, 0 for one per
+  // core
+  int castRaysThreads = m_castRaysThreads;
+  private_nh.param("cast_rays/threads", castRaysThreads, castRaysThreads);
+  m_castRaysThreads = castRaysThreads > 0 ? castRaysThreads : boost::thread::hardware_concurrency();
+
+  // indexed map files (.oti) are decoded by several threads, 0 for one per
+  // core, and can be restricted to a box, e.g. around the initial pose
+  int mapLoadThreads = m_mapLoadThreads;
+  private_nh.param("map_load/threads", mapLoadThreads, mapLoadThreads);
+  m_mapLoadThreads = mapLoadThreads > 0 ? mapLoadThreads : boost::thread::hardware_concurrency();
+  double mapLoadBBXMinX, mapLoadBBXMinY, mapLoadBBXMinZ;
+  double mapLoadBBXMaxX, mapLoadBBXMaxY, mapLoadBBXMaxZ;
+  const double unbounded = std::numeric_limits<double>::max();
+  private_nh.param("map_load/bbx_min_x", mapLoadBBXMinX, -unbounded);
+  private_nh.param("map_load/bbx_min_y", mapLoadBBXMinY, -unbounded);
+  private_nh.param("map_load/bbx_min_z", mapLoadBBXMinZ, -unbounded);
+  private_nh.param("map_load/bbx_max_x", mapLoadBBXMaxX, unbounded);
+  private_nh.param("map_load/bbx_max_y", mapLoadBBXMaxY, unbounded);
+  private_nh.param("map_load/bbx_max_z", mapLoadBBXMaxZ, unbounded);
+  m_mapLoadBBXMin = point3d(mapLoadBBXMinX, mapLoadBBXMinY, mapLoadBBXMinZ);
+  m_mapLoadBBXMax = point3d(mapLoadBBXMaxX, mapLoadBBXMaxY, mapLoadBBXMaxZ);
+  m_mapLoadUseBBX = (mapLoadBBXMinX > -unbounded || mapLoadBBXMinY > -unbounded || mapLoadBBXMinZ > -unbounded
+                     || mapLoadBBXMaxX < unbounded || mapLoadBBXMaxY < unbounded || mapLoadBBXMaxZ < unbounded);
+
+  // save the projected 2D map and the occupied leafs of a loaded map file in
+  // <map>.derived, keyed on the file contents and the parameters they depend
+  // on, and publish them from there instead of traversing the map when the
+  // same file is loaded again
+  private_nh.param("derived_products/cache", m_derivedProductsEnabled, m_derivedProductsEnabled);
+
+  // map areas larger than memory: when the map takes more than
+  // tiles/memory_budget MB, the subtrees at tiles/depth (tiles) used least
+  // recently are written to tiles/directory and dropped from memory. They are
+  // read back when sensor data, a service or a full map request reaches them,
+  // and the tiles within tiles/prefetch_distance of the robot are read ahead
+  // in the background. An empty tiles/directory disables paging. The 2D map
+  // needs incremental_2D_projection then, as projecting the complete map
+  // pages in every tile.
+  std::string tileDirectory;
+  int tileDepth = 10;
+  double tileMemoryBudget = 1024.0;
+  private_nh.param("tiles/directory", tileDirectory, tileDirectory);
+  private_nh.param("tiles/depth", tileDepth, tileDepth);
+  private_nh.param("tiles/memory_budget", tileMemoryBudget, tileMemoryBudget);
+  private_nh.param("tiles/prefetch_distance", m_tilePrefetchDistance, m_tilePrefetchDistance);
+  if (!tileDirectory.empty() && (tileDepth < 1 || tileDepth >= int(m_treeDepth))){
+    ROS_ERROR("tiles/depth must be between 1 and %u, paging disabled", m_treeDepth - 1);
+    tileDirectory.clear();
+  }
+  m_tileCache.configure(tileDirectory, tileDepth, static_cast<size_t>(std::max(tileMemoryBudget, 0.0) * 1024 * 1024));
+  if (m_tileCache.isEnabled())
+    ROS_INFO("Paging tiles of depth %d to %s over %.0f MB", tileDepth, tileDirectory.c_str(), tileMemoryBudget);
+
+  // distance field (ESDF) in a window of esdf/size_xy x esdf/size_xy x
+  // esdf/size_z meters that follows the robot, with distances up to
+  // esdf/max_distance meters, updated with the changes at the map update
+  // rate. Answered by query_distance, and a horizontal slice at height
+  // esdf/slice_z is published on esdf_slice. A size of 0 disables it.
+  double esdfSizeXY = 0.0;
+  double esdfSizeZ = 4.0;
+  double esdfMaxDistance = 2.0;
+  bool esdfUnknownOccupied = false;
+  private_nh.param("esdf/size_xy", esdfSizeXY, esdfSizeXY);
+  private_nh.param("esdf/size_z", esdfSizeZ, esdfSizeZ);
+  private_nh.param("esdf/max_distance", esdfMaxDistance, esdfMaxDistance);
+  private_nh.param("esdf/unknown_as_occupied", esdfUnknownOccupied, esdfUnknownOccupied);
+  private_nh.param("esdf/slice_z", m_esdfSliceZ, m_esdfSliceZ);
+  if (esdfSizeXY > 0.0 && esdfSizeZ > 0.0){
+    m_esdf.configure(static_cast<unsigned>(std::ceil(esdfSizeXY / m_res)),
+                     static_cast<unsigned>(std::ceil(esdfSizeZ / m_res)),
+                     std::max(esdfMaxDistance, 0.0) / m_res, esdfUnknownOccupied, m_treeDepth);
+    ROS_INFO("Distance field of %.1f x %.1f x %.1f m, up to %.2f m", esdfSizeXY, esdfSizeXY, esdfSizeZ,
+             esdfMaxDistance);
+  }
+
+  // track the frontier (free voxels with unknown neighbors) from the changes
+  // at the map update rate. Every frontiers/publish_period seconds, the
+  // frontier voxels are published on frontiers, and the centers of the
+  // groups of at least frontiers/min_cluster_size connected voxels on
+  // frontier_clusters, with their number of voxels as intensity.
+  bool frontiersEnabled = false;
+  private_nh.param("frontiers/enable", frontiersEnabled, frontiersEnabled);
+  private_nh.param("frontiers/publish_period", m_frontierPublishPeriod, m_frontierPublishPeriod);
+  private_nh.param("frontiers/min_cluster_size", m_frontierMinClusterSize, m_frontierMinClusterSize);
+  m_frontiers.configure(frontiersEnabled, m_treeDepth);
+  // paging changes what is unknown without going through the journal
+  m_tileCache.setTrackPaging(m_frontiers.isEnabled());
+
+  // inflate the obstacles of the 2D map by inflation/radius meters for
+  // planners, with the cost decaying exponentially with the distance beyond
+  // inflation/inscribed_radius by inflation/cost_scaling_factor (like
+  // costmap_2d). Only the cells around the changes of each cycle are
+  // inflated again. Like costmap_2d, the whole grid is published on
+  // inflated_map when it is rebuilt and to new subscribers, and the changed
+  // areas on inflated_map_updates. A radius of 0 disables it.
+  double inflationRadius = 0.0;
+  double inscribedRadius = 0.0;
+  double costScalingFactor = 10.0;
+  private_nh.param("inflation/radius", inflationRadius, inflationRadius);
+  private_nh.param("inflation/inscribed_radius", inscribedRadius, inscribedRadius);
+  private_nh.param("inflation/cost_scaling_factor", costScalingFactor, costScalingFactor);
+  m_inflation.configure(inscribedRadius, inflationRadius, costScalingFactor);
+  if (m_inflation.isEnabled())
+    ROS_INFO("Inflating the 2D map by %.2f m (inscribed radius %.2f m)", inflationRadius, inscribedRadius);
+
+  // export the map to the POSIX shared memory segment shared_map/name for
+  // local consumers (see SharedMapReader), so they read it in place instead
+  // of deserializing the map topics. The 2D map is written at the 2D map
+  // rate, with the binary octree when shared_map/octree is set (which pages
+  // in every tile). Maps over shared_map/size MB are not written. An empty
+  // name disables the export.
+  std::string sharedMapName;
+  double sharedMapSize = 64.0;
+  private_nh.param("shared_map/name", sharedMapName, sharedMapName);
+  private_nh.param("shared_map/size", sharedMapSize, sharedMapSize);
+  private_nh.param("shared_map/octree", m_sharedMapOctree, m_sharedMapOctree);
+  if (!sharedMapName.empty()
+      && m_sharedMap.open(sharedMapName, static_cast<size_t>(std::max(sharedMapSize, 0.0) * 1024 * 1024)))
+    ROS_INFO("Exporting the map to shared memory %s", sharedMapName.c_str());
+
+  // keep the changes of the last update cycles, so clients that missed some
+  // updates can ask for the changes since the last update they saw. Keep
+  // tracking changes for a while after the last update subscriber left, so
+  // a client that lost its connection can catch up when it reconnects.
+  int changeRingMaxCycles = 100;
+  int changeRingMaxRecords = 1000000;
+  private_nh.param("change_ring/max_cycles", changeRingMaxCycles, changeRingMaxCycles);
+  private_nh.param("change_ring/max_records", changeRingMaxRecords, changeRingMaxRecords);
+  private_nh.param("change_ring/keep_tracking_time", m_changeRingKeepTrackingTime, m_changeRingKeepTrackingTime);
+  m_changeRing.setLimits(std::max(changeRingMaxCycles, 0), std::max(changeRingMaxRecords, 0));
+  m_changeRing.reset(m_updateSeq);
+
+  // checkpoint the map for crash recovery: a snapshot of the whole map every
+  // checkpoint/snapshot_period seconds, copied checkpoint/snapshot_leafs_per_cycle
+  // leafs per update cycle and written in the background, and a journal of
+  // the nodes changed in every update cycle in between. The map is restored
+  // from the last checkpoint on startup. With checkpoint/restore false, the
+  // checkpoints of the earlier run are removed instead. An empty
+  // checkpoint/directory disables checkpoints.
+  std::string checkpointDirectory;
+  double checkpointSnapshotPeriod = 600.0;
+  int checkpointSnapshotLeafsPerCycle = 200000;
+  bool checkpointRestore = true;
+  private_nh.param("checkpoint/directory", checkpointDirectory, checkpointDirectory);
+  private_nh.param("checkpoint/snapshot_period", checkpointSnapshotPeriod, checkpointSnapshotPeriod);
+  private_nh.param("checkpoint/snapshot_leafs_per_cycle", checkpointSnapshotLeafsPerCycle,
+                   checkpointSnapshotLeafsPerCycle);
+  private_nh.param("checkpoint/restore", checkpointRestore, checkpointRestore);
+  m_checkpointer.setDirectory(checkpointDirectory);
+  m_checkpointer.setSnapshotPeriod(checkpointSnapshotPeriod);
+  m_checkpointer.setSnapshotLeafsPerCycle(std::max(checkpointSnapshotLeafsPerCycle, 0));
+  if (m_checkpointer.isEnabled()){
+    if (checkpointRestore)
+      restoreCheckpoint();
+    else
+      m_checkpointer.discard();
+  }
+  // Tiles paged out by an earlier run are in its checkpoint if it had one,
+  // the files are only removed once it is restored
+  if (m_tileCache.isEnabled())
+    m_tileCache.removeTileFiles();
+
+  // the save_map service writes maps in save_map/directory, to paths relative
+  // to it that may not leave it. An empty directory disables the service.
+  private_nh.param("save_map/directory", m_saveMapDirectory, m_saveMapDirectory);
+  while (m_saveMapDirectory.size() > 1 && m_saveMapDirectory[m_saveMapDirectory.size() - 1] == '/')
+    m_saveMapDirectory.erase(m_saveMapDirectory.size() - 1);
+
+  // publish maps, markers and point clouds at a level of detail that drops
+  // with the distance to the robot: nodes within lod/distances[i] meters of
+  // the base frame are published down to depth lod/depths[i]
+  std::vector<double> lodDistances;
+  std::vector<int> lodDepths;
+  private_nh.param("lod/distances", lodDistances, lodDistances);
+  private_nh.param("lod/depths", lodDepths, lodDepths);
+  if (!m_lod.configure(lodDistances, lodDepths))
+    ROS_ERROR("Invalid level of detail bands (lod/distances must be increasing, lod/depths must not increase and "
+              "match lod/distances), LOD disabled");
+  else if (m_lod.isEnabled())
+    ROS_INFO("Publishing with %zu level of detail bands", lodDistances.size());
+
   private_nh.param("latch", m_latchedTopics, m_latchedTopics);
   if (m_latchedTopics){
     ROS_INFO("Publishing latched (single publish will take longer, all topics are prepared)");
@@ -298,6 +532,11 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
   m_pointCloudPub = m_nh.advertise<sensor_msgs::PointCloud2>("octomap_point_cloud_centers", 1, m_latchedTopics);
   m_mapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("projected_map", 5, m_latchedTopics);
   m_fmarkerPub = m_nh.advertise<visualization_msgs::MarkerArray>("free_cells_vis_array", 1, m_latchedTopics);
+  m_esdfSlicePub = m_nh.advertise<sensor_msgs::PointCloud2>("esdf_slice", 1, m_latchedTopics);
+  m_frontierPub = m_nh.advertise<sensor_msgs::PointCloud2>("frontiers", 1, m_latchedTopics);
+  m_frontierClusterPub = m_nh.advertise<sensor_msgs::PointCloud2>("frontier_clusters", 1, m_latchedTopics);
+  m_inflatedMapPub = m_nh.advertise<nav_msgs::OccupancyGrid>("inflated_map", 5, boost::bind(&OctomapServer::onNewInflatedMapSubscription, this, _1));
+  m_inflatedMapUpdatePub = m_nh.advertise<map_msgs::OccupancyGridUpdate>("inflated_map_updates", 10);
 
   // Already segmented topics
   if (segmented_topics.getType() == XmlRpc::XmlRpcValue::TypeArray) {
@@ -363,13 +602,25 @@ OctomapServer::OctomapServer(ros::NodeHandle private_nh_)
 
   m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServer::octomapBinarySrv, this);
   m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServer::octomapFullSrv, this);
+  m_octomapStampedService = m_nh.advertiseService("octomap_stamped", &OctomapServer::octomapStampedSrv, this);
+  m_octomapRegionService = m_nh.advertiseService("octomap_region", &OctomapServer::octomapRegionSrv, this);
+  m_startMapTransferService = m_nh.advertiseService("start_map_transfer", &OctomapServer::startMapTransferSrv, this);
+  m_getMapChunkService = m_nh.advertiseService("get_map_chunk", &OctomapServer::getMapChunkSrv, this);
+  m_saveMapService = m_nh.advertiseService("save_map", &OctomapServer::saveMapSrv, this);
   m_clearBBXService = private_nh.advertiseService("clear_bbx", &OctomapServer::clearBBXSrv, this);
   m_eraseBBXService = private_nh.advertiseService("erase_bbx", &OctomapServer::eraseBBXSrv, this);
+  m_clearRegionsService = private_nh.advertiseService("clear_regions", &OctomapServer::clearRegionsSrv, this);
   m_resetService = private_nh.advertiseService("reset", &OctomapServer::resetSrv, this);
+  m_octomapUpdateService = m_nh.advertiseService("octomap_updates_since", &OctomapServer::octomapUpdateSrv, this);
+  m_queryOccupancyService = m_nh.advertiseService("query_occupancy", &OctomapServer::queryOccupancySrv, this);
+  m_castRaysService = m_nh.advertiseService("cast_rays", &OctomapServer::castRaysSrv, this);
+  m_queryDistanceService = m_nh.advertiseService("query_distance", &OctomapServer::queryDistanceSrv, this);
 
   dynamic_reconfigure::Server<OctomapServerConfig>::CallbackType f;
   f = boost::bind(&OctomapServer::reconfigureCallback, this, _1, _2);
   m_reconfigureServer.setCallback(f);
+
+  updateChangeTracking();
 }
 
 OctomapServer::~OctomapServer(){
@@ -379,23 +630,59 @@ OctomapServer::~OctomapServer(){
   m_tfPointCloudSubs.clear();
   m_pointCloudSubs.clear();
   m_callbackCounts.clear();
+  // Background map serialization reads the tree
+  m_mapCache.wait();
 
   delete m_universe;
   m_universe = NULL;
 
   delete m_octree;
   m_octree = NULL;
+}
 
-  delete m_octree_deltaBB_;
-  m_octree_deltaBB_ = NULL;
+bool OctomapServer::restoreCheckpoint(){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  OcTreeT* octree = m_checkpointer.restore();
+  if (!octree)
+    return false;
+  if (octree->getResolution() != m_res){
+    ROS_ERROR("Checkpoint resolution %f does not match the configured resolution %f, not restoring it",
+              octree->getResolution(), m_res);
+    delete octree;
+    return false;
+  }
+  // Keep the configured sensor model and expiry, like openFile()
+  octree->copyParameters(*m_octree);
+  m_tileCache.clear();
+  m_esdf.reset();
+  m_frontiers.reset();
+  delete m_octree;
+  m_octree = octree;
+  m_octree->setTreeDepth(m_treeDepth);
+  if (m_updateJournal.isEnabled())
+    enableChangeCallback();
+
+  bumpMapVersion();
+  invalidateChangeHistory();
+  return true;
 }
 
 bool OctomapServer::openFile(const std::string& filename){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   if (filename.length() <= 3)
     return false;
 
   std::string suffix = filename.substr(filename.length()-3, 3);
-  if (suffix== ".bt"){
+  if (isIndexedMapFile(filename)){
+    ros::WallTime startTime = ros::WallTime::now();
+    if (!m_octree->readIndexed(filename, m_mapLoadThreads,
+                               m_mapLoadUseBBX ? &m_mapLoadBBXMin : NULL,
+                               m_mapLoadUseBBX ? &m_mapLoadBBXMax : NULL)){
+      return false;
+    }
+    ROS_INFO("Read indexed map with %u threads in %f sec", m_mapLoadThreads,
+             (ros::WallTime::now() - startTime).toSec());
+  } else if (suffix== ".bt"){
     if (!m_octree->readBinary(filename)){
       return false;
     }
@@ -404,22 +691,33 @@ bool OctomapServer::openFile(const std::string& filename){
     if (!tree){
       return false;
     }
-    if (m_octree){
-      delete m_octree;
-      m_octree = NULL;
-    }
-    m_octree = dynamic_cast<OcTreeT*>(tree);
-    if (!m_octree){
-      ROS_ERROR("Could not read OcTree in file, currently there are no other types supported in .ot");
+    OcTreeT* octree = dynamic_cast<OcTreeT*>(tree);
+    if (!octree){
+      ROS_ERROR("Could not read %s in file, currently there are no other types supported in .ot",
+                m_octree->getTreeType().c_str());
+      delete tree;
       return false;
     }
+    // Keep the configured sensor model and expiry, the timestamps and expiry
+    // of the nodes come from the file
+    octree->copyParameters(*m_octree);
+    delete m_octree;
+    m_octree = octree;
     m_octree->setTreeDepth(m_treeDepth);
+    if (m_updateJournal.isEnabled())
+      enableChangeCallback();
 
   } else{
     return false;
   }
 
   ROS_INFO("Octomap file %s loaded (%zu nodes).", filename.c_str(),m_octree->size());
+  // The tiles paged out belong to the map that was replaced
+  m_tileCache.clear();
+  m_esdf.reset();
+  m_frontiers.reset();
+  bumpMapVersion();
+  invalidateChangeHistory();
 
   m_treeDepth = m_octree->getTreeDepth();
   if (!m_maxTreeDepthSetByConfig)
@@ -443,13 +741,83 @@ bool OctomapServer::openFile(const std::string& filename){
   m_updateCells.setDepth(m_treeDepth);
   resetUpdateBounds();
 
-  publishAll();
+  uint64_t derivedKey = 0;
+  const bool useDerived = m_derivedProductsEnabled && derivedProductsKey(filename, &derivedKey);
+  if (!useDerived || !publishDerivedProducts(filename, derivedKey)){
+    // Collect the derived products in the traversal, to save them
+    DerivedProducts products;
+    if (useDerived)
+      m_derivedProducts = &products;
+    publishAll();
+    m_derivedProducts = NULL;
+
+    if (useDerived && !m_gridmap.data.empty()){
+      products.gridmap = m_gridmap;
+      const std::string derivedFilename = derivedProductsFilename(filename);
+      if (writeDerivedProducts(derivedFilename, derivedKey, products))
+        ROS_INFO("Saved derived products of the map to %s", derivedFilename.c_str());
+      else
+        ROS_WARN("Could not save derived products of the map to %s", derivedFilename.c_str());
+    }
+  }
 
   return true;
 
 }
 
+bool OctomapServer::derivedProductsKey(const std::string& filename, uint64_t* key) const{
+  uint64_t hash;
+  if (!hashFileStat(filename, &hash))
+    return false;
+  // The parameters the traversal depends on
+  std::ostringstream params;
+  params << m_worldFrameId << " " << m_maxTreeDepth << " " << m_occupancyMinZ << " " << m_occupancyMaxZ
+         << " " << m_minSizeX << " " << m_minSizeY << " " << m_filterSpeckles;
+  // and the part of the file that was loaded
+  params << std::setprecision(9) << " " << m_mapLoadUseBBX;
+  if (m_mapLoadUseBBX)
+    params << " " << m_mapLoadBBXMin << " " << m_mapLoadBBXMax;
+  const std::string paramString = params.str();
+  *key = fnv1a64(paramString.data(), paramString.size(), hash);
+  return true;
+}
+
+bool OctomapServer::publishDerivedProducts(const std::string& filename, uint64_t key){
+  ros::WallTime startTime = ros::WallTime::now();
+  DerivedProducts products;
+  if (!readDerivedProducts(derivedProductsFilename(filename), key, &products))
+    return false;
+
+  const ros::Time rostime = ros::Time::now();
+  m_gridmap = products.gridmap;
+  m_gridmap.header.stamp = rostime;
+  m_mapPub.publish(m_gridmap);
+  if (m_inflation.isEnabled())
+    publishInflatedMap(rostime);
+
+  // With level of detail, the cloud depends on where the robot is
+  if (!m_lod.isEnabled()){
+    pcl::PointCloud<PCLPoint> pclCloud;
+    pclCloud.reserve(products.occupied.size());
+    for (size_t i = 0; i < products.occupied.size(); ++i){
+      const DerivedProducts::OccupiedLeaf& leaf = products.occupied[i];
+      pclCloud.push_back(PCLPoint(leaf.x, leaf.y, leaf.z));
+    }
+    sensor_msgs::PointCloud2 cloud;
+    pcl::toROSMsg (pclCloud, cloud);
+    cloud.header.frame_id = m_worldFrameId;
+    cloud.header.stamp = rostime;
+    m_pointCloudPub.publish(cloud);
+  }
+
+  ROS_INFO("Published derived products of the map (%zu occupied leafs) in %f sec", products.occupied.size(),
+           (ros::WallTime::now() - startTime).toSec());
+  return true;
+}
+
 void OctomapServer::insertCloudCallback(const sensor_msgs::PointCloud2::ConstPtr& cloud){
+  // changes the tree, the map cache worker may be reading it
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   ros::WallTime startTime = ros::WallTime::now();
 
 
@@ -555,6 +923,7 @@ void OctomapServer::insertSegmentedCloudCallback(
     const std::string& sensor_origin_frame_id,
     unsigned int callback_id)
 {
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   sensor_msgs::PointCloud2::ConstPtr ground_cloud;
   sensor_msgs::PointCloud2::ConstPtr nonground_cloud;
   sensor_msgs::PointCloud2::ConstPtr nonclearing_nonground_cloud;
@@ -598,6 +967,7 @@ void OctomapServer::insertSegmentedCloudCallback(
     const std::string& sensor_origin_frame_id,
     unsigned int callback_id)
 {
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   if (m_callbackCounts[callback_id] < m_callbackSkipCount)
   {
     // skip the callback until we are at the skip count
@@ -812,6 +1182,13 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
     handleRayPoint(&m_updateCells, sensorOrigin, point, false, true, true);
   }
 
+  // The update must find the tiles it reaches in the tree
+  if (m_tileCache.isEnabled())
+  {
+    m_tileCache.load(m_octree, m_updateBBXMin, m_updateBBXMax);
+    m_tileCache.touch(*m_octree, m_updateBBXMin, m_updateBBXMax);
+  }
+
   if (!m_deferUpdateToPublish)
   {
     applyUpdate();
@@ -848,6 +1225,7 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
     if (now >= m_compressLastTime + ros::Duration(m_compressPeriod)) {
       m_compressLastTime = now;
       m_octree->prune();
+      bumpMapVersion();
       pruned = true;
     }
   }
@@ -858,6 +1236,7 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
     if (now >= m_expireLastTime + ros::Duration(m_expirePeriod)) {
       m_expireLastTime = now;
       m_octree->expireNodes(boost::bind(&OctomapServer::touchKeyAtDepth, this, _1, _2));
+      bumpMapVersion();
     }
   }
 
@@ -883,11 +1262,25 @@ void OctomapServer::insertScan(const tf::Point& sensorOriginTf, const PCLPointCl
       octomap::point3d base_position(origin.x(), origin.y(), origin.z());
       m_octree->outOfBounds(m_base2DDistanceLimit, m_baseHeightLimit, m_baseDepthLimit, base_position,
           boost::bind(&OctomapServer::touchKeyAtDepth, this, _3, _4));
+      if (m_tileCache.numEvicted() > 0)
+      {
+        octomap::OcTreeKey minKey, maxKey;
+        m_octree->calculateBounds(m_base2DDistanceLimit, m_baseHeightLimit, m_baseDepthLimit, base_position,
+                                  &minKey, &maxKey);
+        // Unlike the nodes in memory, dropping the tiles on disk is not
+        // journaled by the tree
+        std::vector<octomap::OcTreeKey> discarded;
+        m_tileCache.discardOutside(*m_octree, minKey, maxKey, &discarded);
+        for (const octomap::OcTreeKey& tile : discarded)
+          touchKeyAtDepth(tile, m_tileCache.getTileDepth());
+      }
+      bumpMapVersion();
     }
   }
 
 
   publishAll(ros::Time::now());
+  pageTiles();
 #ifdef COLOR_OCTOMAP_SERVER
   if (colors)
   {
@@ -967,6 +1360,7 @@ void OctomapServer::applyUpdate()
   m_updateCells.updateLayers(*m_octree);
   // have the tree apply the the (layered) accumulated update
   m_octree->applyUpdate(m_updateCells);
+  bumpMapVersion();
   // reset the bounds now
   resetUpdateBounds();
   // clear the voxel filter
@@ -994,6 +1388,45 @@ void OctomapServer::resetUpdateBounds()
   }
 }
 
+void OctomapServer::pageTiles()
+{
+  if (!m_tileCache.isEnabled())
+    return;
+  m_tileCache.finishPrefetch(m_octree);
+  if (m_tilePrefetchDistance > 0.0 && m_baseToWorldValid && m_tileCache.numEvicted() > 0)
+  {
+    tf::Vector3 origin = m_baseToWorldTf.getOrigin();
+    octomap::point3d base_position(origin.x(), origin.y(), origin.z());
+    octomap::OcTreeKey minKey, maxKey;
+    m_octree->calculateBounds(m_tilePrefetchDistance, m_tilePrefetchDistance, m_tilePrefetchDistance, base_position,
+                              &minKey, &maxKey);
+    m_tileCache.touch(*m_octree, minKey, maxKey);
+    m_tileCache.prefetch(*m_octree, minKey, maxKey);
+  }
+  m_tileCache.evict(m_octree);
+}
+
+void OctomapServer::loadTiles(const point3d& min, const point3d& max)
+{
+  if (m_tileCache.numEvicted() == 0)
+    return;
+  OcTreeKey minKey, maxKey;
+  if (boxToKeys(min, max, &minKey, &maxKey))
+    m_tileCache.load(m_octree, minKey, maxKey);
+}
+
+bool OctomapServer::boxToKeys(const point3d& min, const point3d& max, OcTreeKey* minKey, OcTreeKey* maxKey) const
+{
+  const double lower = m_octree->keyToCoord(0);
+  const double upper = m_octree->keyToCoord(std::numeric_limits<octomap::key_type>::max());
+  point3d clampedMin, clampedMax;
+  for (unsigned i = 0; i < 3; ++i){
+    clampedMin(i) = std::min(std::max(double(min(i)), lower), upper);
+    clampedMax(i) = std::min(std::max(double(max(i)), lower), upper);
+  }
+  return m_octree->coordToKeyChecked(clampedMin, *minKey) && m_octree->coordToKeyChecked(clampedMax, *maxKey);
+}
+
 void OctomapServer::publishAll(const ros::Time& rostime){
 
   // Figure out which category to publish based on rate (if enabled)
@@ -1038,10 +1471,12 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   bool publishMarkerArray = (m_latchedTopics || m_markerPub.getNumSubscribers() > 0);
   bool publishPointCloud = (m_latchedTopics || m_pointCloudPub.getNumSubscribers() > 0);
   bool publishBinaryMap = (m_latchedTopics || m_binaryMapPub.getNumSubscribers() > 0);
-  bool publishBinaryMapUpdate = (m_latchedTopics || m_binaryMapUpdatePub.getNumSubscribers() > 0);
+  // The update topics are never latched, only publish updates to subscribers
+  bool publishBinaryMapUpdate = (m_binaryMapUpdatePub.getNumSubscribers() > 0);
   bool publishFullMap = (m_latchedTopics || m_fullMapPub.getNumSubscribers() > 0);
-  bool publishFullMapUpdate = (m_latchedTopics || m_fullMapUpdatePub.getNumSubscribers() > 0);
-  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0);
+  bool publishFullMapUpdate = (m_fullMapUpdatePub.getNumSubscribers() > 0);
+  m_publish2DMap = (m_latchedTopics || m_mapPub.getNumSubscribers() > 0 || m_sharedMap.isOpen()
+                    || m_inflation.isEnabled());
 
   // Update above based on publish period booleans set above.
   if (!publish_3d)
@@ -1061,15 +1496,59 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   {
     m_publish2DMap = false;
   }
+  // Derived products are being collected to be saved, build the 2D map
+  if (m_derivedProducts)
+  {
+    m_publish2DMap = true;
+  }
 
-  if (publishFullMapUpdate)
+  if (publish_updates)
   {
-    publishFullOctoMapUpdate(rostime);
+    // Deduplicate this cycle's changes, publish them, and start a new cycle
+    m_updateJournal.compact();
+
+    if (m_esdf.isEnabled())
+    {
+      updateEsdf(rostime);
+    }
+
+    if (m_frontiers.isEnabled())
+    {
+      updateFrontiers(rostime);
+    }
+
+    if (m_updateJournal.isEnabled())
+    {
+      if (publishFullMapUpdate)
+      {
+        publishFullOctoMapUpdate(rostime);
+      }
+
+      if (publishBinaryMapUpdate)
+      {
+        publishBinaryOctoMapUpdate(rostime);
+      }
+
+      m_changeRing.push(m_updateSeq, m_updateJournal.records());
+      m_updateSeq++;
+    }
+
+    // Journal the changed nodes, and snapshot the map when it is due
+    m_checkpointer.checkpoint(*m_octree, m_updateJournal.records(), rostime, &m_tileCache);
+
+    m_updateJournal.clear();
+    // Stop (or start) tracking changes as subscribers come and go
+    updateChangeTracking();
   }
 
-  if (publishBinaryMapUpdate)
+  // With level of detail, the binary and full maps follow the robot, so
+  // they are published every cycle instead of only to new subscribers.
+  if ((publishBinaryMap || publishFullMap) && updateLodOrigin())
   {
-    publishBinaryOctoMapUpdate(rostime);
+    if (publishBinaryMap)
+      publishLodMap(true, rostime, m_binaryMapPub);
+    if (publishFullMap)
+      publishLodMap(false, rostime, m_fullMapPub);
   }
 
   // XXX need to publish full/binary non-update maps
@@ -1111,171 +1590,84 @@ void OctomapServer::publishAll(const ros::Time& rostime){
   // call pre-traversal hook:
   handlePreNodeTraversal(rostime);
 
+  // With level of detail, markers and the point cloud come from their own
+  // traversal, which only descends as deep as the distance to the robot
+  // asks for. The full depth traversal still runs for the 2D map and for
+  // subclasses using the node hooks.
+  const bool useLod = updateLodOrigin() && (publishMarkerArray || publishFreeMarkerArray || publishPointCloud);
+  visualization_msgs::MarkerArray* occupiedVisOut = (publishMarkerArray && !useLod) ? &occupiedNodesVis : NULL;
+  visualization_msgs::MarkerArray* freeVisOut = (publishFreeMarkerArray && !useLod) ? &freeNodesVis : NULL;
+  pcl::PointCloud<PCLPoint>* cloudOut = (publishPointCloud && !useLod) ? &pclCloud : NULL;
+
   // now, traverse all leafs in the tree:
-  for (OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
-      end = m_octree->end(); it != end; ++it)
+  if (!useLod || needsNodeTraversal())
   {
-    bool inUpdateBBX = isInUpdateBBX(it);
-
-    // call general hook:
-    handleNode(it);
-    if (inUpdateBBX)
-      handleNodeInBBX(it);
-
-    if (m_octree->isNodeOccupied(*it)){
-      double z = it.getZ();
-      if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
-      {
-        double size = it.getSize();
-        double x = it.getX();
-        double y = it.getY();
-#ifdef COLOR_OCTOMAP_SERVER
-        int r = it->getColor().r;
-        int g = it->getColor().g;
-        int b = it->getColor().b;
-#endif
-
-        // Ignore speckles in the map:
-        if (m_filterSpeckles && (it.getDepth() == m_treeDepth +1) && isSpeckleNode(it.getKey())){
-          ROS_DEBUG("Ignoring single speckle at (%f,%f,%f)", x, y, z);
-          continue;
-        } // else: current octree node is no speckle, send it out
-
-        handleOccupiedNode(it);
-        if (inUpdateBBX)
-          handleOccupiedNodeInBBX(it);
-
-
-        //create marker:
-        if (publishMarkerArray){
-          unsigned idx = it.getDepth();
-          assert(idx < occupiedNodesVis.markers.size());
+    for (OcTreeT::iterator it = m_octree->begin(m_maxTreeDepth),
+        end = m_octree->end(); it != end; ++it)
+    {
+      bool inUpdateBBX = isInUpdateBBX(it);
 
-          geometry_msgs::Point cubeCenter;
-          cubeCenter.x = x;
-          cubeCenter.y = y;
-          cubeCenter.z = z;
+      // call general hook:
+      handleNode(it);
+      if (inUpdateBBX)
+        handleNodeInBBX(it);
 
-          occupiedNodesVis.markers[idx].points.push_back(cubeCenter);
-          if (m_useHeightMap){
-            double minX, minY, minZ, maxX, maxY, maxZ;
-            m_octree->getMetricMin(minX, minY, minZ);
-            m_octree->getMetricMax(maxX, maxY, maxZ);
+      if (m_octree->isNodeOccupied(*it)){
+        double z = it.getZ();
+        if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
+        {
+          double x = it.getX();
+          double y = it.getY();
 
-            double h = (1.0 - std::min(std::max((cubeCenter.z-minZ)/ (maxZ - minZ), 0.0), 1.0)) *m_colorFactor;
-            occupiedNodesVis.markers[idx].colors.push_back(heightMapColor(h));
-          }
+          // Ignore speckles in the map:
+          if (m_filterSpeckles && (it.getDepth() == m_treeDepth +1) && isSpeckleNode(it.getKey())){
+            ROS_DEBUG("Ignoring single speckle at (%f,%f,%f)", x, y, z);
+            continue;
+          } // else: current octree node is no speckle, send it out
 
-          if (m_useTimedMap){
-            time_t expiry = it->getExpiry();
-            time_t max_expiry_delta = m_octree->getMaxExpiryDelta();
-            time_t now = m_octree->getLastUpdateTime();
-            std_msgs::ColorRGBA color;
-            color.a = 1.0;
-            color.r = 0.0;
-            color.g = 0.0;
-            color.b = 0.0;
-            if ( expiry < now ) {
-              // doesn't make sense, so highlight pale yellow.
-              color.r = 1.0;
-              color.g = 1.0;
-              color.b = 0.7;
-            } else {
-              double d;
-              double d_max = static_cast<double>(max_expiry_delta);
-              d = (expiry - now);
-              if(d <= 60.0) {
-                d = sqrt(d) / sqrt(60.0);
-                color.r = 1.0;
-                color.g = d;
-              } else if(d <= 3600.0) {
-                d = sqrt(d-60.0) / sqrt(3600.0-60.0);
-                color.r = 1.0 - d;
-                color.g = 1.0;
-              } else if(d <= 4.0 * 3600.0) {
-                d = sqrt(d-3600.0) / sqrt(3.0 * 3600.0);
-                color.g = 1.0;
-                color.b = d;
-              } else if(d <= 16.0 * 3600.0) {
-                d = sqrt(d-4.0*3600.0) / sqrt(12.0 * 3600.0);
-                color.g = 1.0 - d;
-                color.b = 1.0;
-              } else if(d <= d_max) {
-                double d_max = static_cast<double>(max_expiry_delta);
-                d -= 16.0*3600.0;
-                d_max -= 16.0*3600.0;
-                color.b = 1.0;
-                color.r = d / d_max;
-              } else {
-                // doesn't make sense, highlight lilac
-                color.r = 1.0;
-                color.g = 0.7;
-                color.b = 1.0;
-              }
-
-//              d /= static_cast<double>(max_expiry_delta);
-//              d = sqrt(d);
-//              d *= m_colorFactor;
-            }
-            // use the same color maping as the height map using our
-            // normalized and linearized expiration scale
-//            occupiedNodesVis.markers[idx].colors.push_back(heightMapColor(d));
-            occupiedNodesVis.markers[idx].colors.push_back(color);
-          }
+          handleOccupiedNode(it);
+          if (inUpdateBBX)
+            handleOccupiedNodeInBBX(it);
 
-#ifdef COLOR_OCTOMAP_SERVER
-          if (m_useColoredMap) {
-            std_msgs::ColorRGBA _color; _color.r = (r / 255.); _color.g = (g / 255.); _color.b = (b / 255.); _color.a = 1.0; // TODO/EVALUATE: potentially use occupancy as measure for alpha channel?
-            occupiedNodesVis.markers[idx].colors.push_back(_color);
+          if (m_derivedProducts){
+            DerivedProducts::OccupiedLeaf leaf = {float(x), float(y), float(z), it.getDepth()};
+            m_derivedProducts->occupied.push_back(leaf);
           }
-#endif
-        }
 
-        // insert into pointcloud:
-        if (publishPointCloud) {
-#ifdef COLOR_OCTOMAP_SERVER
-          PCLPoint _point = PCLPoint();
-          _point.x = x; _point.y = y; _point.z = z;
-          _point.r = r; _point.g = g; _point.b = b;
-          pclCloud.push_back(_point);
-#else
-          pclCloud.push_back(PCLPoint(x, y, z));
-#endif
+          addOccupiedNodeVis(*it, x, y, z, it.getDepth(), occupiedVisOut, cloudOut);
         }
-
-      }
-    } else{ // node not occupied => mark as free in 2D map if unknown so far
-      double z = it.getZ();
-      if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
-      {
-        handleFreeNode(it);
-        if (inUpdateBBX)
-          handleFreeNodeInBBX(it);
-
-        if (m_publishFreeSpace){
-          double x = it.getX();
-          double y = it.getY();
-
-          //create marker for free space:
-          if (publishFreeMarkerArray){
-            unsigned idx = it.getDepth();
-            assert(idx < freeNodesVis.markers.size());
-
-            geometry_msgs::Point cubeCenter;
-            cubeCenter.x = x;
-            cubeCenter.y = y;
-            cubeCenter.z = z;
-
-            freeNodesVis.markers[idx].points.push_back(cubeCenter);
+      } else{ // node not occupied => mark as free in 2D map if unknown so far
+        double z = it.getZ();
+        if (z > m_occupancyMinZ && z < m_occupancyMaxZ)
+        {
+          handleFreeNode(it);
+          if (inUpdateBBX)
+            handleFreeNodeInBBX(it);
+
+          if (m_publishFreeSpace){
+            addFreeNodeVis(it.getX(), it.getY(), z, it.getDepth(), freeVisOut);
           }
         }
-
       }
     }
   }
 
+  if (useLod && m_octree->getRoot())
+  {
+    const octomap::key_type center = m_octree->coordToKey(0.0);
+    addLodNodesVisRecurs(m_octree->getRoot(), octomap::OcTreeKey(center, center, center), 0,
+                         publishMarkerArray ? &occupiedNodesVis : NULL,
+                         publishFreeMarkerArray ? &freeNodesVis : NULL,
+                         publishPointCloud ? &pclCloud : NULL);
+  }
+
   // call post-traversal hook:
   handlePostNodeTraversal(rostime);
+  // page out again the tiles a complete 2D projection paged in
+  m_tileCache.evict(m_octree, false);
+
+  if (m_publish2DMap && m_sharedMap.isOpen())
+    writeSharedMap(rostime);
 
   // finish MarkerArray:
   if (publishMarkerArray){
@@ -1343,15 +1735,217 @@ void OctomapServer::publishAll(const ros::Time& rostime){
 }
 
 
+void OctomapServer::addOccupiedNodeVis(const OcTreeT::NodeType& node, double x, double y, double z, unsigned int depth,
+                                       visualization_msgs::MarkerArray* occupiedNodesVis,
+                                       pcl::PointCloud<PCLPoint>* pclCloud) const
+{
+#ifdef COLOR_OCTOMAP_SERVER
+  int r = node.getColor().r;
+  int g = node.getColor().g;
+  int b = node.getColor().b;
+#endif
+
+  //create marker:
+  if (occupiedNodesVis){
+    unsigned idx = depth;
+    assert(idx < occupiedNodesVis->markers.size());
+
+    geometry_msgs::Point cubeCenter;
+    cubeCenter.x = x;
+    cubeCenter.y = y;
+    cubeCenter.z = z;
+
+    occupiedNodesVis->markers[idx].points.push_back(cubeCenter);
+    if (m_useHeightMap){
+      double minX, minY, minZ, maxX, maxY, maxZ;
+      m_octree->getMetricMin(minX, minY, minZ);
+      m_octree->getMetricMax(maxX, maxY, maxZ);
+
+      double h = (1.0 - std::min(std::max((cubeCenter.z-minZ)/ (maxZ - minZ), 0.0), 1.0)) *m_colorFactor;
+      occupiedNodesVis->markers[idx].colors.push_back(heightMapColor(h));
+    }
+
+    if (m_useTimedMap){
+      time_t expiry = node.getExpiry();
+      time_t max_expiry_delta = m_octree->getMaxExpiryDelta();
+      time_t now = m_octree->getLastUpdateTime();
+      std_msgs::ColorRGBA color;
+      color.a = 1.0;
+      color.r = 0.0;
+      color.g = 0.0;
+      color.b = 0.0;
+      if ( expiry < now ) {
+        // doesn't make sense, so highlight pale yellow.
+        color.r = 1.0;
+        color.g = 1.0;
+        color.b = 0.7;
+      } else {
+        double d;
+        double d_max = static_cast<double>(max_expiry_delta);
+        d = (expiry - now);
+        if(d <= 60.0) {
+          d = sqrt(d) / sqrt(60.0);
+          color.r = 1.0;
+          color.g = d;
+        } else if(d <= 3600.0) {
+          d = sqrt(d-60.0) / sqrt(3600.0-60.0);
+          color.r = 1.0 - d;
+          color.g = 1.0;
+        } else if(d <= 4.0 * 3600.0) {
+          d = sqrt(d-3600.0) / sqrt(3.0 * 3600.0);
+          color.g = 1.0;
+          color.b = d;
+        } else if(d <= 16.0 * 3600.0) {
+          d = sqrt(d-4.0*3600.0) / sqrt(12.0 * 3600.0);
+          color.g = 1.0 - d;
+          color.b = 1.0;
+        } else if(d <= d_max) {
+          double d_max = static_cast<double>(max_expiry_delta);
+          d -= 16.0*3600.0;
+          d_max -= 16.0*3600.0;
+          color.b = 1.0;
+          color.r = d / d_max;
+        } else {
+          // doesn't make sense, highlight lilac
+          color.r = 1.0;
+          color.g = 0.7;
+          color.b = 1.0;
+        }
+
+//        d /= static_cast<double>(max_expiry_delta);
+//        d = sqrt(d);
+//        d *= m_colorFactor;
+      }
+      // use the same color maping as the height map using our
+      // normalized and linearized expiration scale
+//      occupiedNodesVis->markers[idx].colors.push_back(heightMapColor(d));
+      occupiedNodesVis->markers[idx].colors.push_back(color);
+    }
+
+#ifdef COLOR_OCTOMAP_SERVER
+    if (m_useColoredMap) {
+      std_msgs::ColorRGBA _color; _color.r = (r / 255.); _color.g = (g / 255.); _color.b = (b / 255.); _color.a = 1.0; // TODO/EVALUATE: potentially use occupancy as measure for alpha channel?
+      occupiedNodesVis->markers[idx].colors.push_back(_color);
+    }
+#endif
+  }
+
+  // insert into pointcloud:
+  if (pclCloud) {
+#ifdef COLOR_OCTOMAP_SERVER
+    PCLPoint _point = PCLPoint();
+    _point.x = x; _point.y = y; _point.z = z;
+    _point.r = r; _point.g = g; _point.b = b;
+    pclCloud->push_back(_point);
+#else
+    pclCloud->push_back(PCLPoint(x, y, z));
+#endif
+  }
+}
+
+void OctomapServer::addFreeNodeVis(double x, double y, double z, unsigned int depth,
+                                   visualization_msgs::MarkerArray* freeNodesVis) const
+{
+  //create marker for free space:
+  if (freeNodesVis){
+    unsigned idx = depth;
+    assert(idx < freeNodesVis->markers.size());
+
+    geometry_msgs::Point cubeCenter;
+    cubeCenter.x = x;
+    cubeCenter.y = y;
+    cubeCenter.z = z;
+
+    freeNodesVis->markers[idx].points.push_back(cubeCenter);
+  }
+}
+
+void OctomapServer::addLodNodesVisRecurs(const OcTreeT::NodeType* node, const octomap::OcTreeKey& key, unsigned int depth,
+                                         visualization_msgs::MarkerArray* occupiedNodesVis,
+                                         visualization_msgs::MarkerArray* freeNodesVis,
+                                         pcl::PointCloud<PCLPoint>* pclCloud) const
+{
+  const octomap::point3d center = m_octree->keyToCoord(key, depth);
+  const unsigned int maxDepth = std::min(m_maxTreeDepth, m_lod.nodeDepth(center, m_octree->getNodeSize(depth)));
+  if (depth < maxDepth && m_octree->nodeHasChildren(node))
+  {
+    const octomap::key_type centerOffset = m_octree->coordToKey(0.0) >> (depth + 1);
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (m_octree->nodeChildExists(node, i))
+      {
+        octomap::OcTreeKey childKey;
+        octomap::computeChildKey(i, centerOffset, key, childKey);
+        addLodNodesVisRecurs(m_octree->getNodeChild(node, i), childKey, depth + 1,
+                             occupiedNodesVis, freeNodesVis, pclCloud);
+      }
+    }
+    return;
+  }
+
+  // Publish the node as a whole. The occupancy of an inner node is the
+  // maximum of its children, so it is occupied if any part of it is.
+  if (center.z() <= m_occupancyMinZ || center.z() >= m_occupancyMaxZ)
+  {
+    return;
+  }
+  if (m_octree->isNodeOccupied(node))
+  {
+    if (m_filterSpeckles && (depth == m_treeDepth +1) && isSpeckleNode(key))
+    {
+      return;
+    }
+    addOccupiedNodeVis(*node, center.x(), center.y(), center.z(), depth, occupiedNodesVis, pclCloud);
+  }
+  else if (m_publishFreeSpace)
+  {
+    addFreeNodeVis(center.x(), center.y(), center.z(), depth, freeNodesVis);
+  }
+}
+
+template <class PUBLISHER>
+void OctomapServer::publishLodMap(bool binary, const ros::Time& rostime, const PUBLISHER& pub) const
+{
+  auto depthFunc = [this](const octomap::point3d& center, double size) {
+    return std::min(m_maxTreeDepth, m_lod.nodeDepth(center, size));
+  };
+  DepthLimitPolicy<OcTreeT, decltype(depthFunc)> policy(*m_octree, depthFunc);
+  octomap_msgs::Octomap map;
+  map.header.frame_id = m_worldFrameId;
+  map.header.stamp = rostime;
+  if (mapToMsg(*m_octree, binary, policy, map, m_serializationThreads))
+    pub.publish(map);
+  else
+    ROS_ERROR("Error serializing OctoMap");
+}
+
+bool OctomapServer::updateLodOrigin()
+{
+  if (!m_lod.isEnabled())
+  {
+    return false;
+  }
+  tf::StampedTransform baseToWorldTf;
+  try {
+    m_tfListener.lookupTransform(m_worldFrameId, m_baseFrameId, ros::Time(0), baseToWorldTf);
+  } catch(tf::TransformException& ex){
+    ROS_WARN_STREAM_THROTTLE(10.0, "Cannot place level of detail origin, publishing at full detail: " << ex.what());
+    return false;
+  }
+  m_lod.setOrigin(pointTfToOctomap(baseToWorldTf.getOrigin()));
+  return true;
+}
+
+
 bool OctomapServer::octomapBinarySrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
   ros::WallTime startTime = ros::WallTime::now();
   ROS_INFO("Sending binary map data on service request");
-  res.map.header.frame_id = m_worldFrameId;
-  res.map.header.stamp = ros::Time::now();
-  if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
+  octomap_msgs::OctomapConstPtr map = getSerializedMap(true);
+  if (!map)
     return false;
+  res.map = *map;
 
   double total_elapsed = (ros::WallTime::now() - startTime).toSec();
   ROS_INFO("Binary octomap sent in %f sec", total_elapsed);
@@ -1362,29 +1956,519 @@ bool OctomapServer::octomapFullSrv(OctomapSrv::Request  &req,
                                     OctomapSrv::Response &res)
 {
   ROS_INFO("Sending full map data on service request");
+  octomap_msgs::OctomapConstPtr map = getSerializedMap(false);
+  if (!map)
+    return false;
+  res.map = *map;
+
+  return true;
+}
+
+bool OctomapServer::octomapRegionSrv(GetOctomapRegion::Request& req, GetOctomapRegion::Response& res)
+{
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  ros::WallTime startTime = ros::WallTime::now();
+  const point3d min = pointMsgToOctomap(req.min);
+  const point3d max = pointMsgToOctomap(req.max);
+  OcTreeKey minKey, maxKey;
+  if (!(min.x() <= max.x() && min.y() <= max.y() && min.z() <= max.z()) || !boxToKeys(min, max, &minKey, &maxKey)){
+    ROS_ERROR("Invalid octomap_region box [%f %f %f] - [%f %f %f]", min.x(), min.y(), min.z(),
+              max.x(), max.y(), max.z());
+    return false;
+  }
+  if (m_tileCache.numEvicted() > 0)
+    m_tileCache.load(m_octree, minKey, maxKey);
+
+  const unsigned treeDepth = m_octree->getTreeDepth();
+  const unsigned maxDepth = (req.max_depth == 0 || req.max_depth > treeDepth) ? treeDepth : req.max_depth;
   res.map.header.frame_id = m_worldFrameId;
   res.map.header.stamp = ros::Time::now();
+  if (!mapToMsg(*m_octree, req.binary, BoundingBoxPolicy(minKey, maxKey, treeDepth, maxDepth), res.map,
+                m_serializationThreads))
+    return false;
+
+  ROS_DEBUG("Sent the map in [%f %f %f] - [%f %f %f] to depth %u (%zu bytes) in %f sec", min.x(), min.y(), min.z(),
+            max.x(), max.y(), max.z(), maxDepth, res.map.data.size(), (ros::WallTime::now() - startTime).toSec());
+  return true;
+}
+
+bool OctomapServer::octomapStampedSrv(OctomapSrv::Request  &req,
+                                       OctomapSrv::Response &res)
+{
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  ROS_INFO("Sending stamped map data on service request");
+  return stampedMapToMsg(res.map);
+}
 
+bool OctomapServer::stampedMapToMsg(octomap_msgs::Octomap& msg)
+{
+  msg.header.frame_id = m_worldFrameId;
+  msg.header.stamp = ros::Time::now();
+  msg.binary = false;
+  msg.id = m_octree->getTreeType();
+  msg.resolution = m_octree->getResolution();
+  m_tileCache.loadAll(m_octree);
+  std::stringstream datastream;
+  const bool ok = m_octree->writeData(datastream);
+  m_tileCache.evict(m_octree, false);
+  if (!ok)
+    return false;
+  std::string datastring = datastream.str();
+  msg.data = std::vector<int8_t>(datastring.begin(), datastring.end());
 
-  if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
+  return true;
+}
+
+bool OctomapServer::startMapTransferSrv(StartMapTransfer::Request& req, StartMapTransfer::Response& res)
+{
+  octomap_msgs::OctomapConstPtr map;
+  if (req.format == StartMapTransfer::Request::STAMPED){
+    octomap_msgs::OctomapPtr stamped(new Octomap);
+    if (stampedMapToMsg(*stamped))
+      map = stamped;
+  } else if (req.format == StartMapTransfer::Request::BINARY || req.format == StartMapTransfer::Request::FULL){
+    // shared with the octomap_binary / octomap_full services and subscribers
+    map = getSerializedMap(req.format == StartMapTransfer::Request::BINARY);
+  } else {
+    ROS_ERROR("Unknown map transfer format %u", req.format);
+    return false;
+  }
+  if (!map)
     return false;
 
+  const size_t chunkSize = req.chunk_size > 0 ? req.chunk_size : std::max(m_mapTransferChunkSize, 1);
+  res.transfer_id = m_mapTransfer.start(map, chunkSize);
+  res.map.header = map->header;
+  res.map.binary = map->binary;
+  res.map.id = map->id;
+  res.map.resolution = map->resolution;
+  res.size = map->data.size();
+  res.chunk_size = chunkSize;
+  res.num_chunks = m_mapTransfer.numChunks(res.transfer_id);
+  res.crc32 = MapTransfer::crc32(map->data.data(), map->data.size());
+  ROS_INFO("Started map transfer %u of %lu bytes in %u chunks", res.transfer_id, (unsigned long)res.size,
+           res.num_chunks);
+  return true;
+}
+
+bool OctomapServer::getMapChunkSrv(GetMapChunk::Request& req, GetMapChunk::Response& res)
+{
+  if (!m_mapTransfer.chunk(req.transfer_id, req.index, &res.data, &res.crc32)){
+    ROS_ERROR("Map transfer %u has no chunk %u, it may have timed out", req.transfer_id, req.index);
+    return false;
+  }
+  return true;
+}
+
+bool OctomapServer::saveMapSrv(SaveMap::Request& req, SaveMap::Response& res)
+{
+  ros::WallTime startTime = ros::WallTime::now();
+  std::string format = req.format;
+  if (format.empty())
+  {
+    const size_t dot = req.path.rfind('.');
+    if (dot != std::string::npos)
+      format = req.path.substr(dot + 1);
+  }
+  if (format != "bt" && format != "ot" && format != "oti" && format != "sbt")
+  {
+    res.success = false;
+    res.message = "Unknown map format '" + format + "', must be bt, ot, oti or sbt";
+    return true;
+  }
+
+  if (m_saveMapDirectory.empty())
+  {
+    res.success = false;
+    res.message = "Saving maps is disabled, save_map/directory is not set";
+    return true;
+  }
+  if (!isSafeRelativePath(req.path))
+  {
+    res.success = false;
+    res.message = "Invalid path '" + req.path + "', must be relative to save_map/directory without '..'";
+    return true;
+  }
+  // Write to a new temporary file next to the target and rename it over the
+  // target once complete, so a failed save leaves no partial map and never
+  // removes a file it did not create
+  const std::string path = m_saveMapDirectory + "/" + req.path;
+  std::ostringstream tempPathStream;
+  tempPathStream << path << ".tmp" << getpid() << "." << ++m_saveMapCount;
+  const std::string tempPath = tempPathStream.str();
+  FileWriteBuffer buffer;
+  if (!buffer.open(tempPath, req.direct_io, true))
+  {
+    // The name is unique to this call, a file left by it is ours
+    unlink(tempPath.c_str());
+    res.success = false;
+    res.message = "Unable to open " + tempPath;
+    return true;
+  }
+  // The serializers write straight into the file buffer
+  std::ostream stream(&buffer);
+  bool ok = false;
+  try
+  {
+    ok = writeMapFile(format, stream);
+  }
+  catch (std::exception& e)
+  {
+    ROS_ERROR("Error serializing the map to %s: %s", tempPath.c_str(), e.what());
+  }
+  ok = buffer.close() && ok;
+  if (ok && rename(tempPath.c_str(), path.c_str()) != 0)
+  {
+    ROS_ERROR("Unable to rename %s to %s: %s", tempPath.c_str(), path.c_str(), strerror(errno));
+    ok = false;
+  }
+
+  res.success = ok;
+  res.bytes_written = buffer.bytesWritten();
+  res.duration = (ros::WallTime::now() - startTime).toSec();
+  if (ok)
+  {
+    res.message = "Saved map to " + path;
+    ROS_INFO("Saved map to %s (%s, %lu bytes%s) in %f sec", path.c_str(), format.c_str(),
+             res.bytes_written, buffer.isDirect() ? ", direct I/O" : "", res.duration);
+  }
+  else
+  {
+    res.message = "Error writing " + path;
+    ROS_ERROR("Error saving map to %s", path.c_str());
+    unlink(tempPath.c_str());
+  }
+  return true;
+}
+
+bool OctomapServer::writeMapFile(const std::string& format, std::ostream& stream)
+{
+  if (m_tileCache.numEvicted() > 0)
+  {
+    // Stream the tiles paged out from their files instead of paging them in
+    TiledMapWriter writer(*m_octree, m_tileCache);
+    return writer.write(format, stream, DEFAULT_INDEXED_SPLIT_DEPTH);
+  }
+  bool ok;
+  if (format == "bt")
+  {
+    // Same as writeBinary(), but naming the type of the stream
+    stream << "# Octomap OcTree binary file\n";
+    stream << "id " << messageTreeType(*m_octree) << "\n";
+    stream << "size " << m_octree->size() << "\n";
+    stream << "res " << m_octree->getResolution() << "\n";
+    stream << "depth " << m_octree->getTreeDepth() << "\n";
+    stream << "data\n";
+    ok = writeBinaryData(*m_octree, stream, WriteAllPolicy());
+  }
+  else if (format == "ot")
+  {
+    ok = m_octree->write(stream);
+  }
+  else if (format == "sbt")
+  {
+    ok = SuccinctOcTree::write(*m_octree, stream);
+  }
+  else
+  {
+    // The index goes in front of the subtrees, so these are encoded in memory
+    ok = writeIndexedMap(*m_octree, true, stream, DEFAULT_INDEXED_SPLIT_DEPTH, m_serializationThreads);
+  }
+  return ok;
+}
+
+octomap_msgs::OctomapConstPtr OctomapServer::getSerializedMap(bool binary, uint64_t* version)
+{
+  if (version)
+    *version = m_mapVersion;
+  const std::string frame_id = m_worldFrameId;
+  const ros::Time stamp = ros::Time::now();
+  if (!m_mapCacheEnabled)
+  {
+    m_tileCache.loadAll(m_octree);
+    octomap_msgs::OctomapPtr map(new Octomap);
+    map->header.frame_id = frame_id;
+    map->header.stamp = stamp;
+    const bool ok = mapToMsg(*m_octree, binary, WriteAllPolicy(), *map, m_serializationThreads);
+    m_tileCache.evict(m_octree, false);
+    if (!ok)
+      return octomap_msgs::OctomapConstPtr();
+    return map;
+  }
+
+  octomap_msgs::OctomapConstPtr map = m_mapCache.get(binary, m_mapVersion);
+  if (map)
+    return map;
+
+  if (m_mapCacheAllowStale)
+  {
+    uint64_t stale_version;
+    map = m_mapCache.getLatest(binary, &stale_version);
+    if (map)
+    {
+      // Serialize the current map in the background, unless that is already
+      // running. The worker reads the tree itself, so neither the tree is
+      // copied nor its tiles paged in here.
+      const unsigned threads = m_serializationThreads;
+      m_mapCache.buildAsync(binary, m_mapVersion,
+          [this, binary, frame_id, stamp, threads](Octomap& msg) {
+            msg.header.frame_id = frame_id;
+            msg.header.stamp = stamp;
+            return serializeMapInBackground(binary, threads, msg);
+          });
+      ROS_DEBUG("Serving map version %lu while version %lu is serialized", stale_version, m_mapVersion);
+      if (version)
+        *version = stale_version;
+      return map;
+    }
+  }
+
+  // A whole map needs all of its tiles. Paging them in does not change the
+  // map, so cached maps stay valid.
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  m_tileCache.loadAll(m_octree);
+  map = m_mapCache.build(binary, m_mapVersion,
+      [this, binary, frame_id, stamp](Octomap& msg) {
+        msg.header.frame_id = frame_id;
+        msg.header.stamp = stamp;
+        return mapToMsg(*m_octree, binary, WriteAllPolicy(), msg, m_serializationThreads);
+      });
+  m_tileCache.evict(m_octree, false);
+  return map;
+}
+
+bool OctomapServer::serializeMapInBackground(bool binary, unsigned threads, Octomap& msg)
+{
+  boost::shared_ptr<const OcTreeT> snapshot;
+  {
+    // The map may be newer than the version it is cached as by now, which
+    // only means it is serialized once more
+    boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+    if (m_tileCache.numEvicted() > 0)
+    {
+      // Stream the tiles paged out from their files, the tree stays locked
+      // meanwhile
+      TiledMapWriter writer(*m_octree, m_tileCache);
+      return writer.toMsg(binary, msg);
+    }
+    snapshot.reset(new OcTreeT(*m_octree));
+  }
+  // mapping continues on the live tree meanwhile
+  return mapToMsg(*snapshot, binary, WriteAllPolicy(), msg, threads);
+}
+
+bool OctomapServer::queryOccupancySrv(QueryOccupancy::Request& req, QueryOccupancy::Response& res)
+{
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  ros::WallTime startTime = ros::WallTime::now();
+  PointQuery query;
+  query.setPoints(req.points, m_octree->getResolution());
+  OcTreeKey minKey, maxKey;
+  if (m_tileCache.isEnabled() && query.bounds(&minKey, &maxKey))
+    m_tileCache.load(m_octree, minKey, maxKey);
+  query.search(*m_octree);
+  res.states = query.states();
+  res.log_odds = query.logOdds();
+
+  ROS_DEBUG("Answered occupancy of %zu points in %f sec", req.points.size(),
+            (ros::WallTime::now() - startTime).toSec());
+  return true;
+}
+
+bool OctomapServer::castRaysSrv(CastRays::Request& req, CastRays::Response& res)
+{
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  ros::WallTime startTime = ros::WallTime::now();
+  std::vector<RayCaster::Ray> rays;
+  if (!RayCaster::makeRays(req.origins, req.directions, &rays)){
+    ROS_ERROR("cast_rays needs one origin, or one origin per direction, got %zu origins for %zu directions",
+              req.origins.size(), req.directions.size());
+    return false;
+  }
+
+  // page in the tiles the rays can reach
+  if (m_tileCache.isEnabled() && !rays.empty()){
+    if (req.max_range > 0.0){
+      point3d min = rays[0].origin, max = rays[0].origin;
+      for (const RayCaster::Ray& ray : rays){
+        for (unsigned i = 0; i < 3; ++i){
+          min(i) = std::min(min(i), ray.origin(i));
+          max(i) = std::max(max(i), ray.origin(i));
+        }
+      }
+      const point3d range(req.max_range, req.max_range, req.max_range);
+      loadTiles(min - range, max + range);
+    } else {
+      m_tileCache.loadAll(m_octree);
+    }
+  }
+
+  RayCaster caster(m_octree->getResolution(), m_octree->getTreeDepth());
+  std::vector<RayCaster::Result> results;
+  const OcTreeT& tree = *m_octree;
+  caster.cast(rays, req.max_range, m_castRaysThreads,
+              [&tree](const OcTreeKey& key, unsigned* depth){ return RayCaster::searchTree(tree, key, depth); },
+              &results);
+  m_tileCache.evict(m_octree, false);
+  RayCaster::fillResponse(results, &res);
+
+  ROS_DEBUG("Cast %zu rays in %f sec", rays.size(), (ros::WallTime::now() - startTime).toSec());
+  return true;
+}
+
+void OctomapServer::updateEsdf(const ros::Time& rostime)
+{
+  if (m_baseToWorldValid){
+    const tf::Vector3 origin = m_baseToWorldTf.getOrigin();
+    OcTreeKey baseKey;
+    if (m_octree->coordToKeyChecked(point3d(origin.x(), origin.y(), origin.z()), baseKey))
+      m_esdf.follow(baseKey);
+  }
+  OcTreeKey minKey, maxKey;
+  if (!m_esdf.window(&minKey, &maxKey))
+    return;
+  // The changes only cover what was updated, the window needs all of its tiles
+  if (m_tileCache.numEvicted() > 0)
+    m_tileCache.load(m_octree, minKey, maxKey);
+  m_esdf.update(*m_octree, m_updateJournal.records());
+
+  if (!(m_latchedTopics || m_esdfSlicePub.getNumSubscribers() > 0))
+    return;
+  const octomap::key_type sliceZ = m_octree->coordToKey(m_esdfSliceZ);
+  if (sliceZ < minKey[2] || sliceZ > maxKey[2])
+    return;
+  pcl::PointCloud<pcl::PointXYZI> pclCloud;
+  pclCloud.reserve(size_t(maxKey[0] - minKey[0] + 1) * (maxKey[1] - minKey[1] + 1));
+  for (unsigned x = minKey[0]; x <= maxKey[0]; ++x){
+    for (unsigned y = minKey[1]; y <= maxKey[1]; ++y){
+      const OcTreeKey key(x, y, sliceZ);
+      float distance;
+      if (!m_esdf.distance(key, &distance))
+        continue;
+      const point3d coord = m_octree->keyToCoord(key);
+      pcl::PointXYZI point;
+      point.x = coord.x();
+      point.y = coord.y();
+      point.z = coord.z();
+      point.intensity = distance * m_res;
+      pclCloud.push_back(point);
+    }
+  }
+  sensor_msgs::PointCloud2 cloud;
+  pcl::toROSMsg (pclCloud, cloud);
+  cloud.header.frame_id = m_worldFrameId;
+  cloud.header.stamp = rostime;
+  m_esdfSlicePub.publish(cloud);
+}
+
+void OctomapServer::updateFrontiers(const ros::Time& rostime)
+{
+  // Tiles paged out look unknown, the frontier runs along their edges
+  std::vector<OcTreeKey> pagedTiles;
+  m_tileCache.takePagedTiles(&pagedTiles);
+  std::sort(pagedTiles.begin(), pagedTiles.end(), [](const OcTreeKey& a, const OcTreeKey& b){
+    return a[0] != b[0] ? a[0] < b[0] : a[1] != b[1] ? a[1] < b[1] : a[2] < b[2];
+  });
+  pagedTiles.erase(std::unique(pagedTiles.begin(), pagedTiles.end()), pagedTiles.end());
+  const unsigned int tileSize = 1u << (m_treeDepth - m_tileCache.getTileDepth());
+  for (const OcTreeKey& tile : pagedTiles){
+    const OcTreeKey tileMax(tile[0] + tileSize - 1, tile[1] + tileSize - 1, tile[2] + tileSize - 1);
+    m_frontiers.updateBox(*m_octree, tile, tileMax);
+  }
+  m_frontiers.update(*m_octree, m_updateJournal.records());
+
+  if (!m_lastFrontierPublishTime.isZero() && (rostime - m_lastFrontierPublishTime).toSec() < m_frontierPublishPeriod)
+    return;
+  m_lastFrontierPublishTime = rostime;
+
+  if (m_latchedTopics || m_frontierPub.getNumSubscribers() > 0){
+    pcl::PointCloud<pcl::PointXYZ> pclCloud;
+    pclCloud.reserve(m_frontiers.frontiers().size());
+    for (const OcTreeKey& key : m_frontiers.frontiers()){
+      const point3d coord = m_octree->keyToCoord(key);
+      pclCloud.push_back(pcl::PointXYZ(coord.x(), coord.y(), coord.z()));
+    }
+    sensor_msgs::PointCloud2 cloud;
+    pcl::toROSMsg (pclCloud, cloud);
+    cloud.header.frame_id = m_worldFrameId;
+    cloud.header.stamp = rostime;
+    m_frontierPub.publish(cloud);
+  }
+
+  if (m_latchedTopics || m_frontierClusterPub.getNumSubscribers() > 0){
+    std::vector<FrontierTracker::Cluster> clusters;
+    m_frontiers.cluster(std::max(m_frontierMinClusterSize, 1), &clusters);
+    pcl::PointCloud<pcl::PointXYZI> pclCloud;
+    pclCloud.reserve(clusters.size());
+    // the center of a cluster is a mean of keys, usually between voxels
+    const double origin = m_octree->keyToCoord(octomap::key_type(0));
+    for (const FrontierTracker::Cluster& cluster : clusters){
+      pcl::PointXYZI point;
+      point.x = origin + cluster.center[0] * m_res;
+      point.y = origin + cluster.center[1] * m_res;
+      point.z = origin + cluster.center[2] * m_res;
+      point.intensity = cluster.size;
+      pclCloud.push_back(point);
+    }
+    sensor_msgs::PointCloud2 cloud;
+    pcl::toROSMsg (pclCloud, cloud);
+    cloud.header.frame_id = m_worldFrameId;
+    cloud.header.stamp = rostime;
+    m_frontierClusterPub.publish(cloud);
+  }
+}
+
+void OctomapServer::writeSharedMap(const ros::Time& rostime)
+{
+  // Readers already have this version of the map
+  if (m_sharedMap.getGeneration() > 0 && m_sharedMap.getMapVersion() == m_mapVersion)
+    return;
+  octomap_msgs::OctomapConstPtr octree;
+  uint64_t version = m_mapVersion;
+  if (m_sharedMapOctree){
+    // shared with the octomap_binary subscribers and services. A stale map
+    // keeps its own version, so that the current one is written once it is
+    // serialized.
+    octree = getSerializedMap(true, &version);
+    if (!octree)
+      ROS_ERROR("Error serializing the octree for shared memory");
+  }
+  m_sharedMap.write(&m_gridmap, octree.get(), version, m_worldFrameId, rostime);
+}
+
+bool OctomapServer::queryDistanceSrv(QueryDistance::Request& req, QueryDistance::Response& res)
+{
+  if (!m_esdf.isEnabled()){
+    ROS_ERROR("query_distance needs the distance field, set esdf/size_xy");
+    return false;
+  }
+  res.distances.resize(req.points.size());
+  for (size_t i = 0; i < req.points.size(); ++i){
+    OcTreeKey key;
+    float distance;
+    if (m_octree->coordToKeyChecked(pointMsgToOctomap(req.points[i]), key) && m_esdf.distance(key, &distance))
+      res.distances[i] = distance * m_res;
+    else
+      res.distances[i] = -1.0f;
+  }
+  res.max_distance = m_esdf.getMaxDistance() * m_res;
   return true;
 }
 
 bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   point3d min = pointMsgToOctomap(req.min);
   point3d max = pointMsgToOctomap(req.max);
+  OcTreeKey minKey, maxKey;
+  if (!boxToKeys(min, max, &minKey, &maxKey))
+    return false;
+  if (m_tileCache.numEvicted() > 0)
+    m_tileCache.load(m_octree, minKey, maxKey);
 
-  double thresMin = m_octree->getClampingThresMin();
-  for(OcTreeT::leaf_bbx_iterator it = m_octree->begin_leafs_bbx(min,max),
-      end=m_octree->end_leafs_bbx(); it!= end; ++it){
-
-    it->setLogOdds(octomap::logodds(thresMin));
-    //			m_octree->updateNode(it.getKey(), -6.0f);
-  }
-  // TODO: eval which is faster (setLogOdds+updateInner or updateNode)
-  m_octree->updateInnerOccupancy();
+  // Only the nodes above the box are updated, and the changes reach the
+  // update topics through the value change callback
+  m_octree->clearAABB(minKey, maxKey);
+  bumpMapVersion();
 
   publishAll(ros::Time::now());
 
@@ -1392,11 +2476,66 @@ bool OctomapServer::clearBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
 }
 
 bool OctomapServer::eraseBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   point3d min = pointMsgToOctomap(req.min);
   point3d max = pointMsgToOctomap(req.max);
+  loadTiles(min, max);
 
   m_octree->deleteAABB(min, max, false,
                        std::bind(&OctomapServer::touchKeyAtDepth, this, std::placeholders::_3, std::placeholders::_4));
+  bumpMapVersion();
+
+  publishAll(ros::Time::now());
+
+  return true;
+}
+
+bool OctomapServer::clearRegionsSrv(ClearRegions::Request& req, ClearRegions::Response& res){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  if (req.box_min.size() != req.box_max.size() || req.oriented_box_pose.size() != req.oriented_box_size.size()
+      || req.prism_polygon.size() != req.prism_min_z.size() || req.prism_polygon.size() != req.prism_max_z.size()){
+    ROS_ERROR("Region arrays of different lengths, nothing cleared");
+    return false;
+  }
+  if (req.action != ClearRegions::Request::CLEAR && req.action != ClearRegions::Request::ERASE){
+    ROS_ERROR("Unknown region action %u", req.action);
+    return false;
+  }
+
+  RegionSet regions;
+  for (size_t i = 0; i < req.box_min.size(); ++i)
+    regions.addBox(pointMsgToOctomap(req.box_min[i]), pointMsgToOctomap(req.box_max[i]));
+  for (size_t i = 0; i < req.oriented_box_pose.size(); ++i){
+    const geometry_msgs::Pose& pose = req.oriented_box_pose[i];
+    const double rotation[4] = { pose.orientation.w, pose.orientation.x, pose.orientation.y, pose.orientation.z };
+    const geometry_msgs::Vector3& size = req.oriented_box_size[i];
+    regions.addOrientedBox(pointMsgToOctomap(pose.position), rotation, point3d(size.x, size.y, size.z));
+  }
+  for (size_t i = 0; i < req.prism_polygon.size(); ++i){
+    std::vector<point3d> polygon;
+    for (const geometry_msgs::Point32& p : req.prism_polygon[i].points)
+      polygon.push_back(point3d(p.x, p.y, p.z));
+    regions.addPrism(polygon, req.prism_min_z[i], req.prism_max_z[i]);
+  }
+
+  point3d min, max;
+  OcTreeKey minKey, maxKey;
+  if (!regions.bounds(&min, &max) || !boxToKeys(min, max, &minKey, &maxKey))
+    return true;
+  if (m_tileCache.numEvicted() > 0)
+    m_tileCache.load(m_octree, minKey, maxKey);
+
+  // All regions are tested against each node in one pass, and only the
+  // nodes above them are visited. The changes reach the update topics
+  // through the value change callback.
+  const unsigned int treeDepth = m_octree->getTreeDepth();
+  m_octree->clearRegion(
+      [&](const OcTreeKey& key, unsigned int depth){
+        return regions.overlap(m_octree->keyToCoord(key, depth), m_octree->getNodeSize(depth) / 2,
+                               depth == treeDepth);
+      },
+      req.action == ClearRegions::Request::ERASE);
+  bumpMapVersion();
 
   publishAll(ros::Time::now());
 
@@ -1404,10 +2543,16 @@ bool OctomapServer::eraseBBXSrv(BBXSrv::Request& req, BBXSrv::Response& resp){
 }
 
 bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Response& resp) {
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   visualization_msgs::MarkerArray occupiedNodesVis;
   occupiedNodesVis.markers.resize(m_treeDepth +1);
   ros::Time rostime = ros::Time::now();
   m_octree->clear();
+  m_tileCache.clear();
+  m_esdf.reset();
+  m_frontiers.reset();
+  bumpMapVersion();
+  invalidateChangeHistory();
   // clear 2D map:
   m_gridmap.data.clear();
   m_gridmap.info.height = 0.0;
@@ -1452,74 +2597,68 @@ bool OctomapServer::resetSrv(std_srvs::Empty::Request& req, std_srvs::Empty::Res
 
 void OctomapServer::onNewFullMapSubscription(const ros::SingleSubscriberPublisher& pub)
 {
-  publishAll();
-  Octomap map;
-  map.header.frame_id = m_worldFrameId;
-  map.header.stamp = ros::Time::now();
-
-  if (octomap_msgs::fullMapToMsg(*m_octree, map))
-    pub.publish(map);
+  if (updateLodOrigin())
+  {
+    publishLodMap(false, ros::Time::now(), pub);
+    return;
+  }
+  octomap_msgs::OctomapConstPtr map = getSerializedMap(false);
+  if (map)
+    pub.publish(*map);
   else
     ROS_ERROR("Error serializing OctoMap");
 }
 
 void OctomapServer::onNewFullMapUpdateSubscription(const ros::SingleSubscriberPublisher& pub)
 {
+  // Start tracking changes before sending the universe
+  updateChangeTracking(true);
   publishFullOctoMapUpdate(ros::Time::now(), &pub);
 }
 
 void OctomapServer::onNewBinaryMapSubscription(const ros::SingleSubscriberPublisher& pub)
 {
-  publishAll();
-  Octomap map;
-  map.header.frame_id = m_worldFrameId;
-  map.header.stamp = ros::Time::now();
-
-  if (octomap_msgs::binaryMapToMsg(*m_octree, map))
-    pub.publish(map);
+  if (updateLodOrigin())
+  {
+    publishLodMap(true, ros::Time::now(), pub);
+    return;
+  }
+  octomap_msgs::OctomapConstPtr map = getSerializedMap(true);
+  if (map)
+    pub.publish(*map);
   else
     ROS_ERROR("Error serializing OctoMap");
 }
 
 void OctomapServer::onNewBinaryMapUpdateSubscription(const ros::SingleSubscriberPublisher& pub)
 {
+  // Start tracking changes before sending the universe
+  updateChangeTracking(true);
   publishBinaryOctoMapUpdate(ros::Time::now(), &pub);
 }
 
 void OctomapServer::publishBinaryOctoMapUpdate(const ros::Time& rostime, const ros::SingleSubscriberPublisher* pub /* =  nullptr */) {
 
   octomap_msgs::OctomapUpdatePtr map_msg_ptr(new octomap_msgs::OctomapUpdate());
-  octomap_msgs::OctomapUpdate& map_msg = *map_msg_ptr;
-  OcTreeT delta_map(m_res);
-  delta_map.setTreeDepth(m_treeDepth);
 
-  // Set up header info
-  map_msg.header.frame_id = m_worldFrameId;
-  map_msg.header.stamp = rostime;
-  map_msg.octomap_bounds.header.seq = m_binarySeq;
-  map_msg.octomap_bounds.header.frame_id = m_worldFrameId;
-  map_msg.octomap_bounds.header.stamp = rostime;
-  map_msg.octomap_update.header.seq = m_binarySeq;
-  map_msg.octomap_update.header.frame_id = m_worldFrameId;
-  map_msg.octomap_update.header.stamp = rostime;
-
-  OcTreeT* bounds_map_ptr = m_octree_binary_deltaBB_;
+  // The bounds tree is only built here, from the change journal, when there
+  // is actually someone to send it to.
+  OcTreeT bounds_map(m_res);
+  OcTreeT* bounds_map_ptr = &bounds_map;
+  uint32_t seq = m_updateSeq;
   if (pub)
   {
     // new subscription, force full publish, set seq unequal for sentinel
     bounds_map_ptr = m_universe;
-    map_msg.octomap_update.header.seq--;
+    seq--;
   }
   else
   {
-    // publishing normally, increment our seq
-    m_binarySeq++;
+    configureBoundsTree(bounds_map_ptr);
+    m_updateJournal.markTree(bounds_map_ptr, true);
   }
 
-  delta_map.setTreeValues(m_octree, bounds_map_ptr, false, false);
-
-  if(   octomap_msgs::binaryMapToMsg(*bounds_map_ptr, map_msg.octomap_bounds)
-     && octomap_msgs::binaryMapToMsg(delta_map, map_msg.octomap_update))
+  if (buildOctoMapUpdate(bounds_map_ptr, true, seq, rostime, *map_msg_ptr))
   {
     if (pub)
       pub->publish(map_msg_ptr);
@@ -1530,47 +2669,28 @@ void OctomapServer::publishBinaryOctoMapUpdate(const ros::Time& rostime, const r
   {
     ROS_ERROR("Error serializing OctoMap Update");
   }
-
-  if (!pub)
-  {
-    bounds_map_ptr->clear();
-  }
 }
 
 void OctomapServer::publishFullOctoMapUpdate(const ros::Time& rostime, const ros::SingleSubscriberPublisher* pub /* =  nullptr */) {
 
   octomap_msgs::OctomapUpdatePtr map_msg_ptr(new octomap_msgs::OctomapUpdate());
-  octomap_msgs::OctomapUpdate& map_msg = *map_msg_ptr;
-  OcTreeT delta_map(m_res);
-  delta_map.setTreeDepth(m_treeDepth);
-
-  // Set up header info
-  map_msg.header.frame_id = m_worldFrameId;
-  map_msg.header.stamp = rostime;
-  map_msg.octomap_bounds.header.seq = m_fullSeq;
-  map_msg.octomap_bounds.header.frame_id = m_worldFrameId;
-  map_msg.octomap_bounds.header.stamp = rostime;
-  map_msg.octomap_update.header.seq = m_fullSeq;
-  map_msg.octomap_update.header.frame_id = m_worldFrameId;
-  map_msg.octomap_update.header.stamp = rostime;
 
-  OcTreeT* bounds_map_ptr = m_octree_deltaBB_;
+  OcTreeT bounds_map(m_res);
+  OcTreeT* bounds_map_ptr = &bounds_map;
+  uint32_t seq = m_updateSeq;
   if (pub)
   {
     // new subscription, force full publish, set seq unequal for sentinel
     bounds_map_ptr = m_universe;
-    map_msg.octomap_update.header.seq--;
+    seq--;
   }
   else
   {
-    // publishing normally, increment our seq
-    m_fullSeq++;
+    configureBoundsTree(bounds_map_ptr);
+    m_updateJournal.markTree(bounds_map_ptr, false);
   }
 
-  delta_map.setTreeValues(m_octree, bounds_map_ptr, false, false);
-
-  if(   octomap_msgs::binaryMapToMsg(*bounds_map_ptr, map_msg.octomap_bounds)
-     && octomap_msgs::fullMapToMsg(delta_map, map_msg.octomap_update))
+  if (buildOctoMapUpdate(bounds_map_ptr, false, seq, rostime, *map_msg_ptr))
   {
     if(pub)
       pub->publish(map_msg_ptr);
@@ -1581,13 +2701,138 @@ void OctomapServer::publishFullOctoMapUpdate(const ros::Time& rostime, const ros
   {
     ROS_ERROR("Error serializing OctoMap Update");
   }
+}
+
+bool OctomapServer::buildOctoMapUpdate(OcTreeT* bounds_tree, bool binary, uint32_t seq, const ros::Time& rostime,
+                                       octomap_msgs::OctomapUpdate& map_msg) const
+{
+  OcTreeT delta_map(m_res);
+  delta_map.setTreeDepth(m_treeDepth);
 
-  if (!pub)
+  // Set up header info
+  map_msg.header.frame_id = m_worldFrameId;
+  map_msg.header.stamp = rostime;
+  map_msg.octomap_bounds.header.seq = seq;
+  map_msg.octomap_bounds.header.frame_id = m_worldFrameId;
+  map_msg.octomap_bounds.header.stamp = rostime;
+  map_msg.octomap_update.header.seq = seq;
+  map_msg.octomap_update.header.frame_id = m_worldFrameId;
+  map_msg.octomap_update.header.stamp = rostime;
+
+  delta_map.setTreeValues(m_octree, bounds_tree, false, false);
+
+  if (!mapToMsg(*bounds_tree, true, WriteAllPolicy(), map_msg.octomap_bounds))
+    return false;
+  return mapToMsg(delta_map, binary, WriteAllPolicy(), map_msg.octomap_update);
+}
+
+bool OctomapServer::octomapUpdateSrv(GetOctomapUpdate::Request& req, GetOctomapUpdate::Response& res)
+{
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
+  ros::WallTime startTime = ros::WallTime::now();
+  // Asking for updates is as good as subscribing to them, keep tracking
+  m_lastUpdateInterestTime = ros::Time::now();
+  updateChangeTracking(true);
+
+  // The changes of the cycle in progress are sent with the next update, the
+  // values in the tree already reflect them, which does no harm.
+  const uint32_t lastSeq = m_updateSeq - 1;
+  std::vector<ChangeJournal::Record> records;
+  OcTreeT bounds_map(m_res);
+  OcTreeT* bounds_map_ptr = m_universe;
+  res.full_snapshot = !m_changeRing.collect(req.since_seq, &records);
+  if (!res.full_snapshot)
+  {
+    configureBoundsTree(&bounds_map);
+    ChangeJournal::markTree(records, &bounds_map, req.binary);
+    bounds_map_ptr = &bounds_map;
+  }
+
+  // The changes may be in tiles paged out since
+  if (m_tileCache.numEvicted() > 0)
+  {
+    if (res.full_snapshot)
+    {
+      m_tileCache.loadAll(m_octree);
+    }
+    else if (bounds_map.getRoot())
+    {
+      double minX, minY, minZ, maxX, maxY, maxZ;
+      bounds_map.getMetricMin(minX, minY, minZ);
+      bounds_map.getMetricMax(maxX, maxY, maxZ);
+      loadTiles(point3d(minX, minY, minZ), point3d(maxX, maxY, maxZ));
+    }
+  }
+
+  const bool built = buildOctoMapUpdate(bounds_map_ptr, req.binary, lastSeq, ros::Time::now(), res.update);
+  m_tileCache.evict(m_octree, false);
+  if (!built)
+  {
+    ROS_ERROR("Error serializing OctoMap Update");
+    return false;
+  }
+
+  ROS_INFO("Sending %s map update since seq %u up to seq %u%s (%zu changes) on service request, took %f sec",
+           req.binary ? "binary" : "full", req.since_seq, lastSeq,
+           res.full_snapshot ? " as a full snapshot" : "", records.size(),
+           (ros::WallTime::now() - startTime).toSec());
+  return true;
+}
+
+void OctomapServer::configureBoundsTree(OcTreeT* tree) const
+{
+  // make the universe and bounds trees "binary" in nature by making the
+  // probability of hit/miss much bigger than the clamping thresholds
+  tree->setTreeDepth(m_treeDepth);
+  tree->setProbHit(.99);
+  tree->setProbMiss(.01);
+  tree->setClampingThresMin(.1);
+  tree->setClampingThresMax(.9);
+}
+
+void OctomapServer::updateChangeTracking(bool force_enable /* = false */)
+{
+  // The update topics are not latched, so changes only need to be tracked
+  // while someone is subscribed to them. A new subscriber is always sent
+  // the whole universe first. When the change ring is enabled, keep
+  // tracking for a while after the last subscriber left, so it can catch up
+  // with octomap_updates_since after reconnecting.
+  ros::Time now = ros::Time::now();
+  bool subscribed = m_binaryMapUpdatePub.getNumSubscribers() > 0
+                    || m_fullMapUpdatePub.getNumSubscribers() > 0;
+  if (subscribed)
+  {
+    m_lastUpdateInterestTime = now;
+  }
+  bool enable = force_enable || subscribed || m_checkpointer.isEnabled() || m_esdf.isEnabled() || m_frontiers.isEnabled()
+                || (m_changeRing.isEnabled() && !m_lastUpdateInterestTime.isZero()
+                    && (now - m_lastUpdateInterestTime).toSec() < m_changeRingKeepTrackingTime);
+  if (enable == m_updateJournal.isEnabled())
+  {
+    return;
+  }
+  ROS_DEBUG("%s change tracking", enable ? "Enabling" : "Disabling");
+  m_updateJournal.setEnabled(enable);
+  if (enable)
+  {
+    enableChangeCallback();
+  }
+  else
   {
-    bounds_map_ptr->clear();
+    disableChangeCallback();
+    invalidateChangeHistory();
   }
 }
 
+void OctomapServer::invalidateChangeHistory()
+{
+  // Skip a seq, so clients following the update topics see a gap, and drop
+  // the history, so nothing before the gap can be merged.
+  m_updateSeq++;
+  m_changeRing.reset(m_updateSeq);
+  // The journal of the checkpoint misses these changes as well
+  m_checkpointer.requestSnapshot();
+}
 
 void OctomapServer::filterGroundPlane(const PCLPointCloud& pc, PCLPointCloud& ground, PCLPointCloud& nonground) const{
   ground.header = pc.header;
@@ -1709,6 +2954,16 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
     double minX, minY, minZ, maxX, maxY, maxZ;
     m_octree->getMetricMin(minX, minY, minZ);
     m_octree->getMetricMax(maxX, maxY, maxZ);
+    // The map keeps covering the tiles paged out
+    point3d evictedMin, evictedMax;
+    if (m_tileCache.evictedBounds(*m_octree, &evictedMin, &evictedMax)){
+      minX = std::min(minX, double(evictedMin.x()));
+      minY = std::min(minY, double(evictedMin.y()));
+      minZ = std::min(minZ, double(evictedMin.z()));
+      maxX = std::max(maxX, double(evictedMax.x()));
+      maxY = std::max(maxY, double(evictedMax.y()));
+      maxZ = std::max(maxZ, double(evictedMax.z()));
+    }
 
     octomap::point3d minPt(minX, minY, minZ);
     octomap::point3d maxPt(maxX, maxY, maxZ);
@@ -1765,6 +3020,11 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
     if (m_maxTreeDepth < m_treeDepth)
       m_projectCompleteMap = true;
 
+    // The cells of the tiles paged out are only kept by an incremental
+    // projection, a complete one needs the tiles back
+    if (m_projectCompleteMap)
+      m_tileCache.loadAll(m_octree);
+
 
     if(m_projectCompleteMap){
       ROS_DEBUG("Rebuilding complete 2D map");
@@ -1810,8 +3070,48 @@ void OctomapServer::handlePreNodeTraversal(const ros::Time& rostime){
 
 void OctomapServer::handlePostNodeTraversal(const ros::Time& rostime){
 
-  if (m_publish2DMap)
+  if (m_publish2DMap){
     m_mapPub.publish(m_gridmap);
+    if (m_inflation.isEnabled())
+      publishInflatedMap(rostime);
+  }
+}
+
+void OctomapServer::publishInflatedMap(const ros::Time& rostime){
+  std::vector<InflationLayer::Patch> patches;
+  bool rebuilt = false;
+  if (!m_inflation.update(m_gridmap, &patches, &rebuilt))
+    return;
+  const nav_msgs::OccupancyGrid& inflated = m_inflation.getGrid();
+  // Subscribers got the whole grid when they subscribed, and follow the
+  // changes on the update topic from there
+  if (rebuilt){
+    m_inflatedMapPub.publish(inflated);
+    return;
+  }
+
+  if (m_inflatedMapUpdatePub.getNumSubscribers() == 0)
+    return;
+  for (const InflationLayer::Patch& patch : patches){
+    map_msgs::OccupancyGridUpdate update;
+    update.header.frame_id = m_worldFrameId;
+    update.header.stamp = rostime;
+    update.x = patch.x;
+    update.y = patch.y;
+    update.width = patch.width;
+    update.height = patch.height;
+    update.data.reserve(size_t(patch.width) * patch.height);
+    for (unsigned y = patch.y; y < patch.y + patch.height; ++y){
+      const size_t start = size_t(inflated.info.width) * y + patch.x;
+      update.data.insert(update.data.end(), inflated.data.begin() + start, inflated.data.begin() + start + patch.width);
+    }
+    m_inflatedMapUpdatePub.publish(update);
+  }
+}
+
+void OctomapServer::onNewInflatedMapSubscription(const ros::SingleSubscriberPublisher& pub){
+  if (!m_inflation.getGrid().data.empty())
+    pub.publish(m_inflation.getGrid());
 }
 
 void OctomapServer::handleOccupiedNode(const OcTreeT::iterator& it){
@@ -1896,6 +3196,7 @@ bool OctomapServer::isSpeckleNode(const OcTreeKey&nKey) const {
 }
 
 void OctomapServer::reconfigureCallback(octomap_server::OctomapServerConfig& config, uint32_t level){
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   {
     if (config.max_depth < 0) {
       m_maxTreeDepth = m_treeDepth;
@@ -1999,8 +3300,7 @@ void OctomapServer::adjustMapData(nav_msgs::OccupancyGrid& map, const nav_msgs::
 
 void OctomapServer::touchKeyAtDepth(const OcTreeKey& key, unsigned int depth /* = MAX_INT */)
 {
-  m_octree_deltaBB_->setNodeValueAtDepth(key, depth, m_octree_deltaBB_->getClampingThresMaxLog());
-  m_octree_binary_deltaBB_->setNodeValueAtDepth(key, depth, m_octree_binary_deltaBB_->getClampingThresMaxLog());
+  m_updateJournal.append(key, std::min(depth, m_treeDepth), true);
 }
 
 // for convenience
@@ -2023,9 +3323,7 @@ void OctomapServer::disableChangeCallback()
 void OctomapServer::valueChangeCallback(const OcTreeKey& key, unsigned int depth, const bool node_just_created,
       const float prev_full_val, const bool prev_binary_val,
       const float curr_full_val, const bool curr_binary_val){
-  if (prev_binary_val != curr_binary_val || node_just_created)
-    m_octree_binary_deltaBB_->setNodeValueAtDepth(key, depth, m_octree_binary_deltaBB_->getClampingThresMaxLog());
-  m_octree_deltaBB_->setNodeValueAtDepth(key, depth, m_octree_deltaBB_->getClampingThresMaxLog());
+  m_updateJournal.append(key, depth, prev_binary_val != curr_binary_val || node_just_created);
 }
 
 std_msgs::ColorRGBA OctomapServer::heightMapColor(double h) {
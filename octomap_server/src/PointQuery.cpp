@@ -0,0 +1,105 @@
+#include <octomap_server/PointQuery.h>
+
+namespace octomap_server {
+
+namespace {
+
+// Spread the 16 bits of v to every third bit
+inline uint64_t spreadBits(uint64_t v)
+{
+  v = (v | (v << 16)) & 0x0000ff0000ffULL;
+  v = (v | (v << 8)) & 0x00f00f00f00fULL;
+  v = (v | (v << 4)) & 0x0c30c30c30c3ULL;
+  v = (v | (v << 2)) & 0x249249249249ULL;
+  return v;
+}
+
+}  // namespace
+
+void PointQuery::setPoints(const std::vector<geometry_msgs::Point>& points, double resolution)
+{
+  const size_t n = points.size();
+  states_.assign(n, UNKNOWN);
+  log_odds_.assign(n, 0.0f);
+
+  // Coordinates as arrays, so the key loop runs over contiguous values
+  std::vector<double> coords[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    coords[i].resize(n);
+  }
+  for (size_t j = 0; j < n; ++j)
+  {
+    coords[0][j] = points[j].x;
+    coords[1][j] = points[j].y;
+    coords[2][j] = points[j].z;
+  }
+
+  // Same as OcTreeBaseImpl::coordToKeyChecked(): floor(coord / resolution)
+  // offset by the center key, for coordinates in [-center, center). The floor
+  // is a truncation corrected for negative values, and NaN fails the range
+  // check.
+  const double resolution_factor = 1.0 / resolution;
+  const int32_t center = 1 << (TREE_DEPTH - 1);
+  std::vector<int32_t> keys[3];
+  std::vector<uint8_t> inside(n, 1);
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    keys[i].resize(n);
+    const double* coord = coords[i].data();
+    int32_t* key = keys[i].data();
+    uint8_t* in = inside.data();
+    for (size_t j = 0; j < n; ++j)
+    {
+      double scaled = resolution_factor * coord[j];
+      const bool valid = scaled >= -center && scaled < center;
+      scaled = valid ? scaled : 0.0;
+      const int32_t truncated = static_cast<int32_t>(scaled);
+      key[j] = truncated - (scaled < truncated) + center;
+      in[j] &= valid;
+    }
+  }
+
+  sorted_.clear();
+  sorted_.reserve(n);
+  for (size_t j = 0; j < n; ++j)
+  {
+    if (!inside[j])
+      continue;
+    SortedKey sorted;
+    sorted.key = octomap::OcTreeKey(keys[0][j], keys[1][j], keys[2][j]);
+    sorted.morton = spreadBits(sorted.key[0]) | (spreadBits(sorted.key[1]) << 1) | (spreadBits(sorted.key[2]) << 2);
+    sorted.index = j;
+    sorted_.push_back(sorted);
+  }
+  std::sort(sorted_.begin(), sorted_.end());
+}
+
+bool PointQuery::bounds(octomap::OcTreeKey* min, octomap::OcTreeKey* max) const
+{
+  if (sorted_.empty())
+    return false;
+  *min = *max = sorted_.front().key;
+  for (const SortedKey& sorted : sorted_)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      (*min)[i] = std::min((*min)[i], sorted.key[i]);
+      (*max)[i] = std::max((*max)[i], sorted.key[i]);
+    }
+  }
+  return true;
+}
+
+unsigned int PointQuery::sharedLevels(uint64_t a, uint64_t b)
+{
+  const uint64_t diff = a ^ b;
+  unsigned int levels = 0;
+  while (levels < TREE_DEPTH && ((diff >> (3 * (TREE_DEPTH - 1 - levels))) & 7) == 0)
+  {
+    ++levels;
+  }
+  return levels;
+}
+
+}  // namespace octomap_server
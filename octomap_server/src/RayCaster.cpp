@@ -0,0 +1,120 @@
+#include <octomap_server/RayCaster.h>
+
+#include <cmath>
+
+namespace octomap_server {
+
+RayCaster::RayCaster(double resolution, unsigned int tree_depth)
+  : resolution_(resolution), tree_depth_(tree_depth), tree_max_val_(1 << (tree_depth - 1))
+{
+}
+
+bool RayCaster::makeRays(const std::vector<geometry_msgs::Point>& origins,
+                         const std::vector<geometry_msgs::Vector3>& directions, std::vector<Ray>* rays)
+{
+  if (origins.size() != 1 && origins.size() != directions.size())
+    return false;
+  rays->resize(directions.size());
+  for (size_t i = 0; i < directions.size(); ++i)
+  {
+    const geometry_msgs::Point& origin = origins.size() == 1 ? origins[0] : origins[i];
+    (*rays)[i].origin = octomap::point3d(origin.x, origin.y, origin.z);
+    (*rays)[i].direction = octomap::point3d(directions[i].x, directions[i].y, directions[i].z);
+  }
+  return true;
+}
+
+bool RayCaster::enter(const Ray& ray, double max_t, octomap::OcTreeKey* key, double* t) const
+{
+  // Clip the ray to the bounds of the tree
+  const double bound = tree_max_val_ * resolution_;
+  double t_min = 0.0;
+  double t_max = max_t;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const double origin = ray.origin(i);
+    const double direction = ray.direction(i);
+    if (direction == 0.0)
+    {
+      if (origin < -bound || origin >= bound)
+        return false;
+      continue;
+    }
+    double t_low = (-bound - origin) / direction;
+    double t_high = (bound - origin) / direction;
+    if (t_low > t_high)
+      std::swap(t_low, t_high);
+    t_min = std::max(t_min, t_low);
+    t_max = std::min(t_max, t_high);
+  }
+  if (t_min > t_max)
+    return false;
+
+  // Same as coordToKey(), kept inside of the tree at the clipped ends
+  const double resolution_factor = 1.0 / resolution_;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const double coord = ray.origin(i) + ray.direction(i) * t_min;
+    const int k = static_cast<int>(std::floor(resolution_factor * coord)) + tree_max_val_;
+    (*key)[i] = std::min(std::max(k, 0), 2 * tree_max_val_ - 1);
+  }
+  *t = t_min;
+  return true;
+}
+
+bool RayCaster::step(const Ray& ray, unsigned int depth, octomap::OcTreeKey* key, double* t) const
+{
+  // Cube of the node, in keys
+  const int size = 1 << (tree_depth_ - depth);
+  int min_key[3];
+  double t_exit[3];
+  double t_next = std::numeric_limits<double>::infinity();
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    min_key[i] = (*key)[i] & ~(size - 1);
+    const double direction = ray.direction(i);
+    if (direction > 0.0)
+      t_exit[i] = ((min_key[i] + size - tree_max_val_) * resolution_ - ray.origin(i)) / direction;
+    else if (direction < 0.0)
+      t_exit[i] = ((min_key[i] - tree_max_val_) * resolution_ - ray.origin(i)) / direction;
+    else
+      t_exit[i] = std::numeric_limits<double>::infinity();
+    t_next = std::min(t_next, t_exit[i]);
+  }
+  if (std::isinf(t_next))
+    return false;
+  t_next = std::max(*t, t_next);
+
+  // Step over the faces the ray leaves through. On the other axes, move to
+  // the voxel at t_next, but never backwards and never out of the cube, so
+  // rounding can not make the ray go round in circles.
+  const double resolution_factor = 1.0 / resolution_;
+  octomap::OcTreeKey next = *key;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const double direction = ray.direction(i);
+    if (t_exit[i] <= t_next)
+    {
+      const int k = direction > 0.0 ? min_key[i] + size : min_key[i] - 1;
+      if (k < 0 || k >= 2 * tree_max_val_)
+      {
+        // the ray ends at the bounds of the tree
+        *t = t_next;
+        return false;
+      }
+      next[i] = k;
+    }
+    else if (direction != 0.0)
+    {
+      const double coord = ray.origin(i) + direction * t_next;
+      int k = static_cast<int>(std::floor(resolution_factor * coord)) + tree_max_val_;
+      k = direction > 0.0 ? std::max(k, int((*key)[i])) : std::min(k, int((*key)[i]));
+      next[i] = std::min(std::max(k, min_key[i]), min_key[i] + size - 1);
+    }
+  }
+  *key = next;
+  *t = t_next;
+  return true;
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,252 @@
+#include <octomap_server/RegionSet.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace octomap_server {
+
+RegionSet::RegionSet()
+{
+}
+
+void RegionSet::addBox(const octomap::point3d& min, const octomap::point3d& max)
+{
+  Box box;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    box.min[i] = min(i);
+    box.max[i] = max(i);
+  }
+  boxes_.push_back(box);
+}
+
+void RegionSet::addOrientedBox(const octomap::point3d& center, const double* rotation, const octomap::point3d& size)
+{
+  double norm = std::sqrt(rotation[0] * rotation[0] + rotation[1] * rotation[1] + rotation[2] * rotation[2]
+                          + rotation[3] * rotation[3]);
+  if (norm <= 0.0)
+  {
+    norm = 1.0;
+  }
+  const double w = rotation[0] / norm, x = rotation[1] / norm, y = rotation[2] / norm, z = rotation[3] / norm;
+  // the columns of the rotation matrix
+  const double axes[3][3] = { { 1 - 2 * (y * y + z * z), 2 * (x * y + w * z), 2 * (x * z - w * y) },
+                              { 2 * (x * y - w * z), 1 - 2 * (x * x + z * z), 2 * (y * z + w * x) },
+                              { 2 * (x * z + w * y), 2 * (y * z - w * x), 1 - 2 * (x * x + y * y) } };
+  OrientedBox box;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    box.center[i] = center(i);
+    box.half_size[i] = std::fabs(size(i)) / 2;
+    for (unsigned int j = 0; j < 3; ++j)
+    {
+      box.axes[i][j] = axes[i][j];
+    }
+  }
+  oriented_boxes_.push_back(box);
+}
+
+void RegionSet::addPrism(const std::vector<octomap::point3d>& polygon, double min_z, double max_z)
+{
+  if (polygon.size() < 3)
+  {
+    return;
+  }
+  Prism prism;
+  prism.min[0] = prism.min[1] = std::numeric_limits<double>::max();
+  prism.max[0] = prism.max[1] = -std::numeric_limits<double>::max();
+  for (const octomap::point3d& vertex : polygon)
+  {
+    prism.xy.push_back(vertex.x());
+    prism.xy.push_back(vertex.y());
+    prism.min[0] = std::min(prism.min[0], double(vertex.x()));
+    prism.min[1] = std::min(prism.min[1], double(vertex.y()));
+    prism.max[0] = std::max(prism.max[0], double(vertex.x()));
+    prism.max[1] = std::max(prism.max[1], double(vertex.y()));
+  }
+  prism.min[2] = min_z;
+  prism.max[2] = max_z;
+  prisms_.push_back(prism);
+}
+
+bool RegionSet::bounds(octomap::point3d* min, octomap::point3d* max) const
+{
+  if (empty())
+  {
+    return false;
+  }
+  double lower[3], upper[3];
+  std::fill(lower, lower + 3, std::numeric_limits<double>::max());
+  std::fill(upper, upper + 3, -std::numeric_limits<double>::max());
+  for (const Box& box : boxes_)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      lower[i] = std::min(lower[i], box.min[i]);
+      upper[i] = std::max(upper[i], box.max[i]);
+    }
+  }
+  for (const OrientedBox& box : oriented_boxes_)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      double extent = 0.0;
+      for (unsigned int j = 0; j < 3; ++j)
+      {
+        extent += std::fabs(box.axes[j][i]) * box.half_size[j];
+      }
+      lower[i] = std::min(lower[i], box.center[i] - extent);
+      upper[i] = std::max(upper[i], box.center[i] + extent);
+    }
+  }
+  for (const Prism& prism : prisms_)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      lower[i] = std::min(lower[i], prism.min[i]);
+      upper[i] = std::max(upper[i], prism.max[i]);
+    }
+  }
+  *min = octomap::point3d(lower[0], lower[1], lower[2]);
+  *max = octomap::point3d(upper[0], upper[1], upper[2]);
+  return true;
+}
+
+RegionOverlap RegionSet::overlap(const octomap::point3d& center, double half_size, bool voxel) const
+{
+  const double c[3] = { center.x(), center.y(), center.z() };
+  // a voxel is in the union if its center is, on the boundaries included
+  if (voxel)
+  {
+    half_size = 0.0;
+  }
+  bool partial = false;
+  for (const Box& box : boxes_)
+  {
+    const RegionOverlap o = overlap(box, c, half_size);
+    if (o == RegionOverlap::INSIDE)
+      return o;
+    partial = partial || o == RegionOverlap::PARTIAL;
+  }
+  for (const OrientedBox& box : oriented_boxes_)
+  {
+    const RegionOverlap o = overlap(box, c, half_size);
+    if (o == RegionOverlap::INSIDE)
+      return o;
+    partial = partial || o == RegionOverlap::PARTIAL;
+  }
+  for (const Prism& prism : prisms_)
+  {
+    const RegionOverlap o = overlap(prism, c, half_size);
+    if (o == RegionOverlap::INSIDE)
+      return o;
+    partial = partial || o == RegionOverlap::PARTIAL;
+  }
+  if (voxel)
+  {
+    return partial ? RegionOverlap::INSIDE : RegionOverlap::OUTSIDE;
+  }
+  // Partly in several regions can still be entirely in their union, the
+  // children tell
+  return partial ? RegionOverlap::PARTIAL : RegionOverlap::OUTSIDE;
+}
+
+RegionOverlap RegionSet::overlap(const Box& box, const double* center, double half_size)
+{
+  bool inside = true;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (center[i] - half_size > box.max[i] || center[i] + half_size < box.min[i])
+      return RegionOverlap::OUTSIDE;
+    inside = inside && center[i] - half_size >= box.min[i] && center[i] + half_size <= box.max[i];
+  }
+  return inside ? RegionOverlap::INSIDE : RegionOverlap::PARTIAL;
+}
+
+RegionOverlap RegionSet::overlap(const OrientedBox& box, const double* center, double half_size)
+{
+  // Separating axes of the box only: a cube reported PARTIAL may still miss
+  // the box, its children sort that out
+  const double d[3] = { center[0] - box.center[0], center[1] - box.center[1], center[2] - box.center[2] };
+  bool inside = true;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const double* axis = box.axes[i];
+    const double p = std::fabs(axis[0] * d[0] + axis[1] * d[1] + axis[2] * d[2]);
+    const double r = half_size * (std::fabs(axis[0]) + std::fabs(axis[1]) + std::fabs(axis[2]));
+    if (p - r > box.half_size[i])
+      return RegionOverlap::OUTSIDE;
+    inside = inside && p + r <= box.half_size[i];
+  }
+  return inside ? RegionOverlap::INSIDE : RegionOverlap::PARTIAL;
+}
+
+RegionOverlap RegionSet::overlap(const Prism& prism, const double* center, double half_size)
+{
+  // bounding box of the prism first
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (center[i] - half_size > prism.max[i] || center[i] + half_size < prism.min[i])
+      return RegionOverlap::OUTSIDE;
+  }
+  const bool inside_z = center[2] - half_size >= prism.min[2] && center[2] + half_size <= prism.max[2];
+  // A square no edge crosses is either entirely inside or entirely outside
+  // of the polygon
+  const size_t n = prism.xy.size() / 2;
+  for (size_t i = 0, j = n - 1; i < n; j = i++)
+  {
+    if (segmentHitsSquare(prism.xy[2 * j], prism.xy[2 * j + 1], prism.xy[2 * i], prism.xy[2 * i + 1], center,
+                          half_size))
+      return RegionOverlap::PARTIAL;
+  }
+  if (!contains(prism, center[0], center[1]))
+    return RegionOverlap::OUTSIDE;
+  return inside_z ? RegionOverlap::INSIDE : RegionOverlap::PARTIAL;
+}
+
+bool RegionSet::contains(const Prism& prism, double x, double y)
+{
+  // crossings of a ray towards +x
+  bool inside = false;
+  const size_t n = prism.xy.size() / 2;
+  for (size_t i = 0, j = n - 1; i < n; j = i++)
+  {
+    const double xi = prism.xy[2 * i], yi = prism.xy[2 * i + 1];
+    const double xj = prism.xy[2 * j], yj = prism.xy[2 * j + 1];
+    if ((yi > y) != (yj > y) && x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+      inside = !inside;
+  }
+  return inside;
+}
+
+bool RegionSet::segmentHitsSquare(double x0, double y0, double x1, double y1, const double* center,
+                                  double half_size)
+{
+  // Liang-Barsky clipping of the segment to the square
+  const double p[4] = { -(x1 - x0), x1 - x0, -(y1 - y0), y1 - y0 };
+  const double q[4] = { x0 - (center[0] - half_size), (center[0] + half_size) - x0,
+                        y0 - (center[1] - half_size), (center[1] + half_size) - y0 };
+  double t0 = 0.0, t1 = 1.0;
+  for (unsigned int i = 0; i < 4; ++i)
+  {
+    if (p[i] == 0.0)
+    {
+      if (q[i] < 0.0)
+        return false;
+    }
+    else
+    {
+      const double t = q[i] / p[i];
+      if (p[i] < 0.0)
+        t0 = std::max(t0, t);
+      else
+        t1 = std::min(t1, t);
+      if (t0 > t1)
+        return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace octomap_server
@@ -325,18 +325,9 @@ void SensorUpdateKeyMapHashImpl::doubleCapacity()
     Node* node = old_table[i];
     while (node)
     {
-      if (node->value == voxel_state::FREE)
-      {
-        insertFree(node->key);
-      }
-      else if (node->value == voxel_state::OCCUPIED)
-      {
-        insertOccupied(node->key);
-      }
-      else if (node->value == voxel_state::INNER)
-      {
-        insertInner(node->key);
-      }
+      // Down sampled layers also hold inner nodes with free and/or occupied
+      // bits, keep every state as is
+      insert(node->key, node->value);
       node = node->next;
     }
   }
@@ -0,0 +1,164 @@
+#include <octomap_server/SharedMapWriter.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <ros/ros.h>
+
+namespace octomap_server {
+
+SharedMapWriter::SharedMapWriter()
+  : data_(NULL),
+    size_(0),
+    map_version_(0)
+{
+}
+
+SharedMapWriter::~SharedMapWriter()
+{
+  close();
+}
+
+bool SharedMapWriter::open(const std::string& name, size_t slot_size)
+{
+  close();
+  slot_size = (std::max(slot_size, sizeof(SharedMapSlot)) + 63) / 64 * 64;
+  // Readers of a segment left behind keep their mapping of it
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+  {
+    ROS_ERROR("Unable to create shared memory segment %s: %s", name.c_str(), strerror(errno));
+    return false;
+  }
+  const size_t size = sharedMapSlotOffset(slot_size, 2);
+  if (ftruncate(fd, size) != 0)
+  {
+    ROS_ERROR("Unable to size shared memory segment %s to %zu bytes: %s", name.c_str(), size, strerror(errno));
+    ::close(fd);
+    shm_unlink(name.c_str());
+    return false;
+  }
+  void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED)
+  {
+    ROS_ERROR("Unable to map shared memory segment %s: %s", name.c_str(), strerror(errno));
+    shm_unlink(name.c_str());
+    return false;
+  }
+  name_ = name;
+  data_ = data;
+  size_ = size;
+  map_version_ = 0;
+
+  // The segment is zero filled. The magic number goes last, readers that
+  // see it see the rest of the header.
+  SharedMapHeader* h = new (data_) SharedMapHeader;
+  h->magic.store(0, std::memory_order_relaxed);
+  h->layout_version = SHARED_MAP_LAYOUT_VERSION;
+  h->slot_size = slot_size;
+  h->generation.store(0, std::memory_order_relaxed);
+  h->closed.store(0, std::memory_order_relaxed);
+  for (unsigned int i = 0; i < 2; ++i)
+  {
+    SharedMapSlot* slot = new (static_cast<char*>(data_) + sharedMapSlotOffset(slot_size, i)) SharedMapSlot;
+    slot->sequence.store(0, std::memory_order_relaxed);
+  }
+  h->magic.store(SHARED_MAP_MAGIC, std::memory_order_release);
+  return true;
+}
+
+void SharedMapWriter::close()
+{
+  if (!data_)
+    return;
+  header()->closed.store(1, std::memory_order_release);
+  munmap(data_, size_);
+  shm_unlink(name_.c_str());
+  data_ = NULL;
+  size_ = 0;
+}
+
+bool SharedMapWriter::write(const nav_msgs::OccupancyGrid* grid, const octomap_msgs::Octomap* octree,
+                            uint64_t map_version, const std::string& frame_id, const ros::Time& stamp)
+{
+  if (!data_)
+    return false;
+  const size_t slot_size = header()->slot_size;
+  const size_t grid_offset = (sizeof(SharedMapSlot) + 63) / 64 * 64;
+  const size_t grid_size = grid ? grid->data.size() : 0;
+  const size_t octree_offset = (grid_offset + grid_size + 63) / 64 * 64;
+  const size_t octree_size = octree ? octree->data.size() : 0;
+  if (octree_offset + octree_size > slot_size)
+  {
+    ROS_ERROR_THROTTLE(10.0, "Map of %zu bytes does not fit the shared memory slots of %zu bytes, not exported",
+                       octree_offset + octree_size, slot_size);
+    return false;
+  }
+
+  // Write the slot the readers are not pointed at
+  const uint64_t generation = header()->generation.load(std::memory_order_relaxed) + 1;
+  char* base = static_cast<char*>(data_) + sharedMapSlotOffset(slot_size, (generation - 1) % 2);
+  SharedMapSlot* slot = reinterpret_cast<SharedMapSlot*>(base);
+  const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed);
+  slot->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  slot->generation = generation;
+  slot->map_version = map_version;
+  slot->stamp_sec = stamp.sec;
+  slot->stamp_nsec = stamp.nsec;
+  std::strncpy(slot->frame_id, frame_id.c_str(), sizeof(slot->frame_id) - 1);
+  slot->frame_id[sizeof(slot->frame_id) - 1] = '\0';
+
+  slot->grid_offset = grid_offset;
+  slot->grid_size = grid_size;
+  if (grid)
+  {
+    slot->grid_width = grid->info.width;
+    slot->grid_height = grid->info.height;
+    slot->grid_resolution = grid->info.resolution;
+    const geometry_msgs::Pose& origin = grid->info.origin;
+    slot->grid_origin_position[0] = origin.position.x;
+    slot->grid_origin_position[1] = origin.position.y;
+    slot->grid_origin_position[2] = origin.position.z;
+    slot->grid_origin_orientation[0] = origin.orientation.x;
+    slot->grid_origin_orientation[1] = origin.orientation.y;
+    slot->grid_origin_orientation[2] = origin.orientation.z;
+    slot->grid_origin_orientation[3] = origin.orientation.w;
+    // A grid being resized can be short of width * height cells
+    if (uint64_t(grid->info.width) * grid->info.height > grid_size)
+      slot->grid_width = slot->grid_height = 0;
+    std::copy(grid->data.begin(), grid->data.end(), reinterpret_cast<int8_t*>(base + grid_offset));
+  }
+  else
+  {
+    slot->grid_width = slot->grid_height = 0;
+    slot->grid_resolution = 0.0f;
+  }
+
+  slot->octree_offset = octree_offset;
+  slot->octree_size = octree_size;
+  if (octree)
+  {
+    std::strncpy(slot->octree_id, octree->id.c_str(), sizeof(slot->octree_id) - 1);
+    slot->octree_id[sizeof(slot->octree_id) - 1] = '\0';
+    slot->octree_resolution = octree->resolution;
+    std::copy(octree->data.begin(), octree->data.end(), base + octree_offset);
+  }
+  else
+  {
+    slot->octree_id[0] = '\0';
+    slot->octree_resolution = 0.0;
+  }
+
+  slot->sequence.store(sequence + 2, std::memory_order_release);
+  header()->generation.store(generation, std::memory_order_release);
+  map_version_ = map_version;
+  return true;
+}
+
+}  // namespace octomap_server
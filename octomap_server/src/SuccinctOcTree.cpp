@@ -0,0 +1,408 @@
+#include <octomap_server/SuccinctOcTree.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+namespace octomap_server {
+
+const char* const SuccinctOcTree::FILE_EXTENSION = ".sbt";
+
+static const char* const SUCCINCT_FILE_HEADER = "# Octomap succinct tree file";
+
+SuccinctOcTree::SuccinctOcTree()
+  : data_(NULL), size_(0), resolution_(0.0), tree_depth_(0), tree_max_val_(0), occupancy_threshold_(0.0f),
+    num_nodes_(0), num_inner_(0), inner_bits_(NULL), inner_ranks_(NULL), child_bits_(NULL), child_ranks_(NULL),
+    leaf_values_(NULL)
+{
+}
+
+SuccinctOcTree::~SuccinctOcTree()
+{
+  close();
+}
+
+void SuccinctOcTree::buildRanks(const std::vector<uint64_t>& words, uint64_t bits, std::vector<uint64_t>* ranks)
+{
+  ranks->assign(numRanks(bits), 0);
+  uint64_t rank = 0;
+  for (size_t w = 0; w < words.size(); ++w)
+  {
+    if (w % RANK_BLOCK_WORDS == 0)
+    {
+      (*ranks)[w / RANK_BLOCK_WORDS] = rank;
+    }
+    rank += __builtin_popcountll(words[w]);
+  }
+  // a rank at the very end of a full last block
+  if (words.size() % RANK_BLOCK_WORDS == 0 && words.size() / RANK_BLOCK_WORDS < ranks->size())
+  {
+    (*ranks)[words.size() / RANK_BLOCK_WORDS] = rank;
+  }
+}
+
+bool SuccinctOcTree::Builder::write(std::ostream& s, const std::string& id, double resolution,
+                                    unsigned int tree_depth, float occupancy_threshold)
+{
+  std::vector<uint64_t> inner_ranks, child_ranks;
+  buildRanks(inner_bits_, num_nodes_, &inner_ranks);
+  buildRanks(child_bits_, 8 * num_inner_, &child_ranks);
+
+  std::ostringstream header;
+  header << SUCCINCT_FILE_HEADER << "\n";
+  header << "id " << id << "\n";
+  header << "res " << resolution << "\n";
+  header << "depth " << tree_depth << "\n";
+  header << "occupancy_threshold " << occupancy_threshold << "\n";
+  header << "nodes " << num_nodes_ << "\n";
+  header << "inner " << num_inner_ << "\n";
+  header << "data\n";
+  std::string header_str = header.str();
+  // Keep the sections aligned for mapping
+  header_str.resize((header_str.size() + 7) / 8 * 8, '\n');
+  s.write(header_str.data(), header_str.size());
+
+  inner_bits_.resize(numWords(num_nodes_), 0);
+  child_bits_.resize(numWords(8 * num_inner_), 0);
+  s.write(reinterpret_cast<const char*>(inner_bits_.data()), inner_bits_.size() * sizeof(uint64_t));
+  s.write(reinterpret_cast<const char*>(inner_ranks.data()), inner_ranks.size() * sizeof(uint64_t));
+  s.write(reinterpret_cast<const char*>(child_bits_.data()), child_bits_.size() * sizeof(uint64_t));
+  s.write(reinterpret_cast<const char*>(child_ranks.data()), child_ranks.size() * sizeof(uint64_t));
+  s.write(reinterpret_cast<const char*>(leaf_values_.data()), leaf_values_.size() * sizeof(float));
+  return s.good();
+}
+
+bool SuccinctOcTree::open(const std::string& filename)
+{
+  close();
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    ROS_ERROR("Unable to open %s: %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    ROS_ERROR("Unable to read %s", filename.c_str());
+    ::close(fd);
+    return false;
+  }
+  void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  // the mapping stays valid after closing the file
+  ::close(fd);
+  if (data == MAP_FAILED)
+  {
+    ROS_ERROR("Unable to map %s: %s", filename.c_str(), strerror(errno));
+    return false;
+  }
+  data_ = static_cast<const char*>(data);
+  size_ = st.st_size;
+
+  // Parse the header lines in place
+  const char* pos = data_;
+  const char* end = data_ + size_;
+  bool found_data = false, first_line = true, have_res = false, have_nodes = false, have_inner = false;
+  tree_depth_ = 16;
+  while (pos < end && !found_data)
+  {
+    const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+    if (!eol)
+    {
+      break;
+    }
+    const std::string line(pos, eol);
+    pos = eol + 1;
+    if (first_line)
+    {
+      first_line = false;
+      if (line.compare(0, strlen(SUCCINCT_FILE_HEADER), SUCCINCT_FILE_HEADER) != 0)
+      {
+        break;
+      }
+      continue;
+    }
+    std::istringstream ss(line);
+    std::string token;
+    ss >> token;
+    if (token == "id")
+    {
+      ss >> id_;
+    }
+    else if (token == "res")
+    {
+      have_res = static_cast<bool>(ss >> resolution_);
+    }
+    else if (token == "depth")
+    {
+      ss >> tree_depth_;
+    }
+    else if (token == "occupancy_threshold")
+    {
+      ss >> occupancy_threshold_;
+    }
+    else if (token == "nodes")
+    {
+      have_nodes = static_cast<bool>(ss >> num_nodes_);
+    }
+    else if (token == "inner")
+    {
+      have_inner = static_cast<bool>(ss >> num_inner_);
+    }
+    else if (token == "data")
+    {
+      found_data = true;
+    }
+  }
+  if (!found_data || !have_res || !have_nodes || !have_inner || id_.empty() || tree_depth_ == 0 ||
+      tree_depth_ > 16 || num_inner_ > num_nodes_)
+  {
+    ROS_ERROR("Unable to parse the header of %s", filename.c_str());
+    close();
+    return false;
+  }
+  tree_max_val_ = 1 << (tree_depth_ - 1);
+
+  // The sections follow the padding of the header
+  while (pos < end && *pos == '\n' && (pos - data_) % 8 != 0)
+  {
+    ++pos;
+  }
+  const uint64_t offset = pos - data_;
+  const uint64_t expected_size = offset +
+      sizeof(uint64_t) * (numWords(num_nodes_) + numRanks(num_nodes_) +
+                          numWords(8 * num_inner_) + numRanks(8 * num_inner_)) +
+      sizeof(float) * (num_nodes_ - num_inner_);
+  if (offset % 8 != 0 || size_ != expected_size)
+  {
+    ROS_ERROR("Unable to parse %s, expected %lu bytes but the file has %zu", filename.c_str(),
+              (unsigned long)expected_size, size_);
+    close();
+    return false;
+  }
+  const uint64_t* words = reinterpret_cast<const uint64_t*>(pos);
+  inner_bits_ = words;
+  words += numWords(num_nodes_);
+  inner_ranks_ = words;
+  words += numRanks(num_nodes_);
+  child_bits_ = words;
+  words += numWords(8 * num_inner_);
+  child_ranks_ = words;
+  words += numRanks(8 * num_inner_);
+  leaf_values_ = reinterpret_cast<const float*>(words);
+
+  // Queries jump around the file
+  madvise(const_cast<char*>(data_), size_, MADV_RANDOM);
+  return true;
+}
+
+void SuccinctOcTree::close()
+{
+  if (data_)
+  {
+    munmap(const_cast<char*>(data_), size_);
+  }
+  data_ = NULL;
+  size_ = 0;
+  id_.clear();
+  num_nodes_ = 0;
+  num_inner_ = 0;
+  inner_bits_ = inner_ranks_ = child_bits_ = child_ranks_ = NULL;
+  leaf_values_ = NULL;
+}
+
+bool SuccinctOcTree::coordToKeyChecked(const octomap::point3d& coord, octomap::OcTreeKey* key) const
+{
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const int scaled = static_cast<int>(std::floor(coord(i) / resolution_));
+    if (scaled < -static_cast<int>(tree_max_val_) || scaled >= static_cast<int>(tree_max_val_))
+    {
+      return false;
+    }
+    (*key)[i] = scaled + tree_max_val_;
+  }
+  return true;
+}
+
+octomap::point3d SuccinctOcTree::keyToCoord(const octomap::OcTreeKey& key, unsigned int depth) const
+{
+  octomap::point3d coord;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (depth >= tree_depth_)
+    {
+      coord(i) = (static_cast<double>(static_cast<int>(key[i]) - static_cast<int>(tree_max_val_)) + 0.5) *
+                 resolution_;
+    }
+    else if (depth == 0)
+    {
+      coord(i) = 0.0;
+    }
+    else
+    {
+      // center of the node holding key at depth
+      const unsigned int shift = tree_depth_ - depth;
+      const int node_size = 1 << shift;
+      const int base = static_cast<int>((key[i] >> shift) << shift) - static_cast<int>(tree_max_val_);
+      coord(i) = (base + node_size / 2.0) * resolution_;
+    }
+  }
+  return coord;
+}
+
+bool SuccinctOcTree::search(const octomap::OcTreeKey& key, float* log_odds, unsigned int* depth) const
+{
+  if (num_nodes_ == 0)
+  {
+    return false;
+  }
+  uint64_t node = 0;
+  unsigned int d = 0;
+  while (hasChildren(node))
+  {
+    const uint64_t inner = innerRank(node);
+    const uint8_t mask = childMask(inner);
+    const unsigned int pos = octomap::computeChildIdx(key, tree_depth_ - 1 - d);
+    if (!(mask & (1 << pos)))
+    {
+      if (depth)
+      {
+        *depth = d + 1;
+      }
+      return false;
+    }
+    // children are numbered in the order of their bits
+    node = firstChild(inner) + __builtin_popcount(mask & ((1 << pos) - 1));
+    d++;
+  }
+  *log_odds = leafValue(node);
+  if (depth)
+  {
+    *depth = d;
+  }
+  return true;
+}
+
+void SuccinctOcTree::writeBinaryRecurs(uint64_t node, std::vector<int8_t>* data) const
+{
+  const uint64_t inner = innerRank(node);
+  const uint8_t mask = childMask(inner);
+  const uint64_t first_child = firstChild(inner);
+
+  // 2 bits per child: 01 free leaf, 10 occupied leaf, 11 inner node
+  uint16_t bits = 0;
+  uint64_t child = first_child;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (mask & (1 << i))
+    {
+      if (hasChildren(child))
+      {
+        bits |= 3 << (2 * i);
+      }
+      else if (isOccupied(leafValue(child)))
+      {
+        bits |= 2 << (2 * i);
+      }
+      else
+      {
+        bits |= 1 << (2 * i);
+      }
+      child++;
+    }
+  }
+  data->push_back(static_cast<int8_t>(bits & 0xff));
+  data->push_back(static_cast<int8_t>(bits >> 8));
+
+  child = first_child;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (mask & (1 << i))
+    {
+      if (hasChildren(child))
+      {
+        writeBinaryRecurs(child, data);
+      }
+      child++;
+    }
+  }
+}
+
+float SuccinctOcTree::writeFullRecurs(uint64_t node, std::vector<int8_t>* data) const
+{
+  // the value of an inner node is the maximum of its children, known only
+  // once they are written, so it is filled in afterwards
+  const size_t value_pos = data->size();
+  data->resize(value_pos + sizeof(float) + 1);
+  float value;
+  if (!hasChildren(node))
+  {
+    value = leafValue(node);
+    (*data)[value_pos + sizeof(float)] = 0;
+  }
+  else
+  {
+    const uint64_t inner = innerRank(node);
+    const uint8_t mask = childMask(inner);
+    (*data)[value_pos + sizeof(float)] = static_cast<int8_t>(mask);
+    value = -std::numeric_limits<float>::max();
+    uint64_t child = firstChild(inner);
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (mask & (1 << i))
+      {
+        value = std::max(value, writeFullRecurs(child, data));
+        child++;
+      }
+    }
+  }
+  memcpy(&(*data)[value_pos], &value, sizeof(float));
+  return value;
+}
+
+bool SuccinctOcTree::binaryMapToMsg(octomap_msgs::Octomap& msg) const
+{
+  msg.data.clear();
+  msg.id = id_;
+  msg.resolution = resolution_;
+  msg.binary = true;
+  if (num_nodes_ > 0)
+  {
+    if (hasChildren(0))
+    {
+      // a mask of 2 bits per node for about 1.14 nodes per inner node
+      msg.data.reserve(2 * num_inner_);
+      writeBinaryRecurs(0, &msg.data);
+    }
+    else
+    {
+      msg.data.assign(2, 0);
+    }
+  }
+  return true;
+}
+
+bool SuccinctOcTree::fullMapToMsg(octomap_msgs::Octomap& msg) const
+{
+  msg.data.clear();
+  msg.id = id_;
+  msg.resolution = resolution_;
+  msg.binary = false;
+  if (num_nodes_ > 0)
+  {
+    msg.data.reserve((sizeof(float) + 1) * num_nodes_);
+    writeFullRecurs(0, &msg.data);
+  }
+  return true;
+}
+
+}  // namespace octomap_server
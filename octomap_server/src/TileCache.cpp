@@ -0,0 +1,455 @@
+#include <octomap_server/TileCache.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ros/ros.h>
+
+namespace octomap_server {
+
+static const char* const TILE_PREFIX = "tile_";
+static const char* const TILE_SUFFIX = ".bin";
+// Allocator overhead per node, and the children array of the inner nodes
+// (8 pointers for about every 8 nodes)
+static const size_t NODE_OVERHEAD = 16 + sizeof(void*);
+// Evict down to this fraction of the budget, so the next cycles do not
+// evict again right away
+static const double EVICT_TARGET = 0.9;
+
+TileCache::TileCache()
+  : tile_depth_(0),
+    memory_budget_(0),
+    clock_(1),
+    generation_(0),
+    reading_(false),
+    track_paging_(false)
+{
+}
+
+TileCache::~TileCache()
+{
+  waitForPrefetch();
+}
+
+void TileCache::configure(const std::string& directory, unsigned int tile_depth, size_t memory_budget)
+{
+  clear();
+  directory_ = directory;
+  tile_depth_ = tile_depth;
+  memory_budget_ = memory_budget;
+  if (directory_.empty())
+  {
+    return;
+  }
+  if (mkdir(directory_.c_str(), 0755) != 0 && errno != EEXIST)
+  {
+    ROS_ERROR("Unable to create tile directory %s: %s", directory_.c_str(), strerror(errno));
+  }
+}
+
+size_t TileCache::memoryUsage(const OcTreeStampedWithExpiry& tree)
+{
+  return tree.size() * (sizeof(OcTreeStampedWithExpiry::NodeType) + NODE_OVERHEAD);
+}
+
+octomap::key_type TileCache::tileMask(const OcTreeStampedWithExpiry& tree) const
+{
+  const unsigned int shift = tree.getTreeDepth() - std::min(tile_depth_, tree.getTreeDepth());
+  return static_cast<octomap::key_type>(~((1u << shift) - 1));
+}
+
+octomap::OcTreeKey TileCache::tileKey(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& key) const
+{
+  const octomap::key_type mask = tileMask(tree);
+  return octomap::OcTreeKey(key[0] & mask, key[1] & mask, key[2] & mask);
+}
+
+bool TileCache::overlaps(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& tile,
+                         const octomap::OcTreeKey& min, const octomap::OcTreeKey& max) const
+{
+  const uint32_t last = static_cast<octomap::key_type>(~tileMask(tree));
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (tile[i] > max[i] || tile[i] + last < min[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string TileCache::tileFilename(const octomap::OcTreeKey& tile) const
+{
+  std::ostringstream ss;
+  ss << directory_ << "/" << TILE_PREFIX << tile[0] << "_" << tile[1] << "_" << tile[2] << TILE_SUFFIX;
+  return ss.str();
+}
+
+void TileCache::touch(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min,
+                      const octomap::OcTreeKey& max)
+{
+  if (!isEnabled())
+  {
+    return;
+  }
+  const octomap::OcTreeKey first = tileKey(tree, min);
+  const octomap::OcTreeKey last = tileKey(tree, max);
+  const uint32_t step = static_cast<octomap::key_type>(~tileMask(tree)) + 1;
+  for (uint32_t x = first[0]; x <= last[0]; x += step)
+  {
+    for (uint32_t y = first[1]; y <= last[1]; y += step)
+    {
+      for (uint32_t z = first[2]; z <= last[2]; z += step)
+      {
+        last_used_[octomap::OcTreeKey(x, y, z)] = clock_;
+      }
+    }
+  }
+}
+
+bool TileCache::loadTile(OcTreeStampedWithExpiry* tree, TileMap::iterator it, uint64_t used)
+{
+  const octomap::OcTreeKey tile = it->first;
+  const std::string filename = tileFilename(tile);
+  std::ifstream s(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  const bool ok = s.is_open() && tree->readSubtree(s, tile, tile_depth_);
+  if (!ok)
+  {
+    ROS_ERROR("Unable to read tile %s, its part of the map is lost", filename.c_str());
+  }
+  evicted_.erase(it);
+  last_used_[tile] = used;
+  unlink(filename.c_str());
+  if (track_paging_)
+  {
+    paged_.push_back(tile);
+  }
+  return ok;
+}
+
+size_t TileCache::load(OcTreeStampedWithExpiry* tree, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max)
+{
+  return loadTiles(tree, min, max, clock_);
+}
+
+size_t TileCache::loadTiles(OcTreeStampedWithExpiry* tree, const octomap::OcTreeKey& min,
+                            const octomap::OcTreeKey& max, uint64_t used)
+{
+  size_t loaded = 0;
+  for (TileMap::iterator it = evicted_.begin(); it != evicted_.end();)
+  {
+    TileMap::iterator next = it;
+    ++next;
+    if (overlaps(*tree, it->first, min, max) && loadTile(tree, it, used))
+    {
+      loaded++;
+    }
+    it = next;
+  }
+  if (loaded > 0)
+  {
+    ROS_DEBUG("Paged in %zu tiles, %zu remain on disk", loaded, evicted_.size());
+  }
+  return loaded;
+}
+
+size_t TileCache::loadAll(OcTreeStampedWithExpiry* tree)
+{
+  if (evicted_.empty())
+  {
+    return 0;
+  }
+  // Least recently used, so the next eviction takes them first
+  const octomap::key_type max_key = std::numeric_limits<octomap::key_type>::max();
+  return loadTiles(tree, octomap::OcTreeKey(0, 0, 0), octomap::OcTreeKey(max_key, max_key, max_key), 0);
+}
+
+void TileCache::prefetch(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min,
+                         const octomap::OcTreeKey& max)
+{
+  // The tiles read last time are grafted first
+  if (reading_ || !prefetched_.empty())
+  {
+    return;
+  }
+  for (const TileMap::value_type& tile : evicted_)
+  {
+    if (overlaps(tree, tile.first, min, max))
+    {
+      PrefetchedTile prefetched;
+      prefetched.key = tile.first;
+      prefetched.generation = tile.second;
+      prefetched_.push_back(prefetched);
+    }
+  }
+  if (prefetched_.empty())
+  {
+    return;
+  }
+  waitForPrefetch();
+  reading_ = true;
+  reader_ = boost::thread(&TileCache::readTiles, this, &prefetched_);
+}
+
+void TileCache::readTiles(std::vector<PrefetchedTile>* tiles)
+{
+  for (PrefetchedTile& tile : *tiles)
+  {
+    std::ifstream s(tileFilename(tile.key).c_str(), std::ios_base::in | std::ios_base::binary);
+    std::ostringstream data;
+    if (s.is_open() && (data << s.rdbuf()))
+    {
+      tile.data = data.str();
+    }
+  }
+  reading_ = false;
+}
+
+void TileCache::waitForPrefetch()
+{
+  if (reader_.joinable())
+  {
+    reader_.join();
+  }
+}
+
+size_t TileCache::finishPrefetch(OcTreeStampedWithExpiry* tree)
+{
+  if (reading_ || prefetched_.empty())
+  {
+    return 0;
+  }
+  waitForPrefetch();
+  size_t grafted = 0;
+  for (const PrefetchedTile& tile : prefetched_)
+  {
+    TileMap::iterator it = evicted_.find(tile.key);
+    // Loaded, discarded or evicted again since it was read
+    if (it == evicted_.end() || it->second != tile.generation)
+    {
+      continue;
+    }
+    std::istringstream s(tile.data);
+    if (tile.data.empty() || !tree->readSubtree(s, tile.key, tile_depth_))
+    {
+      // Read it synchronously next time it is needed
+      continue;
+    }
+    evicted_.erase(it);
+    last_used_[tile.key] = clock_;
+    unlink(tileFilename(tile.key).c_str());
+    if (track_paging_)
+    {
+      paged_.push_back(tile.key);
+    }
+    grafted++;
+  }
+  prefetched_.clear();
+  if (grafted > 0)
+  {
+    ROS_DEBUG("Prefetched %zu tiles, %zu remain on disk", grafted, evicted_.size());
+  }
+  return grafted;
+}
+
+void TileCache::collectTilesRecurs(const OcTreeStampedWithExpiry& tree, const OcTreeStampedWithExpiry::NodeType* node,
+                                   const octomap::OcTreeKey& key, unsigned int depth,
+                                   std::vector<octomap::OcTreeKey>* tiles) const
+{
+  if (depth == tile_depth_)
+  {
+    tiles->push_back(tileKey(tree, key));
+    return;
+  }
+  // A leaf above the tile depth is small, it stays
+  if (!tree.nodeHasChildren(node))
+  {
+    return;
+  }
+  const octomap::key_type center_offset_key = octomap::computeCenterOffsetKey(depth, tree.coordToKey(0.0));
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (tree.nodeChildExists(node, i))
+    {
+      octomap::OcTreeKey child_key;
+      octomap::computeChildKey(i, center_offset_key, key, child_key);
+      collectTilesRecurs(tree, tree.getNodeChild(node, i), child_key, depth + 1, tiles);
+    }
+  }
+}
+
+size_t TileCache::evict(OcTreeStampedWithExpiry* tree, bool end_cycle)
+{
+  if (!isEnabled())
+  {
+    return 0;
+  }
+  size_t usage = memoryUsage(*tree);
+  size_t evicted = 0;
+  if (usage > memory_budget_ && tree->getRoot())
+  {
+    ros::WallTime start_time = ros::WallTime::now();
+    const octomap::key_type center = tree->coordToKey(0.0);
+    std::vector<octomap::OcTreeKey> tiles;
+    collectTilesRecurs(*tree, tree->getRoot(), octomap::OcTreeKey(center, center, center), 0, &tiles);
+
+    // Least recently used first, keeping the tiles used in this cycle. Only
+    // the resident tiles are remembered.
+    TileMap last_used;
+    std::vector<std::pair<uint64_t, octomap::OcTreeKey> > candidates;
+    for (const octomap::OcTreeKey& tile : tiles)
+    {
+      TileMap::const_iterator it = last_used_.find(tile);
+      const uint64_t used = it != last_used_.end() ? it->second : 0;
+      last_used[tile] = used;
+      if (used != clock_)
+      {
+        candidates.push_back(std::make_pair(used, tile));
+      }
+    }
+    last_used_.swap(last_used);
+    std::sort(candidates.begin(), candidates.end(),
+              [](const std::pair<uint64_t, octomap::OcTreeKey>& a, const std::pair<uint64_t, octomap::OcTreeKey>& b)
+              { return a.first < b.first; });
+
+    const size_t target = static_cast<size_t>(memory_budget_ * EVICT_TARGET);
+    const size_t node_size = sizeof(OcTreeStampedWithExpiry::NodeType) + NODE_OVERHEAD;
+    for (size_t i = 0; i < candidates.size() && usage > target; ++i)
+    {
+      const octomap::OcTreeKey& tile = candidates[i].second;
+      const std::string filename = tileFilename(tile);
+      std::ofstream s(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+      const bool written = s.is_open() && tree->writeSubtree(s, tile, tile_depth_);
+      s.close();
+      if (!written || s.fail())
+      {
+        ROS_ERROR("Error writing tile %s, not evicting any more tiles", filename.c_str());
+        unlink(filename.c_str());
+        break;
+      }
+      usage -= std::min(usage, tree->deleteSubtree(tile, tile_depth_) * node_size);
+      evicted_[tile] = ++generation_;
+      last_used_.erase(tile);
+      if (track_paging_)
+      {
+        paged_.push_back(tile);
+      }
+      evicted++;
+    }
+    if (evicted > 0)
+    {
+      ROS_INFO("Paged out %zu tiles in %f sec, %zu tiles on disk, %zu nodes in memory", evicted,
+               (ros::WallTime::now() - start_time).toSec(), evicted_.size(), tree->size());
+    }
+  }
+  if (end_cycle)
+  {
+    clock_++;
+  }
+  return evicted;
+}
+
+bool TileCache::evictedBounds(const OcTreeStampedWithExpiry& tree, octomap::point3d* min,
+                              octomap::point3d* max) const
+{
+  if (evicted_.empty())
+  {
+    return false;
+  }
+  const octomap::key_type last = static_cast<octomap::key_type>(~tileMask(tree));
+  octomap::OcTreeKey min_key = evicted_.begin()->first;
+  octomap::OcTreeKey max_key = min_key;
+  for (const TileMap::value_type& tile : evicted_)
+  {
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      min_key[i] = std::min(min_key[i], tile.first[i]);
+      max_key[i] = std::max(max_key[i], tile.first[i]);
+    }
+  }
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    max_key[i] += last;
+  }
+  *min = tree.keyToCoord(min_key);
+  *max = tree.keyToCoord(max_key);
+  return true;
+}
+
+void TileCache::discardOutside(const OcTreeStampedWithExpiry& tree, const octomap::OcTreeKey& min,
+                               const octomap::OcTreeKey& max, std::vector<octomap::OcTreeKey>* discarded)
+{
+  for (TileMap::iterator it = evicted_.begin(); it != evicted_.end();)
+  {
+    if (!overlaps(tree, it->first, min, max))
+    {
+      if (discarded)
+      {
+        discarded->push_back(it->first);
+      }
+      unlink(tileFilename(it->first).c_str());
+      it = evicted_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+void TileCache::setTrackPaging(bool enabled)
+{
+  track_paging_ = enabled;
+  paged_.clear();
+}
+
+void TileCache::takePagedTiles(std::vector<octomap::OcTreeKey>* tiles)
+{
+  tiles->insert(tiles->end(), paged_.begin(), paged_.end());
+  paged_.clear();
+}
+
+void TileCache::clear()
+{
+  waitForPrefetch();
+  prefetched_.clear();
+  for (const TileMap::value_type& tile : evicted_)
+  {
+    unlink(tileFilename(tile.first).c_str());
+  }
+  evicted_.clear();
+  last_used_.clear();
+  paged_.clear();
+}
+
+void TileCache::removeTileFiles() const
+{
+  DIR* dir = opendir(directory_.c_str());
+  if (!dir)
+  {
+    return;
+  }
+  const size_t prefix_length = strlen(TILE_PREFIX);
+  const size_t suffix_length = strlen(TILE_SUFFIX);
+  while (struct dirent* entry = readdir(dir))
+  {
+    const std::string name(entry->d_name);
+    if (name.length() > prefix_length + suffix_length && name.compare(0, prefix_length, TILE_PREFIX) == 0 &&
+        name.compare(name.length() - suffix_length, suffix_length, TILE_SUFFIX) == 0)
+    {
+      unlink((directory_ + "/" + name).c_str());
+    }
+  }
+  closedir(dir);
+}
+
+}  // namespace octomap_server
@@ -0,0 +1,545 @@
+#include <octomap_server/TiledMapWriter.h>
+
+#include <bitset>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <ros/ros.h>
+#include <octomap_server/IndexedMapFile.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+#include <octomap_server/SuccinctOcTree.h>
+
+namespace octomap_server {
+
+namespace {
+
+typedef OcTreeStampedWithExpiry::NodeType NodeType;
+
+// The encoders get the nodes of the map depth first, each with its children,
+// NULL where there is none
+
+// Binary (.bt) stream, same as writeBinaryData()
+class BinaryEncoder
+{
+public:
+  BinaryEncoder(const OcTreeStampedWithExpiry& tree, std::ostream* s) : tree_(tree), s_(s) {}
+
+  void setStream(std::ostream* s) { s_ = s; }
+
+  void visit(const NodeType* node, const NodeType* const* children, const octomap::OcTreeKey&, unsigned int depth)
+  {
+    // Leafs are written by their parent
+    if (depth > 0 && !tree_.nodeHasChildren(node))
+    {
+      return;
+    }
+    std::bitset<8> child_masks[2];
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (!children[i])
+      {
+        continue;
+      }
+      std::bitset<8>& mask = child_masks[i / 4];
+      const unsigned int bit = (i % 4) * 2;
+      if (tree_.nodeHasChildren(children[i]))
+      {
+        mask[bit] = 1;
+        mask[bit + 1] = 1;
+      }
+      else if (tree_.isNodeOccupied(children[i]))
+      {
+        mask[bit + 1] = 1;
+      }
+      else
+      {
+        mask[bit] = 1;
+      }
+    }
+    char child1to4 = static_cast<char>(child_masks[0].to_ulong());
+    char child5to8 = static_cast<char>(child_masks[1].to_ulong());
+    s_->write(&child1to4, sizeof(char));
+    s_->write(&child5to8, sizeof(char));
+  }
+
+  void leave(const NodeType*, const octomap::OcTreeKey&, unsigned int) {}
+
+private:
+  const OcTreeStampedWithExpiry& tree_;
+  std::ostream* s_;
+};
+
+// Binary stream cut at split_depth, same as writeIndexedMap()
+class IndexedEncoder
+{
+public:
+  IndexedEncoder(const OcTreeStampedWithExpiry& tree, unsigned int split_depth)
+    : tree_(tree), split_depth_(split_depth), binary_(tree, &top_) {}
+
+  void visit(const NodeType* node, const NodeType* const* children, const octomap::OcTreeKey& key,
+             unsigned int depth)
+  {
+    if (depth == split_depth_ && tree_.nodeHasChildren(node))
+    {
+      IndexedSubtreeEntry entry;
+      entry.key = key;
+      entry.write_children = true;
+      entry.splice_offset = static_cast<uint64_t>(top_.tellp());
+      entries_.push_back(entry);
+      subtree_.str("");
+      binary_.setStream(&subtree_);
+    }
+    binary_.visit(node, children, key, depth);
+  }
+
+  void leave(const NodeType* node, const octomap::OcTreeKey&, unsigned int depth)
+  {
+    if (depth == split_depth_ && tree_.nodeHasChildren(node))
+    {
+      data_.push_back(subtree_.str());
+      binary_.setStream(&top_);
+    }
+  }
+
+  bool write(std::ostream& s)
+  {
+    IndexedMapHeader header;
+    header.id = messageTreeType(tree_);
+    header.resolution = tree_.getResolution();
+    header.tree_depth = tree_.getTreeDepth();
+    header.binary = true;
+    header.split_depth = split_depth_;
+    std::vector<const std::string*> data;
+    for (const std::string& subtree : data_)
+    {
+      data.push_back(&subtree);
+    }
+    return writeIndexedMapPieces(s, header, top_.str(), &entries_, data);
+  }
+
+private:
+  const OcTreeStampedWithExpiry& tree_;
+  unsigned int split_depth_;
+  std::ostringstream top_;
+  std::ostringstream subtree_;
+  BinaryEncoder binary_;
+  std::vector<IndexedSubtreeEntry> entries_;
+  std::vector<std::string> data_;
+};
+
+// Native (.ot) stream, same as writeData()
+class NativeEncoder
+{
+public:
+  explicit NativeEncoder(std::ostream* s) : s_(s), base_stamp_(0) {}
+
+  void visit(const NodeType* node, const NodeType* const* children, const octomap::OcTreeKey&, unsigned int depth)
+  {
+    if (depth == 0)
+    {
+      base_stamp_ = node->getTimestamp();
+      s_->write(reinterpret_cast<const char*>(&base_stamp_), sizeof(base_stamp_));
+    }
+    uint8_t bits = 0;
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (children[i])
+      {
+        bits |= 1 << i;
+      }
+    }
+    OcTreeStampedWithExpiry::writeNativeNode(*s_, *node, base_stamp_, bits);
+  }
+
+  void leave(const NodeType*, const octomap::OcTreeKey&, unsigned int) {}
+
+private:
+  std::ostream* s_;
+  int64_t base_stamp_;
+};
+
+// Full map message stream, same as writeFullData()
+class FullEncoder
+{
+public:
+  explicit FullEncoder(std::ostream* s) : s_(s) {}
+
+  void visit(const NodeType* node, const NodeType* const* children, const octomap::OcTreeKey&, unsigned int)
+  {
+    node->writeData(*s_);
+    char bits = 0;
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (children[i])
+      {
+        bits |= 1 << i;
+      }
+    }
+    s_->write(&bits, sizeof(char));
+  }
+
+  void leave(const NodeType*, const octomap::OcTreeKey&, unsigned int) {}
+
+private:
+  std::ostream* s_;
+};
+
+// Succinct (.sbt) stream, same as SuccinctOcTree::write(). That one is in
+// level order: within a level, the nodes come in depth first order, so every
+// level is collected separately and they are put together at the end.
+class SuccinctEncoder
+{
+public:
+  void visit(const NodeType* node, const NodeType* const* children, const octomap::OcTreeKey&, unsigned int depth)
+  {
+    if (levels_.size() <= depth)
+    {
+      levels_.resize(depth + 1);
+    }
+    uint8_t mask = 0;
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      if (children[i])
+      {
+        mask |= 1 << i;
+      }
+    }
+    levels_[depth].masks.push_back(mask);
+    if (!mask)
+    {
+      levels_[depth].leaf_values.push_back(node->getLogOdds());
+    }
+  }
+
+  void leave(const NodeType*, const octomap::OcTreeKey&, unsigned int) {}
+
+  bool write(const OcTreeStampedWithExpiry& tree, std::ostream& s)
+  {
+    SuccinctOcTree::Builder builder;
+    for (Level& level : levels_)
+    {
+      size_t leaf = 0;
+      for (uint8_t mask : level.masks)
+      {
+        builder.addNode(mask, mask ? 0.0f : level.leaf_values[leaf++]);
+      }
+      level = Level();
+    }
+    return builder.write(s, messageTreeType(tree), tree.getResolution(), tree.getTreeDepth(),
+                         tree.getOccupancyThresLog());
+  }
+
+private:
+  struct Level
+  {
+    std::vector<uint8_t> masks;
+    std::vector<float> leaf_values;
+  };
+  std::vector<Level> levels_;
+};
+
+}  // namespace
+
+TiledMapWriter::TiledMapWriter(const OcTreeStampedWithExpiry& tree, const TileCache& tiles)
+  : tree_(tree), tiles_(tiles), tile_depth_(tiles.getTileDepth()), top_(tree.getResolution()), size_(0)
+{
+  top_.setTreeDepth(tree.getTreeDepth());
+  top_.copyParameters(tree);
+}
+
+size_t TiledMapWriter::countNodesRecurs(const NodeType* node) const
+{
+  size_t count = 1;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (tree_.nodeChildExists(node, i))
+    {
+      count += countNodesRecurs(tree_.getNodeChild(node, i));
+    }
+  }
+  return count;
+}
+
+octomap::OcTreeKey TiledMapWriter::tileKey(const octomap::OcTreeKey& key) const
+{
+  const octomap::key_type mask = static_cast<octomap::key_type>(~((1u << (tree_.getTreeDepth() - tile_depth_)) - 1));
+  return octomap::OcTreeKey(key[0] & mask, key[1] & mask, key[2] & mask);
+}
+
+size_t TiledMapWriter::copyTopRecurs(const NodeType* node, NodeType* copy, unsigned int depth)
+{
+  // Returns the nodes left out below the tile depth
+  if (depth == tile_depth_)
+  {
+    return countNodesRecurs(node) - 1;
+  }
+  size_t below = 0;
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (tree_.nodeChildExists(node, i))
+    {
+      const NodeType* child = tree_.getNodeChild(node, i);
+      NodeType* child_copy = top_.createNodeChild(copy, i);
+      child_copy->copyData(*child);
+      below += copyTopRecurs(child, child_copy, depth + 1);
+    }
+  }
+  return below;
+}
+
+bool TiledMapWriter::readTile(const octomap::OcTreeKey& tile, const NodeType* resident,
+                              OcTreeStampedWithExpiry* dst) const
+{
+  if (resident)
+  {
+    std::stringstream s;
+    if (!tree_.writeSubtree(s, tile, tile_depth_) || !dst->readSubtree(s, tile, tile_depth_))
+    {
+      return false;
+    }
+  }
+  const std::string filename = tiles_.tileFilename(tile);
+  std::ifstream s(filename.c_str(), std::ios_base::in | std::ios_base::binary);
+  if (!s.is_open() || !dst->readSubtree(s, tile, tile_depth_))
+  {
+    ROS_ERROR("Unable to read tile %s", filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool TiledMapWriter::build()
+{
+  top_.clear();
+  size_ = 0;
+  if (tree_.getRoot())
+  {
+    const NodeType* root = tree_.getRoot();
+    top_.setNodeAtDepth(detail::rootKey(tree_), 0, root->getLogOdds(), root->getTimestamp(), root->getExpiry());
+    size_ += copyTopRecurs(root, top_.getRoot(), 0);
+  }
+
+  bool merged = false;
+  for (const TileCache::TileMap::value_type& tile : tiles_.evictedTiles())
+  {
+    // The top node of the tile, as a leaf
+    const std::string filename = tiles_.tileFilename(tile.first);
+    std::ifstream file(filename.c_str(), std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    const std::streamoff file_size = file.is_open() ? static_cast<std::streamoff>(file.tellg()) : 0;
+    char top_node[sizeof(int64_t) + OcTreeStampedWithExpiry::NATIVE_NODE_SIZE];
+    const bool ok = file_size >= static_cast<std::streamoff>(sizeof(top_node)) &&
+                    (file_size - sizeof(int64_t)) % OcTreeStampedWithExpiry::NATIVE_NODE_SIZE == 0 &&
+                    file.seekg(0) && file.read(top_node, sizeof(top_node));
+    top_node[sizeof(top_node) - 1] = 0;
+    std::istringstream s(std::string(top_node, sizeof(top_node)));
+    if (!ok || !top_.readSubtree(s, tile.first, tile_depth_))
+    {
+      ROS_ERROR("Unable to read tile %s", filename.c_str());
+      return false;
+    }
+    size_t tile_size = (file_size - sizeof(int64_t)) / OcTreeStampedWithExpiry::NATIVE_NODE_SIZE;
+
+    const NodeType* resident = tree_.getRoot();
+    for (unsigned int d = 0; resident && d < tile_depth_; ++d)
+    {
+      const unsigned int pos = octomap::computeChildIdx(tile.first, tree_.getTreeDepth() - 1 - d);
+      resident = tree_.nodeChildExists(resident, pos) ? tree_.getNodeChild(resident, pos) : NULL;
+    }
+    if (resident)
+    {
+      // Partly in the tree as well, merge the two to get the top node
+      OcTreeStampedWithExpiry tile_tree(tree_.getResolution());
+      tile_tree.setTreeDepth(tree_.getTreeDepth());
+      if (!readTile(tile.first, resident, &tile_tree))
+      {
+        return false;
+      }
+      const NodeType* node = tile_tree.search(tile.first, tile_depth_);
+      top_.search(tile.first, tile_depth_)->copyData(*node);
+      tile_size = countNodesRecurs(node);
+      size_ -= countNodesRecurs(resident) - 1;
+      merged = true;
+    }
+    size_ += tile_size - 1;
+  }
+  if (merged)
+  {
+    top_.updateInnerOccupancy();
+  }
+  size_ += top_.size();
+  return true;
+}
+
+template <class ENCODER>
+bool TiledMapWriter::walk(ENCODER* encoder)
+{
+  if (!top_.getRoot())
+  {
+    return true;
+  }
+  return walkRecurs(top_.getRoot(), top_.getRoot(), tree_.getRoot(), detail::rootKey(tree_), 0, encoder);
+}
+
+template <class ENCODER>
+bool TiledMapWriter::walkRecurs(const NodeType* node, NodeType* top_node, const NodeType* resident,
+                                const octomap::OcTreeKey& key, unsigned int depth, ENCODER* encoder)
+{
+  // The node accessors only look at the node, so those of tree_ serve for
+  // the nodes of top_ as well
+  const NodeType* children[8] = {NULL};
+  NodeType* top_children[8] = {NULL};
+  const NodeType* resident_children[8] = {NULL};
+  octomap::OcTreeKey child_keys[8];
+  bool read_in[8] = {false};
+  const octomap::key_type offset = detail::childCenterOffset(tree_, depth);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!tree_.nodeChildExists(node, i))
+    {
+      continue;
+    }
+    octomap::computeChildKey(i, offset, key, child_keys[i]);
+    children[i] = tree_.getNodeChild(node, i);
+    if (!top_node)
+    {
+      continue;
+    }
+    top_children[i] = top_.getNodeChild(top_node, i);
+    if (resident && tree_.nodeChildExists(resident, i))
+    {
+      resident_children[i] = tree_.getNodeChild(resident, i);
+    }
+    if (depth + 1 < tile_depth_)
+    {
+      continue;
+    }
+    // A tile: read in from its file, or written straight from the tree
+    const octomap::OcTreeKey tile = tileKey(child_keys[i]);
+    if (tiles_.evictedTiles().count(tile))
+    {
+      if (!readTile(tile, resident_children[i], &top_))
+      {
+        return false;
+      }
+      read_in[i] = true;
+    }
+    else if (resident_children[i])
+    {
+      children[i] = resident_children[i];
+    }
+    top_children[i] = NULL;
+    resident_children[i] = NULL;
+  }
+
+  encoder->visit(node, children, key, depth);
+  bool ok = true;
+  for (unsigned int i = 0; i < 8 && ok; ++i)
+  {
+    if (children[i])
+    {
+      ok = walkRecurs(children[i], top_children[i], resident_children[i], child_keys[i], depth + 1, encoder);
+    }
+  }
+  encoder->leave(node, key, depth);
+
+  // Drop the tiles read in, back to their top nodes
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!read_in[i])
+    {
+      continue;
+    }
+    NodeType* tile = top_.getNodeChild(top_node, i);
+    for (unsigned int j = 0; j < 8; ++j)
+    {
+      if (top_.nodeChildExists(tile, j))
+      {
+        top_.deleteNodeChild(tile, j);
+      }
+    }
+  }
+  return ok;
+}
+
+bool TiledMapWriter::write(const std::string& format, std::ostream& s, unsigned int split_depth)
+{
+  ros::WallTime start_time = ros::WallTime::now();
+  if (!build())
+  {
+    return false;
+  }
+  ROS_DEBUG("Built the top of the map with %zu evicted tiles in %f sec", tiles_.numEvicted(),
+            (ros::WallTime::now() - start_time).toSec());
+
+  bool ok;
+  if (format == "bt")
+  {
+    s << "# Octomap OcTree binary file\n";
+    s << "id " << messageTreeType(tree_) << "\n";
+    s << "size " << size_ << "\n";
+    s << "res " << tree_.getResolution() << "\n";
+    s << "depth " << tree_.getTreeDepth() << "\n";
+    s << "data\n";
+    BinaryEncoder encoder(tree_, &s);
+    ok = walk(&encoder);
+  }
+  else if (format == "ot")
+  {
+    // Same header as AbstractOcTree::write()
+    s << "# Octomap OcTree file\n# (feel free to add / change comments, but leave the first line as it is!)\n#\n";
+    s << "id " << tree_.getTreeType() << "\n";
+    s << "size " << size_ << "\n";
+    s << "res " << tree_.getResolution() << "\n";
+    s << "data\n";
+    NativeEncoder encoder(&s);
+    ok = walk(&encoder);
+  }
+  else if (format == "sbt")
+  {
+    SuccinctEncoder encoder;
+    ok = walk(&encoder) && encoder.write(tree_, s);
+  }
+  else
+  {
+    IndexedEncoder encoder(tree_, split_depth);
+    ok = walk(&encoder) && encoder.write(s);
+  }
+  top_.clear();
+  return ok && s.good();
+}
+
+bool TiledMapWriter::toMsg(bool binary, octomap_msgs::Octomap& msg)
+{
+  if (!build())
+  {
+    return false;
+  }
+  msg.resolution = tree_.getResolution();
+  msg.id = messageTreeType(tree_);
+  msg.binary = binary;
+
+  std::stringstream datastream;
+  bool ok;
+  if (binary)
+  {
+    BinaryEncoder encoder(tree_, &datastream);
+    ok = walk(&encoder);
+  }
+  else
+  {
+    FullEncoder encoder(&datastream);
+    ok = walk(&encoder);
+  }
+  top_.clear();
+  if (!ok)
+  {
+    return false;
+  }
+  const std::string datastring = datastream.str();
+  msg.data = std::vector<int8_t>(datastring.begin(), datastring.end());
+  return true;
+}
+
+}  // namespace octomap_server
@@ -44,6 +44,7 @@ TrackingOctomapServer::TrackingOctomapServer(const std::string& filename) :
       m_treeDepth = m_octree->getTreeDepth();
       m_res = m_octree->getResolution();
       m_gridmap.info.resolution = m_res;
+      bumpMapVersion();
 
       publishAll();
     } else {
@@ -139,6 +140,7 @@ void TrackingOctomapServer::trackChanges() {
 }
 
 void TrackingOctomapServer::trackCallback(sensor_msgs::PointCloud2Ptr cloud) {
+  boost::recursive_mutex::scoped_lock lock(m_octreeMutex);
   pcl::PointCloud<pcl::PointXYZI> cells;
   pcl::fromROSMsg(*cloud, cells);
   ROS_DEBUG("[client] size of newly occupied cloud: %i", (int)cells.points.size());
@@ -149,6 +151,7 @@ void TrackingOctomapServer::trackCallback(sensor_msgs::PointCloud2Ptr cloud) {
   }
 
   m_octree->updateInnerOccupancy();
+  bumpMapVersion();
   ROS_DEBUG("[client] octomap size after updating: %d", (int)m_octree->calcNumNodes());
 }
 
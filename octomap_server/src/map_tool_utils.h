@@ -0,0 +1,41 @@
+#ifndef OCTOMAP_SERVER_MAP_TOOL_UTILS_H
+#define OCTOMAP_SERVER_MAP_TOOL_UTILS_H
+
+// Helpers shared by the command line map tools
+
+#include <chrono>
+#include <string>
+
+#include <octomap/octomap.h>
+
+namespace octomap_server {
+namespace tools {
+
+typedef std::chrono::steady_clock Clock;
+
+inline double secondsSince(const Clock::time_point& start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// Read a .bt file as an OcTree, or any other map through
+/// AbstractOcTree::read(). Returns NULL if the file could not be read.
+inline octomap::AbstractOcTree* readMap(const std::string& filename)
+{
+  if (filename.length() > 3 && filename.compare(filename.length() - 3, 3, ".bt") == 0)
+  {
+    octomap::OcTree* octree = new octomap::OcTree(0.1);
+    if (!octree->readBinary(filename))
+    {
+      delete octree;
+      return NULL;
+    }
+    return octree;
+  }
+  return octomap::AbstractOcTree::read(filename);
+}
+
+}  // namespace tools
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_MAP_TOOL_UTILS_H
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <octomap/octomap.h>
+#include <octomap_msgs/conversions.h>
+#include <octomap_server/OcTreeDag.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+
+#include "map_tool_utils.h"
+
+#define USAGE "\nUSAGE: octomap_dag_converter [-p] [-q <queries>] <input.[bt|ot]> <output.dag>\n" \
+              "  -p: prune inner nodes whose children are 8 leafs of the same occupancy\n" \
+              "  -q: number of random point queries to time on the tree and the DAG (default 1000000)\n" \
+              "  input: map to convert, output: DAG for octomap_server_static\n"
+
+using octomap_server::OcTreeDag;
+using octomap_server::tools::Clock;
+using octomap_server::tools::readMap;
+using octomap_server::tools::secondsSince;
+
+// Build the DAG of tree, write it and report the compression and the query
+// latency against the tree
+template <class TREE>
+static bool convert(const TREE& tree, bool prune, size_t num_queries, const std::string& output)
+{
+  Clock::time_point start = Clock::now();
+  OcTreeDag dag;
+  dag.build(tree, prune);
+  const double build_time = secondsSince(start);
+  if (!dag.write(output))
+  {
+    fprintf(stderr, "Error writing to file %s\n", output.c_str());
+    return false;
+  }
+
+  octomap_msgs::Octomap tree_msg, dag_msg;
+  octomap_server::mapToMsg(tree, true, octomap_server::WriteAllPolicy(), tree_msg);
+  start = Clock::now();
+  dag.binaryMapToMsg(dag_msg);
+  const double expand_time = secondsSince(start);
+
+  printf("Built DAG in %f sec, expanded it in %f sec\n", build_time, expand_time);
+  printf("tree:   %zu nodes, %zu bytes in memory, %zu bytes of binary stream\n", tree.size(),
+         tree.memoryUsage(), tree_msg.data.size());
+  printf("DAG:    %zu nodes for %lu tree nodes, %zu bytes\n", dag.size(), (unsigned long)dag.treeSize(),
+         dag.memoryUsage());
+  printf("ratio:  %.2f tree nodes per DAG node, %.2fx smaller than the tree, %.2fx smaller than the stream\n",
+         dag.size() ? double(dag.treeSize()) / dag.size() : 0.0,
+         dag.memoryUsage() ? double(tree.memoryUsage()) / dag.memoryUsage() : 0.0,
+         dag.memoryUsage() ? double(tree_msg.data.size()) / dag.memoryUsage() : 0.0);
+  if (!prune && tree_msg.data != dag_msg.data)
+  {
+    fprintf(stderr, "The expanded DAG differs from the binary stream of the tree\n");
+    return false;
+  }
+
+  if (num_queries == 0 || tree.size() == 0)
+    return true;
+
+  // Random points in the bounds of the map
+  double min_x, min_y, min_z, max_x, max_y, max_z;
+  tree.getMetricMin(min_x, min_y, min_z);
+  tree.getMetricMax(max_x, max_y, max_z);
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<double> x(min_x, max_x), y(min_y, max_y), z(min_z, max_z);
+  std::vector<octomap::OcTreeKey> keys;
+  keys.reserve(num_queries);
+  for (size_t i = 0; i < num_queries; ++i)
+  {
+    keys.push_back(tree.coordToKey(x(generator), y(generator), z(generator)));
+  }
+
+  std::vector<int> tree_results(keys.size()), dag_results(keys.size());
+  start = Clock::now();
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    const typename TREE::NodeType* node = tree.search(keys[i]);
+    tree_results[i] = !node ? OcTreeDag::UNKNOWN : tree.isNodeOccupied(node) ? OcTreeDag::OCCUPIED : OcTreeDag::FREE;
+  }
+  const double tree_time = secondsSince(start);
+  start = Clock::now();
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    dag_results[i] = dag.search(keys[i]);
+  }
+  const double dag_time = secondsSince(start);
+
+  printf("query:  tree %.1f ns, DAG %.1f ns per point (%zu points)\n", 1e9 * tree_time / keys.size(),
+         1e9 * dag_time / keys.size(), keys.size());
+  if (tree_results != dag_results)
+  {
+    fprintf(stderr, "The DAG and the tree disagree on the occupancy of some points\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  bool prune = false;
+  size_t num_queries = 1000000;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-p") == 0)
+      prune = true;
+    else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc)
+      num_queries = strtoul(argv[++i], NULL, 10);
+    else
+      files.push_back(argv[i]);
+  }
+  if (files.size() != 2)
+  {
+    fprintf(stderr, "%s", USAGE);
+    exit(1);
+  }
+  const std::string& input = files[0];
+  const std::string& output = files[1];
+
+  octomap::AbstractOcTree* tree = readMap(input);
+  if (!tree)
+  {
+    fprintf(stderr, "Could not read octree from %s\n", input.c_str());
+    exit(1);
+  }
+
+  bool ok = false;
+  octomap::OcTree* octree = dynamic_cast<octomap::OcTree*>(tree);
+  octomap_server::OcTreeStampedWithExpiry* stamped = dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(tree);
+  if (octree)
+  {
+    ok = convert(*octree, prune, num_queries, output);
+  }
+  else if (stamped)
+  {
+    ok = convert(*stamped, prune, num_queries, output);
+  }
+  else
+  {
+    fprintf(stderr, "DAGs can only be built from OcTree maps, not %s\n", tree->getTreeType().c_str());
+  }
+  delete tree;
+  exit(ok ? 0 : 1);
+}
@@ -31,42 +31,81 @@
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
 #include <fstream>
+#include <stdexcept>
+#include <string>
 
 #include <octomap_msgs/GetOctomap.h>
+#include <octomap_server/GetMapChunk.h>
+#include <octomap_server/IndexedMapFile.h>
+#include <octomap_server/MapTransfer.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/StartMapTransfer.h>
+#include <octomap_server/SuccinctOcTree.h>
+#include <boost/thread.hpp>
 using octomap_msgs::GetOctomap;
+using octomap_server::GetMapChunk;
+using octomap_server::MapTransfer;
+using octomap_server::StartMapTransfer;
 
-#define USAGE "\nUSAGE: octomap_saver [-f] <mapfile.[bt|ot]>\n" \
+#define USAGE "\nUSAGE: octomap_saver [-f|-s] <mapfile.[bt|ot|oti|sbt]>\n" \
                 "  -f: Query for the full occupancy octree, instead of just the compact binary one\n" \
-		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree)\n"
+                "  -s: Query for the stamped octree, keeping the timestamps and expiry of the nodes in .ot files\n" \
+		"  mapfile.bt: filename of map to be saved (.bt: binary tree, .ot: general octree,\n" \
+		"              .oti: indexed tree, binary or full depending on -f,\n" \
+		"              .sbt: succinct tree for octomap_server_static)\n" \
+                "  Gives up after ~max_attempts failed requests (default 30, 0 retries forever)\n"
 
 using namespace std;
 using namespace octomap;
 
 class MapSaver{
 public:
-  MapSaver(const std::string& mapname, bool full){
+  MapSaver(const std::string& mapname, bool full, bool stamped){
     ros::NodeHandle n;
     std::string servname = "octomap_binary";
-    if (full)
+    uint8_t format = StartMapTransfer::Request::BINARY;
+    if (stamped){
+      servname = "octomap_stamped";
+      format = StartMapTransfer::Request::STAMPED;
+    } else if (full){
       servname = "octomap_full";
-    ROS_INFO("Requesting the map from %s...", n.resolveName(servname).c_str());
-    GetOctomap::Request req;
-    GetOctomap::Response resp;
-    while(n.ok() && !ros::service::call(servname, req, resp))
-    {
-      ROS_WARN("Request to %s failed; trying again...", n.resolveName(servname).c_str());
-      usleep(1000000);
+      format = StartMapTransfer::Request::FULL;
+    }
+    // Fetch the map in chunks, or whole from servers without chunked
+    // transfers (e.g. octomap_server_static)
+    octomap_msgs::Octomap map;
+    bool received = false;
+    int maxAttempts = 30;
+    ros::NodeHandle("~").param("max_attempts", maxAttempts, maxAttempts);
+    for (int attempt = 1; n.ok() && !received; ++attempt){
+      if (ros::service::exists("start_map_transfer", false)){
+        ROS_INFO("Requesting the map from %s...", n.resolveName("start_map_transfer").c_str());
+        received = fetchChunked(n, format, &map);
+      } else if (ros::service::exists(servname, false)){
+        ROS_INFO("Requesting the map from %s...", n.resolveName(servname).c_str());
+        GetOctomap::Request req;
+        GetOctomap::Response resp;
+        received = ros::service::call(servname, req, resp);
+        if (received)
+          map = resp.map;
+      }
+      if (!received){
+        if (maxAttempts > 0 && attempt >= maxAttempts)
+          throw std::runtime_error("requesting the map failed " + std::to_string(attempt) + " times, giving up");
+        ROS_WARN("Requesting the map failed; trying again...");
+        ros::WallDuration(1.0).sleep();
+      }
     }
 
     if (n.ok()){ // skip when CTRL-C
 
-      AbstractOcTree* tree = octomap_msgs::msgToMap(resp.map);
+      AbstractOcTree* tree = octomap_msgs::msgToMap(map);
       AbstractOccupancyOcTree* octree = NULL;
       if (tree){
         octree = dynamic_cast<AbstractOccupancyOcTree*>(tree);
       } else {
         ROS_ERROR("Error creating octree from received message");
-        if (resp.map.id == "ColorOcTree")
+        if (map.id == "ColorOcTree")
           ROS_WARN("You requested a binary map for a ColorOcTree - this is currently not supported. Please add -f to request a full map");
       }
 
@@ -74,7 +113,44 @@ public:
         ROS_INFO("Map received (%zu nodes, %f m res), saving to %s", octree->size(), octree->getResolution(), mapname.c_str());
         
         std::string suffix = mapname.substr(mapname.length()-3, 3);
-        if (suffix== ".bt"){ // write to binary file:
+        if (octomap_server::isIndexedMapFile(mapname)){ // write to indexed file:
+          OcTree* ocTree = dynamic_cast<OcTree*>(octree);
+          octomap_server::OcTreeStampedWithExpiry* stampedTree =
+              dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(octree);
+          const unsigned threads = boost::thread::hardware_concurrency();
+          bool ok = false;
+          if (ocTree){
+            ok = octomap_server::writeIndexedMap(*ocTree, !full, mapname,
+                                                 octomap_server::DEFAULT_INDEXED_SPLIT_DEPTH, threads);
+          } else if (stampedTree){
+            ok = octomap_server::writeIndexedMap(*stampedTree, !full, mapname,
+                                                 octomap_server::DEFAULT_INDEXED_SPLIT_DEPTH, threads);
+          } else {
+            ROS_ERROR("Indexed files can only be written for OcTree maps, not %s", octree->getTreeType().c_str());
+          }
+          if ((ocTree || stampedTree) && !ok){
+            ROS_ERROR("Error writing to file %s", mapname.c_str());
+          }
+        } else if (mapname.length() > 4 &&
+                   mapname.substr(mapname.length()-4) == octomap_server::SuccinctOcTree::FILE_EXTENSION){
+          // write to succinct file:
+          OcTree* ocTree = dynamic_cast<OcTree*>(octree);
+          octomap_server::OcTreeStampedWithExpiry* stampedTree =
+              dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(octree);
+          std::ofstream file(mapname.c_str(), std::ios_base::out | std::ios_base::binary);
+          bool ok = false;
+          if (ocTree){
+            ok = octomap_server::SuccinctOcTree::write(*ocTree, file);
+          } else if (stampedTree){
+            ok = octomap_server::SuccinctOcTree::write(*stampedTree, file);
+          } else {
+            ROS_ERROR("Succinct files can only be written for OcTree maps, not %s", octree->getTreeType().c_str());
+          }
+          file.close();
+          if ((ocTree || stampedTree) && (!ok || !file)){
+            ROS_ERROR("Error writing to file %s", mapname.c_str());
+          }
+        } else if (suffix== ".bt"){ // write to binary file:
           if (!octree->writeBinary(mapname)){
             ROS_ERROR("Error writing to file %s", mapname.c_str());
           }
@@ -83,7 +159,7 @@ public:
             ROS_ERROR("Error writing to file %s", mapname.c_str());
           }
         } else{
-          ROS_ERROR("Unknown file extension, must be either .bt or .ot");
+          ROS_ERROR("Unknown file extension, must be either .bt, .ot, .oti or .sbt");
         }
 
 
@@ -95,15 +171,61 @@ public:
 
     }
   }
+
+private:
+  // Fetch the map with start_map_transfer and get_map_chunk, retrying
+  // chunks that fail or arrive corrupted
+  static bool fetchChunked(ros::NodeHandle& n, uint8_t format, octomap_msgs::Octomap* map)
+  {
+    StartMapTransfer start;
+    start.request.format = format;
+    if (!ros::service::call("start_map_transfer", start))
+      return false;
+    const StartMapTransfer::Response& transfer = start.response;
+    *map = transfer.map;
+    map->data.clear();
+    map->data.reserve(transfer.size);
+    ros::ServiceClient chunkClient = n.serviceClient<GetMapChunk>("get_map_chunk", true);
+    for (uint32_t i = 0; i < transfer.num_chunks; ++i){
+      GetMapChunk chunk;
+      chunk.request.transfer_id = transfer.transfer_id;
+      chunk.request.index = i;
+      bool ok = false;
+      for (unsigned attempt = 0; attempt < 3 && !ok && n.ok(); ++attempt){
+        if (!chunkClient.isValid())
+          chunkClient = n.serviceClient<GetMapChunk>("get_map_chunk", true);
+        ok = chunkClient.call(chunk)
+             && MapTransfer::crc32(chunk.response.data.data(), chunk.response.data.size()) == chunk.response.crc32;
+        if (!ok)
+          ROS_WARN("Chunk %u of %u of map transfer %u failed", i + 1, transfer.num_chunks, transfer.transfer_id);
+      }
+      if (!ok)
+        return false;
+      map->data.insert(map->data.end(), chunk.response.data.begin(), chunk.response.data.end());
+      ROS_DEBUG("Received chunk %u of %u", i + 1, transfer.num_chunks);
+    }
+    if (map->data.size() != transfer.size
+        || MapTransfer::crc32(map->data.data(), map->data.size()) != transfer.crc32){
+      ROS_ERROR("Map transfer %u does not match its checksum", transfer.transfer_id);
+      return false;
+    }
+    return true;
+  }
 };
 
 int main(int argc, char** argv){
   ros::init(argc, argv, "octomap_saver");
   std::string mapFilename("");
   bool fullmap = false;
+  bool stampedmap = false;
   if (argc == 3 && strcmp(argv[1], "-f")==0){
     fullmap = true;
     mapFilename = std::string(argv[2]);
+  } else if (argc == 3 && strcmp(argv[1], "-s")==0){
+    // the stamped stream is a full one
+    fullmap = true;
+    stampedmap = true;
+    mapFilename = std::string(argv[2]);
   } else if (argc == 2)
     mapFilename = std::string(argv[1]);
   else{
@@ -112,7 +234,7 @@ int main(int argc, char** argv){
   }
 
   try{
-    MapSaver ms(mapFilename, fullmap);
+    MapSaver ms(mapFilename, fullmap, stampedmap);
   }catch(std::runtime_error& e){
     ROS_ERROR("octomap_saver exception: %s", e.what());
     exit(2);
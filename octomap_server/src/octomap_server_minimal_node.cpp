@@ -27,12 +27,21 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include <fstream>
-#include <sstream>
+#include <sys/resource.h>
 
 #include <ros/ros.h>
 #include <octomap_msgs/Octomap.h>
-#include <octomap/OcTreeKey.h>
+#include <octomap_server/BinaryMapFile.h>
+
+// Peak resident set size of this process so far, in MiB
+static double peakRssMiB()
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0.0;
+  // ru_maxrss is in KiB on Linux
+  return usage.ru_maxrss / 1024.0;
+}
 
 int main(int argc, char** argv)
 {
@@ -90,87 +99,23 @@ int main(int argc, char** argv)
       ROS_ERROR("Minimal node must be given a .bt file!");
       exit(1);
     }
-    std::ifstream infile(map_filename);
-    if (!infile)
-    {
-      ROS_ERROR_STREAM("Unable to open file " << map_filename);
-      exit(1);
-    }
-
-    size_t node_count = 0;
+    ros::WallTime start_time = ros::WallTime::now();
     octomap_msgs::OctomapPtr msg(new octomap_msgs::Octomap);
-    msg->binary = true;
     msg->header.frame_id = frame_id;
-    msg->depth = 16;
-    msg->resolution = 0.0;
-    msg->id = "";
-
-    std::string line;
-    while (std::getline(infile, line))
-    {
-      std::istringstream ss(line);
-      std::string first_word;
-      ss >> first_word;
-      if (first_word == "id")
-      {
-        ss >> msg->id;
-        ROS_INFO_STREAM("id " << msg->id);
-      }
-      else if (first_word == "res")
-      {
-        ss >> msg->resolution;
-        ROS_INFO_STREAM("resolution " << msg->resolution);
-      }
-      else if (first_word == "size")
-      {
-        ss >> node_count;
-        ROS_INFO_STREAM("node count: " << node_count);
-      }
-      else if (first_word == "depth")
-      {
-        unsigned int depth;
-        ss >> depth;
-        if (depth > octomap::KEY_BIT_WIDTH)
-        {
-          ROS_ERROR_STREAM("Unable to parse " << map_filename
-                           << " invalid depth " << depth);
-          exit(1);
-        }
-        msg->depth = depth;
-        ROS_INFO_STREAM("tree depth: " << depth);
-      }
-      else if (first_word == "data")
-      {
-        std::stringstream data_ss;
-        infile >> data_ss.rdbuf();
-        std::string msg_data = data_ss.str();
-        msg->data.assign(msg_data.begin(), msg_data.end());
-      }
-    }
-
-    if (msg->resolution == 0.0)
-    {
-      ROS_ERROR_STREAM("Unable to parse " << map_filename
-                       << " could not read resolution");
-      exit(1);
-    }
-    if (msg->id.empty())
-    {
-      ROS_ERROR_STREAM("Unable to parse " << map_filename
-                       << " could not read id");
-      exit(1);
-    }
-    if (msg->data.empty() && node_count > 0)
+    std::string error;
+    if (!octomap_server::readBinaryMapFile(map_filename, msg.get(), &error))
     {
-      ROS_ERROR_STREAM("Unable to parse " << map_filename
-                       << " data size mismatch. Header says there are "
-                       << node_count << " nodes but actually read "
-                       << msg->data.size() << " bytes.");
+      ROS_ERROR_STREAM("Unable to parse " << map_filename << " " << error);
       exit(1);
     }
+    ROS_INFO_STREAM("id " << msg->id << ", resolution " << msg->resolution << ", tree depth " << int(msg->depth));
+    ROS_INFO("Loaded %zu bytes of map data in %f sec, peak RSS %.1f MiB",
+             msg->data.size(), (ros::WallTime::now() - start_time).toSec(), peakRssMiB());
     // The message will stay latched in the publisher, so there is no need to
     // save a copy of it here.
     binary_map_publisher.publish(msg);
+    ROS_INFO("Published map after %f sec, peak RSS %.1f MiB",
+             (ros::WallTime::now() - start_time).toSec(), peakRssMiB());
   }
 
   ROS_INFO_STREAM("Publishing map from " << map_filename
@@ -31,12 +31,30 @@
 #include <octomap_msgs/conversions.h>
 #include <octomap/octomap.h>
 #include <fstream>
+#include <limits>
 
 #include <octomap_msgs/GetOctomap.h>
+#include <octomap_server/IndexedMapFile.h>
+#include <octomap_server/OcTreeDag.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/PointQuery.h>
+#include <octomap_server/QueryOccupancy.h>
+#include <octomap_server/CastRays.h>
+#include <octomap_server/GetOctomapRegion.h>
+#include <octomap_server/RayCaster.h>
+#include <octomap_server/SuccinctOcTree.h>
+#include <boost/thread.hpp>
 using octomap_msgs::GetOctomap;
+using octomap_server::PointQuery;
+using octomap_server::QueryOccupancy;
+using octomap_server::CastRays;
+using octomap_server::GetOctomapRegion;
+using octomap_server::RayCaster;
 
-#define USAGE "\nUSAGE: octomap_server_static <mapfile.[bt|ot]>\n" \
-		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree)\n"
+#define USAGE "\nUSAGE: octomap_server_static <mapfile.[bt|ot|oti|sbt|dag]>\n" \
+		"  mapfile.bt: OctoMap filename to be loaded (.bt: binary tree, .ot: general octree, including stamped trees,\n" \
+		"              .oti: indexed binary or full tree, .sbt: succinct tree, mapped read-only,\n" \
+		"              .dag: binary tree with shared subtrees, from octomap_dag_converter)\n"
 
 using namespace std;
 using namespace octomap;
@@ -44,11 +62,14 @@ using namespace octomap;
 class OctomapServerStatic{
 public:
   OctomapServerStatic(const std::string& filename)
-    : m_octree(NULL), m_worldFrameId("/map")
+    : m_octree(NULL), m_worldFrameId("/map"), m_castRaysThreads(0)
   {
 
     ros::NodeHandle private_nh("~");
     private_nh.param("frame_id", m_worldFrameId, m_worldFrameId);
+    int castRaysThreads = 0;
+    private_nh.param("cast_rays/threads", castRaysThreads, castRaysThreads);
+    m_castRaysThreads = castRaysThreads > 0 ? castRaysThreads : boost::thread::hardware_concurrency();
 
 
     // open file:
@@ -60,7 +81,29 @@ public:
     std::string suffix = filename.substr(filename.length()-3, 3);
 
     // .bt files only as OcTree, all other classes need to be in .ot files:
-    if (suffix == ".bt"){
+    if (hasExtension(filename, octomap_server::OcTreeDag::FILE_EXTENSION)){
+      // expanded on every request, the tree is never built
+      if (!m_dag.read(filename) || m_dag.empty()){
+        ROS_ERROR("Could not read octree DAG from file");
+        exit(1);
+      }
+    } else if (hasExtension(filename, octomap_server::SuccinctOcTree::FILE_EXTENSION)){
+      // served straight from the mapping, the tree is never built
+      if (!m_succinct.open(filename)){
+        ROS_ERROR("Could not read succinct octree from file");
+        exit(1);
+      }
+    } else if (octomap_server::isIndexedMapFile(filename)){
+      int threads = 0;
+      private_nh.param("map_load/threads", threads, threads);
+      octomap_server::OcTreeStampedWithExpiry* octree = new octomap_server::OcTreeStampedWithExpiry(0.1);
+      if (!octree->readIndexed(filename, threads > 0 ? threads : boost::thread::hardware_concurrency())){
+        ROS_ERROR("Could not read indexed octree from file");
+        exit(1);
+      }
+
+      m_octree = octree;
+    } else if (suffix == ".bt"){
       OcTree* octree = new OcTree(filename);
 
       m_octree = octree;
@@ -74,26 +117,39 @@ public:
       m_octree = dynamic_cast<AbstractOccupancyOcTree*>(tree);
 
     } else{
-      ROS_ERROR("Octree file does not have .bt or .ot extension");
+      ROS_ERROR("Octree file does not have .bt, .ot, .oti, .sbt or .dag extension");
       exit(1);
     }
 
-    if (!m_octree ){
-      ROS_ERROR("Could not read right octree class in file");
-      exit(1);
-    }
+    if (!m_dag.empty()){
+      ROS_INFO("Read octree DAG type \"%s\" from file %s", m_dag.getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %lu, DAG nodes: %zu (%zu bytes)", m_dag.getResolution(),
+               (unsigned long)m_dag.treeSize(), m_dag.size(), m_dag.memoryUsage());
+    } else if (m_succinct.isOpen()){
+      ROS_INFO("Mapped succinct octree type \"%s\" from file %s", m_succinct.getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %lu, mapped bytes: %zu", m_succinct.getResolution(),
+               (unsigned long)m_succinct.size(), m_succinct.memoryUsage());
+    } else {
+      if (!m_octree ){
+        ROS_ERROR("Could not read right octree class in file");
+        exit(1);
+      }
 
-    ROS_INFO("Read octree type \"%s\" from file %s", m_octree->getTreeType().c_str(), filename.c_str());
-    ROS_INFO("Octree resultion: %f, size: %zu", m_octree->getResolution(), m_octree->size());
+      ROS_INFO("Read octree type \"%s\" from file %s", m_octree->getTreeType().c_str(), filename.c_str());
+      ROS_INFO("Octree resultion: %f, size: %zu", m_octree->getResolution(), m_octree->size());
+    }
 
 
     m_octomapBinaryService = m_nh.advertiseService("octomap_binary", &OctomapServerStatic::octomapBinarySrv, this);
     m_octomapFullService = m_nh.advertiseService("octomap_full", &OctomapServerStatic::octomapFullSrv, this);
+    m_octomapRegionService = m_nh.advertiseService("octomap_region", &OctomapServerStatic::octomapRegionSrv, this);
+    m_queryOccupancyService = m_nh.advertiseService("query_occupancy", &OctomapServerStatic::queryOccupancySrv, this);
+    m_castRaysService = m_nh.advertiseService("cast_rays", &OctomapServerStatic::castRaysSrv, this);
 
   }
 
   ~OctomapServerStatic(){
-
+    delete m_octree;
 
   }
 
@@ -103,7 +159,7 @@ public:
     ROS_INFO("Sending binary map data on service request");
     res.map.header.frame_id = m_worldFrameId;
     res.map.header.stamp = ros::Time::now();
-    if (!octomap_msgs::binaryMapToMsg(*m_octree, res.map))
+    if (!mapToMsg(true, res.map))
       return false;
 
     return true;
@@ -117,17 +173,171 @@ public:
     res.map.header.stamp = ros::Time::now();
 
 
-    if (!octomap_msgs::fullMapToMsg(*m_octree, res.map))
+    if (!mapToMsg(false, res.map))
+      return false;
+
+    return true;
+  }
+
+  bool octomapRegionSrv(GetOctomapRegion::Request& req, GetOctomapRegion::Response& res)
+  {
+    res.map.header.frame_id = m_worldFrameId;
+    res.map.header.stamp = ros::Time::now();
+    OcTree* octree = dynamic_cast<OcTree*>(m_octree);
+    octomap_server::OcTreeStampedWithExpiry* stamped =
+        dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(m_octree);
+    if (octree)
+      return regionToMsg(*octree, req, res.map);
+    if (stamped)
+      return regionToMsg(*stamped, req, res.map);
+    ROS_ERROR("Map regions are not supported on DAGs, succinct trees and octree type \"%s\"",
+              m_octree ? m_octree->getTreeType().c_str() : "");
+    return false;
+  }
+
+  bool queryOccupancySrv(QueryOccupancy::Request& req, QueryOccupancy::Response& res)
+  {
+    PointQuery query;
+    if (!m_dag.empty()){
+      query.setPoints(req.points, m_dag.getResolution());
+      query.searchEach([this](const OcTreeKey& key, float* log_odds) -> PointQuery::State {
+        return static_cast<PointQuery::State>(m_dag.search(key));
+      });
+    } else if (m_succinct.isOpen()){
+      query.setPoints(req.points, m_succinct.getResolution());
+      query.searchEach([this](const OcTreeKey& key, float* log_odds) -> PointQuery::State {
+        if (!m_succinct.search(key, log_odds))
+          return PointQuery::UNKNOWN;
+        return m_succinct.isOccupied(*log_odds) ? PointQuery::OCCUPIED : PointQuery::FREE;
+      });
+    } else {
+      query.setPoints(req.points, m_octree->getResolution());
+      OcTree* octree = dynamic_cast<OcTree*>(m_octree);
+      octomap_server::OcTreeStampedWithExpiry* stamped =
+          dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(m_octree);
+      if (octree)
+        query.search(*octree);
+      else if (stamped)
+        query.search(*stamped);
+      else {
+        ROS_ERROR("Occupancy queries are not supported on octree type \"%s\"", m_octree->getTreeType().c_str());
+        return false;
+      }
+    }
+    res.states = query.states();
+    res.log_odds = query.logOdds();
+    return true;
+  }
+
+  bool castRaysSrv(CastRays::Request& req, CastRays::Response& res)
+  {
+    std::vector<RayCaster::Ray> rays;
+    if (!RayCaster::makeRays(req.origins, req.directions, &rays)){
+      ROS_ERROR("cast_rays needs one origin, or one origin per direction, got %zu origins for %zu directions",
+                req.origins.size(), req.directions.size());
       return false;
+    }
 
+    std::vector<RayCaster::Result> results;
+    if (!m_dag.empty()){
+      RayCaster caster(m_dag.getResolution(), m_dag.getTreeDepth());
+      caster.cast(rays, req.max_range, m_castRaysThreads,
+                  [this](const OcTreeKey& key, unsigned* depth){
+                    return static_cast<PointQuery::State>(m_dag.search(key, depth));
+                  }, &results);
+    } else if (m_succinct.isOpen()){
+      RayCaster caster(m_succinct.getResolution(), m_succinct.getTreeDepth());
+      caster.cast(rays, req.max_range, m_castRaysThreads,
+                  [this](const OcTreeKey& key, unsigned* depth) -> PointQuery::State {
+                    float logOdds;
+                    if (!m_succinct.search(key, &logOdds, depth))
+                      return PointQuery::UNKNOWN;
+                    return m_succinct.isOccupied(logOdds) ? PointQuery::OCCUPIED : PointQuery::FREE;
+                  }, &results);
+    } else {
+      RayCaster caster(m_octree->getResolution(), m_octree->getTreeDepth());
+      OcTree* octree = dynamic_cast<OcTree*>(m_octree);
+      octomap_server::OcTreeStampedWithExpiry* stamped =
+          dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(m_octree);
+      if (octree)
+        caster.cast(rays, req.max_range, m_castRaysThreads,
+                    [octree](const OcTreeKey& key, unsigned* depth){
+                      return RayCaster::searchTree(*octree, key, depth);
+                    }, &results);
+      else if (stamped)
+        caster.cast(rays, req.max_range, m_castRaysThreads,
+                    [stamped](const OcTreeKey& key, unsigned* depth){
+                      return RayCaster::searchTree(*stamped, key, depth);
+                    }, &results);
+      else {
+        ROS_ERROR("Ray casting is not supported on octree type \"%s\"", m_octree->getTreeType().c_str());
+        return false;
+      }
+    }
+    RayCaster::fillResponse(results, &res);
     return true;
   }
 
 private:
-  ros::ServiceServer m_octomapBinaryService, m_octomapFullService;
+  static bool hasExtension(const std::string& filename, const std::string& extension)
+  {
+    return filename.length() > extension.length() &&
+           filename.compare(filename.length() - extension.length(), extension.length(), extension) == 0;
+  }
+
+  template <class TREE>
+  static bool regionToMsg(const TREE& tree, const GetOctomapRegion::Request& req, octomap_msgs::Octomap& msg)
+  {
+    // Clamp the box to the keys of the tree
+    const double lower = tree.keyToCoord(0);
+    const double upper = tree.keyToCoord(std::numeric_limits<key_type>::max());
+    point3d min = pointMsgToOctomap(req.min), max = pointMsgToOctomap(req.max);
+    OcTreeKey minKey, maxKey;
+    for (unsigned i = 0; i < 3; ++i){
+      if (min(i) > max(i)){
+        ROS_ERROR("Invalid octomap_region box, min is above max");
+        return false;
+      }
+      min(i) = std::min(std::max(double(min(i)), lower), upper);
+      max(i) = std::min(std::max(double(max(i)), lower), upper);
+    }
+    if (!tree.coordToKeyChecked(min, minKey) || !tree.coordToKeyChecked(max, maxKey))
+      return false;
+    const unsigned treeDepth = tree.getTreeDepth();
+    const unsigned maxDepth = (req.max_depth == 0 || req.max_depth > treeDepth) ? treeDepth : req.max_depth;
+    return octomap_server::mapToMsg(tree, req.binary,
+                                    octomap_server::BoundingBoxPolicy(minKey, maxKey, treeDepth, maxDepth), msg);
+  }
+
+  bool mapToMsg(bool binary, octomap_msgs::Octomap& msg)
+  {
+    if (!m_dag.empty()){
+      if (!binary){
+        ROS_ERROR("An octree DAG only holds the binary occupancy, it can not be sent as a full map");
+        return false;
+      }
+      return m_dag.binaryMapToMsg(msg);
+    }
+    if (m_succinct.isOpen())
+      return binary ? m_succinct.binaryMapToMsg(msg) : m_succinct.fullMapToMsg(msg);
+
+    // Stamped trees are sent as OcTree, like the server does
+    octomap_server::OcTreeStampedWithExpiry* stamped =
+        dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(m_octree);
+    if (stamped)
+      return octomap_server::mapToMsg(*stamped, binary, octomap_server::WriteAllPolicy(), msg);
+    if (binary)
+      return octomap_msgs::binaryMapToMsg(*m_octree, msg);
+    return octomap_msgs::fullMapToMsg(*m_octree, msg);
+  }
+
+  ros::ServiceServer m_octomapBinaryService, m_octomapFullService, m_octomapRegionService, m_queryOccupancyService, m_castRaysService;
   ros::NodeHandle m_nh;
   std::string m_worldFrameId;
   AbstractOccupancyOcTree* m_octree;
+  octomap_server::SuccinctOcTree m_succinct;
+  octomap_server::OcTreeDag m_dag;
+  unsigned m_castRaysThreads;
 
 };
 
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <octomap/octomap.h>
+#include <octomap_msgs/Octomap.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+
+#include "map_tool_utils.h"
+
+#define USAGE "\nUSAGE: octomap_stream_writer_benchmark [-g <nodes>] [-r <resolution>] [-t <threads>] " \
+              "[<input.[bt|ot]>]\n" \
+              "  -g: generate a random map of at least this many nodes instead of loading one\n" \
+              "  -r: resolution of the generated map (default 0.05)\n" \
+              "  -t: highest number of threads to time, doubling from 1 (default: number of cores)\n" \
+              "  input: map to write\n"
+
+using octomap_server::tools::Clock;
+using octomap_server::tools::readMap;
+using octomap_server::tools::secondsSince;
+
+// Random hits and misses in a cube large enough for num_nodes nodes to fit
+// at about half occupancy, so that few of them are pruned
+static octomap::OcTree* generateTree(size_t num_nodes, double resolution)
+{
+  octomap::OcTree* tree = new octomap::OcTree(resolution);
+  const double side = std::cbrt(2.0 * num_nodes) * resolution;
+  std::mt19937 generator(0);
+  std::uniform_real_distribution<double> coord(-side / 2.0, side / 2.0);
+  std::bernoulli_distribution hit(0.5);
+  while (tree->size() < num_nodes)
+  {
+    for (unsigned int i = 0; i < 100000; ++i)
+    {
+      tree->updateNode(octomap::point3d(coord(generator), coord(generator), coord(generator)), hit(generator));
+    }
+  }
+  return tree;
+}
+
+// Write the tree with octomap's writer, then with the parallel writer for
+// 1, 2, 4... max_threads threads, to a stream and to a message, and check
+// that all of them are the same bytes
+template <class TREE>
+static bool benchmark(const TREE& tree, unsigned int max_threads)
+{
+  printf("tree: %zu nodes, %zu bytes in memory\n", tree.size(), tree.memoryUsage());
+  bool ok = true;
+  for (int binary = 1; binary >= 0; --binary)
+  {
+    const char* format = binary ? "binary" : "full";
+    std::stringstream reference_stream;
+    Clock::time_point start = Clock::now();
+    if (binary)
+      tree.writeBinaryData(reference_stream);
+    else
+      tree.writeData(reference_stream);
+    const double reference_time = secondsSince(start);
+    const std::string reference = reference_stream.str();
+    printf("%-6s octomap:        %8.3f sec, %zu bytes\n", format, reference_time, reference.size());
+
+    for (unsigned int num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+      std::stringstream stream;
+      start = Clock::now();
+      const bool written =
+          octomap_server::writeDataParallel(tree, binary, stream, octomap_server::WriteAllPolicy(), num_threads);
+      const double stream_time = secondsSince(start);
+
+      octomap_msgs::Octomap msg;
+      start = Clock::now();
+      const bool converted =
+          octomap_server::mapToMsg(tree, binary, octomap_server::WriteAllPolicy(), msg, num_threads);
+      const double msg_time = secondsSince(start);
+
+      printf("%-6s %2u threads:     %8.3f sec (%.2fx), message %8.3f sec\n", format, num_threads, stream_time,
+             stream_time > 0.0 ? reference_time / stream_time : 0.0, msg_time);
+      if (!written || !converted || stream.str() != reference
+          || msg.data.size() != reference.size()
+          || !std::equal(msg.data.begin(), msg.data.end(), reference.begin(),
+                         [](int8_t a, char b) { return a == static_cast<int8_t>(b); }))
+      {
+        fprintf(stderr, "The %s stream written with %u threads differs from octomap's\n", format, num_threads);
+        ok = false;
+      }
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char** argv)
+{
+  size_t generate_nodes = 0;
+  double resolution = 0.05;
+  unsigned int max_threads = boost::thread::hardware_concurrency();
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "-g") == 0 && i + 1 < argc)
+      generate_nodes = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+      resolution = strtod(argv[++i], NULL);
+    else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+      max_threads = strtoul(argv[++i], NULL, 10);
+    else
+      files.push_back(argv[i]);
+  }
+  if (files.size() != (generate_nodes > 0 ? 0u : 1u) || resolution <= 0.0)
+  {
+    fprintf(stderr, "%s", USAGE);
+    exit(1);
+  }
+  max_threads = std::max(max_threads, 1u);
+
+  octomap::AbstractOcTree* tree = NULL;
+  if (generate_nodes > 0)
+  {
+    Clock::time_point start = Clock::now();
+    tree = generateTree(generate_nodes, resolution);
+    printf("Generated map in %f sec\n", secondsSince(start));
+  }
+  else
+  {
+    tree = readMap(files[0]);
+    if (!tree)
+    {
+      fprintf(stderr, "Could not read octree from %s\n", files[0].c_str());
+      exit(1);
+    }
+  }
+
+  bool ok = false;
+  octomap::OcTree* octree = dynamic_cast<octomap::OcTree*>(tree);
+  octomap_server::OcTreeStampedWithExpiry* stamped = dynamic_cast<octomap_server::OcTreeStampedWithExpiry*>(tree);
+  if (octree)
+  {
+    ok = benchmark(*octree, max_threads);
+  }
+  else if (stamped)
+  {
+    ok = benchmark(*stamped, max_threads);
+  }
+  else
+  {
+    fprintf(stderr, "Only OcTree maps can be benchmarked, not %s\n", tree->getTreeType().c_str());
+  }
+  delete tree;
+  exit(ok ? 0 : 1);
+}
@@ -0,0 +1,115 @@
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/BinaryMapFile.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+std::string temporaryFilename()
+{
+  char filename[] = "/tmp/test_binary_map_fileXXXXXX";
+  const int fd = mkstemp(filename);
+  if (fd >= 0)
+    close(fd);
+  return filename;
+}
+
+std::string binaryStream(const octomap::OcTree& tree)
+{
+  std::stringstream s;
+  tree.writeBinaryData(s);
+  return s.str();
+}
+
+// Write a file with the given header lines followed by data
+void writeFile(const std::string& filename, const std::string& header, const std::string& data)
+{
+  std::ofstream s(filename.c_str(), std::ios_base::out | std::ios_base::binary);
+  s << header << data;
+}
+
+}  // namespace
+
+TEST(BinaryMapFile, SameMapAsWritten)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 30000, 1, 3.0);
+  test::updateBox(&tree, octomap::point3d(3.0, -0.4, -0.4), octomap::point3d(3.8, 0.4, 0.4), false);
+  const std::string filename = temporaryFilename();
+  ASSERT_TRUE(tree.writeBinaryConst(filename));
+
+  octomap_msgs::Octomap msg;
+  msg.header.frame_id = "map";
+  std::string error;
+  ASSERT_TRUE(readBinaryMapFile(filename, &msg, &error)) << error;
+  unlink(filename.c_str());
+  EXPECT_TRUE(msg.binary);
+  EXPECT_EQ(tree.getTreeType(), msg.id);
+  EXPECT_EQ(tree.getResolution(), msg.resolution);
+  EXPECT_EQ(tree.getTreeDepth(), msg.depth);
+  EXPECT_EQ("map", msg.header.frame_id);
+  const std::string data = binaryStream(tree);
+  EXPECT_EQ(data, std::string(msg.data.begin(), msg.data.end()));
+
+  // and it reads back into the same tree
+  octomap::OcTree copy(msg.resolution);
+  std::stringstream s(std::string(msg.data.begin(), msg.data.end()));
+  copy.readBinaryData(s);
+  EXPECT_EQ(tree.size(), copy.size());
+  EXPECT_EQ(data, binaryStream(copy));
+}
+
+TEST(BinaryMapFile, EmptyMap)
+{
+  octomap::OcTree tree(0.05);
+  const std::string filename = temporaryFilename();
+  ASSERT_TRUE(tree.writeBinaryConst(filename));
+  octomap_msgs::Octomap msg;
+  std::string error;
+  EXPECT_TRUE(readBinaryMapFile(filename, &msg, &error)) << error;
+  unlink(filename.c_str());
+  EXPECT_EQ(0.05, msg.resolution);
+  EXPECT_TRUE(msg.data.empty());
+}
+
+TEST(BinaryMapFile, BadFilesAreRejected)
+{
+  octomap_msgs::Octomap msg;
+  std::string error;
+  const std::string filename = temporaryFilename();
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "empty file";
+  EXPECT_FALSE(error.empty());
+
+  writeFile(filename, "# Octomap OcTree binary file\nid OcTree\nsize 1\ndata\n", "\x01\x02");
+  error.clear();
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "no resolution";
+  EXPECT_EQ("could not read resolution", error);
+
+  writeFile(filename, "# Octomap OcTree binary file\nsize 1\nres 0.1\ndata\n", "\x01\x02");
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "no id";
+  EXPECT_EQ("could not read id", error);
+
+  writeFile(filename, "# Octomap OcTree binary file\nid OcTree\nsize 1\nres 0.1\ndepth 17\ndata\n", "\x01\x02");
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "too deep";
+
+  writeFile(filename, "# Octomap OcTree binary file\nid OcTree\nsize 3\nres 0.1\ndata\n", "");
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "no data";
+
+  writeFile(filename, "# Octomap OcTree binary file\nid OcTree\nsize 1\nres 0.1\ndepth 12\ndata\n", "\x01\x02");
+  EXPECT_TRUE(readBinaryMapFile(filename, &msg, &error)) << error;
+  EXPECT_EQ(12u, msg.depth);
+  EXPECT_EQ(2u, msg.data.size());
+  unlink(filename.c_str());
+
+  EXPECT_FALSE(readBinaryMapFile(filename, &msg, &error)) << "missing file";
+}
@@ -0,0 +1,93 @@
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap_server/ChangeJournal.h>
+
+using namespace octomap_server;
+
+namespace {
+
+typedef std::pair<std::vector<unsigned int>, unsigned int> NodeId;
+
+NodeId nodeId(const octomap::OcTreeKey& key, unsigned int depth)
+{
+  return NodeId(std::vector<unsigned int>{ key[0], key[1], key[2] }, depth);
+}
+
+octomap::OcTreeKey randomKey(std::mt19937* generator, unsigned int range)
+{
+  std::uniform_int_distribution<unsigned int> coord(32768 - range, 32768 + range);
+  const unsigned int x = coord(*generator), y = coord(*generator);
+  return octomap::OcTreeKey(x, y, coord(*generator));
+}
+
+}  // namespace
+
+TEST(ChangeJournal, PackRoundTrip)
+{
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<unsigned int> key(0, 0xffff), depth(0, 16);
+  for (unsigned int i = 0; i < 100000; ++i)
+  {
+    const octomap::OcTreeKey k(key(generator), key(generator), key(generator));
+    const unsigned int d = depth(generator);
+    const bool binary_changed = generator() % 2;
+    const ChangeJournal::Record record = ChangeJournal::pack(k, d, binary_changed);
+    EXPECT_EQ(k, ChangeJournal::recordKey(record));
+    EXPECT_EQ(d, ChangeJournal::recordDepth(record));
+    EXPECT_EQ(binary_changed, ChangeJournal::recordBinaryChanged(record));
+  }
+}
+
+TEST(ChangeJournal, CompactMergesRecordsOfTheSameNode)
+{
+  std::mt19937 generator(2);
+  std::uniform_int_distribution<unsigned int> depth(14, 16);
+  ChangeJournal journal;
+  journal.setEnabled(true);
+  // node -> whether any of its changes changed the binary state
+  std::map<NodeId, bool> reference;
+  // more than the compaction threshold, so the journal compacts by itself
+  for (unsigned int i = 0; i < 300000; ++i)
+  {
+    const octomap::OcTreeKey key = randomKey(&generator, 30);
+    const unsigned int d = depth(generator);
+    const bool binary_changed = generator() % 8 == 0;
+    journal.append(key, d, binary_changed);
+    bool& changed = reference[nodeId(key, d)];
+    changed = changed || binary_changed;
+  }
+  EXPECT_LT(journal.size(), 300000u);
+  journal.compact();
+
+  ASSERT_EQ(reference.size(), journal.size());
+  for (size_t i = 0; i < journal.records().size(); ++i)
+  {
+    const ChangeJournal::Record record = journal.records()[i];
+    if (i > 0)
+    {
+      EXPECT_LT(journal.records()[i - 1], record);
+    }
+    const std::map<NodeId, bool>::const_iterator it =
+        reference.find(nodeId(ChangeJournal::recordKey(record), ChangeJournal::recordDepth(record)));
+    ASSERT_TRUE(it != reference.end());
+    EXPECT_EQ(it->second, ChangeJournal::recordBinaryChanged(record));
+  }
+}
+
+TEST(ChangeJournal, DisabledJournalDropsChanges)
+{
+  ChangeJournal journal;
+  EXPECT_FALSE(journal.isEnabled());
+  journal.append(octomap::OcTreeKey(1, 2, 3), 16, true);
+  EXPECT_TRUE(journal.empty());
+
+  journal.setEnabled(true);
+  journal.append(octomap::OcTreeKey(1, 2, 3), 16, true);
+  EXPECT_EQ(1u, journal.size());
+  journal.setEnabled(false);
+  EXPECT_TRUE(journal.empty());
+}
@@ -0,0 +1,206 @@
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap_server/ChangeJournal.h>
+#include <octomap_server/Checkpointer.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+
+using namespace octomap_server;
+
+namespace {
+
+// Random hits and misses around the origin, with the journal records of the
+// voxels updated
+void randomUpdates(std::mt19937* generator, unsigned int num_updates, OcTreeStampedWithExpiry* tree,
+                   std::vector<ChangeJournal::Record>* records)
+{
+  std::uniform_real_distribution<double> coord(-3.0, 3.0);
+  std::bernoulli_distribution hit(0.4);
+  for (unsigned int i = 0; i < num_updates; ++i)
+  {
+    const octomap::OcTreeKey key =
+        tree->coordToKey(octomap::point3d(coord(*generator), coord(*generator), coord(*generator)));
+    tree->updateNode(key, hit(*generator));
+    records->push_back(ChangeJournal::pack(key, tree->getTreeDepth(), true));
+  }
+  ChangeJournal::compactRecords(records);
+}
+
+std::string nativeStream(const OcTreeStampedWithExpiry& tree)
+{
+  std::stringstream s;
+  tree.writeData(s);
+  return s.str();
+}
+
+bool fileExists(const std::string& filename)
+{
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0;
+}
+
+// A temporary checkpoint directory, removed with its files
+class CheckpointDirectory
+{
+public:
+  CheckpointDirectory()
+  {
+    char name[] = "/tmp/test_checkpointerXXXXXX";
+    if (mkdtemp(name))
+      name_ = name;
+  }
+  ~CheckpointDirectory()
+  {
+    DIR* dir = name_.empty() ? NULL : opendir(name_.c_str());
+    if (!dir)
+      return;
+    while (struct dirent* entry = readdir(dir))
+    {
+      const std::string file(entry->d_name);
+      if (file != "." && file != "..")
+        unlink((name_ + "/" + file).c_str());
+    }
+    closedir(dir);
+    rmdir(name_.c_str());
+  }
+
+  const std::string& name() const { return name_; }
+  std::string file(const std::string& name) const { return name_ + "/" + name; }
+
+private:
+  std::string name_;
+};
+
+std::unique_ptr<OcTreeStampedWithExpiry> restore(const std::string& directory)
+{
+  Checkpointer checkpointer;
+  checkpointer.setDirectory(directory);
+  return std::unique_ptr<OcTreeStampedWithExpiry>(checkpointer.restore());
+}
+
+}  // namespace
+
+TEST(Checkpointer, RestoreReplaysTheJournal)
+{
+  CheckpointDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  EXPECT_FALSE(restore(directory.name()));
+
+  std::mt19937 generator(1);
+  OcTreeStampedWithExpiry tree(0.1);
+  std::vector<ChangeJournal::Record> records;
+  randomUpdates(&generator, 20000, &tree, &records);
+  {
+    Checkpointer checkpointer;
+    checkpointer.setDirectory(directory.name());
+    checkpointer.setSnapshotPeriod(0.0);
+    // Copied over a few cycles, with updates in between
+    checkpointer.setSnapshotLeafsPerCycle(tree.getNumLeafNodes() / 3);
+    ros::Time now;
+    checkpointer.checkpoint(tree, std::vector<ChangeJournal::Record>(), now);
+    for (unsigned int cycle = 0; cycle < 6; ++cycle)
+    {
+      records.clear();
+      randomUpdates(&generator, 500, &tree, &records);
+      checkpointer.checkpoint(tree, records, now);
+    }
+    // Waits for the snapshot to be written
+  }
+  EXPECT_TRUE(fileExists(directory.file("snapshot_1.ot")));
+  EXPECT_TRUE(fileExists(directory.file("journal_1.bin")));
+
+  std::unique_ptr<OcTreeStampedWithExpiry> restored = restore(directory.name());
+  ASSERT_TRUE(restored.get());
+  EXPECT_EQ(nativeStream(tree), nativeStream(*restored));
+}
+
+TEST(Checkpointer, InterruptedSnapshotIsIgnored)
+{
+  CheckpointDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+
+  std::mt19937 generator(2);
+  OcTreeStampedWithExpiry tree(0.1);
+  std::vector<ChangeJournal::Record> records;
+  randomUpdates(&generator, 20000, &tree, &records);
+  {
+    Checkpointer checkpointer;
+    checkpointer.setDirectory(directory.name());
+    checkpointer.setSnapshotPeriod(0.0);
+    checkpointer.setSnapshotLeafsPerCycle(0);
+    ros::Time now;
+    checkpointer.checkpoint(tree, std::vector<ChangeJournal::Record>(), now);
+    records.clear();
+    randomUpdates(&generator, 500, &tree, &records);
+    checkpointer.checkpoint(tree, records, now);
+  }
+
+  // A crash while writing the next snapshot leaves part of it
+  std::ifstream complete(directory.file("snapshot_1.ot").c_str(), std::ios_base::in | std::ios_base::binary);
+  std::ostringstream data;
+  data << complete.rdbuf();
+  const std::string written = data.str().substr(0, data.str().size() / 2);
+  std::ofstream interrupted(directory.file("snapshot_2.ot.tmp").c_str(), std::ios_base::out | std::ios_base::binary);
+  interrupted.write(written.data(), written.size());
+  interrupted.close();
+
+  std::unique_ptr<OcTreeStampedWithExpiry> restored = restore(directory.name());
+  ASSERT_TRUE(restored.get());
+  EXPECT_EQ(nativeStream(tree), nativeStream(*restored));
+}
+
+TEST(Checkpointer, CompleteSnapshotRemovesOlderCheckpoints)
+{
+  CheckpointDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+
+  std::mt19937 generator(3);
+  OcTreeStampedWithExpiry tree(0.1);
+  std::vector<ChangeJournal::Record> records;
+  randomUpdates(&generator, 20000, &tree, &records);
+  {
+    Checkpointer checkpointer;
+    checkpointer.setDirectory(directory.name());
+    checkpointer.setSnapshotPeriod(0.0);
+    checkpointer.setSnapshotLeafsPerCycle(0);
+    ros::Time now;
+    checkpointer.checkpoint(tree, std::vector<ChangeJournal::Record>(), now);
+  }
+  ASSERT_TRUE(fileExists(directory.file("snapshot_1.ot")));
+  {
+    // Continues after the checkpoint there
+    Checkpointer checkpointer;
+    checkpointer.setDirectory(directory.name());
+    checkpointer.setSnapshotPeriod(0.0);
+    checkpointer.setSnapshotLeafsPerCycle(0);
+    records.clear();
+    randomUpdates(&generator, 500, &tree, &records);
+    ros::Time now;
+    checkpointer.checkpoint(tree, records, now);
+  }
+  EXPECT_TRUE(fileExists(directory.file("snapshot_2.ot")));
+  EXPECT_TRUE(fileExists(directory.file("journal_2.bin")));
+  EXPECT_FALSE(fileExists(directory.file("snapshot_1.ot")));
+  EXPECT_FALSE(fileExists(directory.file("journal_1.bin")));
+
+  std::unique_ptr<OcTreeStampedWithExpiry> restored = restore(directory.name());
+  ASSERT_TRUE(restored.get());
+  EXPECT_EQ(nativeStream(tree), nativeStream(*restored));
+
+  // Starting a new map instead
+  Checkpointer checkpointer;
+  checkpointer.setDirectory(directory.name());
+  checkpointer.discard();
+  EXPECT_FALSE(fileExists(directory.file("snapshot_2.ot")));
+  EXPECT_FALSE(restore(directory.name()));
+}
@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/EsdfLayer.h>
+
+using namespace octomap_server;
+
+namespace {
+
+const int SIZE_XY = 24;
+const int SIZE_Z = 16;
+const double MAX_DISTANCE = 8.0;
+// distances may exceed the exact ones by this much (in voxels)
+const double TOLERANCE = 0.1;
+
+typedef std::tuple<int, int, int> Cell;
+
+// Window centered on the origin of the tree, every voxel of it known free
+struct Window
+{
+  explicit Window(octomap::OcTree* tree) : tree(tree)
+  {
+    const octomap::OcTreeKey center = tree->coordToKey(0.0, 0.0, 0.0);
+    origin[0] = center[0] - SIZE_XY / 2;
+    origin[1] = center[1] - SIZE_XY / 2;
+    origin[2] = center[2] - SIZE_Z / 2;
+    for (int x = 0; x < SIZE_XY; ++x)
+      for (int y = 0; y < SIZE_XY; ++y)
+        for (int z = 0; z < SIZE_Z; ++z)
+          tree->setNodeValue(key(Cell(x, y, z)), -2.0f);
+  }
+
+  octomap::OcTreeKey key(const Cell& cell) const
+  {
+    return octomap::OcTreeKey(origin[0] + std::get<0>(cell), origin[1] + std::get<1>(cell),
+                              origin[2] + std::get<2>(cell));
+  }
+
+  octomap::OcTreeKey center() const
+  {
+    return key(Cell(SIZE_XY / 2, SIZE_XY / 2, SIZE_Z / 2));
+  }
+
+  octomap::OcTree* tree;
+  int origin[3];
+};
+
+double exactDistance(const std::set<Cell>& obstacles, const Cell& cell)
+{
+  double best = MAX_DISTANCE;
+  for (const Cell& obstacle : obstacles)
+  {
+    const int dx = std::get<0>(obstacle) - std::get<0>(cell);
+    const int dy = std::get<1>(obstacle) - std::get<1>(cell);
+    const int dz = std::get<2>(obstacle) - std::get<2>(cell);
+    best = std::min(best, std::sqrt(double(dx * dx + dy * dy + dz * dz)));
+  }
+  return best;
+}
+
+// Compare every cell of esdf with a brute force EDT of obstacles
+void compareWithBruteForce(const EsdfLayer& esdf, const Window& window, const std::set<Cell>& obstacles)
+{
+  for (int x = 0; x < SIZE_XY; ++x)
+  {
+    for (int y = 0; y < SIZE_XY; ++y)
+    {
+      for (int z = 0; z < SIZE_Z; ++z)
+      {
+        const Cell cell(x, y, z);
+        float distance;
+        EXPECT_TRUE(esdf.distance(window.key(cell), &distance));
+        const double exact = exactDistance(obstacles, cell);
+        // every cell points at an actual obstacle, so it is never closer
+        EXPECT_GE(distance, exact - 1e-4) << x << " " << y << " " << z;
+        EXPECT_LE(distance, exact + TOLERANCE) << x << " " << y << " " << z;
+      }
+    }
+  }
+}
+
+Cell randomCell(std::mt19937* generator)
+{
+  std::uniform_int_distribution<int> xy(0, SIZE_XY - 1), z(0, SIZE_Z - 1);
+  const int x = xy(*generator), y = xy(*generator);
+  return Cell(x, y, z(*generator));
+}
+
+}  // namespace
+
+TEST(EsdfLayer, RebuildMatchesBruteForce)
+{
+  std::mt19937 generator(1);
+  // from a few obstacles far apart to cluttered space
+  for (unsigned int num_obstacles : { 1u, 3u, 10u, 40u, 200u, 1000u })
+  {
+    octomap::OcTree tree(0.1);
+    Window window(&tree);
+    std::set<Cell> obstacles;
+    for (unsigned int i = 0; i < num_obstacles; ++i)
+    {
+      const Cell cell = randomCell(&generator);
+      obstacles.insert(cell);
+      tree.setNodeValue(window.key(cell), 2.0f);
+    }
+    EsdfLayer esdf;
+    esdf.configure(SIZE_XY, SIZE_Z, MAX_DISTANCE, false);
+    ASSERT_TRUE(esdf.follow(window.center()));
+    esdf.update(tree, std::vector<ChangeJournal::Record>());
+    compareWithBruteForce(esdf, window, obstacles);
+  }
+}
+
+TEST(EsdfLayer, IncrementalMatchesBruteForce)
+{
+  std::mt19937 generator(2);
+  octomap::OcTree tree(0.1);
+  Window window(&tree);
+  EsdfLayer esdf;
+  esdf.configure(SIZE_XY, SIZE_Z, MAX_DISTANCE, false);
+  ASSERT_TRUE(esdf.follow(window.center()));
+  esdf.update(tree, std::vector<ChangeJournal::Record>());
+
+  std::set<Cell> obstacles;
+  for (unsigned int round = 0; round < 40; ++round)
+  {
+    std::vector<ChangeJournal::Record> records;
+    for (unsigned int i = 0; i < 20; ++i)
+    {
+      const Cell cell = randomCell(&generator);
+      // grow the obstacles first, then add and remove them
+      const bool occupied = obstacles.count(cell) == 0 && (round < 5 || generator() % 2);
+      if (occupied)
+        obstacles.insert(cell);
+      else if (!obstacles.erase(cell))
+        continue;
+      tree.setNodeValue(window.key(cell), occupied ? 2.0f : -2.0f);
+      records.push_back(ChangeJournal::pack(window.key(cell), tree.getTreeDepth(), true));
+    }
+    if (round % 7 == 3)
+    {
+      // a cube cleared at once, recorded as one coarse node. The window is
+      // centered on the origin of the tree, so its center is on the corner
+      // of a node.
+      const Cell corner(SIZE_XY / 2, SIZE_XY / 2, SIZE_Z / 2);
+      for (int x = 0; x < 8; ++x)
+        for (int y = 0; y < 8; ++y)
+          for (int z = 0; z < 8; ++z)
+          {
+            const Cell cell(std::get<0>(corner) + x, std::get<1>(corner) + y, std::get<2>(corner) + z);
+            obstacles.erase(cell);
+            tree.setNodeValue(window.key(cell), -2.0f);
+          }
+      records.push_back(ChangeJournal::pack(window.key(corner), tree.getTreeDepth() - 3, true));
+    }
+    esdf.update(tree, records);
+    compareWithBruteForce(esdf, window, obstacles);
+  }
+}
+
+TEST(EsdfLayer, OutsideOfWindow)
+{
+  octomap::OcTree tree(0.1);
+  Window window(&tree);
+  EsdfLayer esdf;
+  esdf.configure(SIZE_XY, SIZE_Z, MAX_DISTANCE, false);
+  float distance;
+  EXPECT_FALSE(esdf.distance(window.center(), &distance));
+  ASSERT_TRUE(esdf.follow(window.center()));
+  esdf.update(tree, std::vector<ChangeJournal::Record>());
+  EXPECT_TRUE(esdf.distance(window.center(), &distance));
+  EXPECT_FLOAT_EQ(MAX_DISTANCE, distance);
+  EXPECT_FALSE(esdf.distance(window.key(Cell(-1, 0, 0)), &distance));
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap_server/MapTransfer.h>
+
+using namespace octomap_server;
+
+namespace {
+
+// CRC-32 (IEEE 802.3, as zlib) one bit at a time
+uint32_t bitwiseCrc32(const int8_t* data, size_t size)
+{
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < size; ++i)
+  {
+    crc ^= uint8_t(data[i]);
+    for (unsigned int bit = 0; bit < 8; ++bit)
+      crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+  }
+  return ~crc;
+}
+
+octomap_msgs::OctomapConstPtr randomMap(std::mt19937* generator, size_t size)
+{
+  octomap_msgs::OctomapPtr map(new octomap_msgs::Octomap);
+  map->data.resize(size);
+  for (size_t i = 0; i < size; ++i)
+    map->data[i] = int8_t((*generator)());
+  return map;
+}
+
+}  // namespace
+
+TEST(MapTransfer, Crc32)
+{
+  const std::string check = "123456789";
+  EXPECT_EQ(0xcbf43926u, MapTransfer::crc32(reinterpret_cast<const int8_t*>(check.data()), check.size()));
+  EXPECT_EQ(0u, MapTransfer::crc32(NULL, 0));
+
+  std::mt19937 generator(1);
+  for (size_t size = 0; size < 2000; size += 1 + size / 4)
+  {
+    const octomap_msgs::OctomapConstPtr map = randomMap(&generator, size);
+    EXPECT_EQ(bitwiseCrc32(map->data.data(), size), MapTransfer::crc32(map->data.data(), size)) << size;
+  }
+}
+
+TEST(MapTransfer, ChunksMakeUpTheMap)
+{
+  std::mt19937 generator(2);
+  const size_t sizes[] = { 0, 1, 999, 1000, 1001, 12345 };
+  const size_t chunk_sizes[] = { 0, 1, 7, 1000, 100000 };
+  MapTransfer transfer;
+  transfer.setLimits(100, 60.0);
+  for (size_t size : sizes)
+  {
+    for (size_t chunk_size : chunk_sizes)
+    {
+      const octomap_msgs::OctomapConstPtr map = randomMap(&generator, size);
+      const uint32_t id = transfer.start(map, chunk_size);
+      EXPECT_NE(0u, id);
+      const size_t expected_chunk_size = std::max(chunk_size, size_t(1));
+      const uint32_t num_chunks = transfer.numChunks(id);
+      ASSERT_EQ((size + expected_chunk_size - 1) / expected_chunk_size, num_chunks);
+
+      // Fetch the chunks backwards, and some twice
+      std::vector<std::vector<int8_t> > chunks(num_chunks);
+      for (uint32_t i = num_chunks; i-- > 0;)
+      {
+        uint32_t crc = 0;
+        ASSERT_TRUE(transfer.chunk(id, i, &chunks[i], &crc));
+        EXPECT_EQ(bitwiseCrc32(chunks[i].data(), chunks[i].size()), crc);
+        EXPECT_EQ(i + 1 < num_chunks ? expected_chunk_size : size - i * expected_chunk_size, chunks[i].size());
+        if (i % 3 == 0)
+        {
+          std::vector<int8_t> again;
+          ASSERT_TRUE(transfer.chunk(id, i, &again, &crc));
+          EXPECT_EQ(chunks[i], again);
+        }
+      }
+      std::vector<int8_t> data;
+      for (uint32_t i = 0; i < num_chunks; ++i)
+        data.insert(data.end(), chunks[i].begin(), chunks[i].end());
+      EXPECT_EQ(map->data, data);
+
+      std::vector<int8_t> chunk;
+      uint32_t crc = 0;
+      EXPECT_FALSE(transfer.chunk(id, num_chunks, &chunk, &crc));
+    }
+  }
+}
+
+TEST(MapTransfer, UnknownSessions)
+{
+  MapTransfer transfer;
+  std::vector<int8_t> chunk;
+  uint32_t crc = 0;
+  EXPECT_EQ(0u, transfer.numChunks(0));
+  EXPECT_FALSE(transfer.chunk(0, 0, &chunk, &crc));
+
+  std::mt19937 generator(3);
+  const uint32_t id = transfer.start(randomMap(&generator, 100), 10);
+  EXPECT_EQ(0u, transfer.numChunks(id + 1));
+  EXPECT_FALSE(transfer.chunk(id + 1, 0, &chunk, &crc));
+  transfer.clear();
+  EXPECT_EQ(0u, transfer.numChunks(id));
+}
+
+TEST(MapTransfer, LeastRecentlyUsedSessionIsDropped)
+{
+  std::mt19937 generator(4);
+  MapTransfer transfer;
+  transfer.setLimits(3, 60.0);
+  std::vector<uint32_t> ids;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    ids.push_back(transfer.start(randomMap(&generator, 100), 10));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  // The first session is used last
+  std::vector<int8_t> chunk;
+  uint32_t crc = 0;
+  ASSERT_TRUE(transfer.chunk(ids[0], 0, &chunk, &crc));
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+  const uint32_t id = transfer.start(randomMap(&generator, 100), 10);
+  EXPECT_EQ(10u, transfer.numChunks(id));
+  EXPECT_EQ(10u, transfer.numChunks(ids[0]));
+  EXPECT_EQ(0u, transfer.numChunks(ids[1]));
+  EXPECT_EQ(10u, transfer.numChunks(ids[2]));
+}
+
+TEST(MapTransfer, SessionsTimeOut)
+{
+  std::mt19937 generator(5);
+  MapTransfer transfer;
+  transfer.setLimits(4, 0.05);
+  const uint32_t idle = transfer.start(randomMap(&generator, 100), 10);
+  const uint32_t used = transfer.start(randomMap(&generator, 100), 10);
+  std::vector<int8_t> chunk;
+  uint32_t crc = 0;
+  for (unsigned int i = 0; i < 4; ++i)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_TRUE(transfer.chunk(used, i, &chunk, &crc));
+  }
+  EXPECT_FALSE(transfer.chunk(idle, 0, &chunk, &crc));
+  EXPECT_EQ(0u, transfer.numChunks(idle));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_FALSE(transfer.chunk(used, 0, &chunk, &crc));
+}
@@ -0,0 +1,172 @@
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/OcTreeDag.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+std::string binaryStream(const octomap::OcTree& tree)
+{
+  std::stringstream s;
+  tree.writeBinaryData(s);
+  return s.str();
+}
+
+// Occupancy and depth of the leaf of tree holding key
+OcTreeDag::Occupancy treeOccupancy(const octomap::OcTree& tree, const octomap::OcTreeKey& key, unsigned int* depth)
+{
+  const octomap::OcTreeNode* node = tree.getRoot();
+  *depth = 0;
+  while (node && tree.nodeHasChildren(node))
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, tree.getTreeDepth() - 1 - *depth);
+    node = tree.nodeChildExists(node, pos) ? tree.getNodeChild(node, pos) : NULL;
+    ++*depth;
+  }
+  if (!node)
+    return OcTreeDag::UNKNOWN;
+  return tree.isNodeOccupied(node) ? OcTreeDag::OCCUPIED : OcTreeDag::FREE;
+}
+
+void expectSameOccupancy(const octomap::OcTree& tree, const OcTreeDag& dag, bool check_depth)
+{
+  std::mt19937 generator(3);
+  std::uniform_real_distribution<double> coord(-3.0, 7.0);
+  for (unsigned int i = 0; i < 50000; ++i)
+  {
+    const octomap::OcTreeKey key = tree.coordToKey(coord(generator), coord(generator), coord(generator));
+    unsigned int depth, dag_depth = 0;
+    const OcTreeDag::Occupancy occupancy = treeOccupancy(tree, key, &depth);
+    ASSERT_EQ(occupancy, dag.search(key, &dag_depth));
+    if (check_depth && occupancy != OcTreeDag::UNKNOWN)
+    {
+      EXPECT_EQ(depth, dag_depth);
+    }
+  }
+}
+
+std::string temporaryFilename()
+{
+  char filename[] = "/tmp/test_octree_dagXXXXXX";
+  const int fd = mkstemp(filename);
+  if (fd >= 0)
+    close(fd);
+  return filename;
+}
+
+}  // namespace
+
+TEST(OcTreeDag, SameBinaryStreamAsOctomap)
+{
+  for (unsigned int seed = 1; seed <= 3; ++seed)
+  {
+    octomap::OcTree tree(0.1);
+    test::addRandomUpdates(&tree, 20000, seed, 2.0);
+    // Free and occupied boxes repeated along x, which the DAG stores once
+    test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.05), octomap::point3d(6.4, 0.8, 0.2), false);
+    test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.25), octomap::point3d(6.4, 0.8, 0.4), true);
+    OcTreeDag dag;
+    dag.build(tree, false);
+    EXPECT_EQ(tree.size(), dag.treeSize());
+    EXPECT_LT(dag.size(), tree.size());
+
+    octomap_msgs::Octomap msg;
+    ASSERT_TRUE(dag.binaryMapToMsg(msg));
+    EXPECT_EQ(binaryStream(tree), std::string(msg.data.begin(), msg.data.end()));
+    EXPECT_TRUE(msg.binary);
+    EXPECT_EQ(tree.getResolution(), msg.resolution);
+  }
+}
+
+TEST(OcTreeDag, SearchMatchesTree)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 20000, 4, 2.0);
+  test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.05), octomap::point3d(6.4, 0.8, 0.2), false);
+  test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.25), octomap::point3d(6.4, 0.8, 0.4), true);
+  OcTreeDag dag;
+  dag.build(tree, false);
+  expectSameOccupancy(tree, dag, true);
+
+  // pruning merges leafs of the same occupancy, which keeps it
+  OcTreeDag pruned;
+  pruned.build(tree, true);
+  EXPECT_LE(pruned.size(), dag.size());
+  expectSameOccupancy(tree, pruned, false);
+}
+
+TEST(OcTreeDag, FileRoundTrip)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 20000, 5, 2.0);
+  test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.05), octomap::point3d(6.4, 0.8, 0.2), false);
+  test::updateBox(&tree, octomap::point3d(3.2, 0.05, 0.25), octomap::point3d(6.4, 0.8, 0.4), true);
+  OcTreeDag dag;
+  dag.build(tree, false);
+  const std::string filename = temporaryFilename();
+  ASSERT_TRUE(dag.write(filename));
+  OcTreeDag read;
+  ASSERT_TRUE(read.read(filename));
+  unlink(filename.c_str());
+
+  EXPECT_EQ(dag.size(), read.size());
+  EXPECT_EQ(dag.treeSize(), read.treeSize());
+  EXPECT_EQ(dag.getTreeType(), read.getTreeType());
+  EXPECT_EQ(dag.getTreeDepth(), read.getTreeDepth());
+  octomap_msgs::Octomap msg;
+  ASSERT_TRUE(read.binaryMapToMsg(msg));
+  EXPECT_EQ(binaryStream(tree), std::string(msg.data.begin(), msg.data.end()));
+  expectSameOccupancy(tree, read, true);
+}
+
+TEST(OcTreeDag, LeafRoot)
+{
+  // a root without children, as read from a stream of one empty node
+  octomap::OcTree tree(0.1);
+  std::istringstream stream(std::string(2, '\0'));
+  tree.readBinaryData(stream);
+  ASSERT_TRUE(tree.getRoot() != NULL);
+  ASSERT_FALSE(tree.nodeHasChildren(tree.getRoot()));
+  const OcTreeDag::Occupancy occupancy = tree.isNodeOccupied(tree.getRoot()) ? OcTreeDag::OCCUPIED : OcTreeDag::FREE;
+
+  OcTreeDag dag;
+  dag.build(tree, false);
+  EXPECT_FALSE(dag.empty());
+  EXPECT_EQ(1u, dag.treeSize());
+  unsigned int depth = 1;
+  EXPECT_EQ(occupancy, dag.search(tree.coordToKey(1.0, -2.0, 3.0), &depth));
+  EXPECT_EQ(0u, depth);
+  octomap_msgs::Octomap msg;
+  ASSERT_TRUE(dag.binaryMapToMsg(msg));
+  EXPECT_EQ(binaryStream(tree), std::string(msg.data.begin(), msg.data.end()));
+
+  const std::string filename = temporaryFilename();
+  ASSERT_TRUE(dag.write(filename));
+  OcTreeDag read;
+  ASSERT_TRUE(read.read(filename));
+  unlink(filename.c_str());
+  EXPECT_EQ(occupancy, read.search(tree.coordToKey(-1.0, 2.0, 0.0)));
+}
+
+TEST(OcTreeDag, EmptyTree)
+{
+  octomap::OcTree tree(0.1);
+  OcTreeDag dag;
+  dag.build(tree, false);
+  EXPECT_TRUE(dag.empty());
+  EXPECT_EQ(0u, dag.treeSize());
+  EXPECT_EQ(OcTreeDag::UNKNOWN, dag.search(tree.coordToKey(0.0, 0.0, 0.0)));
+  octomap_msgs::Octomap msg;
+  ASSERT_TRUE(dag.binaryMapToMsg(msg));
+  EXPECT_TRUE(msg.data.empty());
+}
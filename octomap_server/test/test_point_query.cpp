@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <geometry_msgs/Point.h>
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/PointQuery.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+geometry_msgs::Point makePoint(double x, double y, double z)
+{
+  geometry_msgs::Point point;
+  point.x = x;
+  point.y = y;
+  point.z = z;
+  return point;
+}
+
+// Points in and around the map, repeated points, points on voxel borders and
+// points outside of the tree
+std::vector<geometry_msgs::Point> randomPoints(const octomap::OcTree& tree, unsigned int num_points)
+{
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<double> coord(-3.0, 3.0);
+  std::uniform_int_distribution<int> border(-30, 30);
+  std::vector<geometry_msgs::Point> points;
+  for (unsigned int i = 0; i < num_points; ++i)
+  {
+    switch (i % 4)
+    {
+      case 0:
+      case 1:
+        points.push_back(makePoint(coord(generator), coord(generator), coord(generator)));
+        break;
+      case 2:
+        points.push_back(makePoint(border(generator) * tree.getResolution(), border(generator) * tree.getResolution(),
+                                   border(generator) * tree.getResolution()));
+        break;
+      case 3:
+        points.push_back(points[generator() % points.size()]);
+        break;
+    }
+  }
+  const double outside = 32768.0 * tree.getResolution();
+  points.push_back(makePoint(outside, 0.0, 0.0));
+  points.push_back(makePoint(0.0, -outside - tree.getResolution(), 0.0));
+  points.push_back(makePoint(0.0, 0.0, std::numeric_limits<double>::quiet_NaN()));
+  return points;
+}
+
+// The octomap way: one search from the root per point
+PointQuery::State searchPoint(const octomap::OcTree& tree, const geometry_msgs::Point& point, float* log_odds,
+                              octomap::OcTreeKey* key)
+{
+  *log_odds = 0.0f;
+  if (!tree.coordToKeyChecked(point.x, (*key)[0]) || !tree.coordToKeyChecked(point.y, (*key)[1]) ||
+      !tree.coordToKeyChecked(point.z, (*key)[2]))
+    return PointQuery::UNKNOWN;
+  const octomap::OcTreeNode* node = tree.search(*key);
+  if (!node)
+    return PointQuery::UNKNOWN;
+  *log_odds = node->getLogOdds();
+  return tree.isNodeOccupied(node) ? PointQuery::OCCUPIED : PointQuery::FREE;
+}
+
+}  // namespace
+
+TEST(PointQuery, SameAsSearchingEachPoint)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 30000, 1, 2.0);
+  const std::vector<geometry_msgs::Point> points = randomPoints(tree, 100000);
+
+  PointQuery query;
+  query.setPoints(points, tree.getResolution());
+  query.search(tree);
+  ASSERT_EQ(points.size(), query.states().size());
+  ASSERT_EQ(points.size(), query.logOdds().size());
+  unsigned int num_states[3] = { 0, 0, 0 };
+  for (size_t i = 0; i < points.size(); ++i)
+  {
+    float log_odds;
+    octomap::OcTreeKey key;
+    const PointQuery::State state = searchPoint(tree, points[i], &log_odds, &key);
+    ASSERT_EQ(state, query.states()[i]) << "point " << i;
+    EXPECT_EQ(log_odds, query.logOdds()[i]) << "point " << i;
+    num_states[state]++;
+  }
+  // the points cover every state
+  EXPECT_GT(num_states[PointQuery::UNKNOWN], 0u);
+  EXPECT_GT(num_states[PointQuery::FREE], 0u);
+  EXPECT_GT(num_states[PointQuery::OCCUPIED], 0u);
+}
+
+TEST(PointQuery, SearchEachSeesEveryKey)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 30000, 1, 2.0);
+  const std::vector<geometry_msgs::Point> points = randomPoints(tree, 20000);
+
+  PointQuery query;
+  query.setPoints(points, tree.getResolution());
+  query.searchEach([&tree](const octomap::OcTreeKey& key, float* log_odds) {
+    const octomap::OcTreeNode* node = tree.search(key);
+    if (!node)
+      return PointQuery::UNKNOWN;
+    *log_odds = node->getLogOdds();
+    return tree.isNodeOccupied(node) ? PointQuery::OCCUPIED : PointQuery::FREE;
+  });
+  for (size_t i = 0; i < points.size(); ++i)
+  {
+    float log_odds;
+    octomap::OcTreeKey key;
+    EXPECT_EQ(searchPoint(tree, points[i], &log_odds, &key), query.states()[i]) << "point " << i;
+    EXPECT_EQ(log_odds, query.logOdds()[i]) << "point " << i;
+  }
+}
+
+TEST(PointQuery, Bounds)
+{
+  octomap::OcTree tree(0.1);
+  const std::vector<geometry_msgs::Point> points = randomPoints(tree, 1000);
+  PointQuery query;
+  query.setPoints(points, tree.getResolution());
+  octomap::OcTreeKey min, max;
+  ASSERT_TRUE(query.bounds(&min, &max));
+
+  octomap::OcTreeKey expected_min(0xffff, 0xffff, 0xffff), expected_max(0, 0, 0);
+  for (const geometry_msgs::Point& point : points)
+  {
+    octomap::OcTreeKey key;
+    if (!tree.coordToKeyChecked(point.x, key[0]) || !tree.coordToKeyChecked(point.y, key[1]) ||
+        !tree.coordToKeyChecked(point.z, key[2]))
+      continue;
+    for (unsigned int i = 0; i < 3; ++i)
+    {
+      expected_min[i] = std::min(expected_min[i], key[i]);
+      expected_max[i] = std::max(expected_max[i], key[i]);
+    }
+  }
+  EXPECT_TRUE(expected_min == min);
+  EXPECT_TRUE(expected_max == max);
+
+  query.setPoints(std::vector<geometry_msgs::Point>(1, makePoint(1e9, 0.0, 0.0)), tree.getResolution());
+  EXPECT_FALSE(query.bounds(&min, &max));
+}
+
+TEST(PointQuery, EmptyTree)
+{
+  octomap::OcTree tree(0.1);
+  PointQuery query;
+  query.setPoints(std::vector<geometry_msgs::Point>(3, makePoint(0.5, 0.5, 0.5)), tree.getResolution());
+  query.search(tree);
+  EXPECT_EQ(std::vector<uint8_t>(3, PointQuery::UNKNOWN), query.states());
+}
@@ -0,0 +1,189 @@
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/RayCaster.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+const double RESOLUTION = 0.1;
+
+// Scattered obstacles in known free space, with unknown space around it
+void buildObstacleTree(octomap::OcTree* tree)
+{
+  std::mt19937 generator(1);
+  std::uniform_real_distribution<double> coord(-2.0, 2.0);
+  test::updateBox(tree, octomap::point3d(-1.95, -1.95, -0.75), octomap::point3d(2.05, 2.05, 0.85), false);
+  for (unsigned int i = 0; i < 300; ++i)
+  {
+    const octomap::point3d point(coord(generator), coord(generator), coord(generator) * 0.4);
+    tree->updateNode(point, true);
+    tree->updateNode(point, true);
+  }
+}
+
+struct Expected
+{
+  bool hit;
+  bool crossed_unknown;
+  octomap::OcTreeKey key;
+  double range;
+};
+
+// Visit every voxel along the ray (Amanatides & Woo), up to max_range or to
+// the bounds of the tree
+Expected traverseVoxels(const octomap::OcTree& tree, const RayCaster::Ray& ray, double max_range)
+{
+  Expected expected;
+  expected.hit = false;
+  expected.crossed_unknown = false;
+  expected.range = 0.0;
+  const int center = 1 << (tree.getTreeDepth() - 1);
+  const double max_t = max_range > 0.0 ? max_range : std::numeric_limits<double>::infinity();
+  const double length = ray.direction.norm();
+  double origin[3], direction[3], t_max[3], t_delta[3];
+  int key[3], step[3];
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    origin[i] = ray.origin(i);
+    direction[i] = ray.direction(i) / length;
+    key[i] = static_cast<int>(std::floor(origin[i] / RESOLUTION)) + center;
+    step[i] = direction[i] > 0.0 ? 1 : direction[i] < 0.0 ? -1 : 0;
+    if (step[i] == 0)
+    {
+      t_max[i] = t_delta[i] = std::numeric_limits<double>::infinity();
+      continue;
+    }
+    const double border = (key[i] - center + (step[i] > 0 ? 1 : 0)) * RESOLUTION;
+    t_max[i] = (border - origin[i]) / direction[i];
+    t_delta[i] = RESOLUTION / std::fabs(direction[i]);
+  }
+  double t = 0.0;
+  while (key[0] >= 0 && key[0] < 2 * center && key[1] >= 0 && key[1] < 2 * center && key[2] >= 0 &&
+         key[2] < 2 * center)
+  {
+    const octomap::OcTreeKey voxel(key[0], key[1], key[2]);
+    const octomap::OcTreeNode* node = tree.search(voxel);
+    if (node && tree.isNodeOccupied(node))
+    {
+      expected.hit = true;
+      expected.key = voxel;
+      expected.range = t;
+      return expected;
+    }
+    if (!node)
+      expected.crossed_unknown = true;
+    unsigned int axis = 0;
+    if (t_max[1] < t_max[axis])
+      axis = 1;
+    if (t_max[2] < t_max[axis])
+      axis = 2;
+    if (t_max[axis] > max_t)
+    {
+      t = max_t;
+      break;
+    }
+    t = t_max[axis];
+    key[axis] += step[axis];
+    t_max[axis] += t_delta[axis];
+  }
+  expected.range = std::min(t, max_t);
+  return expected;
+}
+
+std::vector<RayCaster::Ray> randomRays(unsigned int num_rays, double origin_range)
+{
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<float> origin(-origin_range, origin_range), direction(-1.0f, 1.0f);
+  std::vector<RayCaster::Ray> rays;
+  while (rays.size() < num_rays)
+  {
+    RayCaster::Ray ray;
+    ray.origin = octomap::point3d(origin(generator), origin(generator), origin(generator));
+    ray.direction = octomap::point3d(direction(generator), direction(generator), direction(generator));
+    // rays along the axes and in the planes of the axes
+    if (rays.size() % 10 == 1)
+      ray.direction(2) = 0.0f;
+    if (rays.size() % 10 == 2)
+      ray.direction(0) = ray.direction(1) = 0.0f;
+    if (ray.direction.norm() > 0.0)
+      rays.push_back(ray);
+  }
+  return rays;
+}
+
+void compareWithVoxelTraversal(const octomap::OcTree& tree, const std::vector<RayCaster::Ray>& rays,
+                               double max_range, unsigned int num_threads)
+{
+  RayCaster caster(tree.getResolution(), tree.getTreeDepth());
+  std::vector<RayCaster::Result> results;
+  caster.cast(rays, max_range, num_threads,
+              [&tree](const octomap::OcTreeKey& key, unsigned int* depth) {
+                return RayCaster::searchTree(tree, key, depth);
+              },
+              &results);
+  ASSERT_EQ(rays.size(), results.size());
+  unsigned int num_hits = 0;
+  for (size_t i = 0; i < rays.size(); ++i)
+  {
+    const Expected expected = traverseVoxels(tree, rays[i], max_range);
+    ASSERT_EQ(expected.hit, results[i].hit) << "ray " << i;
+    EXPECT_EQ(expected.crossed_unknown, results[i].crossed_unknown) << "ray " << i;
+    // the voxel traversal accumulates rounding errors over long rays
+    EXPECT_NEAR(expected.range, results[i].range, 1e-4 + 1e-7 * expected.range) << "ray " << i;
+    if (expected.hit)
+    {
+      ++num_hits;
+      const octomap::point3d center = tree.keyToCoord(expected.key);
+      for (unsigned int j = 0; j < 3; ++j)
+      {
+        EXPECT_NEAR(center(j), results[i].end(j), 1e-4) << "ray " << i;
+      }
+    }
+  }
+  EXPECT_GT(num_hits, 0u);
+  EXPECT_LT(num_hits, rays.size());
+}
+
+}  // namespace
+
+TEST(RayCaster, SameAsVoxelTraversal)
+{
+  octomap::OcTree tree(RESOLUTION);
+  buildObstacleTree(&tree);
+  compareWithVoxelTraversal(tree, randomRays(2000, 3.0), 6.0, 1);
+}
+
+TEST(RayCaster, SameAsVoxelTraversalToTheBoundsOfTheTree)
+{
+  octomap::OcTree tree(RESOLUTION);
+  buildObstacleTree(&tree);
+  compareWithVoxelTraversal(tree, randomRays(50, 2.0), 0.0, 1);
+}
+
+TEST(RayCaster, ThreadsGiveTheSameResults)
+{
+  octomap::OcTree tree(RESOLUTION);
+  buildObstacleTree(&tree);
+  compareWithVoxelTraversal(tree, randomRays(2000, 3.0), 6.0, 4);
+}
+
+TEST(RayCaster, MakeRays)
+{
+  std::vector<geometry_msgs::Point> origins(1);
+  std::vector<geometry_msgs::Vector3> directions(3);
+  std::vector<RayCaster::Ray> rays;
+  EXPECT_TRUE(RayCaster::makeRays(origins, directions, &rays));
+  EXPECT_EQ(3u, rays.size());
+  origins.resize(3);
+  EXPECT_TRUE(RayCaster::makeRays(origins, directions, &rays));
+  origins.resize(2);
+  EXPECT_FALSE(RayCaster::makeRays(origins, directions, &rays));
+}
@@ -0,0 +1,324 @@
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap_server/RegionSet.h>
+
+using namespace octomap_server;
+using octomap::point3d;
+
+namespace {
+
+// The regions of a RegionSet, kept to test points against them one by one
+class PointSampler
+{
+public:
+  void addBox(const point3d& min, const point3d& max)
+  {
+    regions_.addBox(min, max);
+    boxes_.push_back(Box{ min, max });
+  }
+  void addOrientedBox(const point3d& center, const double* rotation, const point3d& size)
+  {
+    regions_.addOrientedBox(center, rotation, size);
+    const double norm = std::sqrt(rotation[0] * rotation[0] + rotation[1] * rotation[1]
+                                  + rotation[2] * rotation[2] + rotation[3] * rotation[3]);
+    OrientedBox box;
+    box.center = center;
+    box.size = size;
+    for (unsigned int i = 0; i < 4; ++i)
+      box.rotation[i] = rotation[i] / norm;
+    oriented_boxes_.push_back(box);
+  }
+  void addPrism(const std::vector<point3d>& polygon, double min_z, double max_z)
+  {
+    regions_.addPrism(polygon, min_z, max_z);
+    prisms_.push_back(Prism{ polygon, min_z, max_z });
+  }
+
+  const RegionSet& regions() const { return regions_; }
+
+  bool contains(double x, double y, double z) const
+  {
+    for (const Box& box : boxes_)
+    {
+      if (x >= box.min.x() && x <= box.max.x() && y >= box.min.y() && y <= box.max.y() && z >= box.min.z()
+          && z <= box.max.z())
+        return true;
+    }
+    for (const OrientedBox& box : oriented_boxes_)
+    {
+      // Rotate the point into the box frame by the inverse quaternion
+      const double v[3] = { x - box.center.x(), y - box.center.y(), z - box.center.z() };
+      const double w = box.rotation[0];
+      const double u[3] = { -box.rotation[1], -box.rotation[2], -box.rotation[3] };
+      const double uv[3] = { u[1] * v[2] - u[2] * v[1], u[2] * v[0] - u[0] * v[2], u[0] * v[1] - u[1] * v[0] };
+      const double uuv[3] = { u[1] * uv[2] - u[2] * uv[1], u[2] * uv[0] - u[0] * uv[2],
+                              u[0] * uv[1] - u[1] * uv[0] };
+      bool inside = true;
+      for (unsigned int i = 0; i < 3; ++i)
+      {
+        const double p = v[i] + 2 * w * uv[i] + 2 * uuv[i];
+        inside = inside && std::fabs(p) <= std::fabs(box.size(i)) / 2;
+      }
+      if (inside)
+        return true;
+    }
+    for (const Prism& prism : prisms_)
+    {
+      if (z >= prism.min_z && z <= prism.max_z && windingNumber(prism.polygon, x, y) != 0)
+        return true;
+    }
+    return false;
+  }
+
+private:
+  struct Box
+  {
+    point3d min, max;
+  };
+  struct OrientedBox
+  {
+    point3d center, size;
+    double rotation[4];
+  };
+  struct Prism
+  {
+    std::vector<point3d> polygon;
+    double min_z, max_z;
+  };
+
+  static int windingNumber(const std::vector<point3d>& polygon, double x, double y)
+  {
+    int winding = 0;
+    for (size_t i = 0; i < polygon.size(); ++i)
+    {
+      const point3d& a = polygon[i];
+      const point3d& b = polygon[(i + 1) % polygon.size()];
+      const double side = (b.x() - a.x()) * (y - a.y()) - (x - a.x()) * (b.y() - a.y());
+      if (a.y() <= y && b.y() > y && side > 0)
+        ++winding;
+      else if (a.y() > y && b.y() <= y && side < 0)
+        --winding;
+    }
+    return winding;
+  }
+
+  RegionSet regions_;
+  std::vector<Box> boxes_;
+  std::vector<OrientedBox> oriented_boxes_;
+  std::vector<Prism> prisms_;
+};
+
+double uniform(std::mt19937* generator, double min, double max)
+{
+  return std::uniform_real_distribution<double>(min, max)(*generator);
+}
+
+point3d randomPoint(std::mt19937* generator, double min, double max)
+{
+  return point3d(uniform(generator, min, max), uniform(generator, min, max), uniform(generator, min, max));
+}
+
+void addRandomBox(std::mt19937* generator, PointSampler* sampler)
+{
+  const point3d min = randomPoint(generator, -5, 5);
+  sampler->addBox(min, min + randomPoint(generator, 0, 4));
+}
+
+void addRandomOrientedBox(std::mt19937* generator, PointSampler* sampler)
+{
+  const double rotation[4] = { uniform(generator, -1, 1), uniform(generator, -1, 1), uniform(generator, -1, 1),
+                               uniform(generator, -1, 1) };
+  sampler->addOrientedBox(randomPoint(generator, -5, 5), rotation, randomPoint(generator, 0.5, 4));
+}
+
+// A star shaped polygon, concave most of the time
+void addRandomPrism(std::mt19937* generator, PointSampler* sampler)
+{
+  const point3d center(uniform(generator, -5, 5), uniform(generator, -5, 5), 0);
+  const unsigned int num_vertices = 3 + (*generator)() % 6;
+  std::vector<point3d> polygon;
+  for (unsigned int i = 0; i < num_vertices; ++i)
+  {
+    const double angle = 2 * M_PI * i / num_vertices, radius = uniform(generator, 0.5, 3);
+    polygon.push_back(center + point3d(radius * std::cos(angle), radius * std::sin(angle), 0));
+  }
+  const double min_z = uniform(generator, -5, 3);
+  sampler->addPrism(polygon, min_z, min_z + uniform(generator, 0, 4));
+}
+
+// Region sets of one kind of region, then of all of them
+PointSampler randomRegions(std::mt19937* generator, unsigned int trial)
+{
+  PointSampler sampler;
+  const unsigned int num_regions = 1 + trial % 3;
+  for (unsigned int i = 0; i < num_regions; ++i)
+  {
+    if (trial % 4 == 0 || trial % 4 == 3)
+      addRandomBox(generator, &sampler);
+    if (trial % 4 == 1 || trial % 4 == 3)
+      addRandomOrientedBox(generator, &sampler);
+    if (trial % 4 == 2 || trial % 4 == 3)
+      addRandomPrism(generator, &sampler);
+  }
+  return sampler;
+}
+
+// Collect the centers of the voxels of the cube found inside, subdividing
+// the cubes found partly inside as a traversal of the tree does
+void collectVoxels(const RegionSet& regions, const point3d& center, double half_size, double resolution,
+                   std::vector<point3d>* voxels)
+{
+  const bool voxel = half_size <= resolution / 2;
+  const RegionOverlap overlap = regions.overlap(center, half_size, voxel);
+  if (overlap == RegionOverlap::OUTSIDE)
+    return;
+  if (overlap == RegionOverlap::INSIDE)
+  {
+    const unsigned int n = std::lround(2 * half_size / resolution);
+    for (unsigned int i = 0; i < n * n * n; ++i)
+    {
+      voxels->push_back(center + point3d(((i % n) + 0.5) * resolution - half_size,
+                                         ((i / n % n) + 0.5) * resolution - half_size,
+                                         ((i / n / n) + 0.5) * resolution - half_size));
+    }
+    return;
+  }
+  ASSERT_FALSE(voxel);
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    const double h = half_size / 2;
+    collectVoxels(regions, center + point3d(i & 1 ? h : -h, i & 2 ? h : -h, i & 4 ? h : -h), h, resolution,
+                  voxels);
+  }
+}
+
+}  // namespace
+
+TEST(RegionSet, OverlapMatchesPointSamples)
+{
+  std::mt19937 generator(1);
+  unsigned int partial = 0;
+  for (unsigned int trial = 0; trial < 200; ++trial)
+  {
+    const PointSampler sampler = randomRegions(&generator, trial);
+    for (unsigned int i = 0; i < 100; ++i)
+    {
+      const point3d center = randomPoint(&generator, -8, 8);
+      const double half_size = uniform(&generator, 0.05, 2);
+      const RegionOverlap overlap = sampler.regions().overlap(center, half_size, false);
+      // A cube inside has all of its samples inside, one outside none of
+      // them. Partly inside is allowed either way, as subdividing sorts it out.
+      const unsigned int n = 8;
+      unsigned int num_inside = 0;
+      for (unsigned int j = 0; j < (n + 1) * (n + 1) * (n + 1); ++j)
+      {
+        const double x = center.x() - half_size + 2 * half_size * (j % (n + 1)) / n;
+        const double y = center.y() - half_size + 2 * half_size * (j / (n + 1) % (n + 1)) / n;
+        const double z = center.z() - half_size + 2 * half_size * (j / (n + 1) / (n + 1)) / n;
+        num_inside += sampler.contains(x, y, z);
+      }
+      if (overlap == RegionOverlap::INSIDE)
+        EXPECT_EQ((n + 1) * (n + 1) * (n + 1), num_inside) << "trial " << trial << " cube " << i;
+      else if (overlap == RegionOverlap::OUTSIDE)
+        EXPECT_EQ(0u, num_inside) << "trial " << trial << " cube " << i;
+      else
+        ++partial;
+    }
+  }
+  // Not everything is left to the children
+  EXPECT_LT(partial, 200u * 100u / 2);
+}
+
+TEST(RegionSet, VoxelsTestTheirCenter)
+{
+  std::mt19937 generator(2);
+  for (unsigned int trial = 0; trial < 200; ++trial)
+  {
+    const PointSampler sampler = randomRegions(&generator, trial);
+    for (unsigned int i = 0; i < 1000; ++i)
+    {
+      const point3d center = randomPoint(&generator, -8, 8);
+      const RegionOverlap overlap = sampler.regions().overlap(center, 0.05, true);
+      EXPECT_NE(RegionOverlap::PARTIAL, overlap);
+      EXPECT_EQ(sampler.contains(center.x(), center.y(), center.z()), overlap == RegionOverlap::INSIDE)
+          << "trial " << trial << " point " << i;
+    }
+  }
+}
+
+TEST(RegionSet, SubdividingFindsTheVoxelsInside)
+{
+  std::mt19937 generator(3);
+  const double resolution = 0.25;
+  const double half_size = 16 * resolution;
+  for (unsigned int trial = 0; trial < 40; ++trial)
+  {
+    const PointSampler sampler = randomRegions(&generator, trial);
+    // Eight cubes of 32 voxels around the origin
+    std::vector<point3d> voxels;
+    for (unsigned int i = 0; i < 8; ++i)
+    {
+      const point3d center(i & 1 ? half_size : -half_size, i & 2 ? half_size : -half_size,
+                           i & 4 ? half_size : -half_size);
+      collectVoxels(sampler.regions(), center, half_size, resolution, &voxels);
+    }
+
+    std::vector<point3d> expected;
+    const int n = std::lround(2 * half_size / resolution);
+    for (int x = -n; x < n; ++x)
+    {
+      for (int y = -n; y < n; ++y)
+      {
+        for (int z = -n; z < n; ++z)
+        {
+          const point3d center((x + 0.5) * resolution, (y + 0.5) * resolution, (z + 0.5) * resolution);
+          if (sampler.contains(center.x(), center.y(), center.z()))
+            expected.push_back(center);
+        }
+      }
+    }
+
+    ASSERT_EQ(expected.size(), voxels.size()) << "trial " << trial;
+    const auto less = [](const point3d& a, const point3d& b) {
+      return a.x() != b.x() ? a.x() < b.x() : a.y() != b.y() ? a.y() < b.y() : a.z() < b.z();
+    };
+    std::sort(expected.begin(), expected.end(), less);
+    std::sort(voxels.begin(), voxels.end(), less);
+    for (size_t i = 0; i < voxels.size(); ++i)
+    {
+      EXPECT_NEAR(expected[i].x(), voxels[i].x(), 1e-6);
+      EXPECT_NEAR(expected[i].y(), voxels[i].y(), 1e-6);
+      EXPECT_NEAR(expected[i].z(), voxels[i].z(), 1e-6);
+    }
+  }
+}
+
+TEST(RegionSet, BoundsHoldTheRegions)
+{
+  RegionSet empty;
+  point3d min, max;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_FALSE(empty.bounds(&min, &max));
+
+  std::mt19937 generator(4);
+  for (unsigned int trial = 0; trial < 100; ++trial)
+  {
+    const PointSampler sampler = randomRegions(&generator, trial);
+    EXPECT_FALSE(sampler.regions().empty());
+    ASSERT_TRUE(sampler.regions().bounds(&min, &max));
+    for (unsigned int i = 0; i < 10000; ++i)
+    {
+      const point3d p = randomPoint(&generator, -10, 10);
+      if (sampler.contains(p.x(), p.y(), p.z()))
+      {
+        EXPECT_TRUE(p.x() >= min.x() && p.y() >= min.y() && p.z() >= min.z() && p.x() <= max.x()
+                    && p.y() <= max.y() && p.z() <= max.z())
+            << "trial " << trial << " point " << i;
+      }
+    }
+  }
+}
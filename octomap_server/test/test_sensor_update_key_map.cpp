@@ -0,0 +1,108 @@
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/SensorUpdateKeyMap.h>
+#include <octomap_server/SensorUpdateKeyMapHashImpl.h>
+
+using namespace octomap_server;
+
+namespace {
+
+// A scan of random rays from origin, most of them ending in a hit, clipped to a
+// box of bounds_size voxels around origin
+void randomScan(std::mt19937* generator, const octomap::OcTree& space, const octomap::point3d& origin,
+                unsigned int bounds_size, SensorUpdateKeyMap* update)
+{
+  const octomap::OcTreeKey origin_key = space.coordToKey(origin);
+  const octomap::key_type half = bounds_size / 2;
+  update->setBounds(octomap::OcTreeKey(origin_key[0] - half, origin_key[1] - half, origin_key[2] - half),
+                    octomap::OcTreeKey(origin_key[0] + half, origin_key[1] + half, origin_key[2] + half));
+  std::uniform_real_distribution<double> angle(-M_PI, M_PI), range(0.5, 4.0);
+  for (unsigned int i = 0; i < 2000; ++i)
+  {
+    const double yaw = angle(*generator), pitch = angle(*generator) / 4, r = range(*generator);
+    const octomap::point3d end = origin + octomap::point3d(r * std::cos(pitch) * std::cos(yaw),
+                                                           r * std::cos(pitch) * std::sin(yaw), r * std::sin(pitch));
+    update->insertRay(space, origin, end, false, false, r < 3.0);
+  }
+  update->updateLayers(space);
+}
+
+}  // namespace
+
+TEST(SensorUpdateKeyMap, HashKeepsEveryStateWhenItGrows)
+{
+  // Start small, so the node cache doubles many times
+  SensorUpdateKeyMapHashImpl map(4);
+  const VoxelState states[] = { voxel_state::FREE,
+                                voxel_state::OCCUPIED,
+                                voxel_state::INNER,
+                                voxel_state::INNER | voxel_state::FREE,
+                                voxel_state::INNER | voxel_state::OCCUPIED,
+                                voxel_state::INNER | voxel_state::FREE | voxel_state::OCCUPIED };
+  const size_t num_states = sizeof(states) / sizeof(states[0]);
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<unsigned int> coord(32768 - 100, 32768 + 100);
+  std::vector<std::pair<octomap::OcTreeKey, VoxelState> > inserted;
+  for (unsigned int i = 0; i < 20000; ++i)
+  {
+    const octomap::OcTreeKey key(coord(generator), coord(generator), coord(generator));
+    if (map.find(key) != voxel_state::UNKNOWN)
+      continue;
+    const VoxelState state = states[i % num_states];
+    map.insert(key, state);
+    inserted.push_back(std::make_pair(key, state));
+  }
+  ASSERT_GT(inserted.size(), 10000u);
+  for (size_t i = 0; i < inserted.size(); ++i)
+  {
+    ASSERT_EQ(inserted[i].second, map.find(inserted[i].first)) << "key " << i;
+  }
+}
+
+TEST(SensorUpdateKeyMap, ArrayAndHashVoxelsAgree)
+{
+  const unsigned int bounds_size = 64;
+  octomap::OcTree space(0.1);
+  std::mt19937 generator(2);
+  std::uniform_real_distribution<double> position(-1.0, 1.0);
+  // The array implementation for the whole box, the hash one for any size
+  SensorUpdateKeyMap array_update, hash_update;
+  array_update.setVoxelVolumeArrayThreshold(64 * 1024 * 1024);
+  hash_update.setVoxelVolumeArrayThreshold(0);
+  array_update.setDepth(16);
+  hash_update.setDepth(16);
+  for (unsigned int scan = 0; scan < 3; ++scan)
+  {
+    const octomap::point3d origin(position(generator), position(generator), position(generator));
+    std::mt19937 array_generator(generator), hash_generator(generator);
+    randomScan(&array_generator, space, origin, bounds_size, &array_update);
+    randomScan(&hash_generator, space, origin, bounds_size, &hash_update);
+    generator = array_generator;
+
+    // The down sampled layers may be coarser in one implementation than in
+    // the other, the voxels must be the same
+    const octomap::OcTreeKey origin_key = space.coordToKey(origin);
+    const unsigned int half = bounds_size / 2;
+    size_t known = 0;
+    for (unsigned int x = origin_key[0] - half; x <= origin_key[0] + half; ++x)
+    {
+      for (unsigned int y = origin_key[1] - half; y <= origin_key[1] + half; ++y)
+      {
+        for (unsigned int z = origin_key[2] - half; z <= origin_key[2] + half; ++z)
+        {
+          const octomap::OcTreeKey key(x, y, z);
+          const VoxelState state = array_update.find(key);
+          ASSERT_EQ(state, hash_update.find(key)) << "scan " << scan;
+          if (state != voxel_state::UNKNOWN)
+            known++;
+        }
+      }
+    }
+    EXPECT_GT(known, 0u);
+  }
+}
@@ -0,0 +1,184 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap_server/SharedMap.h>
+#include <octomap_server/SharedMapWriter.h>
+
+using namespace octomap_server;
+
+namespace {
+
+std::string segmentName(const char* test)
+{
+  return std::string("/test_shared_map_") + test + "_" + std::to_string(getpid());
+}
+
+// A map of which every field, cell and byte is derived from i, so that a
+// reader can tell a map written at once from a torn one
+void makeMap(uint64_t i, nav_msgs::OccupancyGrid* grid, octomap_msgs::Octomap* octree)
+{
+  grid->info.width = 10 + i % 50;
+  grid->info.height = 20 + i % 30;
+  grid->info.resolution = 0.05f * (1 + i % 4);
+  grid->info.origin.position.x = double(i);
+  grid->data.assign(grid->info.width * grid->info.height, int8_t(i % 101));
+  octree->id = "OcTree";
+  octree->resolution = 0.1 * (1 + i % 3);
+  octree->data.assign(1000 + (i * 7919) % 20000, int8_t(i % 127));
+}
+
+// Whether the view holds the map makeMap(view.slot->map_version)
+bool isConsistent(const SharedMapView& view)
+{
+  const uint64_t i = view.slot->map_version;
+  if (view.slot->generation != i || view.slot->stamp_sec != uint32_t(i))
+    return false;
+  nav_msgs::OccupancyGrid grid;
+  octomap_msgs::Octomap octree;
+  makeMap(i, &grid, &octree);
+  if (view.slot->grid_width != grid.info.width || view.slot->grid_height != grid.info.height
+      || view.slot->grid_resolution != grid.info.resolution
+      || view.slot->grid_origin_position[0] != grid.info.origin.position.x
+      || view.slot->grid_size != grid.data.size()
+      || view.slot->octree_resolution != octree.resolution || view.slot->octree_size != octree.data.size()
+      || std::string(view.slot->octree_id) != octree.id || std::string(view.slot->frame_id) != "map")
+    return false;
+  for (size_t j = 0; j < grid.data.size(); ++j)
+  {
+    if (view.grid[j] != grid.data[j])
+      return false;
+  }
+  for (size_t j = 0; j < octree.data.size(); ++j)
+  {
+    if (view.octree[j] != char(octree.data[j]))
+      return false;
+  }
+  return true;
+}
+
+bool writeMap(SharedMapWriter* writer, uint64_t i)
+{
+  nav_msgs::OccupancyGrid grid;
+  octomap_msgs::Octomap octree;
+  makeMap(i, &grid, &octree);
+  ros::Time stamp;
+  stamp.sec = i;
+  return writer->write(&grid, &octree, i, "map", stamp);
+}
+
+}  // namespace
+
+TEST(SharedMap, ReadWhatWasWritten)
+{
+  const std::string name = segmentName("read");
+  SharedMapReader reader;
+  EXPECT_FALSE(reader.open(name));
+
+  SharedMapWriter writer;
+  ASSERT_TRUE(writer.open(name, 64 * 1024));
+  ASSERT_TRUE(reader.open(name));
+  EXPECT_EQ(0u, reader.generation());
+  EXPECT_FALSE(reader.read([](const SharedMapView&) {}));
+
+  for (uint64_t i = 1; i <= 10; ++i)
+  {
+    ASSERT_TRUE(writeMap(&writer, i));
+    EXPECT_EQ(i, writer.getGeneration());
+    EXPECT_EQ(i, reader.generation());
+    bool consistent = false;
+    uint64_t version = 0;
+    ASSERT_TRUE(reader.read([&](const SharedMapView& view) {
+      consistent = isConsistent(view);
+      version = view.slot->map_version;
+    }));
+    EXPECT_TRUE(consistent);
+    EXPECT_EQ(i, version);
+  }
+
+  EXPECT_FALSE(reader.isClosed());
+  writer.close();
+  EXPECT_TRUE(reader.isClosed());
+  EXPECT_FALSE(reader.open(name));
+}
+
+TEST(SharedMap, MapTooLargeIsNotWritten)
+{
+  const std::string name = segmentName("large");
+  SharedMapWriter writer;
+  ASSERT_TRUE(writer.open(name, 4096));
+  ASSERT_TRUE(writeMap(&writer, 0));
+  nav_msgs::OccupancyGrid grid;
+  octomap_msgs::Octomap octree;
+  makeMap(1, &grid, &octree);
+  octree.data.resize(8192);
+  EXPECT_FALSE(writer.write(&grid, &octree, 1, "map", ros::Time()));
+  EXPECT_EQ(1u, writer.getGeneration());
+  EXPECT_EQ(0u, writer.getMapVersion());
+}
+
+TEST(SharedMap, ReadersNeverSeeTornMaps)
+{
+  const std::string name = segmentName("torn");
+  SharedMapWriter writer;
+  ASSERT_TRUE(writer.open(name, 64 * 1024));
+  ASSERT_TRUE(writeMap(&writer, 1));
+
+  // Made up front so that the writer overwrites the slots as fast as it can
+  const unsigned int num_maps = 20000;
+  std::vector<nav_msgs::OccupancyGrid> grids(num_maps + 1);
+  std::vector<octomap_msgs::Octomap> octrees(num_maps + 1);
+  for (uint64_t i = 2; i <= num_maps; ++i)
+    makeMap(i, &grids[i], &octrees[i]);
+
+  std::atomic<bool> done(false);
+  std::thread writer_thread([&]() {
+    for (uint64_t i = 2; i <= num_maps; ++i)
+    {
+      ros::Time stamp;
+      stamp.sec = i;
+      writer.write(&grids[i], &octrees[i], i, "map", stamp);
+    }
+    done = true;
+  });
+
+  std::vector<std::thread> reader_threads;
+  std::atomic<unsigned int> reads(0), torn(0);
+  for (unsigned int t = 0; t < 3; ++t)
+  {
+    reader_threads.push_back(std::thread([&]() {
+      SharedMapReader reader;
+      if (!reader.open(name))
+      {
+        ++torn;
+        return;
+      }
+      uint64_t last_version = 0;
+      while (!done)
+      {
+        bool consistent = false;
+        uint64_t version = 0;
+        // The writer may overwrite the map on every attempt
+        if (!reader.read([&](const SharedMapView& view) {
+              consistent = isConsistent(view);
+              version = view.slot->map_version;
+            }, 1000000))
+          continue;
+        ++reads;
+        // A read that returned true saw one map, newer than the last one
+        if (!consistent || version < last_version)
+          ++torn;
+        last_version = version;
+      }
+    }));
+  }
+  writer_thread.join();
+  for (size_t t = 0; t < reader_threads.size(); ++t)
+    reader_threads[t].join();
+  EXPECT_EQ(0u, torn.load());
+  EXPECT_GT(reads.load(), 0u);
+}
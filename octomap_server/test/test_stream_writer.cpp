@@ -0,0 +1,80 @@
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+std::string octomapStream(const octomap::OcTree& tree, bool binary)
+{
+  std::stringstream stream;
+  if (binary)
+    tree.writeBinaryData(stream);
+  else
+    tree.writeData(stream);
+  return stream.str();
+}
+
+}  // namespace
+
+TEST(OcTreeStreamWriter, SameBytesAsOctomap)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 50000, 42, 3.0);
+  test::updateBox(&tree, octomap::point3d(3.0, -0.4, -0.4), octomap::point3d(3.8, 0.4, 0.4), false);
+  ASSERT_GT(tree.size(), 10000u);
+  for (int binary = 0; binary < 2; ++binary)
+  {
+    const std::string reference = octomapStream(tree, binary);
+    std::stringstream serial;
+    ASSERT_TRUE(binary ? writeBinaryData(tree, serial, WriteAllPolicy())
+                       : writeFullData(tree, serial, WriteAllPolicy()));
+    EXPECT_EQ(reference, serial.str());
+    for (unsigned int num_threads = 1; num_threads <= 16; ++num_threads)
+    {
+      std::stringstream parallel;
+      ASSERT_TRUE(writeDataParallel(tree, binary, parallel, WriteAllPolicy(), num_threads));
+      EXPECT_EQ(reference, parallel.str()) << num_threads << " threads, binary " << binary;
+
+      octomap_msgs::Octomap msg;
+      ASSERT_TRUE(mapToMsg(tree, binary, WriteAllPolicy(), msg, num_threads));
+      EXPECT_EQ(reference, std::string(msg.data.begin(), msg.data.end()))
+          << num_threads << " threads, binary " << binary;
+      EXPECT_EQ(bool(binary), bool(msg.binary));
+    }
+  }
+}
+
+TEST(OcTreeStreamWriter, ParallelMatchesSerialWithPolicy)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 20000, 42, 3.0);
+  test::updateBox(&tree, octomap::point3d(3.0, -0.4, -0.4), octomap::point3d(3.8, 0.4, 0.4), false);
+  const BoundingBoxPolicy policy(tree.coordToKey(-1.0, -2.0, -0.5), tree.coordToKey(2.0, 1.0, 0.5),
+                                 tree.getTreeDepth(), tree.getTreeDepth() - 2);
+  for (int binary = 0; binary < 2; ++binary)
+  {
+    std::stringstream serial;
+    ASSERT_TRUE(writeDataParallel(tree, binary, serial, policy, 1));
+    for (unsigned int num_threads = 2; num_threads <= 8; ++num_threads)
+    {
+      std::stringstream parallel;
+      ASSERT_TRUE(writeDataParallel(tree, binary, parallel, policy, num_threads));
+      EXPECT_EQ(serial.str(), parallel.str()) << num_threads << " threads, binary " << binary;
+    }
+  }
+}
+
+TEST(OcTreeStreamWriter, EmptyTree)
+{
+  octomap::OcTree tree(0.1);
+  std::stringstream parallel;
+  ASSERT_TRUE(writeDataParallel(tree, true, parallel, WriteAllPolicy(), 4));
+  EXPECT_EQ(octomapStream(tree, true), parallel.str());
+}
@@ -0,0 +1,198 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap/octomap.h>
+#include <octomap_server/SuccinctOcTree.h>
+
+#include "test_util.h"
+
+using namespace octomap_server;
+
+namespace {
+
+// Write tree to a temporary .sbt file and map it
+class SuccinctFile
+{
+public:
+  explicit SuccinctFile(const octomap::OcTree& tree)
+  {
+    char filename[] = "/tmp/test_succinct_octreeXXXXXX";
+    const int fd = mkstemp(filename);
+    if (fd >= 0)
+      close(fd);
+    filename_ = filename;
+    std::ofstream s(filename_.c_str(), std::ios_base::out | std::ios_base::binary);
+    written_ = SuccinctOcTree::write(tree, s);
+    s.close();
+    opened_ = written_ && !s.fail() && succinct_.open(filename_);
+  }
+  ~SuccinctFile()
+  {
+    succinct_.close();
+    unlink(filename_.c_str());
+  }
+
+  bool ok() const { return written_ && opened_; }
+  const SuccinctOcTree& tree() const { return succinct_; }
+
+private:
+  std::string filename_;
+  bool written_;
+  bool opened_;
+  SuccinctOcTree succinct_;
+};
+
+// Leaf of tree holding key by walking down from the root, NULL in unknown
+// space
+const octomap::OcTreeNode* findLeaf(const octomap::OcTree& tree, const octomap::OcTreeKey& key,
+                                    unsigned int* depth)
+{
+  const octomap::OcTreeNode* node = tree.getRoot();
+  *depth = 0;
+  while (node && tree.nodeHasChildren(node))
+  {
+    const unsigned int pos = octomap::computeChildIdx(key, tree.getTreeDepth() - 1 - *depth);
+    node = tree.nodeChildExists(node, pos) ? tree.getNodeChild(node, pos) : NULL;
+    ++*depth;
+  }
+  return node;
+}
+
+// Leafs of the subtree of node overlapping [min, max], and the sum of
+// their values
+void countLeafsBBX(const octomap::OcTree& tree, const octomap::OcTreeNode* node, const octomap::OcTreeKey& key,
+                   unsigned int depth, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max,
+                   size_t* count, double* sum)
+{
+  const unsigned int tree_depth = tree.getTreeDepth();
+  const unsigned int half = depth < tree_depth ? 1u << (tree_depth - depth - 1) : 0;
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    const unsigned int lo = depth < tree_depth ? key[i] - half : key[i];
+    const unsigned int hi = depth < tree_depth ? key[i] + half - 1 : key[i];
+    if (hi < min[i] || lo > max[i])
+      return;
+  }
+  if (!tree.nodeHasChildren(node))
+  {
+    ++*count;
+    *sum += node->getLogOdds();
+    return;
+  }
+  for (unsigned int i = 0; i < 8; ++i)
+  {
+    if (!tree.nodeChildExists(node, i))
+      continue;
+    octomap::OcTreeKey child_key;
+    octomap::computeChildKey(i, half / 2, key, child_key);
+    countLeafsBBX(tree, tree.getNodeChild(node, i), child_key, depth + 1, min, max, count, sum);
+  }
+}
+
+}  // namespace
+
+TEST(SuccinctOcTree, SameStreamsAsOctomap)
+{
+  for (unsigned int seed = 1; seed <= 3; ++seed)
+  {
+    octomap::OcTree tree(0.1);
+    test::addRandomUpdates(&tree, 20000, seed, 2.0);
+    test::updateBox(&tree, octomap::point3d(2.0, -0.4, -0.4), octomap::point3d(2.8, 0.4, 0.4), false);
+    SuccinctFile file(tree);
+    ASSERT_TRUE(file.ok());
+    EXPECT_EQ(tree.size(), file.tree().size());
+
+    std::stringstream binary, full;
+    tree.writeBinaryData(binary);
+    tree.writeData(full);
+    octomap_msgs::Octomap msg;
+    ASSERT_TRUE(file.tree().binaryMapToMsg(msg));
+    EXPECT_EQ(binary.str(), std::string(msg.data.begin(), msg.data.end()));
+    ASSERT_TRUE(file.tree().fullMapToMsg(msg));
+    EXPECT_EQ(full.str(), std::string(msg.data.begin(), msg.data.end()));
+  }
+}
+
+TEST(SuccinctOcTree, SearchMatchesTree)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 20000, 4, 2.0);
+  test::updateBox(&tree, octomap::point3d(2.0, -0.4, -0.4), octomap::point3d(2.8, 0.4, 0.4), false);
+  SuccinctFile file(tree);
+  ASSERT_TRUE(file.ok());
+
+  std::mt19937 generator(5);
+  std::uniform_real_distribution<double> coord(-3.0, 3.0);
+  for (unsigned int i = 0; i < 100000; ++i)
+  {
+    const octomap::OcTreeKey key = tree.coordToKey(coord(generator), coord(generator), coord(generator));
+    unsigned int depth;
+    const octomap::OcTreeNode* leaf = findLeaf(tree, key, &depth);
+    float log_odds;
+    unsigned int succinct_depth;
+    ASSERT_EQ(leaf != NULL, file.tree().search(key, &log_odds, &succinct_depth));
+    if (leaf)
+    {
+      EXPECT_EQ(leaf->getLogOdds(), log_odds);
+      EXPECT_EQ(depth, succinct_depth);
+      EXPECT_EQ(tree.isNodeOccupied(leaf), file.tree().isOccupied(log_odds));
+    }
+  }
+}
+
+TEST(SuccinctOcTree, LeafsInBoxMatchTree)
+{
+  octomap::OcTree tree(0.1);
+  test::addRandomUpdates(&tree, 20000, 6, 2.0);
+  test::updateBox(&tree, octomap::point3d(2.0, -0.4, -0.4), octomap::point3d(2.8, 0.4, 0.4), false);
+  SuccinctFile file(tree);
+  ASSERT_TRUE(file.ok());
+
+  std::mt19937 generator(7);
+  std::uniform_real_distribution<double> coord(-3.0, 3.0);
+  for (unsigned int i = 0; i < 50; ++i)
+  {
+    octomap::OcTreeKey min = tree.coordToKey(coord(generator), coord(generator), coord(generator));
+    octomap::OcTreeKey max = tree.coordToKey(coord(generator), coord(generator), coord(generator));
+    for (unsigned int j = 0; j < 3; ++j)
+    {
+      if (min[j] > max[j])
+        std::swap(min[j], max[j]);
+    }
+    size_t expected_count = 0;
+    double expected_sum = 0.0;
+    const unsigned int center = 1u << (tree.getTreeDepth() - 1);
+    countLeafsBBX(tree, tree.getRoot(), octomap::OcTreeKey(center, center, center), 0, min, max, &expected_count,
+                  &expected_sum);
+    size_t count = 0;
+    double sum = 0.0;
+    file.tree().forEachLeafBBX(min, max, [&](const octomap::OcTreeKey&, unsigned int, float log_odds) {
+      ++count;
+      sum += log_odds;
+    });
+    EXPECT_EQ(expected_count, count);
+    EXPECT_DOUBLE_EQ(expected_sum, sum);
+  }
+}
+
+TEST(SuccinctOcTree, EmptyTree)
+{
+  octomap::OcTree tree(0.1);
+  SuccinctFile file(tree);
+  ASSERT_TRUE(file.ok());
+  EXPECT_EQ(0u, file.tree().size());
+  float log_odds;
+  EXPECT_FALSE(file.tree().search(octomap::OcTreeKey(32768, 32768, 32768), &log_odds));
+  octomap_msgs::Octomap msg;
+  ASSERT_TRUE(file.tree().binaryMapToMsg(msg));
+  EXPECT_TRUE(msg.data.empty());
+}
@@ -0,0 +1,314 @@
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <octomap_server/IndexedMapFile.h>
+#include <octomap_server/OcTreeStampedWithExpiry.h>
+#include <octomap_server/OcTreeStreamWriter.h>
+#include <octomap_server/SuccinctOcTree.h>
+#include <octomap_server/TileCache.h>
+#include <octomap_server/TiledMapWriter.h>
+
+using namespace octomap_server;
+
+namespace {
+
+// Tiles of 6.4 m
+const unsigned int TILE_DEPTH = 10;
+
+// Random hits and misses in a cube of 20 m, over a few dozen tiles
+void buildRandomTree(OcTreeStampedWithExpiry* tree, unsigned int seed)
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> coord(-10.0, 10.0);
+  std::bernoulli_distribution hit(0.4);
+  for (unsigned int i = 0; i < 30000; ++i)
+  {
+    const octomap::point3d point(coord(generator), coord(generator), coord(generator));
+    tree->updateNode(tree->coordToKey(point), hit(generator));
+  }
+}
+
+std::string nativeStream(const OcTreeStampedWithExpiry& tree)
+{
+  std::stringstream s;
+  tree.writeData(s);
+  return s.str();
+}
+
+const char* const FORMATS[] = {"bt", "ot", "oti", "sbt"};
+
+// The map file the server writes with all tiles in the tree
+std::string mapFile(const OcTreeStampedWithExpiry& tree, const std::string& format, unsigned int split_depth)
+{
+  std::stringstream s;
+  if (format == "bt")
+  {
+    s << "# Octomap OcTree binary file\n";
+    s << "id " << messageTreeType(tree) << "\n";
+    s << "size " << tree.size() << "\n";
+    s << "res " << tree.getResolution() << "\n";
+    s << "depth " << tree.getTreeDepth() << "\n";
+    s << "data\n";
+    writeBinaryData(tree, s, WriteAllPolicy());
+  }
+  else if (format == "ot")
+  {
+    tree.write(s);
+  }
+  else if (format == "sbt")
+  {
+    SuccinctOcTree::write(tree, s);
+  }
+  else
+  {
+    writeIndexedMap(tree, true, s, split_depth, 1);
+  }
+  return s.str();
+}
+
+std::string tiledMapFile(const OcTreeStampedWithExpiry& tree, const TileCache& cache, const std::string& format,
+                         unsigned int split_depth)
+{
+  std::stringstream s;
+  TiledMapWriter writer(tree, cache);
+  EXPECT_TRUE(writer.write(format, s, split_depth)) << format;
+  return s.str();
+}
+
+// Whether the tile starting at key tile overlaps the box of keys [min, max]
+bool overlaps(const octomap::OcTreeKey& tile, const octomap::OcTreeKey& min, const octomap::OcTreeKey& max)
+{
+  const unsigned int size = 1u << (16 - TILE_DEPTH);
+  for (unsigned int i = 0; i < 3; ++i)
+  {
+    if (tile[i] > max[i] || tile[i] + size <= min[i])
+      return false;
+  }
+  return true;
+}
+
+bool fileExists(const std::string& filename)
+{
+  struct stat st;
+  return stat(filename.c_str(), &st) == 0;
+}
+
+// A temporary tile directory, removed with its tiles
+class TileDirectory
+{
+public:
+  TileDirectory()
+  {
+    char name[] = "/tmp/test_tile_cacheXXXXXX";
+    if (mkdtemp(name))
+      name_ = name;
+  }
+  ~TileDirectory()
+  {
+    if (name_.empty())
+      return;
+    TileCache cache;
+    cache.configure(name_, TILE_DEPTH, 0);
+    cache.removeTileFiles();
+    rmdir(name_.c_str());
+  }
+
+  const std::string& name() const { return name_; }
+
+private:
+  std::string name_;
+};
+
+}  // namespace
+
+TEST(TileCache, EvictAndLoadAllRoundTrip)
+{
+  TileDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  OcTreeStampedWithExpiry tree(0.1);
+  buildRandomTree(&tree, 1);
+  const std::string before = nativeStream(tree);
+  const size_t usage = TileCache::memoryUsage(tree);
+
+  TileCache cache;
+  cache.configure(directory.name(), TILE_DEPTH, usage / 3);
+  const size_t evicted = cache.evict(&tree);
+  ASSERT_GT(evicted, 0u);
+  EXPECT_EQ(evicted, cache.numEvicted());
+  EXPECT_LE(TileCache::memoryUsage(tree), usage / 3);
+  for (const TileCache::TileMap::value_type& tile : cache.evictedTiles())
+  {
+    EXPECT_TRUE(fileExists(cache.tileFilename(tile.first)));
+  }
+  EXPECT_NE(before, nativeStream(tree));
+
+  // Within the budget, nothing more to evict
+  EXPECT_EQ(0u, cache.evict(&tree));
+
+  const TileCache::TileMap tiles = cache.evictedTiles();
+  EXPECT_EQ(evicted, cache.loadAll(&tree));
+  EXPECT_EQ(0u, cache.numEvicted());
+  for (const TileCache::TileMap::value_type& tile : tiles)
+  {
+    EXPECT_FALSE(fileExists(cache.tileFilename(tile.first)));
+  }
+  EXPECT_EQ(before, nativeStream(tree));
+
+  // The tiles loaded for a whole map operation are the first to go again
+  EXPECT_GT(cache.evict(&tree, false), 0u);
+  EXPECT_LE(TileCache::memoryUsage(tree), usage / 3);
+  cache.loadAll(&tree);
+  EXPECT_EQ(before, nativeStream(tree));
+}
+
+TEST(TileCache, TilesUsedInTheCycleStay)
+{
+  TileDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  OcTreeStampedWithExpiry tree(0.1);
+  buildRandomTree(&tree, 2);
+  const std::string before = nativeStream(tree);
+
+  TileCache cache;
+  cache.configure(directory.name(), TILE_DEPTH, TileCache::memoryUsage(tree) / 4);
+  const octomap::OcTreeKey min = tree.coordToKey(octomap::point3d(-1.0, -1.0, -1.0));
+  const octomap::OcTreeKey max = tree.coordToKey(octomap::point3d(1.0, 1.0, 1.0));
+  cache.touch(tree, min, max);
+  ASSERT_GT(cache.evict(&tree), 0u);
+  for (const TileCache::TileMap::value_type& tile : cache.evictedTiles())
+  {
+    EXPECT_FALSE(overlaps(tile.first, min, max));
+  }
+
+  // Load a box back, then the rest
+  const octomap::OcTreeKey far_min = tree.coordToKey(octomap::point3d(5.0, 5.0, 5.0));
+  const octomap::OcTreeKey far_max = tree.coordToKey(octomap::point3d(9.0, 9.0, 9.0));
+  const size_t num_evicted = cache.numEvicted();
+  const size_t loaded = cache.load(&tree, far_min, far_max);
+  EXPECT_EQ(num_evicted - loaded, cache.numEvicted());
+  EXPECT_GT(loaded, 0u);
+  for (const TileCache::TileMap::value_type& tile : cache.evictedTiles())
+  {
+    EXPECT_FALSE(overlaps(tile.first, far_min, far_max));
+  }
+  cache.loadAll(&tree);
+  EXPECT_EQ(before, nativeStream(tree));
+}
+
+TEST(TileCache, PrefetchRoundTrip)
+{
+  TileDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  OcTreeStampedWithExpiry tree(0.1);
+  buildRandomTree(&tree, 3);
+  const std::string before = nativeStream(tree);
+
+  TileCache cache;
+  cache.configure(directory.name(), TILE_DEPTH, TileCache::memoryUsage(tree) / 3);
+  const size_t evicted = cache.evict(&tree);
+  ASSERT_GT(evicted, 0u);
+
+  const octomap::key_type max_key = 0xffff;
+  cache.prefetch(tree, octomap::OcTreeKey(0, 0, 0), octomap::OcTreeKey(max_key, max_key, max_key));
+  size_t grafted = 0;
+  for (unsigned int i = 0; i < 1000 && grafted == 0; ++i)
+  {
+    grafted = cache.finishPrefetch(&tree);
+    if (grafted == 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  EXPECT_EQ(evicted, grafted);
+  EXPECT_EQ(0u, cache.numEvicted());
+  EXPECT_EQ(before, nativeStream(tree));
+}
+
+TEST(TiledMapWriter, SameFilesAsWithAllTilesIn)
+{
+  TileDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  OcTreeStampedWithExpiry tree(0.1);
+  buildRandomTree(&tree, 4);
+
+  TileCache cache;
+  cache.configure(directory.name(), TILE_DEPTH, TileCache::memoryUsage(tree) / 3);
+  ASSERT_GT(cache.evict(&tree), 0u);
+  const std::string evicted = nativeStream(tree);
+  // Subtrees of the indexed file above and below the tiles
+  const unsigned int split_depths[] = {DEFAULT_INDEXED_SPLIT_DEPTH, TILE_DEPTH + 2};
+  std::vector<std::string> files;
+  for (const char* format : FORMATS)
+  {
+    for (unsigned int split_depth : split_depths)
+    {
+      files.push_back(tiledMapFile(tree, cache, format, split_depth));
+    }
+  }
+  // and the binary and full map messages
+  octomap_msgs::Octomap messages[2];
+  for (int binary = 0; binary < 2; ++binary)
+  {
+    TiledMapWriter writer(tree, cache);
+    ASSERT_TRUE(writer.toMsg(binary, messages[binary]));
+  }
+  // Writing leaves the tree and the tiles alone
+  EXPECT_EQ(evicted, nativeStream(tree));
+  EXPECT_GT(cache.numEvicted(), 0u);
+
+  cache.loadAll(&tree);
+  size_t i = 0;
+  for (const char* format : FORMATS)
+  {
+    for (unsigned int split_depth : split_depths)
+    {
+      EXPECT_EQ(mapFile(tree, format, split_depth), files[i++]) << format << " split at " << split_depth;
+    }
+  }
+  for (int binary = 0; binary < 2; ++binary)
+  {
+    octomap_msgs::Octomap msg;
+    ASSERT_TRUE(mapToMsg(tree, binary, WriteAllPolicy(), msg));
+    EXPECT_EQ(msg.id, messages[binary].id);
+    EXPECT_EQ(msg.binary, messages[binary].binary);
+    EXPECT_EQ(msg.resolution, messages[binary].resolution);
+    EXPECT_TRUE(msg.data == messages[binary].data) << (binary ? "binary" : "full") << " map";
+  }
+}
+
+TEST(TiledMapWriter, TilePartlyInTheTree)
+{
+  TileDirectory directory;
+  ASSERT_FALSE(directory.name().empty());
+  OcTreeStampedWithExpiry tree(0.1);
+  buildRandomTree(&tree, 5);
+
+  TileCache cache;
+  cache.configure(directory.name(), TILE_DEPTH, TileCache::memoryUsage(tree) / 3);
+  ASSERT_GT(cache.evict(&tree), 0u);
+  // Updates in an evicted tile without loading it, which loading merges
+  const octomap::OcTreeKey tile = cache.evictedTiles().begin()->first;
+  for (unsigned int i = 0; i < 20; ++i)
+  {
+    tree.updateNode(octomap::OcTreeKey(tile[0] + i, tile[1] + 2 * i, tile[2] + 1), i % 3 == 0);
+  }
+  tree.updateInnerOccupancy();
+
+  std::vector<std::string> files;
+  for (const char* format : FORMATS)
+  {
+    files.push_back(tiledMapFile(tree, cache, format, DEFAULT_INDEXED_SPLIT_DEPTH));
+  }
+  cache.loadAll(&tree);
+  size_t i = 0;
+  for (const char* format : FORMATS)
+  {
+    EXPECT_EQ(mapFile(tree, format, DEFAULT_INDEXED_SPLIT_DEPTH), files[i++]) << format;
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef OCTOMAP_SERVER_TEST_UTIL_H
+#define OCTOMAP_SERVER_TEST_UTIL_H
+
+#include <random>
+#include <octomap/octomap.h>
+
+namespace octomap_server {
+namespace test {
+
+/// Random hits and misses in the cube of half size extent around the origin
+inline void addRandomUpdates(octomap::OcTree* tree, unsigned int num_updates, unsigned int seed, double extent)
+{
+  std::mt19937 generator(seed);
+  std::uniform_real_distribution<double> coord(-extent, extent);
+  std::bernoulli_distribution hit(0.4);
+  for (unsigned int i = 0; i < num_updates; ++i)
+  {
+    tree->updateNode(octomap::point3d(coord(generator), coord(generator), coord(generator)), hit(generator));
+  }
+}
+
+/// Update the voxels of the box from min up to, but not including, max as
+/// occupied or free, one resolution apart. Free boxes get pruned into larger
+/// leafs.
+inline void updateBox(octomap::OcTree* tree, const octomap::point3d& min, const octomap::point3d& max, bool occupied)
+{
+  const double resolution = tree->getResolution();
+  for (double x = min.x(); x < max.x(); x += resolution)
+    for (double y = min.y(); y < max.y(); y += resolution)
+      for (double z = min.z(); z < max.z(); z += resolution)
+        tree->updateNode(octomap::point3d(x, y, z), occupied);
+}
+
+}  // namespace test
+}  // namespace octomap_server
+
+#endif  // OCTOMAP_SERVER_TEST_UTIL_H